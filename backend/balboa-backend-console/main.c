@@ -4,8 +4,12 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <math.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +22,7 @@
 #include <ketopt.h>
 #include <protocol.h>
 #include <trace.h>
+#include <zio.h>
 
 typedef struct state_t state_t;
 struct state_t {
@@ -25,7 +30,10 @@ struct state_t {
   size_t scrtch0_sz;
   FILE* os;
   int sock;
+  void* usr;
   int (*dump_entry_cb)(state_t* state, protocol_entry_t* entry);
+  // optional; called once all entries were processed
+  int (*dump_done_cb)(state_t* state);
 };
 
 static int dump_state_init(state_t* state) {
@@ -34,6 +42,8 @@ static int dump_state_init(state_t* state) {
   if(state->scrtch0 == NULL) { return (-1); }
   state->os = NULL;
   state->sock = -1;
+  state->usr = NULL;
+  state->dump_done_cb = NULL;
   return (0);
 }
 
@@ -43,6 +53,10 @@ static void dump_state_teardown(state_t* state) {
 
 static ssize_t dump_process(state_t* state, FILE* is) {
   protocol_dump_stream_t* stream = blb_protocol_dump_stream_new(is);
+  if(stream == NULL) {
+    L(log_error("unable to read the dump"));
+    return (-1);
+  }
   ssize_t entries = 0;
   while(1) {
     protocol_entry_t entry;
@@ -52,20 +66,19 @@ static ssize_t dump_process(state_t* state, FILE* is) {
       int rc = state->dump_entry_cb(state, &entry);
       if(rc != 0) {
         L(log_error("dump_entry_cb() failed with `%d`", rc));
+        blb_protocol_dump_stream_teardown(stream);
         return (-entries);
       }
       entries++;
       continue;
     }
-    case -1: return (entries);
+    case -1: blb_protocol_dump_stream_teardown(stream); return (entries);
     default:
       L(log_error("blb_dump_stream_decode() failed with `%d`", rc));
       blb_protocol_dump_stream_teardown(stream);
       return (-entries);
     }
   }
-  blb_protocol_dump_stream_teardown(stream);
-  return (entries);
 }
 
 static int dump(state_t* state, const char* dump_file) {
@@ -83,6 +96,9 @@ static int dump(state_t* state, const char* dump_file) {
     return (-1);
   }
   ssize_t rc = dump_process(state, f);
+  if(rc >= 0 && state->dump_done_cb != NULL) {
+    if(state->dump_done_cb(state) != 0) { rc = -1; }
+  }
   L(log_info("done; processed `%zd` entries", rc));
   dump_state_teardown(state);
   fclose(f);
@@ -93,12 +109,12 @@ static int dump(state_t* state, const char* dump_file) {
   }
 }
 
-static void dump_entry_as_json(
-    FILE* os, uint8_t* p, size_t p_sz, const protocol_entry_t* entry) {
-  bytestring_sink_t __sink = bs_sink(p, p_sz);
-  bytestring_sink_t* sink = &__sink;
+// encodes `entry` as one line of json at the end of `sink`; on failure the
+// sink is left as it was
+static int json_encode_entry(
+    bytestring_sink_t* sink, const protocol_entry_t* entry) {
+  size_t index = sink->index;
   int ok = 0;
-  char buf[64] = {0};
   ok += bs_cat(sink, "{\"rrname\":\"", 11);
   ok +=
       bs_append_escape(sink, (const uint8_t*)entry->rrname, entry->rrname_len);
@@ -111,57 +127,466 @@ static void dump_entry_as_json(
   ok += bs_cat(sink, "\",\"rdata\":\"", 11);
   ok += bs_append_escape(sink, (const uint8_t*)entry->rdata, entry->rdata_len);
   ok += bs_cat(sink, "\",\"count\":", 10);
-  snprintf(buf, 63, "%u", entry->count);
-  ok += bs_cat(sink, buf, strlen(buf));
+  ok += bs_append_u64(sink, entry->count);
   ok += bs_cat(sink, ",\"first_seen\":", 14);
-  snprintf(buf, 63, "%u", entry->first_seen);
-  ok += bs_cat(sink, buf, strlen(buf));
+  ok += bs_append_u64(sink, entry->first_seen);
   ok += bs_cat(sink, ",\"last_seen\":", 13);
-  snprintf(buf, 63, "%u", entry->last_seen);
-  ok += bs_cat(sink, buf, strlen(buf));
+  ok += bs_append_u64(sink, entry->last_seen);
+  if(entry->hist_len > 0) {
+    ok += bs_cat(sink, ",\"histogram\":{\"granularity\":", 28);
+    ok += bs_append_u64(sink, entry->hist_granularity);
+    ok += bs_cat(sink, ",\"buckets\":[", 12);
+    for(size_t i = 0; i < entry->hist_len; i++) {
+      if(i > 0) { ok += bs_append1(sink, ','); }
+      ok += bs_append1(sink, '[');
+      ok += bs_append_u64(sink, entry->hist[i * 2]);
+      ok += bs_append1(sink, ',');
+      ok += bs_append_u64(sink, entry->hist[i * 2 + 1]);
+      ok += bs_append1(sink, ']');
+    }
+    ok += bs_cat(sink, "]}", 2);
+  }
   ok += bs_append1(sink, '}');
   ok += bs_append1(sink, '\n');
-  if(ok == 0) {
-    fwrite(sink->p, sink->index, 1, os);
+  if(ok != 0) {
+    sink->index = index;
+    return (-1);
+  }
+  return (0);
+}
+
+static void dump_entry_as_json(
+    FILE* os, uint8_t* p, size_t p_sz, const protocol_entry_t* entry) {
+  bytestring_sink_t sink = bs_sink(p, p_sz);
+  if(json_encode_entry(&sink, entry) == 0) {
+    fwrite(sink.p, sink.index, 1, os);
   } else {
     fputs("{\"error\":\"buffer-out-of-space\"}", os);
   }
 }
 
+// jsonize collects lines in `scrtch0`, which `usr` points into as a sink,
+// and writes them out in large blocks
+static int dump_json_flush(state_t* state) {
+  bytestring_sink_t* sink = state->usr;
+  if(sink->index == 0) { return (0); }
+  size_t n = fwrite(sink->p, 1, sink->index, state->os);
+  bool short_write = n != sink->index;
+  sink->index = 0;
+  if(short_write) {
+    L(log_error("unable to write json output"));
+    return (-1);
+  }
+  return (0);
+}
+
 static int dump_entry_json_cb(state_t* state, protocol_entry_t* entry) {
   ASSERT(state->os != NULL);
-  dump_entry_as_json(state->os, state->scrtch0, state->scrtch0_sz, entry);
+  bytestring_sink_t* sink = state->usr;
+  if(json_encode_entry(sink, entry) == 0) { return (0); }
+  if(dump_json_flush(state) != 0) { return (-1); }
+  if(json_encode_entry(sink, entry) != 0) {
+    fputs("{\"error\":\"buffer-out-of-space\"}", state->os);
+  }
   return (0);
 }
 
-static int dump_entry_replay_cb(state_t* state, protocol_entry_t* entry) {
-  ASSERT(state->sock != -1);
+// replay decodes the dump on the calling thread and packs the entries into
+// chunks; sender threads, each with its own backend connection, encode
+// them as input requests into a large buffer and write it out in one go
+#define REPLAY_SENDERS_MAX (32)
+#define REPLAY_CHUNK_ENTRIES (4096)
+#define REPLAY_CHUNK_ARENA (1024 * 1024)
+#define REPLAY_SEND_BUFFER (4 * 1024 * 1024)
+#define REPLAY_FRAME_OVERHEAD (256)
 
-  protocol_input_request_t input = {.entry = *entry};
-  ssize_t rc = blb_protocol_encode_input_request(
-      &input, (char*)state->scrtch0, state->scrtch0_sz);
-  if(rc <= 0) {
-    L(log_error("unable to encode input request"));
-    return (-1);
-  }
+typedef struct replay_chunk_t replay_chunk_t;
+struct replay_chunk_t {
+  replay_chunk_t* next;
+  // position in the dump, for consumers that keep the order
+  uint64_t seq;
+  size_t len;
+  size_t arena_len;
+  protocol_entry_t entries[REPLAY_CHUNK_ENTRIES];
+  char arena[REPLAY_CHUNK_ARENA];
+};
 
-  uint8_t* p = state->scrtch0;
-  ssize_t r = rc;
-  while(r > 0) {
-    ssize_t rc = write(state->sock, p, r);
-    if(rc < 0) {
+typedef struct replay_t replay_t;
+struct replay_t {
+  pthread_mutex_t lock;
+  // signalled when work is queued or the decoder is done
+  pthread_cond_t work_cond;
+  // signalled when a chunk is returned or a sender failed
+  pthread_cond_t free_cond;
+  // signalled when `written` advances or a sender failed
+  pthread_cond_t written_cond;
+  replay_chunk_t* work_head;
+  replay_chunk_t* work_tail;
+  replay_chunk_t* free;
+  uint64_t pushed;
+  uint64_t written;
+  bool done;
+  bool failed;
+  // owned by the decoder
+  replay_chunk_t* cur;
+  uint64_t entries;
+  struct timespec start;
+  struct timespec last;
+  uint64_t last_entries;
+};
+
+typedef struct replay_sender_t replay_sender_t;
+struct replay_sender_t {
+  replay_t* replay;
+  pthread_t thread;
+  int sock;
+  char* buf;
+  size_t buf_len;
+  int rc;
+};
+
+static double replay_seconds(
+    const struct timespec* from, const struct timespec* to) {
+  return ((double)(to->tv_sec - from->tv_sec)
+          + (double)(to->tv_nsec - from->tv_nsec) / 1e9);
+}
+
+static int replay_write_all(int sock, const char* p, size_t len) {
+  while(len > 0) {
+    ssize_t rc = write(sock, p, len);
+    if(rc < 0 && errno == EINTR) {
+      continue;
+    } else if(rc < 0) {
       L(log_error("write() failed with `%s`", strerror(errno)));
       return (-1);
-    } else if(rc == 0 && errno == EINTR) {
-      continue;
     }
-    r -= rc;
+    len -= rc;
     p += rc;
   }
   return (0);
 }
 
-static int main_query(int argc, char** argv) {
+static int replay_flush(replay_sender_t* s) {
+  int rc = replay_write_all(s->sock, s->buf, s->buf_len);
+  s->buf_len = 0;
+  return (rc);
+}
+
+static int replay_send_chunk(replay_sender_t* s, const replay_chunk_t* c) {
+  for(size_t i = 0; i < c->len; i++) {
+    const protocol_entry_t* e = &c->entries[i];
+    // flush early rather than have the encoder run out of space
+    size_t sz = REPLAY_FRAME_OVERHEAD + e->rrname_len + e->rrtype_len
+                + e->rdata_len + e->sensorid_len
+                + e->hist_len * 2 * sizeof(uint64_t);
+    if(REPLAY_SEND_BUFFER - s->buf_len < sz && replay_flush(s) != 0) {
+      return (-1);
+    }
+    protocol_input_request_t input = {.entry = *e};
+    ssize_t rc = blb_protocol_encode_input_request(
+        &input, s->buf + s->buf_len, REPLAY_SEND_BUFFER - s->buf_len);
+    if(rc <= 0) {
+      L(log_error("unable to encode input request"));
+      return (-1);
+    }
+    s->buf_len += rc;
+  }
+  return (0);
+}
+
+// the next queued chunk, or `NULL` once the decoder is done
+static replay_chunk_t* replay_next(replay_t* r) {
+  pthread_mutex_lock(&r->lock);
+  while(r->work_head == NULL && !r->done) {
+    pthread_cond_wait(&r->work_cond, &r->lock);
+  }
+  replay_chunk_t* c = r->work_head;
+  if(c != NULL) {
+    r->work_head = c->next;
+    if(r->work_head == NULL) { r->work_tail = NULL; }
+  }
+  pthread_mutex_unlock(&r->lock);
+  return (c);
+}
+
+static void replay_return(replay_t* r, replay_chunk_t* c, bool failed) {
+  pthread_mutex_lock(&r->lock);
+  if(failed) {
+    r->failed = true;
+    pthread_cond_broadcast(&r->written_cond);
+  }
+  c->next = r->free;
+  r->free = c;
+  pthread_cond_broadcast(&r->free_cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+static void* replay_send(void* usr) {
+  replay_sender_t* s = usr;
+  replay_t* r = s->replay;
+  replay_chunk_t* c;
+  while((c = replay_next(r)) != NULL) {
+    // a failed sender keeps returning chunks so the decoder never stalls
+    if(s->rc == 0) { s->rc = replay_send_chunk(s, c); }
+    replay_return(r, c, s->rc != 0);
+  }
+  if(s->rc == 0) { s->rc = replay_flush(s); }
+  return (NULL);
+}
+
+static void replay_init(replay_t* r, replay_chunk_t* pool, int chunks) {
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->work_cond, NULL);
+  pthread_cond_init(&r->free_cond, NULL);
+  pthread_cond_init(&r->written_cond, NULL);
+  for(int i = 0; i < chunks; i++) {
+    pool[i].next = r->free;
+    r->free = &pool[i];
+  }
+}
+
+static void replay_teardown(replay_t* r) {
+  pthread_cond_destroy(&r->written_cond);
+  pthread_cond_destroy(&r->free_cond);
+  pthread_cond_destroy(&r->work_cond);
+  pthread_mutex_destroy(&r->lock);
+}
+
+static void replay_push(replay_t* r, replay_chunk_t* c) {
+  c->next = NULL;
+  pthread_mutex_lock(&r->lock);
+  c->seq = r->pushed++;
+  if(r->work_tail == NULL) {
+    r->work_head = c;
+  } else {
+    r->work_tail->next = c;
+  }
+  r->work_tail = c;
+  pthread_cond_signal(&r->work_cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+// queues the partly filled chunk and lets the senders run dry
+static void replay_finish(replay_t* r) {
+  if(r->cur != NULL && r->cur->len > 0) {
+    replay_push(r, r->cur);
+    r->cur = NULL;
+  }
+  pthread_mutex_lock(&r->lock);
+  r->done = true;
+  pthread_cond_broadcast(&r->work_cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+// a free chunk, or `NULL` once a sender failed
+static replay_chunk_t* replay_take(replay_t* r) {
+  pthread_mutex_lock(&r->lock);
+  while(r->free == NULL && !r->failed) {
+    pthread_cond_wait(&r->free_cond, &r->lock);
+  }
+  replay_chunk_t* c = r->failed ? NULL : r->free;
+  if(c != NULL) { r->free = c->next; }
+  pthread_mutex_unlock(&r->lock);
+  if(c != NULL) {
+    c->len = 0;
+    c->arena_len = 0;
+  }
+  return (c);
+}
+
+static const void* replay_copy(replay_chunk_t* c, const void* p, size_t len) {
+  char* q = c->arena + c->arena_len;
+  if(len > 0) { memcpy(q, p, len); }
+  c->arena_len += len;
+  return (q);
+}
+
+static void replay_report(replay_t* r, bool final) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(final) {
+    double dt = replay_seconds(&r->start, &now);
+    L(log_notice(
+        "replayed `%" PRIu64 "` entries in `%.2f` seconds (`%.0f` entries/s)",
+        r->entries,
+        dt,
+        dt > 0 ? (double)r->entries / dt : 0.0));
+    return;
+  }
+  double dt = replay_seconds(&r->last, &now);
+  if(dt < 1.0) { return; }
+  V(log_info(
+      "read `%" PRIu64 "` entries (`%.0f` entries/s)",
+      r->entries,
+      (double)(r->entries - r->last_entries) / dt));
+  r->last = now;
+  r->last_entries = r->entries;
+}
+
+static int dump_entry_replay_cb(state_t* state, protocol_entry_t* entry) {
+  replay_t* r = state->usr;
+  ASSERT(r != NULL);
+
+  size_t sz = entry->rrname_len + entry->rrtype_len + entry->rdata_len
+              + entry->sensorid_len + sizeof(uint32_t)
+              + entry->hist_len * 2 * sizeof(uint32_t);
+  if(sz > REPLAY_CHUNK_ARENA) {
+    L(log_error("entry too large to replay"));
+    return (-1);
+  }
+  replay_chunk_t* c = r->cur;
+  if(c != NULL
+     && (c->len == REPLAY_CHUNK_ENTRIES
+         || REPLAY_CHUNK_ARENA - c->arena_len < sz)) {
+    replay_push(r, c);
+    c = r->cur = NULL;
+    replay_report(r, false);
+  }
+  if(c == NULL && (c = r->cur = replay_take(r)) == NULL) { return (-1); }
+
+  protocol_entry_t* e = &c->entries[c->len++];
+  *e = *entry;
+  e->rrname = replay_copy(c, entry->rrname, entry->rrname_len);
+  e->rrtype = replay_copy(c, entry->rrtype, entry->rrtype_len);
+  e->rdata = replay_copy(c, entry->rdata, entry->rdata_len);
+  e->sensorid = replay_copy(c, entry->sensorid, entry->sensorid_len);
+  if(entry->hist_len > 0) {
+    c->arena_len = (c->arena_len + sizeof(uint32_t) - 1)
+                   & ~(sizeof(uint32_t) - 1);
+    e->hist = replay_copy(
+        c, entry->hist, entry->hist_len * 2 * sizeof(uint32_t));
+  }
+  r->entries += 1;
+  return (0);
+}
+
+// jsonize with `-j` hands the chunks of the replay decoder to encoder
+// threads; each encodes a chunk into a buffer of its own and writes it out
+// once all earlier chunks are written, so the output keeps the dump order
+#define JSONIZE_WORKERS_MAX (32)
+#define JSONIZE_BUFFER (4 * 1024 * 1024)
+
+typedef struct jsonize_worker_t jsonize_worker_t;
+struct jsonize_worker_t {
+  replay_t* replay;
+  pthread_t thread;
+  FILE* os;
+  uint8_t* buf;
+  size_t buf_sz;
+  int rc;
+};
+
+static int jsonize_chunk(jsonize_worker_t* w, const replay_chunk_t* c) {
+  bytestring_sink_t sink = bs_sink(w->buf, w->buf_sz);
+  for(size_t i = 0; i < c->len; i++) {
+    while(json_encode_entry(&sink, &c->entries[i]) != 0) {
+      // a chunk holds at most `REPLAY_CHUNK_ARENA` bytes of strings, so a
+      // few doublings always suffice
+      uint8_t* buf = realloc(w->buf, w->buf_sz * 2);
+      if(buf == NULL) {
+        L(log_error("unable to grow the json buffer"));
+        return (-1);
+      }
+      w->buf = buf;
+      w->buf_sz *= 2;
+      size_t index = sink.index;
+      sink = bs_sink(w->buf, w->buf_sz);
+      sink.index = index;
+    }
+  }
+
+  replay_t* r = w->replay;
+  pthread_mutex_lock(&r->lock);
+  while(r->written != c->seq && !r->failed) {
+    pthread_cond_wait(&r->written_cond, &r->lock);
+  }
+  bool failed = r->failed;
+  pthread_mutex_unlock(&r->lock);
+  if(failed) { return (0); }
+
+  int rc = 0;
+  if(fwrite(sink.p, 1, sink.index, w->os) != sink.index) {
+    L(log_error("unable to write json output"));
+    rc = -1;
+  }
+  pthread_mutex_lock(&r->lock);
+  r->written += 1;
+  pthread_cond_broadcast(&r->written_cond);
+  pthread_mutex_unlock(&r->lock);
+  return (rc);
+}
+
+static void* jsonize_encode(void* usr) {
+  jsonize_worker_t* w = usr;
+  replay_t* r = w->replay;
+  replay_chunk_t* c;
+  while((c = replay_next(r)) != NULL) {
+    if(w->rc == 0) { w->rc = jsonize_chunk(w, c); }
+    replay_return(r, c, w->rc != 0);
+  }
+  return (NULL);
+}
+
+static int jsonize_parallel(const char* dump_file, int workers) {
+  replay_t __r = {0}, *r = &__r;
+  int chunks = 2 * workers + 1;
+  replay_chunk_t* pool = malloc(sizeof(replay_chunk_t) * chunks);
+  jsonize_worker_t* w = calloc(workers, sizeof(jsonize_worker_t));
+  if(pool == NULL || w == NULL) {
+    L(log_error("unable to allocate jsonize buffers"));
+    free(pool);
+    free(w);
+    return (-1);
+  }
+  replay_init(r, pool, chunks);
+
+  int rc = 0;
+  int started = 0;
+  for(; started < workers; started++) {
+    jsonize_worker_t* wk = &w[started];
+    wk->replay = r;
+    wk->os = stdout;
+    wk->buf_sz = JSONIZE_BUFFER;
+    wk->buf = malloc(wk->buf_sz);
+    if(wk->buf == NULL
+       || pthread_create(&wk->thread, NULL, jsonize_encode, wk) != 0) {
+      L(log_error("unable to start encoder thread"));
+      free(wk->buf);
+      rc = -1;
+      break;
+    }
+  }
+
+  if(rc == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+    r->last = r->start;
+    state_t __state = {0}, *state = &__state;
+    int state_ok = dump_state_init(state);
+    if(state_ok != 0) {
+      L(log_error("unable to initialize the dump state"));
+      rc = -1;
+    } else {
+      state->usr = r;
+      state->dump_entry_cb = dump_entry_replay_cb;
+      rc = dump(state, dump_file);
+    }
+  }
+
+  replay_finish(r);
+  for(int i = 0; i < started; i++) {
+    pthread_join(w[i].thread, NULL);
+    free(w[i].buf);
+    if(w[i].rc != 0) { rc = -1; }
+  }
+
+  replay_teardown(r);
+  free(w);
+  free(pool);
+  return (rc);
+}
+
+// queries and subscriptions share their options and their response stream
+static int query_stream(int argc, char** argv, bool subscribe) {
   engine_config_t engine_config = blb_engine_client_config_init();
   trace_config_t trace_config = {.stream = stderr,
                                  .host = "pdns",
@@ -172,9 +597,10 @@ static int main_query(int argc, char** argv) {
   query->limit = 100;
   ketopt_t opt = KETOPT_INIT;
   int c;
-  while((c = ketopt(&opt, argc, argv, 1, "h:p:r:d:s:l:vSR", NULL)) >= 0) {
+  while((c = ketopt(&opt, argc, argv, 1, "h:p:r:d:s:l:vHSR", NULL)) >= 0) {
     switch(c) {
     case 'v': trace_config.verbosity += 1; break;
+    case 'H': query->histogram = true; break;
     case 'h': engine_config.host = opt.arg; break;
     case 'p': engine_config.port = atoi(opt.arg); break;
     case 'd':
@@ -204,6 +630,10 @@ static int main_query(int argc, char** argv) {
 
   theTrace_stream_use(&trace_config);
 
+  // results of a query go out in large writes; subscriptions flush every
+  // entry anyway
+  if(!subscribe) { (void)setvbuf(stdout, NULL, _IOFBF, 1024 * 1024); }
+
   conn_t* conn = blb_engine_client_new(&engine_config);
   if(conn == NULL) {
     L(log_error("unable to connect to backend"));
@@ -213,28 +643,30 @@ static int main_query(int argc, char** argv) {
 
   V(blb_protocol_log_query(query));
 
-  ssize_t used = blb_protocol_encode_query_request(
-      query, conn->scrtch, ENGINE_CONN_SCRTCH_SZ);
+  ssize_t used = subscribe ? blb_protocol_encode_subscribe_request(
+                                 query, conn->scrtch, ENGINE_CONN_SCRTCH_SZ)
+                           : blb_protocol_encode_query_request(
+                                 query, conn->scrtch, ENGINE_CONN_SCRTCH_SZ);
   if(used <= 0) {
     L(log_error("unable to encode query"));
-    blb_engine_teardown(engine);
     blb_engine_conn_teardown(conn);
+    blb_engine_teardown(engine);
     return (-1);
   }
 
   int rc = blb_conn_write_all(conn, conn->scrtch, used);
   if(rc != 0) {
     L(log_debug("blb_conn_write_all() failed"));
-    blb_engine_teardown(engine);
     blb_engine_conn_teardown(conn);
+    blb_engine_teardown(engine);
     return (-1);
   }
 
   protocol_stream_t* stream = blb_engine_stream_new(conn);
   if(stream == NULL) {
     L(log_error("blb_engine_stream_new() failed"));
-    blb_engine_teardown(engine);
     blb_engine_conn_teardown(conn);
+    blb_engine_teardown(engine);
     return (-1);
   }
 
@@ -247,8 +679,8 @@ static int main_query(int argc, char** argv) {
     if(rc < -1) {
       L(log_error("blb_protocol_stream_decode() failed"));
       blb_protocol_stream_teardown(stream);
-      blb_engine_teardown(engine);
       blb_engine_conn_teardown(conn);
+      blb_engine_teardown(engine);
       return (-1);
     } else if(rc == -1) {
       break;
@@ -265,8 +697,9 @@ static int main_query(int argc, char** argv) {
       switch(msg.ty) {
       case PROTOCOL_QUERY_STREAM_END_RESPONSE: st = END; goto done;
       case PROTOCOL_QUERY_STREAM_DATA_RESPONSE: {
-        uint8_t json[1024 * 10];
+        uint8_t json[1024 * 64];
         dump_entry_as_json(stdout, json, sizeof(json), &msg.u.entry);
+        if(subscribe) { fflush(stdout); }
         break;
       }
       default: L(log_emergency("(stream) received invalid message"));
@@ -278,13 +711,136 @@ static int main_query(int argc, char** argv) {
   }
 done:
   blb_protocol_stream_teardown(stream);
-  blb_engine_teardown(engine);
   blb_engine_conn_teardown(conn);
+  blb_engine_teardown(engine);
   return (0);
 }
 
+static int main_query(int argc, char** argv) {
+  return (query_stream(argc, argv, false));
+}
+
+static int main_subscribe(int argc, char** argv) {
+  return (query_stream(argc, argv, true));
+}
+
+// sends an info request on `topic`, a purge of the sensor given by `-s` or
+// an index verification, with repairs on `-r`, and prints the answer as is
+static int text_request(int argc, char** argv, int ty, const char* topic) {
+  engine_config_t engine_config = blb_engine_client_config_init();
+  trace_config_t trace_config = {.stream = stderr,
+                                 .host = "pdns",
+                                 .app = "balboa-backend-console",
+                                 // leaking process number ...
+                                 .procid = getpid()};
+  const char* sensorid = NULL;
+  bool repair = false;
+  ketopt_t opt = KETOPT_INIT;
+  int c;
+  while((c = ketopt(&opt, argc, argv, 1, "h:p:s:rv", NULL)) >= 0) {
+    switch(c) {
+    case 'v': trace_config.verbosity += 1; break;
+    case 'h': engine_config.host = opt.arg; break;
+    case 'p': engine_config.port = atoi(opt.arg); break;
+    case 's': sensorid = opt.arg; break;
+    case 'r': repair = true; break;
+    default: break;
+    }
+  }
+
+  theTrace_stream_use(&trace_config);
+
+  if(ty == PROTOCOL_PURGE_REQUEST
+     && (sensorid == NULL || sensorid[0] == '\0')) {
+    L(log_error("no sensor id given"));
+    return (-1);
+  }
+
+  conn_t* conn = blb_engine_client_new(&engine_config);
+  if(conn == NULL) {
+    L(log_error("unable to connect to backend"));
+    return (-1);
+  }
+  engine_t* engine = conn->engine;
+  // verify answers only once done, which may take hours; reads do not time
+  // out, so keepalives have to tell a busy backend from a dead one
+  if(ty == PROTOCOL_VERIFY_REQUEST) {
+    int one = 1;
+    if(setsockopt(conn->fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one))
+       < 0) {
+      L(log_warn("setsockopt(SO_KEEPALIVE) failed: `%s`", strerror(errno)));
+    }
+  }
+
+  ssize_t used = -1;
+  if(ty == PROTOCOL_INFO_REQUEST) {
+    protocol_info_request_t req = {.topic = topic, .topic_len = strlen(topic)};
+    used = blb_protocol_encode_info_request(
+        &req, conn->scrtch, ENGINE_CONN_SCRTCH_SZ);
+  } else if(ty == PROTOCOL_PURGE_REQUEST) {
+    protocol_purge_request_t req = {.sensorid = sensorid,
+                                    .sensorid_len = strlen(sensorid)};
+    used = blb_protocol_encode_purge_request(
+        &req, conn->scrtch, ENGINE_CONN_SCRTCH_SZ);
+  } else {
+    protocol_verify_request_t req = {.repair = repair};
+    used = blb_protocol_encode_verify_request(
+        &req, conn->scrtch, ENGINE_CONN_SCRTCH_SZ);
+  }
+  if(used <= 0 || blb_conn_write_all(conn, conn->scrtch, used) != 0) {
+    L(log_error("unable to send request"));
+    blb_engine_conn_teardown(conn);
+    blb_engine_teardown(engine);
+    return (-1);
+  }
+
+  protocol_stream_t* stream = blb_engine_stream_new(conn);
+  if(stream == NULL) {
+    L(log_error("blb_engine_stream_new() failed"));
+    blb_engine_conn_teardown(conn);
+    blb_engine_teardown(engine);
+    return (-1);
+  }
+
+  int res = -1;
+  protocol_message_t msg;
+  int rc = blb_protocol_stream_decode(stream, &msg);
+  if(rc == 0 && msg.ty == PROTOCOL_INFO_RESPONSE) {
+    fwrite(msg.u.info_response.text, msg.u.info_response.text_len, 1, stdout);
+    fflush(stdout);
+    res = 0;
+  } else if(ty == PROTOCOL_INFO_REQUEST) {
+    L(log_error("backend does not provide `%s` info", topic));
+  } else if(ty == PROTOCOL_PURGE_REQUEST) {
+    L(log_error("backend failed to purge sensor `%s`", sensorid));
+  } else {
+    L(log_error("backend failed to verify its indexes"));
+  }
+  blb_protocol_stream_teardown(stream);
+  blb_engine_conn_teardown(conn);
+  blb_engine_teardown(engine);
+  return (res);
+}
+
+static int main_compression(int argc, char** argv) {
+  return (text_request(argc, argv, PROTOCOL_INFO_REQUEST, "compression"));
+}
+
+static int main_sensors(int argc, char** argv) {
+  return (text_request(argc, argv, PROTOCOL_INFO_REQUEST, "sensors"));
+}
+
+static int main_purge(int argc, char** argv) {
+  return (text_request(argc, argv, PROTOCOL_PURGE_REQUEST, NULL));
+}
+
+static int main_verify(int argc, char** argv) {
+  return (text_request(argc, argv, PROTOCOL_VERIFY_REQUEST, NULL));
+}
+
 static int main_jsonize(int argc, char** argv) {
   const char* dump_file = "-";
+  int workers = 1;
   int verbosity = 0;
   trace_config_t trace_config = {.stream = stderr,
                                  .host = "pdns",
@@ -294,9 +850,10 @@ static int main_jsonize(int argc, char** argv) {
 
   ketopt_t opt = KETOPT_INIT;
   int c;
-  while((c = ketopt(&opt, argc, argv, 1, "d:v", NULL)) >= 0) {
+  while((c = ketopt(&opt, argc, argv, 1, "d:j:v", NULL)) >= 0) {
     switch(c) {
     case 'd': dump_file = opt.arg; break;
+    case 'j': workers = atoi(opt.arg); break;
     case 'v': verbosity += 1; break;
     default: break;
     }
@@ -305,6 +862,13 @@ static int main_jsonize(int argc, char** argv) {
   theTrace_stream_use(&trace_config);
   theTrace_set_verbosity(verbosity);
 
+  if(workers < 1 || workers > JSONIZE_WORKERS_MAX) {
+    L(log_error("-j must be between 1 and %d", JSONIZE_WORKERS_MAX));
+    return (-1);
+  }
+
+  if(workers > 1) { return (jsonize_parallel(dump_file, workers)); }
+
   V(log_info("dump file is `%s`", dump_file));
 
   state_t __state = {0}, *state = &__state;
@@ -313,8 +877,11 @@ static int main_jsonize(int argc, char** argv) {
     L(log_error("unable to initialize the dump state"));
     return (-1);
   }
+  bytestring_sink_t sink = bs_sink(state->scrtch0, state->scrtch0_sz);
   state->os = stdout;
+  state->usr = &sink;
   state->dump_entry_cb = dump_entry_json_cb;
+  state->dump_done_cb = dump_json_flush;
   int rc = dump(state, dump_file);
   return (rc);
 }
@@ -347,15 +914,20 @@ __attribute__((noreturn)) void usage(void) {
       "\
 `balboa-backend-console` is a management tool for `balboa-backends`\n\
 \n\
-Usage: balboa-backend-console <--version|help|jsonize|dump|replay> [options]\n\
+Usage: balboa-backend-console\n\
+    <--version|help|jsonize|dump|replay|query|subscribe|compression|\n\
+     sensors|purge|verify|bench> [options]\n\
 \n\
 Command help:\n\
     show help\n\
 \n\
 Command jsonize:\n\
-    read a dump file and print all entries as json\n\
+    read a dump file, plain or lz4 or zstd compressed, and print all\n\
+    entries as json\n\
 \n\
     -d <path> path to the dump file to read\n\
+    -j <n> encode on this many threads; the output keeps the order of\n\
+        the dump (default: 1)\n\
 \n\
 Command dump:\n\
     connect to a `balboa-backend` and request a dump of all data to local stdout\n\
@@ -364,19 +936,107 @@ Command dump:\n\
     -p <port> port of the `balboa-backend` (default: 4242)\n\
     -v increase verbosity; can be passed multiple times\n\
     -d <remote-dump-path> unused/ignored (default: -)\n\
+    -z <none|lz4|zstd> compress the dump (default: none)\n\
 \n\
 Command replay:\n\
-    replay a previously generated database dump\n\
+    replay a previously generated database dump, plain or lz4 or zstd\n\
+    compressed\n\
 \n\
     -d <path> database dump file or `-` for stdin (default: -)\n\
     -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
     -p <port> port of the `balboa-backend` (default: 4242)\n\
+    -j <n> send over this many connections in parallel (default: 1)\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
+Command query:\n\
+    query a `balboa-backend` for an rrname or rdata and print the matching\n\
+    entries as json\n\
+\n\
+    -r <rrname> rrname to query\n\
+    -d <rdata> rdata to query (used when no rrname is given)\n\
+    -s <sensor-id> only entries of this sensor\n\
+    -H include per entry activity histograms, where recorded\n\
+    -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
+    -p <port> port of the `balboa-backend` (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
+Command subscribe:\n\
+    print every newly ingested entry matching an rrname or rdata as json\n\
+    until interrupted\n\
+\n\
+    -r <rrname> rrname to watch\n\
+    -d <rdata> rdata to watch; with `-r` narrows the rrname down\n\
+    -s <sensor-id> only entries of this sensor\n\
+    -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
+    -p <port> port of the `balboa-backend` (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
+Command compression:\n\
+    print files, size, codec and achieved compression ratio per level of\n\
+    a `balboa-backend` (rocksdb only)\n\
+\n\
+    -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
+    -p <port> port of the `balboa-backend` (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
+Command sensors:\n\
+    print the estimated number of keys and the size of the default and of\n\
+    every sensor's column family of a `balboa-backend` (rocksdb only)\n\
+\n\
+    -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
+    -p <port> port of the `balboa-backend` (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
+Command purge:\n\
+    delete all entries of a sensor from a `balboa-backend` (rocksdb only);\n\
+    the purge runs in the background, repeat the command for its progress\n\
+    and, once done, its result\n\
+\n\
+    -s <sensor-id> sensor to purge\n\
+    -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
+    -p <port> port of the `balboa-backend` (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
+Command verify:\n\
+    check that every forward index key of a `balboa-backend` has its\n\
+    inverted index key and the other way around (rocksdb only)\n\
+\n\
+    -r write missing and delete orphaned inverted index keys\n\
+    -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
+    -p <port> port of the `balboa-backend` (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
+Command bench:\n\
+    load a `balboa-backend` with a mix of inputs and queries and report\n\
+    throughput and latency percentiles per operation; inputs name keys\n\
+    `h<n>.bench.example` and `10.x.y.z`, so queries find entries once\n\
+    some were ingested\n\
+\n\
+    -c <n> connections, one thread each (default: 4)\n\
+    -t <seconds> duration (default: 10)\n\
+    -q <percent> share of queries, the rest are inputs (default: 10)\n\
+    -d <percent> share of queries by rdata, the rest by rrname (default: 50)\n\
+    -b <n> inputs per batch; a batch ends with a query, and its input\n\
+        latency runs until the backend answered that query, so it has\n\
+        consumed the batch (default: 1)\n\
+    -k <n> distinct rrnames and rdata (default: 100000)\n\
+    -z <s> zipfian key popularity with exponent s, 0 for uniform\n\
+        (default: 0)\n\
+    -l <n> query result limit (default: 100)\n\
+    -h <host> ip address of the `balboa-backend` (default: 127.0.0.1)\n\
+    -p <port> port of the `balboa-backend` (default: 4242)\n\
     -v increase verbosity; can be passed multiple times\n\
 \n\
 Examples:\n\
 \n\
 balboa-backend-console jsonize -r /tmp/pdns.dmp\n\
-lz4cat /tmp/pdns.dmp.lz4 | balboa-backend-console jsonize\n\
+balboa-backend-console jsonize -d /tmp/pdns.dmp.lz4\n\
+balboa-backend-console jsonize -j 8 -d /tmp/pdns.dmp.zst\n\
+balboa-backend-console query -r example.com -H\n\
+balboa-backend-console subscribe -d 192.0.2.1\n\
+balboa-backend-console purge -s decommissioned-sensor\n\
+balboa-backend-console verify -r\n\
+balboa-backend-console bench -c 8 -t 30 -q 20 -z 0.99\n\
 \n");
   exit(1);
 }
@@ -385,6 +1045,7 @@ static int main_dump(int argc, char** argv) {
   const char* host = "127.0.0.1";
   const char* port = "4242";
   const char* dump_path_hint = "-";
+  const char* compression = "none";
   int verbosity = 0;
   trace_config_t trace_config = {.stream = stderr,
                                  .host = "pdns",
@@ -393,12 +1054,13 @@ static int main_dump(int argc, char** argv) {
                                  .procid = getpid()};
   ketopt_t opt = KETOPT_INIT;
   int c;
-  while((c = ketopt(&opt, argc, argv, 1, "h:p:d:v", NULL)) >= 0) {
+  while((c = ketopt(&opt, argc, argv, 1, "h:p:d:z:v", NULL)) >= 0) {
     switch(c) {
     case 'h': host = opt.arg; break;
     case 'p': port = opt.arg; break;
     case 'v': verbosity += 1; break;
     case 'd': dump_path_hint = opt.arg; break;
+    case 'z': compression = opt.arg; break;
     default: break;
     }
   }
@@ -408,6 +1070,8 @@ static int main_dump(int argc, char** argv) {
 
   V(log_info(
       "host `%s` port `%s` dump_path_hint `%s`", host, port, dump_path_hint));
+  zio_codec_t codec = ZIO_NONE;
+  if(blb_zio_codec_parse(compression, &codec) != 0) { return (-1); }
   int sock = dump_connect(host, port);
   if(sock < 0) {
     L(log_error("unable to connect to backend"));
@@ -438,20 +1102,25 @@ static int main_dump(int argc, char** argv) {
     p += rc;
   }
 
+  zio_writer_t* w = blb_zio_writer_new(stdout, codec);
+  if(w == NULL) {
+    close(sock);
+    return (-1);
+  }
+  char buf[64 * 1024];
   while(1) {
-    ssize_t rc = read(sock, scrtch, scrtch_sz);
+    ssize_t rc = read(sock, buf, sizeof(buf));
     if(rc == 0) {
-      fflush(stdout);
       close(sock);
-      return (0);
+      return (blb_zio_writer_finish(w));
     } else if(rc < 0) {
       L(log_error("read() failed with `%s`", strerror(errno)));
+      (void)blb_zio_writer_finish(w);
       close(sock);
       return (-1);
     }
-    rc = fwrite(scrtch, rc, 1, stdout);
-    if(rc != 1) {
-      L(log_error("fwrite() failed with `%s`", strerror(errno)));
+    if(blb_zio_write(w, buf, rc) != 0) {
+      (void)blb_zio_writer_finish(w);
       close(sock);
       return (-1);
     }
@@ -462,6 +1131,7 @@ static int main_replay(int argc, char** argv) {
   const char* host = "127.0.0.1";
   const char* port = "4242";
   const char* dump_file = "-";
+  int senders = 1;
   int verbosity = 0;
   trace_config_t trace_config = {.stream = stderr,
                                  .host = "pdns",
@@ -471,11 +1141,12 @@ static int main_replay(int argc, char** argv) {
 
   ketopt_t opt = KETOPT_INIT;
   int c;
-  while((c = ketopt(&opt, argc, argv, 1, "d:h:p:v", NULL)) >= 0) {
+  while((c = ketopt(&opt, argc, argv, 1, "d:h:p:j:v", NULL)) >= 0) {
     switch(c) {
     case 'd': dump_file = opt.arg; break;
     case 'h': host = opt.arg; break;
     case 'p': port = opt.arg; break;
+    case 'j': senders = atoi(opt.arg); break;
     case 'v': verbosity += 1; break;
     default: break;
     }
@@ -484,22 +1155,535 @@ static int main_replay(int argc, char** argv) {
   theTrace_stream_use(&trace_config);
   theTrace_set_verbosity(verbosity);
 
-  V(log_info("host `%s` port `%s` dump_file `%s`", host, port, dump_file));
+  if(senders < 1 || senders > REPLAY_SENDERS_MAX) {
+    L(log_error("-j must be between 1 and %d", REPLAY_SENDERS_MAX));
+    return (-1);
+  }
 
-  int sock = dump_connect(host, port);
-  if(sock < 0) {
-    L(log_error("unable to connect to backend"));
+  V(log_info(
+      "host `%s` port `%s` dump_file `%s` senders `%d`",
+      host,
+      port,
+      dump_file,
+      senders));
+
+  replay_t __r = {0}, *r = &__r;
+  // two chunks per sender keep every sender busy while the decoder fills
+  int chunks = 2 * senders + 1;
+  replay_chunk_t* pool = malloc(sizeof(replay_chunk_t) * chunks);
+  replay_sender_t* s = calloc(senders, sizeof(replay_sender_t));
+  char* bufs = malloc((size_t)REPLAY_SEND_BUFFER * senders);
+  if(pool == NULL || s == NULL || bufs == NULL) {
+    L(log_error("unable to allocate replay buffers"));
+    free(pool);
+    free(s);
+    free(bufs);
     return (-1);
   }
-  state_t __state = {0}, *state = &__state;
-  int state_ok = dump_state_init(state);
-  if(state_ok != 0) {
-    L(log_error("unable to initialize the dump state"));
+  replay_init(r, pool, chunks);
+
+  int rc = 0;
+  int started = 0;
+  for(; started < senders; started++) {
+    replay_sender_t* sd = &s[started];
+    sd->replay = r;
+    sd->buf = bufs + (size_t)REPLAY_SEND_BUFFER * started;
+    sd->sock = dump_connect(host, port);
+    if(sd->sock < 0) {
+      L(log_error("unable to connect to backend"));
+      rc = -1;
+      break;
+    }
+    int sndbuf = REPLAY_SEND_BUFFER;
+    (void)setsockopt(sd->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    if(pthread_create(&sd->thread, NULL, replay_send, sd) != 0) {
+      L(log_error("unable to start sender thread"));
+      close(sd->sock);
+      rc = -1;
+      break;
+    }
+  }
+
+  if(rc == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+    r->last = r->start;
+    state_t __state = {0}, *state = &__state;
+    int state_ok = dump_state_init(state);
+    if(state_ok != 0) {
+      L(log_error("unable to initialize the dump state"));
+      rc = -1;
+    } else {
+      state->usr = r;
+      state->dump_entry_cb = dump_entry_replay_cb;
+      rc = dump(state, dump_file);
+    }
+  }
+
+  replay_finish(r);
+  for(int i = 0; i < started; i++) {
+    pthread_join(s[i].thread, NULL);
+    close(s[i].sock);
+    if(s[i].rc != 0) { rc = -1; }
+  }
+  if(rc == 0) { replay_report(r, true); }
+
+  replay_teardown(r);
+  free(bufs);
+  free(s);
+  free(pool);
+  return (rc);
+}
+
+// bench drives a backend with a mix of inputs and queries over several
+// connections and reports throughput and latency percentiles per operation.
+// latencies are recorded in log-linear histograms in the manner of
+// HdrHistogram: exact below 128ns, then 128 buckets per power of two, which
+// bounds the relative error of a reported value to 1/128
+#define BENCH_HIST_SUB_BITS (7)
+#define BENCH_HIST_SUB (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS ((64 - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB)
+#define BENCH_CONNS_MAX (256)
+#define BENCH_KEYS_MAX (10 * 1000 * 1000)
+#define BENCH_BATCH_MAX (1024)
+#define BENCH_FRAME_SZ (256)
+#define BENCH_FENCE_RRNAME "fence.bench.example"
+
+enum { BENCH_INPUT = 0, BENCH_QUERY_RRNAME, BENCH_QUERY_RDATA, BENCH_OPS };
+
+static const char* bench_op_names[BENCH_OPS] = {
+    "input", "query-rrname", "query-rdata"};
+
+typedef struct bench_hist_t bench_hist_t;
+struct bench_hist_t {
+  uint64_t n;
+  uint64_t max;
+  uint64_t counts[BENCH_HIST_BUCKETS];
+};
+
+typedef struct bench_t bench_t;
+struct bench_t {
+  engine_config_t engine_config;
+  int conns;
+  int seconds;
+  int query_pct;
+  int rdata_pct;
+  int batch;
+  int limit;
+  uint32_t keys;
+  double zipf;
+  // cumulative key probabilities for zipfian keys, `NULL` for uniform ones
+  double* cdf;
+  atomic_int stop;
+  atomic_ullong ops[BENCH_OPS];
+};
+
+typedef struct bench_worker_t bench_worker_t;
+struct bench_worker_t {
+  bench_t* bench;
+  pthread_t thread;
+  conn_t* conn;
+  uint64_t rng;
+  int rc;
+  uint64_t results;
+  bench_hist_t hist[BENCH_OPS];
+};
+
+static size_t bench_hist_bucket(uint64_t v) {
+  if(v < BENCH_HIST_SUB) { return (v); }
+  int e = 63 - __builtin_clzll(v);
+  size_t m = (v >> (e - BENCH_HIST_SUB_BITS)) & (BENCH_HIST_SUB - 1);
+  return ((size_t)(e - BENCH_HIST_SUB_BITS + 1) * BENCH_HIST_SUB + m);
+}
+
+// the highest value recorded into bucket `idx`
+static uint64_t bench_hist_value(size_t idx) {
+  if(idx < BENCH_HIST_SUB) { return (idx); }
+  int e = (int)(idx / BENCH_HIST_SUB) + BENCH_HIST_SUB_BITS - 1;
+  uint64_t m = idx % BENCH_HIST_SUB;
+  uint64_t lo = (BENCH_HIST_SUB + m) << (e - BENCH_HIST_SUB_BITS);
+  return (lo + ((uint64_t)1 << (e - BENCH_HIST_SUB_BITS)) - 1);
+}
+
+static void bench_hist_record(bench_hist_t* h, uint64_t v) {
+  h->counts[bench_hist_bucket(v)] += 1;
+  h->n += 1;
+  if(v > h->max) { h->max = v; }
+}
+
+static void bench_hist_merge(bench_hist_t* into, const bench_hist_t* h) {
+  for(size_t i = 0; i < BENCH_HIST_BUCKETS; i++) {
+    into->counts[i] += h->counts[i];
+  }
+  into->n += h->n;
+  if(h->max > into->max) { into->max = h->max; }
+}
+
+static uint64_t bench_hist_percentile(const bench_hist_t* h, double q) {
+  uint64_t rank = (uint64_t)ceil(q * (double)h->n);
+  if(rank == 0) { rank = 1; }
+  uint64_t seen = 0;
+  for(size_t i = 0; i < BENCH_HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if(seen >= rank) {
+      uint64_t v = bench_hist_value(i);
+      return (v < h->max ? v : h->max);
+    }
+  }
+  return (h->max);
+}
+
+// xorshift64*
+static inline uint64_t bench_rand(uint64_t* s) {
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return (*s * 0x2545f4914f6cdd1dULL);
+}
+
+static uint32_t bench_key(const bench_t* b, uint64_t* rng) {
+  if(b->cdf == NULL) { return ((uint32_t)(bench_rand(rng) % b->keys)); }
+  double u = (double)(bench_rand(rng) >> 11) * 0x1.0p-53;
+  uint32_t lo = 0;
+  uint32_t hi = b->keys - 1;
+  while(lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if(b->cdf[mid] < u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return (lo);
+}
+
+static int bench_cdf_init(bench_t* b) {
+  b->cdf = malloc(sizeof(double) * b->keys);
+  if(b->cdf == NULL) { return (-1); }
+  double sum = 0;
+  for(uint32_t i = 0; i < b->keys; i++) {
+    sum += 1.0 / pow((double)i + 1, b->zipf);
+    b->cdf[i] = sum;
+  }
+  for(uint32_t i = 0; i < b->keys; i++) { b->cdf[i] /= sum; }
+  return (0);
+}
+
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+// writes an encoded query and reads its response stream
+static int bench_roundtrip(
+    conn_t* conn,
+    protocol_stream_t* stream,
+    char* p,
+    size_t len,
+    uint64_t* results) {
+  if(blb_conn_write_all(conn, p, len) != 0) { return (-1); }
+  bool started = false;
+  while(1) {
+    protocol_message_t msg;
+    if(blb_protocol_stream_decode(stream, &msg) != 0) {
+      L(log_error("blb_protocol_stream_decode() failed"));
+      return (-1);
+    }
+    if(!started && msg.ty == PROTOCOL_QUERY_STREAM_START_RESPONSE) {
+      started = true;
+    } else if(started && msg.ty == PROTOCOL_QUERY_STREAM_DATA_RESPONSE) {
+      *results += 1;
+    } else if(started && msg.ty == PROTOCOL_QUERY_STREAM_END_RESPONSE) {
+      return (0);
+    } else {
+      L(log_error("unexpected message `%d` in query response", msg.ty));
+      return (-1);
+    }
+  }
+}
+
+// a backend consumes the requests of a connection in order, so once the
+// response to a query written after a batch is back, the batch has been
+// consumed; input latency spans writing the batch up to that response. the
+// query asks for a name no input ever uses, so it finds nothing
+static int bench_flush(
+    bench_worker_t* w,
+    conn_t* conn,
+    protocol_stream_t* stream,
+    char* buf,
+    size_t* len,
+    int* pending) {
+  if(*pending == 0) { return (0); }
+  protocol_query_request_t fence = {.qrrname = BENCH_FENCE_RRNAME,
+                                    .qrrname_len =
+                                        sizeof(BENCH_FENCE_RRNAME) - 1,
+                                    .limit = 1};
+  ssize_t used =
+      blb_protocol_encode_query_request(&fence, buf + *len, BENCH_FRAME_SZ);
+  if(used <= 0) {
+    L(log_error("unable to encode query"));
     return (-1);
   }
-  state->sock = sock;
-  state->dump_entry_cb = dump_entry_replay_cb;
-  int rc = dump(state, dump_file);
+  uint64_t results = 0;
+  uint64_t start = bench_now();
+  int rc = bench_roundtrip(conn, stream, buf, *len + used, &results);
+  bench_hist_record(&w->hist[BENCH_INPUT], bench_now() - start);
+  atomic_fetch_add(&w->bench->ops[BENCH_INPUT], *pending);
+  *len = 0;
+  *pending = 0;
+  return (rc);
+}
+
+static int bench_query(
+    bench_worker_t* w,
+    conn_t* conn,
+    protocol_stream_t* stream,
+    const protocol_query_request_t* q,
+    int op) {
+  ssize_t used =
+      blb_protocol_encode_query_request(q, conn->scrtch, ENGINE_CONN_SCRTCH_SZ);
+  if(used <= 0) {
+    L(log_error("unable to encode query"));
+    return (-1);
+  }
+  uint64_t start = bench_now();
+  if(bench_roundtrip(conn, stream, conn->scrtch, used, &w->results) != 0) {
+    return (-1);
+  }
+  bench_hist_record(&w->hist[op], bench_now() - start);
+  atomic_fetch_add(&w->bench->ops[op], 1);
+  return (0);
+}
+
+static void* bench_run(void* usr) {
+  bench_worker_t* w = usr;
+  bench_t* b = w->bench;
+  conn_t* conn = w->conn;
+  w->rc = -1;
+  protocol_stream_t* stream = blb_engine_stream_new(conn);
+  // one frame more for the query ending a batch
+  char* buf = malloc((size_t)(BENCH_BATCH_MAX + 1) * BENCH_FRAME_SZ);
+  if(stream == NULL || buf == NULL) {
+    L(log_error("unable to set up connection state"));
+    goto bench_exit;
+  }
+
+  size_t len = 0;
+  int pending = 0;
+  char rrname[64];
+  char rdata[16];
+  int rc = 0;
+  while(rc == 0 && atomic_load(&b->stop) == 0) {
+    uint32_t key = bench_key(b, &w->rng);
+    int rrname_len = snprintf(rrname, sizeof(rrname), "h%u.bench.example", key);
+    key = bench_key(b, &w->rng);
+    int rdata_len = snprintf(
+        rdata,
+        sizeof(rdata),
+        "10.%u.%u.%u",
+        (key >> 16) & 0xff,
+        (key >> 8) & 0xff,
+        key & 0xff);
+
+    if((int)(bench_rand(&w->rng) % 100) >= b->query_pct) {
+      uint32_t now = (uint32_t)time(NULL);
+      protocol_input_request_t input = {
+          .entry = {.rrname = rrname,
+                    .rrname_len = rrname_len,
+                    .rdata = rdata,
+                    .rdata_len = rdata_len,
+                    .rrtype = "A",
+                    .rrtype_len = 1,
+                    .sensorid = "bench",
+                    .sensorid_len = 5,
+                    .count = 1,
+                    .first_seen = now,
+                    .last_seen = now}};
+      ssize_t used = blb_protocol_encode_input_request(
+          &input, buf + len, BENCH_FRAME_SZ);
+      if(used <= 0) {
+        L(log_error("unable to encode input request"));
+        rc = -1;
+        break;
+      }
+      len += used;
+      pending += 1;
+      if(pending == b->batch) {
+        rc = bench_flush(w, conn, stream, buf, &len, &pending);
+      }
+      continue;
+    }
+
+    // pending inputs go out first so they are not timed as part of the query
+    rc = bench_flush(w, conn, stream, buf, &len, &pending);
+    if(rc != 0) { break; }
+    protocol_query_request_t q = {.limit = b->limit};
+    int op = BENCH_QUERY_RRNAME;
+    if((int)(bench_rand(&w->rng) % 100) < b->rdata_pct) {
+      op = BENCH_QUERY_RDATA;
+      q.qrdata = rdata;
+      q.qrdata_len = rdata_len;
+    } else {
+      q.qrrname = rrname;
+      q.qrrname_len = rrname_len;
+    }
+    rc = bench_query(w, conn, stream, &q, op);
+  }
+  if(rc == 0) { rc = bench_flush(w, conn, stream, buf, &len, &pending); }
+  w->rc = rc;
+
+bench_exit:
+  free(buf);
+  if(stream != NULL) { blb_protocol_stream_teardown(stream); }
+  return (NULL);
+}
+
+static void bench_report(const bench_t* b, bench_worker_t* w, double dt) {
+  bench_hist_t* h = calloc(1, sizeof(bench_hist_t));
+  if(h == NULL) { return; }
+  uint64_t results = 0;
+  printf(
+      "%-13s %10s %10s %10s %10s %10s %10s\n",
+      "op",
+      "count",
+      "ops/s",
+      "p50(us)",
+      "p99(us)",
+      "p999(us)",
+      "max(us)");
+  for(int op = 0; op < BENCH_OPS; op++) {
+    memset(h, 0, sizeof(bench_hist_t));
+    for(int i = 0; i < b->conns; i++) { bench_hist_merge(h, &w[i].hist[op]); }
+    uint64_t n = atomic_load(&b->ops[op]);
+    if(n == 0) { continue; }
+    printf(
+        "%-13s %10" PRIu64 " %10.0f %10.1f %10.1f %10.1f %10.1f\n",
+        bench_op_names[op],
+        n,
+        (double)n / dt,
+        (double)bench_hist_percentile(h, 0.5) / 1e3,
+        (double)bench_hist_percentile(h, 0.99) / 1e3,
+        (double)bench_hist_percentile(h, 0.999) / 1e3,
+        (double)h->max / 1e3);
+  }
+  for(int i = 0; i < b->conns; i++) { results += w[i].results; }
+  printf(
+      "%d connections, %.1f seconds, %" PRIu64 " query results",
+      b->conns,
+      dt,
+      results);
+  if(b->batch > 1) {
+    printf(", input latency per batch of %d inputs", b->batch);
+  }
+  printf("\n");
+  free(h);
+}
+
+static int main_bench(int argc, char** argv) {
+  bench_t __b = {0}, *b = &__b;
+  b->engine_config = blb_engine_client_config_init();
+  b->conns = 4;
+  b->seconds = 10;
+  b->query_pct = 10;
+  b->rdata_pct = 50;
+  b->batch = 1;
+  b->limit = 100;
+  b->keys = 100000;
+  b->zipf = 0;
+  trace_config_t trace_config = {.stream = stderr,
+                                 .host = "pdns",
+                                 .app = "balboa-backend-console",
+                                 // leaking process number ...
+                                 .procid = getpid()};
+  ketopt_t opt = KETOPT_INIT;
+  int c;
+  while((c = ketopt(&opt, argc, argv, 1, "h:p:c:t:q:d:b:k:z:l:v", NULL))
+        >= 0) {
+    switch(c) {
+    case 'h': b->engine_config.host = opt.arg; break;
+    case 'p': b->engine_config.port = atoi(opt.arg); break;
+    case 'c': b->conns = atoi(opt.arg); break;
+    case 't': b->seconds = atoi(opt.arg); break;
+    case 'q': b->query_pct = atoi(opt.arg); break;
+    case 'd': b->rdata_pct = atoi(opt.arg); break;
+    case 'b': b->batch = atoi(opt.arg); break;
+    case 'k': b->keys = (uint32_t)strtoul(opt.arg, NULL, 10); break;
+    case 'z': b->zipf = atof(opt.arg); break;
+    case 'l': b->limit = atoi(opt.arg); break;
+    case 'v': trace_config.verbosity += 1; break;
+    default: break;
+    }
+  }
+
+  theTrace_stream_use(&trace_config);
+
+  if(b->conns < 1 || b->conns > BENCH_CONNS_MAX || b->seconds < 1
+     || b->query_pct < 0 || b->query_pct > 100 || b->rdata_pct < 0
+     || b->rdata_pct > 100 || b->batch < 1 || b->batch > BENCH_BATCH_MAX
+     || b->keys < 1 || b->keys > BENCH_KEYS_MAX || b->zipf < 0
+     || b->limit < 1) {
+    L(log_error("invalid option value, see `help`"));
+    return (-1);
+  }
+  if(b->zipf > 0 && bench_cdf_init(b) != 0) {
+    L(log_error("unable to allocate the key distribution"));
+    return (-1);
+  }
+
+  bench_worker_t* w = calloc(b->conns, sizeof(bench_worker_t));
+  if(w == NULL) {
+    free(b->cdf);
+    return (-1);
+  }
+  int connected = 0;
+  for(; connected < b->conns; connected++) {
+    w[connected].conn = blb_engine_client_new(&b->engine_config);
+    if(w[connected].conn == NULL) {
+      L(log_error("unable to connect to backend"));
+      break;
+    }
+  }
+  uint64_t start = bench_now();
+  int started = 0;
+  for(; started < connected; started++) {
+    w[started].bench = b;
+    w[started].rng = start ^ (0x9e3779b97f4a7c15ULL * (started + 1));
+    if(pthread_create(&w[started].thread, NULL, bench_run, &w[started])
+       != 0) {
+      L(log_error("unable to start bench thread"));
+      break;
+    }
+  }
+
+  uint64_t last[BENCH_OPS] = {0};
+  for(int i = 0; i < b->seconds && started == b->conns; i++) {
+    sleep(1);
+    uint64_t n[BENCH_OPS];
+    for(int op = 0; op < BENCH_OPS; op++) { n[op] = atomic_load(&b->ops[op]); }
+    V(log_info(
+        "inputs/s `%" PRIu64 "` rrname queries/s `%" PRIu64
+        "` rdata queries/s `%" PRIu64 "`",
+        n[BENCH_INPUT] - last[BENCH_INPUT],
+        n[BENCH_QUERY_RRNAME] - last[BENCH_QUERY_RRNAME],
+        n[BENCH_QUERY_RDATA] - last[BENCH_QUERY_RDATA]));
+    memcpy(last, n, sizeof(last));
+  }
+  atomic_store(&b->stop, 1);
+  double dt = (double)(bench_now() - start) / 1e9;
+
+  int rc = started == b->conns ? 0 : -1;
+  for(int i = 0; i < started; i++) {
+    pthread_join(w[i].thread, NULL);
+    if(w[i].rc != 0) { rc = -1; }
+  }
+  if(rc == 0) { bench_report(b, w, dt); }
+  for(int i = 0; i < connected; i++) {
+    engine_t* engine = w[i].conn->engine;
+    blb_engine_conn_teardown(w[i].conn);
+    blb_engine_teardown(engine);
+  }
+  free(w);
+  free(b->cdf);
   return (rc);
 }
 
@@ -523,6 +1707,30 @@ int main(int argc, char** argv) {
     argc--;
     argv++;
     res = main_query(argc, argv);
+  } else if(strcmp(argv[1], "subscribe") == 0) {
+    argc--;
+    argv++;
+    res = main_subscribe(argc, argv);
+  } else if(strcmp(argv[1], "compression") == 0) {
+    argc--;
+    argv++;
+    res = main_compression(argc, argv);
+  } else if(strcmp(argv[1], "sensors") == 0) {
+    argc--;
+    argv++;
+    res = main_sensors(argc, argv);
+  } else if(strcmp(argv[1], "purge") == 0) {
+    argc--;
+    argv++;
+    res = main_purge(argc, argv);
+  } else if(strcmp(argv[1], "verify") == 0) {
+    argc--;
+    argv++;
+    res = main_verify(argc, argv);
+  } else if(strcmp(argv[1], "bench") == 0) {
+    argc--;
+    argv++;
+    res = main_bench(argc, argv);
   } else if(strcmp(argv[1], "--version") == 0) {
     version();
   } else {
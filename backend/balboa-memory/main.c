@@ -0,0 +1,107 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <engine.h>
+#include <ketopt.h>
+#include <trace.h>
+#include <unistd.h>
+
+#include <memory-impl.h>
+
+__attribute__((noreturn)) void version(void) {
+  fprintf(stderr, "balboa-memory v2.0.0\n");
+  exit(1);
+}
+
+__attribute__((noreturn)) void usage(const blb_memory_config_t* c) {
+  fprintf(
+      stderr,
+      "\
+`balboa-memory` provides an in-memory pdns database backend for `balboa`\n\
+\n\
+Usage: balboa-memory [options]\n\
+\n\
+    -h display help\n\
+    -D daemonize (default: off)\n\
+    -d <path> snapshot file, loaded at startup and rewritten periodically\n\
+        (default: none, nothing is persisted)\n\
+    -l listen address (default: 127.0.0.1)\n\
+    -p listen port (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+    -j connection throttle limit, maximum concurrent connections (default: 64)\n\
+    --snapshot_path <path> same as `-d`\n\
+    --snapshot_interval <s> seconds between snapshots (default: %d)\n\
+    --retention <s> drop observations last seen longer ago than this many\n\
+        seconds; 0 keeps them forever (default: %d)\n\
+\n",
+      c->snapshot_interval,
+      c->retention);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  int verbosity = 0;
+  int daemonize = 0;
+  engine_config_t engine_config = blb_engine_server_config_init();
+  blb_memory_config_t config = blb_memory_config_init();
+  trace_config_t trace_config = {.stream = stderr,
+                                 .host = "pdns",
+                                 .app = "balboa-memory",
+                                 // leaking process number ...
+                                 .procid = getpid()};
+
+  ketopt_t opt = KETOPT_INIT;
+  static ko_longopt_t opts[] = {
+      {"snapshot_path", ko_required_argument, 301},
+      {"snapshot_interval", ko_required_argument, 302},
+      {"retention", ko_required_argument, 303},
+      {"version", ko_no_argument, 999},
+      {NULL, 0, 0}};
+
+  int c;
+  while((c = ketopt(&opt, argc, argv, 1, "j:d:l:p:vDh", opts)) >= 0) {
+    switch(c) {
+    case 'D': daemonize = 1; break;
+    case 'd': config.snapshot_path = opt.arg; break;
+    case 'l': engine_config.host = opt.arg; break;
+    case 'p': engine_config.port = atoi(opt.arg); break;
+    case 'v': verbosity += 1; break;
+    case 'j': engine_config.conn_throttle_limit = atoi(opt.arg); break;
+    case 'h': usage(&config);
+    case 301: config.snapshot_path = opt.arg; break;
+    case 302: config.snapshot_interval = atoi(opt.arg); break;
+    case 303: config.retention = atoi(opt.arg); break;
+    case 999: version();
+    default: usage(&config);
+    }
+  }
+
+  theTrace_stream_use(&trace_config);
+  if(daemonize) {
+    theTrace_set_verbosity(0);
+  } else {
+    theTrace_set_verbosity(verbosity);
+  }
+
+  db_t* db = blb_memory_open(&config);
+  if(db == NULL) {
+    L(log_error("unable to open in-memory database"));
+    return (1);
+  }
+
+  engine_config.db = db;
+  engine_t* e = blb_engine_server_new(&engine_config);
+  if(e == NULL) {
+    L(log_error("unable to create io engine"));
+    blb_dbi_teardown(db);
+    return (1);
+  }
+
+  blb_engine_run(e);
+
+  blb_engine_teardown(e);
+
+  blb_dbi_teardown(db);
+
+  return (0);
+}
@@ -0,0 +1,898 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hash.h>
+#include <memory-impl.h>
+
+typedef struct blb_memory_t blb_memory_t;
+
+static void blb_memory_teardown(db_t* _db);
+static db_t* blb_memory_conn_init(conn_t* th, db_t* db);
+static void blb_memory_conn_deinit(conn_t* th, db_t* db);
+static int blb_memory_query(conn_t* th, const protocol_query_request_t* q);
+static int blb_memory_input(conn_t* th, const protocol_input_request_t* i);
+static void blb_memory_dump(conn_t* th, const protocol_dump_request_t* d);
+static void blb_memory_backup(conn_t* th, const protocol_backup_request_t* b);
+static void blb_memory_stats(db_t* db);
+
+static const dbi_t blb_memory_dbi = {.thread_init = blb_memory_conn_init,
+                                     .thread_deinit = blb_memory_conn_deinit,
+                                     .teardown = blb_memory_teardown,
+                                     .query = blb_memory_query,
+                                     .input = blb_memory_input,
+                                     .backup = blb_memory_backup,
+                                     .dump = blb_memory_dump,
+                                     .stats = blb_memory_stats};
+
+#define MEMORY_SHARDS (64)
+#define MEMORY_ARENA_CHUNK (1024 * 1024)
+#define MEMORY_TABLE_MIN (1024)
+#define MEMORY_HASH_SEED (0x6d656d6f7279ULL)
+#define MEMORY_NIL (UINT32_MAX)
+#define MEMORY_ENCODE_SZ (64 * 1024)
+
+// the strings of an observation sit back to back in the arena:
+// rrname, rrtype, rdata, sensorid
+typedef struct blb_memory_obs_t blb_memory_obs_t;
+struct blb_memory_obs_t {
+  uint64_t h;
+  const char* p;
+  uint32_t rrname_len;
+  uint32_t rdata_len;
+  uint16_t rrtype_len;
+  uint16_t sensorid_len;
+  uint32_t count;
+  uint32_t first_seen;
+  uint32_t last_seen;
+  // the next older observation with the same rrname or rdata hash
+  uint32_t rrname_next;
+  uint32_t rdata_next;
+};
+
+// open addressing, linear probing; `idx` is `MEMORY_NIL` in empty slots
+typedef struct blb_memory_slot_t blb_memory_slot_t;
+struct blb_memory_slot_t {
+  uint64_t h;
+  uint32_t idx;
+};
+
+typedef struct blb_memory_table_t blb_memory_table_t;
+struct blb_memory_table_t {
+  blb_memory_slot_t* slots;
+  size_t cap;
+  size_t len;
+};
+
+typedef struct blb_memory_chunk_t blb_memory_chunk_t;
+struct blb_memory_chunk_t {
+  blb_memory_chunk_t* next;
+  size_t used;
+  size_t sz;
+  char buf[];
+};
+
+// observations are spread over the shards by their rrname; the tuple table
+// finds an observation, the rrname and rdata tables the head of a chain
+// through all observations sharing the hash
+typedef struct blb_memory_shard_t blb_memory_shard_t;
+struct blb_memory_shard_t {
+  pthread_rwlock_t lock;
+  blb_memory_obs_t* obs;
+  uint32_t obs_len;
+  uint32_t obs_cap;
+  blb_memory_table_t tuples;
+  blb_memory_table_t rrnames;
+  blb_memory_table_t rdatas;
+  blb_memory_chunk_t* arena;
+  size_t arena_bytes;
+};
+
+struct blb_memory_t {
+  const dbi_t* dbi;
+  const char* snapshot_path;
+  int snapshot_interval;
+  int retention;
+  pthread_t maintenance;
+  bool maintenance_running;
+  pthread_mutex_t stop_lock;
+  pthread_cond_t stop_cond;
+  bool stop;
+  atomic_ullong inputs;
+  atomic_ullong snapshots;
+  atomic_ullong expired;
+  struct timespec stats_last;
+  blb_memory_shard_t shards[MEMORY_SHARDS];
+};
+
+db_t* blb_memory_conn_init(conn_t* th, db_t* db) {
+  (void)th;
+  return (db);
+}
+
+void blb_memory_conn_deinit(conn_t* th, db_t* db) {
+  (void)th;
+  (void)db;
+}
+
+static inline const char* blb_memory_obs_rrname(const blb_memory_obs_t* o) {
+  return (o->p);
+}
+
+static inline const char* blb_memory_obs_rrtype(const blb_memory_obs_t* o) {
+  return (o->p + o->rrname_len);
+}
+
+static inline const char* blb_memory_obs_rdata(const blb_memory_obs_t* o) {
+  return (o->p + o->rrname_len + o->rrtype_len);
+}
+
+static inline const char* blb_memory_obs_sensorid(const blb_memory_obs_t* o) {
+  return (o->p + o->rrname_len + o->rrtype_len + o->rdata_len);
+}
+
+static inline void blb_memory_obs_entry(
+    const blb_memory_obs_t* o, protocol_entry_t* e) {
+  *e = (protocol_entry_t){0};
+  e->rrname = blb_memory_obs_rrname(o);
+  e->rrname_len = o->rrname_len;
+  e->rrtype = blb_memory_obs_rrtype(o);
+  e->rrtype_len = o->rrtype_len;
+  e->rdata = blb_memory_obs_rdata(o);
+  e->rdata_len = o->rdata_len;
+  e->sensorid = blb_memory_obs_sensorid(o);
+  e->sensorid_len = o->sensorid_len;
+  e->count = o->count;
+  e->first_seen = o->first_seen;
+  e->last_seen = o->last_seen;
+}
+
+static inline bool blb_memory_eq(
+    const char* a, size_t a_len, const char* b, size_t b_len) {
+  return (a_len == b_len && memcmp(a, b, a_len) == 0);
+}
+
+static inline bool blb_memory_obs_eq(
+    const blb_memory_obs_t* o, const protocol_entry_t* e) {
+  return (
+      blb_memory_eq(
+          blb_memory_obs_rrname(o), o->rrname_len, e->rrname, e->rrname_len)
+      && blb_memory_eq(
+          blb_memory_obs_rdata(o), o->rdata_len, e->rdata, e->rdata_len)
+      && blb_memory_eq(
+          blb_memory_obs_rrtype(o), o->rrtype_len, e->rrtype, e->rrtype_len)
+      && blb_memory_eq(
+          blb_memory_obs_sensorid(o),
+          o->sensorid_len,
+          e->sensorid,
+          e->sensorid_len));
+}
+
+static inline uint64_t blb_memory_hash(const char* p, size_t p_len) {
+  return (blb_hash64(p, p_len, MEMORY_HASH_SEED));
+}
+
+static inline uint64_t blb_memory_tuple_hash(
+    uint64_t rrname_h, const protocol_entry_t* e) {
+  uint64_t h = blb_hash64(e->rrtype, e->rrtype_len, rrname_h);
+  h = blb_hash64(e->rdata, e->rdata_len, h);
+  return (blb_hash64(e->sensorid, e->sensorid_len, h));
+}
+
+static int blb_memory_table_init(blb_memory_table_t* t, size_t cap) {
+  t->slots = blb_malloc(sizeof(blb_memory_slot_t) * cap);
+  if(t->slots == NULL) { return (-1); }
+  for(size_t i = 0; i < cap; i++) { t->slots[i].idx = MEMORY_NIL; }
+  t->cap = cap;
+  t->len = 0;
+  return (0);
+}
+
+static void blb_memory_table_free(blb_memory_table_t* t) {
+  if(t->slots != NULL) { blb_free(t->slots); }
+  t->slots = NULL;
+  t->cap = 0;
+  t->len = 0;
+}
+
+// the slot holding `h`, or the empty one where it belongs
+static inline blb_memory_slot_t* blb_memory_table_slot(
+    blb_memory_table_t* t, uint64_t h) {
+  size_t mask = t->cap - 1;
+  size_t i = h & mask;
+  while(t->slots[i].idx != MEMORY_NIL && t->slots[i].h != h) {
+    i = (i + 1) & mask;
+  }
+  return (&t->slots[i]);
+}
+
+// keeps the load below 70%
+static int blb_memory_table_reserve(blb_memory_table_t* t) {
+  if((t->len + 1) * 10 < t->cap * 7) { return (0); }
+  blb_memory_table_t grown;
+  if(blb_memory_table_init(&grown, t->cap * 2) != 0) { return (-1); }
+  for(size_t i = 0; i < t->cap; i++) {
+    if(t->slots[i].idx == MEMORY_NIL) { continue; }
+    *blb_memory_table_slot(&grown, t->slots[i].h) = t->slots[i];
+  }
+  grown.len = t->len;
+  blb_memory_table_free(t);
+  *t = grown;
+  return (0);
+}
+
+static char* blb_memory_arena_alloc(blb_memory_shard_t* sh, size_t sz) {
+  blb_memory_chunk_t* c = sh->arena;
+  if(c == NULL || c->sz - c->used < sz) {
+    size_t chunk_sz = sz > MEMORY_ARENA_CHUNK ? sz : MEMORY_ARENA_CHUNK;
+    c = blb_malloc(sizeof(blb_memory_chunk_t) + chunk_sz);
+    if(c == NULL) { return (NULL); }
+    c->next = sh->arena;
+    c->used = 0;
+    c->sz = chunk_sz;
+    sh->arena = c;
+    sh->arena_bytes += chunk_sz;
+  }
+  char* p = c->buf + c->used;
+  c->used += sz;
+  return (p);
+}
+
+static int blb_memory_shard_init(blb_memory_shard_t* sh) {
+  sh->obs = NULL;
+  sh->obs_len = 0;
+  sh->obs_cap = 0;
+  sh->arena = NULL;
+  sh->arena_bytes = 0;
+  sh->tuples.slots = NULL;
+  sh->rrnames.slots = NULL;
+  sh->rdatas.slots = NULL;
+  if(blb_memory_table_init(&sh->tuples, MEMORY_TABLE_MIN) != 0
+     || blb_memory_table_init(&sh->rrnames, MEMORY_TABLE_MIN) != 0
+     || blb_memory_table_init(&sh->rdatas, MEMORY_TABLE_MIN) != 0) {
+    return (-1);
+  }
+  return (0);
+}
+
+static void blb_memory_shard_free(blb_memory_shard_t* sh) {
+  blb_memory_table_free(&sh->tuples);
+  blb_memory_table_free(&sh->rrnames);
+  blb_memory_table_free(&sh->rdatas);
+  if(sh->obs != NULL) { blb_free(sh->obs); }
+  sh->obs = NULL;
+  while(sh->arena != NULL) {
+    blb_memory_chunk_t* next = sh->arena->next;
+    blb_free(sh->arena);
+    sh->arena = next;
+  }
+  sh->arena_bytes = 0;
+}
+
+// links observation `idx` in front of the chain of `h`
+static int blb_memory_chain_push(
+    blb_memory_table_t* t, uint64_t h, uint32_t idx, uint32_t* next) {
+  if(blb_memory_table_reserve(t) != 0) { return (-1); }
+  blb_memory_slot_t* s = blb_memory_table_slot(t, h);
+  if(s->idx == MEMORY_NIL) {
+    s->h = h;
+    t->len += 1;
+    *next = MEMORY_NIL;
+  } else {
+    *next = s->idx;
+  }
+  s->idx = idx;
+  return (0);
+}
+
+// merges `e` into the shard; the caller holds the write lock
+static int blb_memory_shard_put(
+    blb_memory_shard_t* sh, uint64_t rrname_h, const protocol_entry_t* e) {
+  uint64_t h = blb_memory_tuple_hash(rrname_h, e);
+  size_t mask = sh->tuples.cap - 1;
+  for(size_t i = h & mask; sh->tuples.slots[i].idx != MEMORY_NIL;
+      i = (i + 1) & mask) {
+    blb_memory_obs_t* o = &sh->obs[sh->tuples.slots[i].idx];
+    if(sh->tuples.slots[i].h == h && blb_memory_obs_eq(o, e)) {
+      o->count += e->count;
+      if(e->first_seen < o->first_seen) { o->first_seen = e->first_seen; }
+      if(e->last_seen > o->last_seen) { o->last_seen = e->last_seen; }
+      return (0);
+    }
+  }
+
+  if(sh->obs_len == MEMORY_NIL - 1) {
+    L(log_error("shard full"));
+    return (-1);
+  }
+  if(sh->obs_len == sh->obs_cap) {
+    uint32_t cap = sh->obs_cap == 0 ? MEMORY_TABLE_MIN : sh->obs_cap * 2;
+    blb_memory_obs_t* obs =
+        blb_realloc(sh->obs, sizeof(blb_memory_obs_t) * cap);
+    if(obs == NULL) { return (-1); }
+    sh->obs = obs;
+    sh->obs_cap = cap;
+  }
+  if(blb_memory_table_reserve(&sh->tuples) != 0) { return (-1); }
+  mask = sh->tuples.cap - 1;
+
+  size_t sz = e->rrname_len + e->rrtype_len + e->rdata_len + e->sensorid_len;
+  char* p = blb_memory_arena_alloc(sh, sz);
+  if(p == NULL) { return (-1); }
+  blb_memory_obs_t* o = &sh->obs[sh->obs_len];
+  o->h = h;
+  o->p = p;
+  p = mempcpy(p, e->rrname, e->rrname_len);
+  p = mempcpy(p, e->rrtype, e->rrtype_len);
+  p = mempcpy(p, e->rdata, e->rdata_len);
+  (void)mempcpy(p, e->sensorid, e->sensorid_len);
+  o->rrname_len = e->rrname_len;
+  o->rrtype_len = e->rrtype_len;
+  o->rdata_len = e->rdata_len;
+  o->sensorid_len = e->sensorid_len;
+  o->count = e->count;
+  o->first_seen = e->first_seen;
+  o->last_seen = e->last_seen;
+
+  uint32_t idx = sh->obs_len;
+  if(blb_memory_chain_push(&sh->rrnames, rrname_h, idx, &o->rrname_next) != 0
+     || blb_memory_chain_push(
+            &sh->rdatas,
+            blb_memory_hash(e->rdata, e->rdata_len),
+            idx,
+            &o->rdata_next)
+            != 0) {
+    return (-1);
+  }
+  blb_memory_slot_t* s = blb_memory_table_slot(&sh->tuples, h);
+  while(s->idx != MEMORY_NIL) {
+    // an equal hash of another tuple, probe on
+    s = &sh->tuples.slots[(s - sh->tuples.slots + 1) & mask];
+  }
+  s->h = h;
+  s->idx = idx;
+  sh->tuples.len += 1;
+  sh->obs_len += 1;
+  return (0);
+}
+
+static inline blb_memory_shard_t* blb_memory_shard(
+    blb_memory_t* db, uint64_t rrname_h) {
+  return (&db->shards[rrname_h % MEMORY_SHARDS]);
+}
+
+static int blb_memory_put(blb_memory_t* db, const protocol_entry_t* e) {
+  if(e->rrtype_len > UINT16_MAX || e->sensorid_len > UINT16_MAX
+     || e->rrname_len > UINT32_MAX || e->rdata_len > UINT32_MAX) {
+    L(log_error("entry too large"));
+    return (-1);
+  }
+  uint64_t rrname_h = blb_memory_hash(e->rrname, e->rrname_len);
+  blb_memory_shard_t* sh = blb_memory_shard(db, rrname_h);
+  pthread_rwlock_wrlock(&sh->lock);
+  int rc = blb_memory_shard_put(sh, rrname_h, e);
+  pthread_rwlock_unlock(&sh->lock);
+  return (rc);
+}
+
+static int blb_memory_input(conn_t* th, const protocol_input_request_t* i) {
+  ASSERT(th->db->dbi == &blb_memory_dbi);
+  blb_memory_t* db = (blb_memory_t*)th->db;
+
+  T(blb_protocol_log_entry(&i->entry));
+
+  atomic_fetch_add(&db->inputs, 1);
+  return (blb_memory_put(db, &i->entry));
+}
+
+static inline bool blb_memory_obs_match(
+    const blb_memory_obs_t* o, const protocol_query_request_t* q) {
+  if(q->qrrname_len > 0
+     && !blb_memory_eq(
+         blb_memory_obs_rrname(o), o->rrname_len, q->qrrname, q->qrrname_len)) {
+    return (false);
+  }
+  if(q->qrdata_len > 0
+     && !blb_memory_eq(
+         blb_memory_obs_rdata(o), o->rdata_len, q->qrdata, q->qrdata_len)) {
+    return (false);
+  }
+  if(q->qsensorid_len > 0
+     && !blb_memory_eq(
+         blb_memory_obs_sensorid(o),
+         o->sensorid_len,
+         q->qsensorid,
+         q->qsensorid_len)) {
+    return (false);
+  }
+  if(q->qrrtype_len > 0
+     && !blb_memory_eq(
+         blb_memory_obs_rrtype(o), o->rrtype_len, q->qrrtype, q->qrrtype_len)) {
+    return (false);
+  }
+  return (true);
+}
+
+typedef struct blb_memory_buf_t blb_memory_buf_t;
+struct blb_memory_buf_t {
+  char* p;
+  size_t len;
+  size_t sz;
+};
+
+static inline size_t blb_memory_obs_strs_len(const blb_memory_obs_t* o) {
+  return ((size_t)o->rrname_len + o->rrtype_len + o->rdata_len
+          + o->sensorid_len);
+}
+
+// a copied match: the observation followed by its strings, padded so the
+// next one is aligned
+static inline size_t blb_memory_match_sz(const blb_memory_obs_t* o) {
+  size_t sz = sizeof(blb_memory_obs_t) + blb_memory_obs_strs_len(o);
+  return ((sz + _Alignof(blb_memory_obs_t) - 1)
+          & ~(_Alignof(blb_memory_obs_t) - 1));
+}
+
+// walks the rrname or rdata chain of `h` in one shard, newest first; the
+// matches are copied under the read lock and pushed after releasing it, so
+// a slow client does not hold up the inputs
+static int blb_memory_query_shard(
+    conn_t* th,
+    const protocol_query_request_t* q,
+    blb_memory_shard_t* sh,
+    uint64_t h,
+    size_t* hits,
+    blb_memory_buf_t* b) {
+  bool by_rrname = q->qrrname_len > 0;
+  int rc = 0;
+  b->len = 0;
+  pthread_rwlock_rdlock(&sh->lock);
+  blb_memory_slot_t* s =
+      blb_memory_table_slot(by_rrname ? &sh->rrnames : &sh->rdatas, h);
+  for(uint32_t idx = s->idx; idx != MEMORY_NIL && *hits < (size_t)q->limit;) {
+    const blb_memory_obs_t* o = &sh->obs[idx];
+    idx = by_rrname ? o->rrname_next : o->rdata_next;
+    if(!blb_memory_obs_match(o, q)) { continue; }
+    size_t need = blb_memory_match_sz(o);
+    if(b->sz - b->len < need) {
+      size_t sz = b->sz == 0 ? MEMORY_ENCODE_SZ : b->sz * 2;
+      while(sz - b->len < need) { sz *= 2; }
+      char* p = blb_realloc(b->p, sz);
+      if(p == NULL) {
+        rc = -1;
+        break;
+      }
+      b->p = p;
+      b->sz = sz;
+    }
+    memcpy(b->p + b->len, o, sizeof(blb_memory_obs_t));
+    memcpy(
+        b->p + b->len + sizeof(blb_memory_obs_t),
+        o->p,
+        blb_memory_obs_strs_len(o));
+    b->len += need;
+    *hits += 1;
+  }
+  pthread_rwlock_unlock(&sh->lock);
+
+  for(size_t off = 0; rc == 0 && off < b->len;) {
+    blb_memory_obs_t* o = (blb_memory_obs_t*)(b->p + off);
+    off += blb_memory_match_sz(o);
+    o->p = (const char*)(o + 1);
+    protocol_entry_t __e, *e = &__e;
+    blb_memory_obs_entry(o, e);
+    if(blb_conn_query_stream_push_response(th, e) != 0) {
+      L(log_error("unable to push query response entry"));
+      rc = -1;
+    }
+  }
+  return (rc);
+}
+
+// an rrname lives in one shard; an rdata can be in any, so those queries
+// go through the rdata table of every shard
+static int blb_memory_query(conn_t* th, const protocol_query_request_t* q) {
+  ASSERT(th->db->dbi == &blb_memory_dbi);
+  blb_memory_t* db = (blb_memory_t*)th->db;
+
+  int start_ok = blb_conn_query_stream_start_response(th);
+  if(start_ok != 0) {
+    L(log_error("unable to start query stream response"));
+    return (-1);
+  }
+
+  int rc = 0;
+  size_t hits = 0;
+  blb_memory_buf_t b = {.p = NULL, .len = 0, .sz = 0};
+  if(q->qrrname_len > 0) {
+    uint64_t h = blb_memory_hash(q->qrrname, q->qrrname_len);
+    rc = blb_memory_query_shard(th, q, blb_memory_shard(db, h), h, &hits, &b);
+  } else {
+    uint64_t h = blb_memory_hash(q->qrdata, q->qrdata_len);
+    for(int i = 0; i < MEMORY_SHARDS && rc == 0 && hits < (size_t)q->limit;
+        i++) {
+      rc = blb_memory_query_shard(th, q, &db->shards[i], h, &hits, &b);
+    }
+  }
+  if(b.p != NULL) { blb_free(b.p); }
+  T(log_debug("hits `%zu`", hits));
+
+  if(rc == 0) { (void)blb_conn_query_stream_end_response(th); }
+  return (rc);
+}
+
+// appends a shard in dump format; the caller holds the read lock
+static int blb_memory_shard_encode(
+    blb_memory_shard_t* sh, blb_memory_buf_t* b) {
+  b->len = 0;
+  for(uint32_t i = 0; i < sh->obs_len; i++) {
+    if(b->sz - b->len < MEMORY_ENCODE_SZ) {
+      size_t sz = b->sz == 0 ? MEMORY_ENCODE_SZ * 16 : b->sz * 2;
+      char* p = blb_realloc(b->p, sz);
+      if(p == NULL) { return (-1); }
+      b->p = p;
+      b->sz = sz;
+    }
+    protocol_entry_t __e, *e = &__e;
+    blb_memory_obs_entry(&sh->obs[i], e);
+    ssize_t used =
+        blb_protocol_encode_dump_entry(e, b->p + b->len, b->sz - b->len);
+    if(used <= 0) {
+      L(log_error("blb_protocol_encode_dump_entry() failed"));
+      return (-1);
+    }
+    b->len += used;
+  }
+  return (0);
+}
+
+// writes all shards to `path` through a temporary file; each shard is
+// encoded under its read lock and written after releasing it, so inputs
+// are held up for no longer than copying one shard in memory
+static int blb_memory_snapshot(blb_memory_t* db, const char* path) {
+  char tmp[4096];
+  int sz = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if(sz <= 0 || (size_t)sz >= sizeof(tmp)) {
+    L(log_error("invalid path"));
+    return (-1);
+  }
+  FILE* f = fopen(tmp, "wb");
+  if(f == NULL) {
+    L(log_error("unable to open `%s`: `%s`", tmp, strerror(errno)));
+    return (-1);
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  blb_memory_buf_t b = {.p = NULL, .len = 0, .sz = 0};
+  uint64_t entries = 0;
+  int rc = 0;
+  for(int i = 0; i < MEMORY_SHARDS && rc == 0; i++) {
+    blb_memory_shard_t* sh = &db->shards[i];
+    pthread_rwlock_rdlock(&sh->lock);
+    rc = blb_memory_shard_encode(sh, &b);
+    entries += sh->obs_len;
+    pthread_rwlock_unlock(&sh->lock);
+    if(rc == 0 && b.len > 0 && fwrite(b.p, b.len, 1, f) != 1) {
+      L(log_error("unable to write `%s`: `%s`", tmp, strerror(errno)));
+      rc = -1;
+    }
+  }
+  if(b.p != NULL) { blb_free(b.p); }
+  if(rc == 0 && (fflush(f) != 0 || fsync(fileno(f)) != 0)) {
+    L(log_error("unable to sync `%s`: `%s`", tmp, strerror(errno)));
+    rc = -1;
+  }
+  fclose(f);
+  if(rc == 0 && rename(tmp, path) != 0) {
+    L(log_error("unable to rename `%s`: `%s`", tmp, strerror(errno)));
+    rc = -1;
+  }
+  if(rc != 0) {
+    (void)unlink(tmp);
+    return (-1);
+  }
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  atomic_fetch_add(&db->snapshots, 1);
+  V(log_info(
+      "snapshot `%s` written: entries `%" PRIu64 "` seconds `%.2f`",
+      path,
+      entries,
+      (double)(end.tv_sec - start.tv_sec)
+          + (double)(end.tv_nsec - start.tv_nsec) / 1e9));
+  return (0);
+}
+
+static int blb_memory_load(blb_memory_t* db, const char* path) {
+  FILE* f = fopen(path, "rb");
+  if(f == NULL) {
+    if(errno == ENOENT) {
+      V(log_info("no snapshot at `%s`, starting empty", path));
+      return (0);
+    }
+    L(log_error("unable to open `%s`: `%s`", path, strerror(errno)));
+    return (-1);
+  }
+  protocol_dump_stream_t* stream = blb_protocol_dump_stream_new(f);
+  if(stream == NULL) {
+    fclose(f);
+    return (-1);
+  }
+  uint64_t entries = 0;
+  int rc = 0;
+  for(;;) {
+    protocol_entry_t e;
+    int dec = blb_protocol_dump_stream_decode(stream, &e);
+    if(dec == -1) { break; }
+    if(dec != 0) {
+      L(log_error("blb_protocol_dump_stream_decode() failed with `%d`", dec));
+      rc = -1;
+      break;
+    }
+    if(blb_memory_put(db, &e) != 0) {
+      rc = -1;
+      break;
+    }
+    entries += 1;
+  }
+  blb_protocol_dump_stream_teardown(stream);
+  fclose(f);
+  L(log_notice("loaded `%" PRIu64 "` entries from `%s`", entries, path));
+  return (rc);
+}
+
+// rebuilds a shard from the observations seen since `cutoff`, which
+// compacts its arena and tables as well
+static int blb_memory_shard_expire(
+    blb_memory_shard_t* sh, uint32_t cutoff, uint64_t* expired) {
+  blb_memory_shard_t fresh;
+  if(blb_memory_shard_init(&fresh) != 0) {
+    blb_memory_shard_free(&fresh);
+    return (-1);
+  }
+  for(uint32_t i = 0; i < sh->obs_len; i++) {
+    const blb_memory_obs_t* o = &sh->obs[i];
+    if(o->last_seen < cutoff) {
+      *expired += 1;
+      continue;
+    }
+    protocol_entry_t __e, *e = &__e;
+    blb_memory_obs_entry(o, e);
+    uint64_t rrname_h = blb_memory_hash(e->rrname, e->rrname_len);
+    if(blb_memory_shard_put(&fresh, rrname_h, e) != 0) {
+      blb_memory_shard_free(&fresh);
+      return (-1);
+    }
+  }
+  blb_memory_shard_free(sh);
+  sh->obs = fresh.obs;
+  sh->obs_len = fresh.obs_len;
+  sh->obs_cap = fresh.obs_cap;
+  sh->tuples = fresh.tuples;
+  sh->rrnames = fresh.rrnames;
+  sh->rdatas = fresh.rdatas;
+  sh->arena = fresh.arena;
+  sh->arena_bytes = fresh.arena_bytes;
+  return (0);
+}
+
+static void blb_memory_expire(blb_memory_t* db) {
+  uint32_t cutoff = (uint32_t)(time(NULL) - db->retention);
+  uint64_t expired = 0;
+  for(int i = 0; i < MEMORY_SHARDS; i++) {
+    blb_memory_shard_t* sh = &db->shards[i];
+    pthread_rwlock_wrlock(&sh->lock);
+    bool any = false;
+    for(uint32_t k = 0; k < sh->obs_len && !any; k++) {
+      any = sh->obs[k].last_seen < cutoff;
+    }
+    if(any && blb_memory_shard_expire(sh, cutoff, &expired) != 0) {
+      L(log_error("unable to expire shard `%d`", i));
+    }
+    pthread_rwlock_unlock(&sh->lock);
+  }
+  atomic_fetch_add(&db->expired, expired);
+}
+
+// returns true once stop was requested
+static bool blb_memory_sleep(blb_memory_t* db, int seconds) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += seconds;
+  pthread_mutex_lock(&db->stop_lock);
+  while(!db->stop) {
+    if(pthread_cond_timedwait(&db->stop_cond, &db->stop_lock, &ts)
+       == ETIMEDOUT) {
+      break;
+    }
+  }
+  bool stop = db->stop;
+  pthread_mutex_unlock(&db->stop_lock);
+  return (stop);
+}
+
+// expires old observations and writes snapshots, whichever is due
+static void* blb_memory_maintenance(void* usr) {
+  blb_memory_t* db = usr;
+  V(log_info("maintenance thread started"));
+  int expire_interval = db->retention > 0 && db->retention < 60
+                            ? db->retention
+                            : 60;
+  int since_snapshot = 0;
+  int tick = expire_interval;
+  if(db->snapshot_path != NULL && db->snapshot_interval < tick) {
+    tick = db->snapshot_interval;
+  }
+  while(!blb_memory_sleep(db, tick)) {
+    if(db->retention > 0) { blb_memory_expire(db); }
+    since_snapshot += tick;
+    if(db->snapshot_path != NULL && since_snapshot >= db->snapshot_interval) {
+      (void)blb_memory_snapshot(db, db->snapshot_path);
+      since_snapshot = 0;
+    }
+  }
+  V(log_info("maintenance thread stopped"));
+  return (NULL);
+}
+
+static void blb_memory_backup(conn_t* th, const protocol_backup_request_t* b) {
+  ASSERT(th->db->dbi == &blb_memory_dbi);
+  blb_memory_t* db = (blb_memory_t*)th->db;
+
+  X(log_info("backup `%.*s`", (int)b->path_len, b->path));
+
+  if(b->path_len == 0 || b->path_len >= 256) {
+    L(log_error("invalid path"));
+    return;
+  }
+
+  char path[256];
+  snprintf(path, sizeof(path), "%.*s", (int)b->path_len, b->path);
+  (void)blb_memory_snapshot(db, path);
+}
+
+static void blb_memory_dump(conn_t* th, const protocol_dump_request_t* d) {
+  ASSERT(th->db->dbi == &blb_memory_dbi);
+  blb_memory_t* db = (blb_memory_t*)th->db;
+
+  X(log_info("dump `%.*s`", (int)d->path_len, d->path));
+
+  blb_memory_buf_t b = {.p = NULL, .len = 0, .sz = 0};
+  uint64_t cnt = 0;
+  for(int i = 0; i < MEMORY_SHARDS; i++) {
+    blb_memory_shard_t* sh = &db->shards[i];
+    pthread_rwlock_rdlock(&sh->lock);
+    int rc = blb_memory_shard_encode(sh, &b);
+    uint64_t n = sh->obs_len;
+    pthread_rwlock_unlock(&sh->lock);
+    if(rc != 0 || (b.len > 0 && blb_conn_write_all(th, b.p, b.len) != 0)) {
+      L(log_error("unable to dump shard `%d`", i));
+      break;
+    }
+    cnt += n;
+  }
+  if(b.p != NULL) { blb_free(b.p); }
+  L(log_notice("dumped `%" PRIu64 "` entries", cnt));
+}
+
+static void blb_memory_stats(db_t* _db) {
+  ASSERT(_db->dbi == &blb_memory_dbi);
+  blb_memory_t* db = (blb_memory_t*)_db;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double dt = (double)(now.tv_sec - db->stats_last.tv_sec)
+              + (double)(now.tv_nsec - db->stats_last.tv_nsec) / 1e9;
+  db->stats_last = now;
+  uint64_t entries = 0;
+  size_t bytes = 0;
+  for(int i = 0; i < MEMORY_SHARDS; i++) {
+    blb_memory_shard_t* sh = &db->shards[i];
+    pthread_rwlock_rdlock(&sh->lock);
+    entries += sh->obs_len;
+    bytes += sh->arena_bytes + sh->obs_cap * sizeof(blb_memory_obs_t)
+             + (sh->tuples.cap + sh->rrnames.cap + sh->rdatas.cap)
+                   * sizeof(blb_memory_slot_t);
+    pthread_rwlock_unlock(&sh->lock);
+  }
+  L(log_notice(
+      "entries `%" PRIu64 "` bytes `%zu` inputs/s `%.0f` expired `%llu` "
+      "snapshots `%llu`",
+      entries,
+      bytes,
+      dt > 0 ? (double)atomic_exchange(&db->inputs, 0) / dt : 0.0,
+      atomic_exchange(&db->expired, 0),
+      atomic_exchange(&db->snapshots, 0)));
+}
+
+static void blb_memory_free(blb_memory_t* db) {
+  for(int i = 0; i < MEMORY_SHARDS; i++) {
+    blb_memory_shard_free(&db->shards[i]);
+    pthread_rwlock_destroy(&db->shards[i].lock);
+  }
+  pthread_cond_destroy(&db->stop_cond);
+  pthread_mutex_destroy(&db->stop_lock);
+  blb_free(db);
+}
+
+// stops the maintenance thread and writes a last snapshot
+void blb_memory_teardown(db_t* _db) {
+  ASSERT(_db->dbi == &blb_memory_dbi);
+  blb_memory_t* db = (blb_memory_t*)_db;
+  if(db->maintenance_running) {
+    pthread_mutex_lock(&db->stop_lock);
+    db->stop = true;
+    pthread_cond_broadcast(&db->stop_cond);
+    pthread_mutex_unlock(&db->stop_lock);
+    pthread_join(db->maintenance, NULL);
+  }
+  if(db->snapshot_path != NULL) {
+    (void)blb_memory_snapshot(db, db->snapshot_path);
+  }
+  blb_memory_free(db);
+}
+
+db_t* blb_memory_open(const blb_memory_config_t* config) {
+  if(config->snapshot_interval <= 0 || config->retention < 0) {
+    L(log_error("invalid snapshot interval or retention"));
+    return (NULL);
+  }
+
+  blb_memory_t* db = blb_new(blb_memory_t);
+  if(db == NULL) { return (NULL); }
+  db->dbi = &blb_memory_dbi;
+  db->snapshot_path = config->snapshot_path;
+  db->snapshot_interval = config->snapshot_interval;
+  db->retention = config->retention;
+  db->maintenance_running = false;
+  db->stop = false;
+  pthread_mutex_init(&db->stop_lock, NULL);
+  pthread_cond_init(&db->stop_cond, NULL);
+  atomic_init(&db->inputs, 0);
+  atomic_init(&db->snapshots, 0);
+  atomic_init(&db->expired, 0);
+  clock_gettime(CLOCK_MONOTONIC, &db->stats_last);
+  int rc = 0;
+  for(int i = 0; i < MEMORY_SHARDS; i++) {
+    pthread_rwlock_init(&db->shards[i].lock, NULL);
+    if(blb_memory_shard_init(&db->shards[i]) != 0) { rc = -1; }
+  }
+  if(rc != 0) {
+    blb_memory_free(db);
+    return (NULL);
+  }
+
+  if(db->snapshot_path != NULL && blb_memory_load(db, db->snapshot_path) != 0) {
+    L(log_error("unable to load snapshot `%s`", db->snapshot_path));
+    blb_memory_free(db);
+    return (NULL);
+  }
+
+  if(db->snapshot_path != NULL || db->retention > 0) {
+    // signals belong to the engine's consumer thread; the maintenance
+    // thread inherits a mask blocking them
+    sigset_t s, old;
+    sigfillset(&s);
+    pthread_sigmask(SIG_BLOCK, &s, &old);
+    rc = pthread_create(&db->maintenance, NULL, blb_memory_maintenance, db);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(rc != 0) {
+      L(log_error("unable to start maintenance thread"));
+      blb_memory_free(db);
+      return (NULL);
+    }
+    db->maintenance_running = true;
+  }
+
+  return ((db_t*)db);
+}
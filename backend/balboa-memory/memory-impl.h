@@ -0,0 +1,32 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __MEMORY_H
+#define __MEMORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <engine.h>
+
+typedef struct blb_memory_config_t blb_memory_config_t;
+struct blb_memory_config_t {
+  // dump file the data is loaded from at startup and written to every
+  // `snapshot_interval` seconds; `NULL` keeps everything in memory only
+  const char* snapshot_path;
+  int snapshot_interval;
+  // observations last seen longer ago than this many seconds are dropped;
+  // `0` keeps them forever
+  int retention;
+};
+
+static inline blb_memory_config_t blb_memory_config_init(void) {
+  return ((blb_memory_config_t){
+      .snapshot_path = NULL, .snapshot_interval = 300, .retention = 0});
+}
+
+db_t* blb_memory_open(const blb_memory_config_t* config);
+
+#endif
@@ -7,9 +7,40 @@
 #include <trace.h>
 #include <unistd.h>
 
+__attribute__((noreturn)) void usage(const blb_mock_config_t* c) {
+  fprintf(
+      stderr,
+      "\
+`balboa-mock` answers `balboa` requests with synthetic data\n\
+\n\
+Usage: balboa-mock [options]\n\
+\n\
+    -h display help\n\
+    -D daemonize (default: off)\n\
+    -l listen address (default: 127.0.0.1)\n\
+    -p listen port (default: 4242)\n\
+    -v increase verbosity; can be passed multiple times\n\
+    -j connection throttle limit, maximum concurrent connections (default: 64)\n\
+    -S disable the signal consumer\n\
+    -R disable the stats reporter\n\
+    --results <n> entries per answer, at most the query limit (default: %d)\n\
+    --results_max <n> draw the entries per answer from [results, n]\n\
+    --value_size <n> length of the rdata in answers to rrname queries and\n\
+        of the rrname in answers to rdata queries (default: %d)\n\
+    --value_size_max <n> draw the length per entry from [value_size, n]\n\
+    --latency <us> delay before each answer (default: %d)\n\
+    --latency_max <us> draw the delay per answer from [latency, us]\n\
+\n",
+      c->results,
+      c->value_size,
+      c->latency);
+  exit(1);
+}
+
 int main(int argc, char** argv) {
   int daemonize = 0;
   engine_config_t engine_config = blb_engine_server_config_init();
+  blb_mock_config_t config = blb_mock_config_init();
   trace_config_t trace_config = {.stream = stderr,
                                  .host = "pdns",
                                  .app = argv[0],
@@ -17,8 +48,15 @@ int main(int argc, char** argv) {
                                  .procid = getpid(),
                                  .verbosity = 0};
   ketopt_t opt = KETOPT_INIT;
+  static ko_longopt_t opts[] = {{"results", ko_required_argument, 301},
+                                {"results_max", ko_required_argument, 302},
+                                {"value_size", ko_required_argument, 303},
+                                {"value_size_max", ko_required_argument, 304},
+                                {"latency", ko_required_argument, 305},
+                                {"latency_max", ko_required_argument, 306},
+                                {NULL, 0, 0}};
   int c;
-  while((c = ketopt(&opt, argc, argv, 1, "j:l:p:vDSR", NULL)) >= 0) {
+  while((c = ketopt(&opt, argc, argv, 1, "j:l:p:vDSRh", opts)) >= 0) {
     switch(c) {
     case 'D': daemonize = 1; break;
     case 'l': engine_config.host = opt.arg; break;
@@ -27,7 +65,14 @@ int main(int argc, char** argv) {
     case 'j': engine_config.conn_throttle_limit = atoi(opt.arg); break;
     case 'S': engine_config.enable_signal_consumer = false; break;
     case 'R': engine_config.enable_stats_reporter = false; break;
-    default: break;
+    case 'h': usage(&config);
+    case 301: config.results = atoi(opt.arg); break;
+    case 302: config.results_max = atoi(opt.arg); break;
+    case 303: config.value_size = atoi(opt.arg); break;
+    case 304: config.value_size_max = atoi(opt.arg); break;
+    case 305: config.latency = atoi(opt.arg); break;
+    case 306: config.latency_max = atoi(opt.arg); break;
+    default: usage(&config);
     }
   }
 
@@ -37,7 +82,7 @@ int main(int argc, char** argv) {
     theTrace_set_verbosity(0);
   }
 
-  db_t* db = blb_mock_open();
+  db_t* db = blb_mock_open(&config);
   if(db == NULL) { return (1); }
 
   engine_config.db = db;
@@ -1,6 +1,8 @@
 // balboa
 // Copyright (c) 2018, 2019 DCSO GmbH
 
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +18,7 @@ static int blb_mock_query(conn_t* th, const protocol_query_request_t* q);
 static int blb_mock_input(conn_t* th, const protocol_input_request_t* i);
 static void blb_mock_dump(conn_t* th, const protocol_dump_request_t* d);
 static void blb_mock_backup(conn_t* th, const protocol_backup_request_t* b);
+static void blb_mock_stats(db_t* db);
 
 static const dbi_t blb_mock_dbi = {.thread_init = blb_mock_conn_init,
                                    .thread_deinit = blb_mock_conn_deinit,
@@ -23,10 +26,21 @@ static const dbi_t blb_mock_dbi = {.thread_init = blb_mock_conn_init,
                                    .query = blb_mock_query,
                                    .input = blb_mock_input,
                                    .backup = blb_mock_backup,
-                                   .dump = blb_mock_dump};
+                                   .dump = blb_mock_dump,
+                                   .stats = blb_mock_stats};
 
 struct blb_mock_t {
   const dbi_t* dbi;
+  blb_mock_config_t config;
+  // synthetic rrnames and rdata are cut from here at varying offsets
+  char* pattern;
+  size_t pattern_len;
+  atomic_ullong seq;
+  atomic_ullong inputs;
+  atomic_ullong input_bytes;
+  atomic_ullong queries;
+  atomic_ullong results;
+  struct timespec stats_last;
 };
 
 db_t* blb_mock_conn_init(conn_t* th, db_t* db) {
@@ -41,11 +55,36 @@ void blb_mock_conn_deinit(conn_t* th, db_t* db) {
 
 void blb_mock_teardown(db_t* _db) {
   ASSERT(_db->dbi == &blb_mock_dbi);
-  blb_free(_db);
+  blb_mock_t* db = (blb_mock_t*)_db;
+  if(db->pattern != NULL) { blb_free(db->pattern); }
+  blb_free(db);
+}
+
+// splitmix64; every query seeds its own state from the query sequence
+static inline uint64_t blb_mock_rand(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return (z ^ (z >> 31));
+}
+
+static inline int blb_mock_uniform(uint64_t* state, int min, int max) {
+  if(max <= min) { return (min); }
+  return (min + (int)(blb_mock_rand(state) % (uint64_t)(max - min + 1)));
 }
 
 static int blb_mock_query(conn_t* th, const protocol_query_request_t* q) {
-  (void)q;
+  ASSERT(th->db->dbi == &blb_mock_dbi);
+  blb_mock_t* db = (blb_mock_t*)th->db;
+  const blb_mock_config_t* c = &db->config;
+  uint64_t state = atomic_fetch_add(&db->seq, 1);
+
+  int latency = blb_mock_uniform(&state, c->latency, c->latency_max);
+  if(latency > 0) {
+    struct timespec ts = {.tv_sec = latency / 1000000,
+                          .tv_nsec = (latency % 1000000) * 1000};
+    while(nanosleep(&ts, &ts) != 0) {}
+  }
 
   int start_ok = blb_conn_query_stream_start_response(th);
   if(start_ok != 0) {
@@ -53,37 +92,82 @@ static int blb_mock_query(conn_t* th, const protocol_query_request_t* q) {
     return (-1);
   }
 
-  protocol_entry_t __e, *e = &__e;
+  int results = blb_mock_uniform(&state, c->results, c->results_max);
+  if(results > q->limit) { results = q->limit; }
+
+  protocol_entry_t __e = {0}, *e = &__e;
   e->sensorid = "test-sensor-id";
   e->sensorid_len = strlen(e->sensorid);
-  e->rdata = "";
-  e->rdata_len = 0;
-  e->rrname = "test-rrname";
-  e->rrname_len = strlen(e->rrname);
+  if(q->qsensorid_len > 0) {
+    e->sensorid = q->qsensorid;
+    e->sensorid_len = q->qsensorid_len;
+  }
+  e->rrname = q->qrrname;
+  e->rrname_len = q->qrrname_len;
   e->rrtype = "A";
   e->rrtype_len = 1;
+  if(q->qrrtype_len > 0) {
+    e->rrtype = q->qrrtype;
+    e->rrtype_len = q->qrrtype_len;
+  }
   e->count = 23;
   e->first_seen = 15000000;
   e->last_seen = 15001000;
-  int push_ok = blb_conn_query_stream_push_response(th, e);
-  if(push_ok != 0) {
-    L(log_error("unable to push query response entry"));
-    return (-1);
+  e->rdata = q->qrdata;
+  e->rdata_len = q->qrdata_len;
+  // the field not asked for varies in length and content per entry
+  const char** value = q->qrrname_len > 0 ? &e->rdata : &e->rrname;
+  size_t* value_len = q->qrrname_len > 0 ? &e->rdata_len : &e->rrname_len;
+  for(int i = 0; i < results; i++) {
+    *value_len =
+        (size_t)blb_mock_uniform(&state, c->value_size, c->value_size_max);
+    *value = db->pattern
+             + blb_mock_rand(&state) % (db->pattern_len - *value_len + 1);
+    int push_ok = blb_conn_query_stream_push_response(th, e);
+    if(push_ok != 0) {
+      L(log_error("unable to push query response entry"));
+      return (-1);
+    }
   }
 
   (void)blb_conn_query_stream_end_response(th);
 
+  atomic_fetch_add(&db->queries, 1);
+  atomic_fetch_add(&db->results, results);
   return (0);
 }
 
 static int blb_mock_input(conn_t* th, const protocol_input_request_t* i) {
   ASSERT(th->db->dbi == &blb_mock_dbi);
+  blb_mock_t* db = (blb_mock_t*)th->db;
 
   T(blb_protocol_log_entry(&i->entry));
 
+  const protocol_entry_t* e = &i->entry;
+  atomic_fetch_add(&db->inputs, 1);
+  atomic_fetch_add(
+      &db->input_bytes,
+      e->rrname_len + e->rrtype_len + e->rdata_len + e->sensorid_len);
   return (0);
 }
 
+static void blb_mock_stats(db_t* _db) {
+  ASSERT(_db->dbi == &blb_mock_dbi);
+  blb_mock_t* db = (blb_mock_t*)_db;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double dt = (double)(now.tv_sec - db->stats_last.tv_sec)
+              + (double)(now.tv_nsec - db->stats_last.tv_nsec) / 1e9;
+  db->stats_last = now;
+  if(dt <= 0) { return; }
+  L(log_notice(
+      "inputs/s `%.0f` input bytes/s `%.0f` queries/s `%.0f` results/s `%.0f`",
+      (double)atomic_exchange(&db->inputs, 0) / dt,
+      (double)atomic_exchange(&db->input_bytes, 0) / dt,
+      (double)atomic_exchange(&db->queries, 0) / dt,
+      (double)atomic_exchange(&db->results, 0) / dt));
+}
+
 static void blb_mock_backup(conn_t* th, const protocol_backup_request_t* b) {
   ASSERT(th->db->dbi == &blb_mock_dbi);
   // blb_mock_t* db=(blb_mock_t*)th->db;
@@ -98,9 +182,36 @@ static void blb_mock_dump(conn_t* th, const protocol_dump_request_t* d) {
   T(log_debug("dump `%.*s`", (int)d->path_len, d->path));
 }
 
-db_t* blb_mock_open() {
+db_t* blb_mock_open(const blb_mock_config_t* config) {
+  if(config->results < 0 || config->value_size < 0
+     || config->value_size > MOCK_VALUE_MAX
+     || config->value_size_max > MOCK_VALUE_MAX || config->latency < 0) {
+    L(log_error("invalid result count, rdata size or latency"));
+    return (NULL);
+  }
+
   blb_mock_t* db = blb_new(blb_mock_t);
   if(db == NULL) { return (NULL); }
   db->dbi = &blb_mock_dbi;
+  db->config = *config;
+  int value_max = config->value_size_max > config->value_size
+                      ? config->value_size_max
+                      : config->value_size;
+  // room to start at 256 different offsets for the longest value
+  db->pattern_len = (size_t)value_max + 256;
+  db->pattern = blb_malloc(db->pattern_len);
+  if(db->pattern == NULL) {
+    blb_free(db);
+    return (NULL);
+  }
+  for(size_t i = 0; i < db->pattern_len; i++) {
+    db->pattern[i] = "abcdefghijklmnopqrstuvwxyz0123456789.-"[i * 7 % 38];
+  }
+  atomic_init(&db->seq, 0);
+  atomic_init(&db->inputs, 0);
+  atomic_init(&db->input_bytes, 0);
+  atomic_init(&db->queries, 0);
+  atomic_init(&db->results, 0);
+  clock_gettime(CLOCK_MONOTONIC, &db->stats_last);
   return ((db_t*)db);
 }
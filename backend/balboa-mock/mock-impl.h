@@ -11,6 +11,32 @@
 
 #include <engine.h>
 
-db_t* blb_mock_open(void);
+#define MOCK_VALUE_MAX (65536)
+
+// ranges are drawn uniformly per query (results, latency) or per entry
+// (value size); a maximum below its minimum means exactly the minimum
+typedef struct blb_mock_config_t blb_mock_config_t;
+struct blb_mock_config_t {
+  int results;
+  int results_max;
+  // length of the field not queried for: the rdata of answers to rrname
+  // queries, the rrname of answers to rdata queries
+  int value_size;
+  int value_size_max;
+  // microseconds slept before answering a query
+  int latency;
+  int latency_max;
+};
+
+static inline blb_mock_config_t blb_mock_config_init(void) {
+  return ((blb_mock_config_t){.results = 1,
+                              .results_max = 0,
+                              .value_size = 11,
+                              .value_size_max = 0,
+                              .latency = 0,
+                              .latency_max = 0});
+}
+
+db_t* blb_mock_open(const blb_mock_config_t* config);
 
 #endif
@@ -3,9 +3,13 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <ketopt.h>
 #include <mpack.h>
@@ -18,6 +22,10 @@ static int verbosity=0;
 #define V(body) if( verbosity>0 ) { do{ body; }while( 0 );}
 
 #define OBS_SET_STEP_SIZE 1000
+#define MIGRATE_RANGES 65536
+#define MIGRATE_BATCH 10000
+#define MIGRATE_THREADS 8
+#define MIGRATE_V2_VAL_SZ 12
 
 typedef struct{
   char *key, *inv_key;
@@ -210,22 +218,20 @@ static const char* obsdb_mergeop_name(void *state){
     return "observation mergeop";
 }
 
-static void dump_show( ObsDB* db,FILE* file,const char* key,size_t key_len,const char* val,size_t val_len ){
-    enum TokIdx{
-        RRNAME=0
-       ,SENSORID=1
-       ,RRTYPE=2
-       ,RDATA=3
-       ,FIELDS=4
-    };
-
-    struct Tok{
-        const char* tok;
-        int tok_len;
-    };
+enum TokIdx{
+    RRNAME=0
+   ,SENSORID=1
+   ,RRTYPE=2
+   ,RDATA=3
+   ,FIELDS=4
+};
 
-    struct Tok toks[FIELDS]={NULL};
+struct Tok{
+    const char* tok;
+    int tok_len;
+};
 
+static void obs_key_split( const char* key,size_t key_len,struct Tok* toks ){
     enum TokIdx j=RRNAME;
     size_t last=1;
     for( size_t i=2;i<key_len;i++ ){
@@ -240,6 +246,11 @@ static void dump_show( ObsDB* db,FILE* file,const char* key,size_t key_len,const
     }
     toks[RDATA].tok=&key[last+1];
     toks[RDATA].tok_len=key_len-last-1;
+}
+
+static void dump_show( ObsDB* db,FILE* file,const char* key,size_t key_len,const char* val,size_t val_len ){
+    struct Tok toks[FIELDS]={NULL};
+    obs_key_split(key,key_len,toks);
 
     Observation obs={0};
     buf2obs(&obs,val,val_len);
@@ -446,11 +457,369 @@ static int do_checkpoint( const char* db_path,const char* cp_path ){
     return(0);
 }
 
+/* v2 value format and merge operator, must match balboa-rocksdb */
+
+static inline void v2_write_u32_le( unsigned char* p,uint32_t v ){
+    p[0]=v>>0;
+    p[1]=v>>8;
+    p[2]=v>>16;
+    p[3]=v>>24;
+}
+
+static inline uint32_t v2_read_u32_le( const unsigned char* p ){
+    return( ((uint32_t)p[0]<<0)|((uint32_t)p[1]<<8)|((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24) );
+}
+
+static inline void v2_obs2buf( const Observation* o,char* buf ){
+    unsigned char* p=(unsigned char*)buf;
+    v2_write_u32_le(p+0,o->count);
+    v2_write_u32_le(p+4,o->last_seen);
+    v2_write_u32_le(p+8,o->first_seen);
+}
+
+static inline int v2_buf2obs( Observation* o,const char* buf,size_t buflen ){
+    if( buflen<MIGRATE_V2_VAL_SZ ){ return(-1); }
+    const unsigned char* p=(const unsigned char*)buf;
+    o->count=v2_read_u32_le(p+0);
+    o->last_seen=v2_read_u32_le(p+4);
+    o->first_seen=v2_read_u32_le(p+8);
+    return(0);
+}
+
+static char* v2_mergeop_merge( const char* key,const char* existing_value,size_t existing_value_length,
+                               const char* const* operands_list,const size_t* operands_list_length,
+                               int num_operands,unsigned char* success,size_t* new_value_length ){
+    Observation obs={NULL,NULL,0,0,UINT32_MAX};
+    if( key[0]=='o' && existing_value!=NULL ){
+        v2_buf2obs(&obs,existing_value,existing_value_length);
+    }
+    for( int i=0;i<num_operands;i++ ){
+        Observation nobs={NULL,NULL,0,0,0};
+        if( v2_buf2obs(&nobs,operands_list[i],operands_list_length[i])!=0 ){ continue; }
+        obs.count+=nobs.count;
+        obs.last_seen=obsdb_max(obs.last_seen,nobs.last_seen);
+        obs.first_seen=obsdb_min(obs.first_seen,nobs.first_seen);
+    }
+    char* buf=malloc(MIGRATE_V2_VAL_SZ);
+    if( buf==NULL ){
+        *success=(unsigned char)0;
+        *new_value_length=0;
+        return NULL;
+    }
+    v2_obs2buf(&obs,buf);
+    *new_value_length=MIGRATE_V2_VAL_SZ;
+    *success=(unsigned char)1;
+    return buf;
+}
+
+static char* v2_mergeop_full_merge( void *state,const char* key,size_t key_length,
+                                    const char* existing_value,size_t existing_value_length,
+                                    const char* const* operands_list,const size_t* operands_list_length,
+                                    int num_operands,unsigned char* success,size_t* new_value_length ){
+    (void)state;
+    (void)key_length;
+    return v2_mergeop_merge(key,existing_value,existing_value_length,operands_list,
+                            operands_list_length,num_operands,success,new_value_length);
+}
+
+static char* v2_mergeop_partial_merge( void *state,const char* key,size_t key_length,
+                                       const char* const* operands_list,const size_t* operands_list_length,
+                                       int num_operands,unsigned char* success,size_t* new_value_length ){
+    (void)state;
+    (void)key_length;
+    return v2_mergeop_merge(key,NULL,0,operands_list,operands_list_length,
+                            num_operands,success,new_value_length);
+}
+
+static const char* v2_mergeop_name( void *state ){
+    (void)state;
+    return "observation-mergeop";
+}
+
+/* migrate: the forward keys of v1 and v2 share the same layout; values are
+ * re-encoded and the v2 inverted keys derived from the forward keys. the
+ * `o` key space is split into MIGRATE_RANGES ranges on the first two bytes
+ * of the rrname which worker threads pick up one after another */
+
+typedef struct Migrate Migrate;
+struct Migrate{
+    rocksdb_t* src;
+    rocksdb_t* dst;
+    rocksdb_writeoptions_t* wr_opt;
+    size_t batch;
+    atomic_int next_range;
+    atomic_int running;
+    atomic_int failed;
+    atomic_ullong entries;
+    atomic_ullong errors;
+};
+
+static void migrate_bound( int r,char* buf,size_t* len ){
+    buf[0]='o';
+    buf[1]='\x1f';
+    if( r<=0 ){ *len=2; return; }
+    if( r>=MIGRATE_RANGES ){ buf[1]='\x20'; *len=2; return; }
+    buf[2]=(char)(r>>8);
+    if( (r&0xff)==0 ){ *len=3; return; }
+    buf[3]=(char)(r&0xff);
+    *len=4;
+}
+
+static int migrate_commit( Migrate* m,rocksdb_writebatch_t* wb ){
+    if( rocksdb_writebatch_count(wb)==0 ){ return(0); }
+    char* err=NULL;
+    rocksdb_write(m->dst,m->wr_opt,wb,&err);
+    rocksdb_writebatch_clear(wb);
+    if( err!=NULL ){
+        fprintf(stderr,"write error: %s\n",err);
+        free(err);
+        atomic_store(&m->failed,1);
+        return(-1);
+    }
+    return(0);
+}
+
+static int migrate_range( Migrate* m,int r,rocksdb_writebatch_t* wb,char** inv,size_t* inv_sz ){
+    char lower[4],upper[4];
+    size_t lower_len=0,upper_len=0;
+    migrate_bound(r,lower,&lower_len);
+    migrate_bound(r+1,upper,&upper_len);
+
+    rocksdb_readoptions_t* rd_opt=rocksdb_readoptions_create();
+    rocksdb_readoptions_set_fill_cache(rd_opt,0);
+    rocksdb_readoptions_set_iterate_upper_bound(rd_opt,upper,upper_len);
+    rocksdb_iterator_t* it=rocksdb_create_iterator(m->src,rd_opt);
+    int rc=0;
+    rocksdb_iter_seek(it,lower,lower_len);
+    for( ;rocksdb_iter_valid(it)!=0 && rc==0;rocksdb_iter_next(it) ){
+        size_t key_len=0;
+        const char* key=rocksdb_iter_key(it,&key_len);
+        size_t val_len=0;
+        const char* val=rocksdb_iter_value(it,&val_len);
+        Observation obs={0};
+        if( key==NULL || val==NULL || key_len<3 || buf2obs(&obs,val,val_len)!=0 ){
+            atomic_fetch_add(&m->errors,1);
+            continue;
+        }
+
+        struct Tok toks[FIELDS]={NULL};
+        obs_key_split(key,key_len,toks);
+        size_t need=key_len+8;
+        if( need>*inv_sz ){
+            char* p=realloc(*inv,need);
+            if( p==NULL ){
+                fprintf(stderr,"out of memory\n");
+                rc=-1;
+                break;
+            }
+            *inv=p;
+            *inv_sz=need;
+        }
+        int inv_len=snprintf(*inv,*inv_sz,"i\x1f%.*s\x1f%.*s\x1f%.*s\x1f%.*s"
+            ,toks[RDATA].tok_len,toks[RDATA].tok
+            ,toks[SENSORID].tok_len,toks[SENSORID].tok
+            ,toks[RRNAME].tok_len,toks[RRNAME].tok
+            ,toks[RRTYPE].tok_len,toks[RRTYPE].tok);
+        if( inv_len<=0 || (size_t)inv_len>=*inv_sz ){
+            atomic_fetch_add(&m->errors,1);
+            continue;
+        }
+
+        char v2[MIGRATE_V2_VAL_SZ];
+        v2_obs2buf(&obs,v2);
+        rocksdb_writebatch_merge(wb,key,key_len,v2,sizeof(v2));
+        rocksdb_writebatch_put(wb,*inv,inv_len,"",0);
+        atomic_fetch_add(&m->entries,1);
+        if( (size_t)rocksdb_writebatch_count(wb)>=m->batch*2 ){
+            rc=migrate_commit(m,wb);
+        }
+    }
+    char* err=NULL;
+    rocksdb_iter_get_error(it,&err);
+    if( err!=NULL ){
+        fprintf(stderr,"iterator error: %s\n",err);
+        free(err);
+        rc=-1;
+    }
+    rocksdb_iter_destroy(it);
+    rocksdb_readoptions_destroy(rd_opt);
+    return(rc);
+}
+
+static void* migrate_worker( void* usr ){
+    Migrate* m=usr;
+    rocksdb_writebatch_t* wb=rocksdb_writebatch_create();
+    size_t inv_sz=1024;
+    char* inv=malloc(inv_sz);
+    while( inv!=NULL && atomic_load(&m->failed)==0 ){
+        int r=atomic_fetch_add(&m->next_range,1);
+        if( r>=MIGRATE_RANGES ){ break; }
+        if( migrate_range(m,r,wb,&inv,&inv_sz)!=0 ){
+            atomic_store(&m->failed,1);
+            break;
+        }
+    }
+    if( inv==NULL ){ atomic_store(&m->failed,1); }
+    (void)migrate_commit(m,wb);
+    rocksdb_writebatch_destroy(wb);
+    free(inv);
+    atomic_fetch_sub(&m->running,1);
+    return NULL;
+}
+
+static rocksdb_t* migrate_open_v2( const char* path,int threads,rocksdb_options_t** opt,rocksdb_mergeoperator_t** merge_ops ){
+    int level_compression[5]={
+        rocksdb_lz4_compression
+       ,rocksdb_lz4_compression
+       ,rocksdb_lz4_compression
+       ,rocksdb_lz4_compression
+       ,rocksdb_lz4_compression
+    };
+    *merge_ops=rocksdb_mergeoperator_create(
+        NULL
+       ,obsdb_mergeop_destructor
+       ,v2_mergeop_full_merge
+       ,v2_mergeop_partial_merge
+       ,NULL
+       ,v2_mergeop_name
+    );
+    *opt=rocksdb_options_create();
+    rocksdb_options_increase_parallelism(*opt,threads);
+    rocksdb_options_optimize_level_style_compaction(*opt,128*1024*1024);
+    rocksdb_options_set_create_if_missing(*opt,1);
+    rocksdb_options_set_max_log_file_size(*opt,10*1024*1024);
+    rocksdb_options_set_keep_log_file_num(*opt,2);
+    rocksdb_options_set_max_open_files(*opt,300);
+    rocksdb_options_set_merge_operator(*opt,*merge_ops);
+    rocksdb_options_set_compression_per_level(*opt,level_compression,5);
+    char* err=NULL;
+    rocksdb_t* db=rocksdb_open(*opt,path,&err);
+    if( db==NULL ){
+        fprintf(stderr,"db open error: %s\n",err==NULL?"<unknown>":err);
+        if( err!=NULL ){ free(err); }
+        rocksdb_options_destroy(*opt);
+        rocksdb_mergeoperator_destroy(*merge_ops);
+        return NULL;
+    }
+    /* the existence filter of balboa-rocksdb would miss the migrated data */
+    char filter[PATH_MAX];
+    snprintf(filter,sizeof(filter),"%s/BALBOA_FILTER",path);
+    (void)remove(filter);
+    return db;
+}
+
+static int migrate_is_empty( rocksdb_t* db ){
+    rocksdb_readoptions_t* rd_opt=rocksdb_readoptions_create();
+    rocksdb_iterator_t* it=rocksdb_create_iterator(db,rd_opt);
+    rocksdb_iter_seek_to_first(it);
+    int empty=!rocksdb_iter_valid(it);
+    rocksdb_iter_destroy(it);
+    rocksdb_readoptions_destroy(rd_opt);
+    return(empty);
+}
+
+static int do_migrate( const char* db_path,const char* v2_path,int threads,size_t batch,int force ){
+    ObsDB __db={0},*db=&__db;
+    int ok=dump_prepare_open(db);
+    if( ok!=0 ){
+        fprintf(stderr,"preparing database options for '%s' failed\n",db_path);
+        return(-1);
+    }
+    char* err=NULL;
+    db->db=rocksdb_open_for_read_only(db->opt,db_path,0,&err);
+    if( db->db==NULL ){
+        fprintf(stderr,"db open error: %s\n",err==NULL?"<unknown>":err);
+        if( err!=NULL ){ free(err); }
+        return(-1);
+    }
+
+    rocksdb_options_t* v2_opt=NULL;
+    rocksdb_mergeoperator_t* v2_merge_ops=NULL;
+    rocksdb_t* v2=migrate_open_v2(v2_path,threads,&v2_opt,&v2_merge_ops);
+    if( v2==NULL ){
+        dump_close(db);
+        return(-1);
+    }
+    /* forward keys are merged, so migrating into a target that already
+       holds data adds the counts up again; this includes the leftovers of
+       an earlier, interrupted migration */
+    if( !force && !migrate_is_empty(v2) ){
+        fprintf(stderr,"v2 database '%s' is not empty; remove it or pass -f to"
+            " merge into it\n",v2_path);
+        rocksdb_close(v2);
+        rocksdb_options_destroy(v2_opt);
+        rocksdb_mergeoperator_destroy(v2_merge_ops);
+        dump_close(db);
+        return(-1);
+    }
+
+    Migrate __m={0},*m=&__m;
+    m->src=db->db;
+    m->dst=v2;
+    m->batch=batch;
+    m->wr_opt=rocksdb_writeoptions_create();
+    /* without the WAL an interrupted migration leaves a partial target
+       behind, which has to be removed before migrating again; the check
+       for an empty target above enforces that */
+    rocksdb_writeoptions_disable_WAL(m->wr_opt,1);
+    atomic_store(&m->next_range,0);
+    atomic_store(&m->running,threads);
+    atomic_store(&m->failed,0);
+    atomic_store(&m->entries,0);
+    atomic_store(&m->errors,0);
+
+    pthread_t* workers=calloc(threads,sizeof(pthread_t));
+    int spawned=0;
+    for( ;workers!=NULL && spawned<threads;spawned++ ){
+        if( pthread_create(&workers[spawned],NULL,migrate_worker,m)!=0 ){
+            fprintf(stderr,"unable to spawn worker thread\n");
+            atomic_store(&m->failed,1);
+            break;
+        }
+    }
+    atomic_fetch_sub(&m->running,threads-spawned);
+    for( int tick=1;atomic_load(&m->running)>0;tick++ ){
+        sleep(1);
+        if( tick%10==0 ){
+            V(fprintf(stderr,"migrated %llu entries, range %d/%d\n"
+                ,atomic_load(&m->entries)
+                ,obsdb_min(atomic_load(&m->next_range),MIGRATE_RANGES)
+                ,MIGRATE_RANGES));
+        }
+    }
+    for( int i=0;i<spawned;i++ ){
+        pthread_join(workers[i],NULL);
+    }
+    free(workers);
+
+    int res=atomic_load(&m->failed)==0?0:-1;
+    if( res==0 ){
+        rocksdb_flushoptions_t* fl_opt=rocksdb_flushoptions_create();
+        rocksdb_flushoptions_set_wait(fl_opt,1);
+        rocksdb_flush(v2,fl_opt,&err);
+        rocksdb_flushoptions_destroy(fl_opt);
+        if( err!=NULL ){
+            fprintf(stderr,"flush error: %s\n",err);
+            free(err);
+            res=-1;
+        }
+    }
+    fprintf(stderr,"migrated %llu entries (%llu skipped)\n"
+        ,atomic_load(&m->entries),atomic_load(&m->errors));
+
+    rocksdb_writeoptions_destroy(m->wr_opt);
+    rocksdb_close(v2);
+    rocksdb_options_destroy(v2_opt);
+    rocksdb_mergeoperator_destroy(v2_merge_ops);
+    dump_close(db);
+    return(res);
+}
+
 __attribute__((noreturn)) void usage( void ){
     fprintf(stderr,"\
 `balboa-rocksdb-v1-dump` is a management tool for `balboa-rocksdb` version 1\n\
 \n\
-Usage: balboa-rocksdb-v1-dump <--version|dump|checkpoint> [options]\n\
+Usage: balboa-rocksdb-v1-dump <--version|dump|checkpoint|migrate> [options]\n\
 \n\
 Command help:\n\
     show help\n\
@@ -468,10 +837,22 @@ Command checkpoint:\n\
     -c <target-checkpoint-path> target path of the checkpoint to be created\n\
     -v increase verbosity; can be passed multiple times\n\
 \n\
+Command migrate:\n\
+    convert a v1 database directly into a new, empty v2 database\n\
+\n\
+    -d <database-path> path to the v1 rocksdb data directory (opened read-only)\n\
+    -o <v2-database-path> path to the v2 rocksdb data directory\n\
+    -j <threads> number of worker threads (default: 8)\n\
+    -b <entries> entries per write batch (default: 10000)\n\
+    -f migrate into a non-empty v2 database; counts of observations present\n\
+       in both are added up, so never use this to resume a migration\n\
+    -v increase verbosity; can be passed multiple times\n\
+\n\
 Examples:\n\
 \n\
 balboa-rocksdb-v1-dump checkpoint -d /mnt/balboa-rocksdb-live -c /mnt/balboa-rocksdb-checkpoint\n\
 balboa-rocksdb-v1-dump dump -d /mnt/balboa-rocksdb-checkpoint | lz4 > /mnt/backup/balboa.dmp.lz4\n\
+balboa-rocksdb-v1-dump migrate -d /mnt/balboa-rocksdb-checkpoint -o /mnt/balboa-rocksdb-v2\n\
 \n\
 \n");
     exit(1);
@@ -518,6 +899,31 @@ static int main_dump( int argc,char** argv ){
     return(do_dump(db));
 }
 
+static int main_migrate( int argc,char** argv ){
+    ketopt_t opt=KETOPT_INIT;
+    const char* db=NULL;
+    const char* v2=NULL;
+    int threads=MIGRATE_THREADS;
+    size_t batch=MIGRATE_BATCH;
+    int force=0;
+    int c;
+    while( (c=ketopt(&opt,argc,argv,1,"d:o:j:b:fv",NULL))>=0 ){
+        switch( c ){
+            case 'd': db=opt.arg;break;
+            case 'o': v2=opt.arg;break;
+            case 'j': threads=atoi(opt.arg);break;
+            case 'b': batch=atoll(opt.arg);break;
+            case 'f': force=1;break;
+            case 'v': verbosity+=1;break;
+            default: break;
+        }
+    }
+    if( db==NULL || v2==NULL || threads<1 || batch<1 ){
+        usage();
+    }
+    return(do_migrate(db,v2,threads,batch,force));
+}
+
 int main( int argc,char** argv ){
     int res=-1;
     if( argc<2 ){
@@ -530,6 +936,10 @@ int main( int argc,char** argv ){
         argc--;
         argv++;
         res=main_dump(argc,argv);
+    }else if( strcmp(argv[1],"migrate")==0 ){
+        argc--;
+        argv++;
+        res=main_migrate(argc,argv);
     }else if( strcmp(argv[1],"--version")==0 ){
         version();
     }else{
@@ -2,8 +2,10 @@
 // Copyright (c) 2018, 2019 DCSO GmbH
 
 #include <engine.h>
+#include <inttypes.h>
 #include <ketopt.h>
 #include <rocksdb-impl.h>
+#include <string.h>
 #include <trace.h>
 #include <unistd.h>
 
@@ -34,6 +36,52 @@ Usage: balboa-rocksdb [options]\n\
     --max_log_file_size <size> rocksdb log file size option (value: %zu)\n\
     --max_open_files <number> rocksdb max number of open files (value: %d)\n\
     --keep_log_file_num <number> rocksdb max number of log files (value: %d)\n\
+    --inv_cache_size <bytes> memory for skipping known inverted index keys;\n\
+        `0` disables (value: %zu)\n\
+    --query_cache_size <bytes> memory for caching encoded query results;\n\
+        `0` disables (default: 0)\n\
+    --filter_size <bytes> memory for the rrname/rdata existence filter;\n\
+        `0` disables (value: %zu)\n\
+    --filter_fpr <rate> existence filter target false positive rate\n\
+        (value: %.3f)\n\
+    --secondary <primary-path> serve queries from a read-only secondary\n\
+        instance of the database at <primary-path>; `-d` is the path for\n\
+        the secondary's own files; inputs are rejected\n\
+    --catchup_interval <seconds> how often a secondary catches up with\n\
+        its primary (value: %d)\n\
+    --follow <host:port> replicate the write ahead log of the leader at\n\
+        <host:port> into this database; inputs are rejected\n\
+    --wal_ttl <seconds> keep archived write ahead log files this long for\n\
+        followers to replicate from; `0` deletes them (value: %" PRIu64 ")\n\
+    --wal_size_limit <megabytes> upper bound for the archived write ahead\n\
+        log; `0` means unbounded (value: %" PRIu64 ")\n\
+    --histogram <off|daily|hourly> record per key activity histograms in\n\
+        new observations (default: off)\n\
+    --histogram_buckets <number> newest buckets kept per histogram, at\n\
+        most 1024 (value: %" PRIu32 ")\n\
+    --db_path <path:target-bytes> put table files on <path> until it\n\
+        holds <target-bytes>, then move on to the next path; can be passed\n\
+        up to 4 times, fastest storage first, the last path takes the\n\
+        bottommost level (default: all files in `-d`)\n\
+    --compression <codec,...> compression per level, starting with level\n\
+        0, the last one applies to all further levels; codecs are none,\n\
+        snappy, zlib, lz4, lz4hc and zstd (value: %s)\n\
+    --zstd_level <level> zstd compression level (value: %d)\n\
+    --zstd_dict_bytes <bytes> size of the zstd dictionary for the\n\
+        bottommost level if it uses zstd; `0` disables (value: %d)\n\
+    --zstd_train_bytes <bytes> sample data to train the dictionary on;\n\
+        `0` uses the samples as dictionary without training (value: %d)\n\
+    --memory_limit <bytes> cap on the total memory; a quarter goes to\n\
+        connections, which queue and are then shed when it runs out, the\n\
+        rest less the caches and filter to block cache and memtables\n\
+        (overrides `--membudget`); `0` disables (default: 0)\n\
+    --sensor_families store every sensor's observations in a column\n\
+        family of its own, so they can be purged quickly; not replicated\n\
+        to followers (default: off)\n\
+    --build_sst <dump-path> offline mode: sort and merge a dump into sst\n\
+        files, ingest them into the database then exit; `-` reads stdin\n\
+    --sort_budget <bytes> memory for sorting runs in `--build_sst` mode\n\
+        (default: 1073741824)\n\
     --database_path <path> same as `-d`\n\
     --version show version then exit\n\
 \n",
@@ -42,12 +90,26 @@ Usage: balboa-rocksdb [options]\n\
       c->parallelism,
       c->max_log_file_size,
       c->max_open_files,
-      c->keep_log_file_num);
+      c->keep_log_file_num,
+      c->inv_cache_size,
+      c->filter_size,
+      c->filter_fpr,
+      c->catchup_interval,
+      c->wal_ttl,
+      c->wal_size_limit,
+      c->hist_buckets,
+      c->compression,
+      c->zstd_level,
+      c->zstd_dict_bytes,
+      c->zstd_train_bytes);
   exit(1);
 }
 
 int main(int argc, char** argv) {
   int daemonize = 0;
+  const char* build_sst = NULL;
+  size_t sort_budget = 1024 * 1024 * 1024;
+  size_t memory_limit = 0;
   blb_rocksdb_config_t rocksdb_config = blb_rocksdb_config_init();
   engine_config_t engine_config = blb_engine_server_config_init();
   trace_config_t trace_config = {.stream = stderr,
@@ -65,6 +127,26 @@ int main(int argc, char** argv) {
       {"keep_log_file_num", ko_required_argument, 305},
       {"database_path", ko_required_argument, 306},
       {"version", ko_no_argument, 307},
+      {"inv_cache_size", ko_required_argument, 308},
+      {"query_cache_size", ko_required_argument, 309},
+      {"filter_size", ko_required_argument, 310},
+      {"filter_fpr", ko_required_argument, 311},
+      {"build_sst", ko_required_argument, 312},
+      {"sort_budget", ko_required_argument, 313},
+      {"secondary", ko_required_argument, 314},
+      {"catchup_interval", ko_required_argument, 315},
+      {"follow", ko_required_argument, 316},
+      {"wal_ttl", ko_required_argument, 317},
+      {"wal_size_limit", ko_required_argument, 318},
+      {"histogram", ko_required_argument, 319},
+      {"histogram_buckets", ko_required_argument, 320},
+      {"db_path", ko_required_argument, 321},
+      {"compression", ko_required_argument, 322},
+      {"zstd_level", ko_required_argument, 323},
+      {"zstd_dict_bytes", ko_required_argument, 324},
+      {"zstd_train_bytes", ko_required_argument, 325},
+      {"memory_limit", ko_required_argument, 326},
+      {"sensor_families", ko_no_argument, 327},
       {NULL, 0, 0}};
   int c;
   while((c = ketopt(&opt, argc, argv, 1, "j:d:l:p:vDSRh", opts)) >= 0) {
@@ -85,6 +167,57 @@ int main(int argc, char** argv) {
     case 305: rocksdb_config.keep_log_file_num = atoi(opt.arg); break;
     case 306: rocksdb_config.path = opt.arg; break;
     case 307: version();
+    case 308: rocksdb_config.inv_cache_size = atoll(opt.arg); break;
+    case 309: engine_config.query_cache_size = atoll(opt.arg); break;
+    case 310: rocksdb_config.filter_size = atoll(opt.arg); break;
+    case 311: rocksdb_config.filter_fpr = atof(opt.arg); break;
+    case 312: build_sst = opt.arg; break;
+    case 313: sort_budget = atoll(opt.arg); break;
+    case 314: rocksdb_config.primary_path = opt.arg; break;
+    case 315: rocksdb_config.catchup_interval = atoi(opt.arg); break;
+    case 316: {
+      char* port = strrchr(opt.arg, ':');
+      if(port == NULL) { usage(&rocksdb_config); }
+      *port = '\0';
+      rocksdb_config.follow_host = opt.arg;
+      rocksdb_config.follow_port = atoi(port + 1);
+      break;
+    }
+    case 317: rocksdb_config.wal_ttl = strtoull(opt.arg, NULL, 10); break;
+    case 318:
+      rocksdb_config.wal_size_limit = strtoull(opt.arg, NULL, 10);
+      break;
+    case 319:
+      if(strcmp(opt.arg, "daily") == 0) {
+        rocksdb_config.hist_granularity = 86400;
+      } else if(strcmp(opt.arg, "hourly") == 0) {
+        rocksdb_config.hist_granularity = 3600;
+      } else if(strcmp(opt.arg, "off") == 0) {
+        rocksdb_config.hist_granularity = 0;
+      } else {
+        usage(&rocksdb_config);
+      }
+      break;
+    case 320: rocksdb_config.hist_buckets = atoi(opt.arg); break;
+    case 321: {
+      char* size = strrchr(opt.arg, ':');
+      if(size == NULL || size == opt.arg
+         || rocksdb_config.db_paths_len >= ROCKSDB_DB_PATHS_MAX) {
+        usage(&rocksdb_config);
+      }
+      *size = '\0';
+      blb_rocksdb_db_path_t* p =
+          &rocksdb_config.db_paths[rocksdb_config.db_paths_len++];
+      p->path = opt.arg;
+      p->target_size = strtoull(size + 1, NULL, 10);
+      break;
+    }
+    case 322: rocksdb_config.compression = opt.arg; break;
+    case 323: rocksdb_config.zstd_level = atoi(opt.arg); break;
+    case 324: rocksdb_config.zstd_dict_bytes = atoi(opt.arg); break;
+    case 325: rocksdb_config.zstd_train_bytes = atoi(opt.arg); break;
+    case 326: memory_limit = strtoull(opt.arg, NULL, 10); break;
+    case 327: rocksdb_config.sensor_families = true; break;
     default: usage(&rocksdb_config);
     }
   }
@@ -95,12 +228,65 @@ int main(int argc, char** argv) {
     theTrace_set_verbosity(0);
   }
 
+  if(build_sst != NULL && rocksdb_config.primary_path != NULL) {
+    L(log_error("`--build_sst` cannot be used with `--secondary`"));
+    return (1);
+  }
+
+  if(rocksdb_config.follow_host != NULL
+     && (build_sst != NULL || rocksdb_config.primary_path != NULL)) {
+    L(log_error(
+        "`--follow` cannot be used with `--build_sst` or `--secondary`"));
+    return (1);
+  }
+
+  if(rocksdb_config.follow_host != NULL && rocksdb_config.sensor_families) {
+    L(log_error("`--follow` cannot be used with `--sensor_families`"));
+    return (1);
+  }
+
+  if(build_sst != NULL) {
+    // no caches or filters needed for an offline bulk load
+    rocksdb_config.inv_cache_size = 0;
+    rocksdb_config.filter_size = 0;
+  }
+
+  if(memory_limit > 0) {
+    size_t conns = memory_limit / 4;
+    size_t fixed = rocksdb_config.inv_cache_size + rocksdb_config.filter_size
+                   + engine_config.query_cache_size;
+    if(memory_limit < conns + fixed + ROCKSDB_MEMORY_MIN) {
+      L(log_error(
+          "`--memory_limit` `%zu` too small for caches and filter `%zu`",
+          memory_limit,
+          fixed));
+      return (1);
+    }
+    engine_config.memory_limit = conns;
+    rocksdb_config.memory_limit = memory_limit - conns - fixed;
+    rocksdb_config.membudget = rocksdb_config.memory_limit / 2;
+    V(log_info(
+        "memory limit `%zu`: connections `%zu` caches and filter `%zu` "
+        "rocksdb `%zu`",
+        memory_limit,
+        conns,
+        fixed,
+        rocksdb_config.memory_limit));
+  }
+
   db_t* db = blb_rocksdb_open(&rocksdb_config);
   if(db == NULL) {
     L(log_error("unable to open rocksdb at path `%s`", rocksdb_config.path));
     return (1);
   }
 
+  if(build_sst != NULL) {
+    int rc = blb_rocksdb_build_sst(
+        db, build_sst, rocksdb_config.path, sort_budget);
+    blb_dbi_teardown(db);
+    return (rc == 0 ? 0 : 1);
+  }
+
   engine_config.db = db;
   engine_t* e = blb_engine_server_new(&engine_config);
   if(e == NULL) {
@@ -1,14 +1,46 @@
 // balboa
 // Copyright (c) 2018, 2019 DCSO GmbH
 
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <bloom.h>
+#include <hash.h>
+#include <keycache.h>
 #include <rocksdb-impl.h>
 #include <rocksdb/c.h>
 
 #define ROCKSDB_CONN_SCRTCH_SZ (1024 * 10)
+#define ROCKSDB_INV_CACHE_SEED (0x62616c626f61ULL)
+#define ROCKSDB_FILTER_SEED_RRNAME (0x66726e616d65ULL)
+#define ROCKSDB_FILTER_SEED_RDATA (0x6664617461ULL)
+#define ROCKSDB_FILTER_FILE "BALBOA_FILTER"
+// next leader sequence number to apply; outside of the `o` and `i` key space
+#define ROCKSDB_FOLLOW_KEY "r\x1fsequence"
+#define ROCKSDB_FOLLOW_RETRY (5)
+#define ROCKSDB_REPLICATE_POLL_MS (100)
+#define ROCKSDB_REPLICATE_HEARTBEAT (10)
+#define ROCKSDB_CF_SEED (0x73656e736f72ULL)
+#define ROCKSDB_CF_SENSOR_PREFIX "sensor:"
+#define ROCKSDB_CF_NAME_MAX (256)
+// the default family and one per sensor
+#define ROCKSDB_CFS_MAX (ROCKSDB_SENSOR_FAMILIES_MAX + 1)
+#define ROCKSDB_PURGE_BATCH (1024)
+#define ROCKSDB_PURGE_SENSORID_MAX (256)
+#define ROCKSDB_VERIFY_RANGES (256)
+#define ROCKSDB_VERIFY_BATCH_KEYS (4096)
+#define ROCKSDB_VERIFY_BATCH_BYTES (2 * 1024 * 1024)
+// iterator steps the verify join takes towards a key before seeking to it
+#define ROCKSDB_VERIFY_JOIN_NEXTS (16)
+#define ROCKSDB_VERIFY_EXAMPLES (8)
+#define ROCKSDB_VERIFY_EXAMPLE_SZ (128)
+#define ROCKSDB_VERIFY_THREADS_MAX (16)
 
 static void blb_rocksdb_teardown(db_t* _db);
 static db_t* blb_rocksdb_conn_init(conn_t* th, db_t* db);
@@ -17,6 +49,12 @@ static int blb_rocksdb_query(conn_t* th, const protocol_query_request_t* q);
 static int blb_rocksdb_input(conn_t* th, const protocol_input_request_t* i);
 static void blb_rocksdb_backup(conn_t* th, const protocol_backup_request_t* b);
 static void blb_rocksdb_dump(conn_t* th, const protocol_dump_request_t* d);
+static void blb_rocksdb_stats(db_t* db);
+static int blb_rocksdb_replicate(
+    conn_t* th, const protocol_replicate_request_t* r);
+static int blb_rocksdb_info(conn_t* th, const protocol_info_request_t* r);
+static int blb_rocksdb_purge(conn_t* th, const protocol_purge_request_t* r);
+static int blb_rocksdb_verify(conn_t* th, const protocol_verify_request_t* r);
 
 static const dbi_t blb_rocksdb_dbi = {.thread_init = blb_rocksdb_conn_init,
                                       .thread_deinit = blb_rocksdb_conn_deinit,
@@ -24,7 +62,25 @@ static const dbi_t blb_rocksdb_dbi = {.thread_init = blb_rocksdb_conn_init,
                                       .query = blb_rocksdb_query,
                                       .input = blb_rocksdb_input,
                                       .backup = blb_rocksdb_backup,
-                                      .dump = blb_rocksdb_dump};
+                                      .dump = blb_rocksdb_dump,
+                                      .stats = blb_rocksdb_stats,
+                                      .replicate = blb_rocksdb_replicate,
+                                      .info = blb_rocksdb_info,
+                                      .purge = blb_rocksdb_purge,
+                                      .verify = blb_rocksdb_verify};
+
+// a column family along with the sensor it belongs to, the default family
+// has none; handles stay valid after a family is dropped, so they are
+// reference counted and only destroyed once the last user let go
+typedef struct blb_rocksdb_cf_t blb_rocksdb_cf_t;
+struct blb_rocksdb_cf_t {
+  rocksdb_column_family_handle_t* handle;
+  atomic_int refs;
+  atomic_int dropped;
+  uint64_t h;
+  size_t sensorid_len;
+  char sensorid[];
+};
 
 struct blb_rocksdb_t {
   const dbi_t* dbi;
@@ -33,12 +89,87 @@ struct blb_rocksdb_t {
   rocksdb_writeoptions_t* writeoptions;
   rocksdb_readoptions_t* readoptions;
   rocksdb_mergeoperator_t* mergeop;
+  rocksdb_cache_t* cache;
+  rocksdb_block_based_table_options_t* table_options;
+  rocksdb_write_buffer_manager_t* wbm;
+  keycache_t* inv_cache;
+  pthread_t inv_cache_warmup;
+  bool inv_cache_warmup_running;
+  atomic_int inv_cache_warmup_stop;
+  atomic_ullong inv_puts;
+  atomic_ullong inv_skips;
+  bloom_t* filter;
+  char* filter_path;
+  pthread_t filter_rebuild;
+  bool filter_rebuild_running;
+  atomic_int filter_rebuild_stop;
+  atomic_int filter_ready;
+  atomic_ullong filter_negatives;
+  bool secondary;
+  const char* primary_path;
+  // the primary has a family this secondary could not open
+  atomic_int cfs_stale;
+  int catchup_interval;
+  pthread_t catchup;
+  bool catchup_running;
+  atomic_int catchup_stop;
+  atomic_ullong catchups;
+  atomic_ullong sequence;
+  atomic_int replicas;
+  bool follower;
+  const char* follow_host;
+  int follow_port;
+  pthread_t follow;
+  bool follow_running;
+  atomic_ullong follow_batches;
+  atomic_ullong follow_latest;
+  uint32_t hist_granularity;
+  uint32_t hist_buckets;
+  blb_rocksdb_db_path_t db_paths[ROCKSDB_DB_PATHS_MAX];
+  int db_paths_len;
+  int compression[ROCKSDB_LEVELS_MAX];
+  int compression_len;
+  bool sensor_families;
+  pthread_rwlock_t cfs_lock;
+  blb_rocksdb_cf_t* cfs[ROCKSDB_CFS_MAX];
+  int cfs_len;
+  bool cfs_full;
+  atomic_ullong purges;
+  // one purge runs at a time, in the background
+  pthread_mutex_t purge_lock;
+  pthread_t purge;
+  bool purge_running;
+  atomic_int purge_stop;
+  atomic_int purge_done;
+  atomic_ullong purge_deleted;
+  int purge_rc;
+  bool purge_dropped;
+  time_t purge_start;
+  size_t purge_sensorid_len;
+  char purge_sensorid[ROCKSDB_PURGE_SENSORID_MAX];
+  int verify_threads;
+};
+
+#define ROCKSDB_HIST_TAG ('H')
+#define ROCKSDB_HIST_MAX (PROTOCOL_HISTOGRAM_MAX)
+// value, tag, varint granularity and length, varint pairs
+#define ROCKSDB_VAL_MAX \
+  (sizeof(uint32_t) * 3 + 1 + 5 * 2 + ROCKSDB_HIST_MAX * 10)
+
+typedef struct hist_t hist_t;
+struct hist_t {
+  uint32_t granularity;
+  uint32_t len;
+  // (bucket index, count) pairs
+  uint32_t b[ROCKSDB_HIST_MAX * 2];
 };
 
 typedef struct blb_rocksdb_conn_t blb_rocksdb_conn_t;
 struct blb_rocksdb_conn_t {
   char scrtch_key[ROCKSDB_CONN_SCRTCH_SZ];
   char scrtch_inv[ROCKSDB_CONN_SCRTCH_SZ];
+  char scrtch_val[ROCKSDB_VAL_MAX];
+  hist_t hist;
 };
 
 rocksdb_t* blb_rocksdb_handle(db_t* db);
@@ -69,6 +200,18 @@ static inline value_t blb_rocksdb_val_init() {
     _a < _b ? _a : _b;        \
   })
 
+// signals belong to the engine's consumer thread; background threads are
+// started with all of them blocked, which they inherit
+static int blb_rocksdb_thread_start(
+    pthread_t* thread, void* (*fn)(void*), void* usr) {
+  sigset_t s, old;
+  sigfillset(&s);
+  pthread_sigmask(SIG_BLOCK, &s, &old);
+  int rc = pthread_create(thread, NULL, fn, usr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return (rc);
+}
+
 static inline void _write_u32_le(unsigned char* p, uint32_t v) {
   p[0] = v >> 0;
   p[1] = v >> 8;
@@ -95,12 +238,180 @@ static inline int blb_rocksdb_val_encode(
   return (0);
 }
 
+// `o\x1f<rrname>\x1f<sensorid>\x1f<rrtype>\x1f<rdata>`
+static inline int blb_rocksdb_key_o(
+    char* p, size_t p_sz, const protocol_entry_t* e) {
+  int sz = snprintf(
+      p,
+      p_sz,
+      "o\x1f%.*s\x1f%.*s\x1f%.*s\x1f%.*s",
+      (int)e->rrname_len,
+      e->rrname,
+      (int)e->sensorid_len,
+      e->sensorid,
+      (int)e->rrtype_len,
+      e->rrtype,
+      (int)e->rdata_len,
+      e->rdata);
+  if(sz <= 0 || (size_t)sz >= p_sz) { return (-1); }
+  return (sz);
+}
+
+// `i\x1f<rdata>\x1f<sensorid>\x1f<rrname>\x1f<rrtype>`
+static inline int blb_rocksdb_key_i(
+    char* p, size_t p_sz, const protocol_entry_t* e) {
+  int sz = snprintf(
+      p,
+      p_sz,
+      "i\x1f%.*s\x1f%.*s\x1f%.*s\x1f%.*s",
+      (int)e->rdata_len,
+      e->rdata,
+      (int)e->sensorid_len,
+      e->sensorid,
+      (int)e->rrname_len,
+      e->rrname,
+      (int)e->rrtype_len,
+      e->rrtype);
+  if(sz <= 0 || (size_t)sz >= p_sz) { return (-1); }
+  return (sz);
+}
+
 static inline blb_rocksdb_conn_t* blb_rocksdb_get_conn(conn_t* conn) {
   ASSERT(
       conn->usr_ctx != NULL && conn->usr_ctx_sz == sizeof(blb_rocksdb_conn_t));
   return ((blb_rocksdb_conn_t*)(conn->usr_ctx));
 }
 
+static blb_rocksdb_cf_t* blb_rocksdb_cf_new(
+    rocksdb_column_family_handle_t* handle,
+    const char* sensorid,
+    size_t sensorid_len) {
+  blb_rocksdb_cf_t* cf = blb_malloc(sizeof(blb_rocksdb_cf_t) + sensorid_len);
+  if(cf == NULL) { return (NULL); }
+  cf->handle = handle;
+  atomic_init(&cf->refs, 1);
+  atomic_init(&cf->dropped, 0);
+  cf->h = blb_hash64(sensorid, sensorid_len, ROCKSDB_CF_SEED);
+  cf->sensorid_len = sensorid_len;
+  memcpy(cf->sensorid, sensorid, sensorid_len);
+  return (cf);
+}
+
+static void blb_rocksdb_cf_unref(blb_rocksdb_cf_t* cf) {
+  if(atomic_fetch_sub(&cf->refs, 1) > 1) { return; }
+  rocksdb_column_family_handle_destroy(cf->handle);
+  blb_free(cf);
+}
+
+static void blb_rocksdb_cf_release(blb_rocksdb_cf_t** cfs, int n) {
+  for(int i = 0; i < n; i++) { blb_rocksdb_cf_unref(cfs[i]); }
+}
+
+// index of the sensor's family or -1; with the registry lock held
+static int blb_rocksdb_cf_find(
+    blb_rocksdb_t* db, const char* sensorid, size_t sensorid_len) {
+  uint64_t h = blb_hash64(sensorid, sensorid_len, ROCKSDB_CF_SEED);
+  for(int i = 1; i < db->cfs_len; i++) {
+    const blb_rocksdb_cf_t* cf = db->cfs[i];
+    if(cf->h == h && cf->sensorid_len == sensorid_len
+       && memcmp(cf->sensorid, sensorid, sensorid_len) == 0) {
+      return (i);
+    }
+  }
+  return (-1);
+}
+
+// creates the sensor's family and returns its index, or that of the default
+// family if it cannot; with the registry lock held for writing
+static int blb_rocksdb_cf_create(
+    blb_rocksdb_t* db, const char* sensorid, size_t sensorid_len) {
+  if(db->cfs_len >= ROCKSDB_CFS_MAX) {
+    if(!db->cfs_full) {
+      L(log_warn(
+          "more than `%d` sensors; further ones share the default column "
+          "family",
+          ROCKSDB_SENSOR_FAMILIES_MAX));
+      db->cfs_full = true;
+    }
+    return (0);
+  }
+  char name[ROCKSDB_CF_NAME_MAX];
+  int sz = snprintf(
+      name,
+      sizeof(name),
+      ROCKSDB_CF_SENSOR_PREFIX "%.*s",
+      (int)sensorid_len,
+      sensorid);
+  if(sensorid_len == 0 || memchr(sensorid, '\0', sensorid_len) != NULL
+     || sz <= 0 || (size_t)sz >= sizeof(name)) {
+    X(log_debug(
+        "no column family for sensor `%.*s`", (int)sensorid_len, sensorid));
+    return (0);
+  }
+  char* err = NULL;
+  rocksdb_column_family_handle_t* handle =
+      rocksdb_create_column_family(db->db, db->options, name, &err);
+  if(err != NULL) {
+    L(log_error("rocksdb_create_column_family() failed: `%s`", err));
+    free(err);
+    return (0);
+  }
+  blb_rocksdb_cf_t* cf = blb_rocksdb_cf_new(handle, sensorid, sensorid_len);
+  if(cf == NULL) {
+    rocksdb_column_family_handle_destroy(handle);
+    return (0);
+  }
+  db->cfs[db->cfs_len] = cf;
+  db->cfs_len += 1;
+  V(log_info("column family `%s` created", name));
+  return (db->cfs_len - 1);
+}
+
+// the family an input of the sensor goes to, referenced: its own if it has
+// one, a new one if sensors get families, the default one otherwise
+static blb_rocksdb_cf_t* blb_rocksdb_cf_input(
+    blb_rocksdb_t* db, const char* sensorid, size_t sensorid_len) {
+  pthread_rwlock_rdlock(&db->cfs_lock);
+  int i = blb_rocksdb_cf_find(db, sensorid, sensorid_len);
+  if(i < 0 && !db->sensor_families) { i = 0; }
+  if(i >= 0) {
+    blb_rocksdb_cf_t* cf = db->cfs[i];
+    atomic_fetch_add(&cf->refs, 1);
+    pthread_rwlock_unlock(&db->cfs_lock);
+    return (cf);
+  }
+  pthread_rwlock_unlock(&db->cfs_lock);
+
+  pthread_rwlock_wrlock(&db->cfs_lock);
+  i = blb_rocksdb_cf_find(db, sensorid, sensorid_len);
+  if(i < 0) { i = blb_rocksdb_cf_create(db, sensorid, sensorid_len); }
+  blb_rocksdb_cf_t* cf = db->cfs[i];
+  atomic_fetch_add(&cf->refs, 1);
+  pthread_rwlock_unlock(&db->cfs_lock);
+  return (cf);
+}
+
+// the families a query has to look at, referenced: the default one and the
+// sensor's own, or all of them if `sensorid` is empty
+static int blb_rocksdb_cf_query(
+    blb_rocksdb_t* db,
+    const char* sensorid,
+    size_t sensorid_len,
+    blb_rocksdb_cf_t** out) {
+  int n = 0;
+  pthread_rwlock_rdlock(&db->cfs_lock);
+  if(sensorid_len == 0) {
+    for(int i = 0; i < db->cfs_len; i++) { out[n++] = db->cfs[i]; }
+  } else {
+    out[n++] = db->cfs[0];
+    int i = blb_rocksdb_cf_find(db, sensorid, sensorid_len);
+    if(i > 0) { out[n++] = db->cfs[i]; }
+  }
+  for(int i = 0; i < n; i++) { atomic_fetch_add(&out[i]->refs, 1); }
+  pthread_rwlock_unlock(&db->cfs_lock);
+  return (n);
+}
+
 static inline int blb_rocksdb_val_decode(
     value_t* o, const char* buf, size_t buflen) {
   size_t minlen = sizeof(uint32_t) * 3;
@@ -120,17 +431,188 @@ static inline void blb_rocksdb_val_merge(value_t* lhs, const value_t* rhs) {
   lhs->first_seen = blb_rocksdb_min(lhs->first_seen, rhs->first_seen);
 }
 
+// an observation value may carry an activity histogram behind its 12 bytes:
+// `H` varint(granularity) varint(n) followed by n pairs of varint(bucket
+// index delta) varint(count). bucket indexes are absolute (timestamp /
+// granularity) and ascending, the first delta is taken from zero. values
+// without the trailer are what older versions wrote and still decode.
+static inline size_t _write_varint(unsigned char* p, uint32_t v) {
+  size_t n = 0;
+  while(v >= 0x80) {
+    p[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (unsigned char)v;
+  return (n);
+}
+
+static inline int _read_varint(
+    const unsigned char** p, const unsigned char* end, uint32_t* v) {
+  uint32_t r = 0;
+  for(int shift = 0; shift < 35 && *p < end; shift += 7) {
+    unsigned char c = *(*p)++;
+    r |= (uint32_t)(c & 0x7f) << shift;
+    if((c & 0x80) == 0) {
+      *v = r;
+      return (0);
+    }
+  }
+  return (-1);
+}
+
+static inline uint32_t _sat_add_u32(uint32_t a, uint32_t b) {
+  return (a > UINT32_MAX - b ? UINT32_MAX : a + b);
+}
+
+static inline int blb_rocksdb_hist_decode(
+    hist_t* h, const char* buf, size_t buflen) {
+  size_t minlen = sizeof(uint32_t) * 3;
+  h->granularity = 0;
+  h->len = 0;
+  if(buflen <= minlen || buf[minlen] != ROCKSDB_HIST_TAG) { return (0); }
+
+  const unsigned char* p = (const unsigned char*)buf + minlen + 1;
+  const unsigned char* end = (const unsigned char*)buf + buflen;
+  uint32_t n = 0;
+  if(_read_varint(&p, end, &h->granularity) != 0
+     || _read_varint(&p, end, &n) != 0 || h->granularity == 0
+     || n > ROCKSDB_HIST_MAX) {
+    return (-1);
+  }
+  uint32_t idx = 0;
+  for(uint32_t i = 0; i < n; i++) {
+    uint32_t delta = 0;
+    if(_read_varint(&p, end, &delta) != 0
+       || _read_varint(&p, end, &h->b[i * 2 + 1]) != 0) {
+      return (-1);
+    }
+    idx += delta;
+    h->b[i * 2] = idx;
+  }
+  h->len = n;
+  return (0);
+}
+
+// appends the trailer behind the encoded value in `buf` (which holds at
+// least ROCKSDB_VAL_MAX bytes) and returns the full value length
+static inline size_t blb_rocksdb_hist_encode(const hist_t* h, char* buf) {
+  size_t len = sizeof(uint32_t) * 3;
+  if(h->len == 0) { return (len); }
+
+  unsigned char* p = (unsigned char*)buf + len;
+  *p++ = ROCKSDB_HIST_TAG;
+  p += _write_varint(p, h->granularity);
+  p += _write_varint(p, h->len);
+  uint32_t prev = 0;
+  for(uint32_t i = 0; i < h->len; i++) {
+    p += _write_varint(p, h->b[i * 2] - prev);
+    p += _write_varint(p, h->b[i * 2 + 1]);
+    prev = h->b[i * 2];
+  }
+  return ((size_t)(p - (unsigned char*)buf));
+}
+
+// re-buckets to a coarser granularity; indexes stay ascending so buckets
+// falling together are neighbours and coalesce in place
+static void blb_rocksdb_hist_rescale(hist_t* h, uint32_t granularity) {
+  if(h->granularity != granularity && h->len > 0) {
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < h->len; i++) {
+      uint32_t idx =
+          (uint32_t)((uint64_t)h->b[i * 2] * h->granularity / granularity);
+      if(n > 0 && h->b[(n - 1) * 2] == idx) {
+        h->b[(n - 1) * 2 + 1] =
+            _sat_add_u32(h->b[(n - 1) * 2 + 1], h->b[i * 2 + 1]);
+        continue;
+      }
+      h->b[n * 2] = idx;
+      h->b[n * 2 + 1] = h->b[i * 2 + 1];
+      n++;
+    }
+    h->len = n;
+  }
+  h->granularity = granularity;
+}
+
+// unions `rhs` into `lhs` at the coarser of both granularities and keeps
+// the newest `max` buckets; `tmp` is scratch space
+static void blb_rocksdb_hist_merge(
+    hist_t* lhs, hist_t* rhs, hist_t* tmp, uint32_t max) {
+  if(rhs->len == 0) { return; }
+  uint32_t g = blb_rocksdb_max(lhs->granularity, rhs->granularity);
+  blb_rocksdb_hist_rescale(lhs, g);
+  blb_rocksdb_hist_rescale(rhs, g);
+
+  // join from the newest end, so truncation drops the oldest buckets
+  uint32_t i = lhs->len, j = rhs->len, n = 0;
+  while((i > 0 || j > 0) && n < max) {
+    const uint32_t* a = i > 0 ? &lhs->b[(i - 1) * 2] : NULL;
+    const uint32_t* b = j > 0 ? &rhs->b[(j - 1) * 2] : NULL;
+    if(a != NULL && b != NULL && a[0] == b[0]) {
+      tmp->b[n * 2] = a[0];
+      tmp->b[n * 2 + 1] = _sat_add_u32(a[1], b[1]);
+      i--;
+      j--;
+    } else if(b == NULL || (a != NULL && a[0] > b[0])) {
+      tmp->b[n * 2] = a[0];
+      tmp->b[n * 2 + 1] = a[1];
+      i--;
+    } else {
+      tmp->b[n * 2] = b[0];
+      tmp->b[n * 2 + 1] = b[1];
+      j--;
+    }
+    n++;
+  }
+  for(uint32_t k = 0; k < n; k++) {
+    lhs->b[k * 2] = tmp->b[(n - 1 - k) * 2];
+    lhs->b[k * 2 + 1] = tmp->b[(n - 1 - k) * 2 + 1];
+  }
+  lhs->len = n;
+}
+
+// histograms are 8KiB each, too large for the stacks of the rocksdb threads
+// running merges; every such thread gets its own set on the heap, freed
+// when the thread exits
+typedef struct merge_scratch_t merge_scratch_t;
+struct merge_scratch_t {
+  hist_t hist;
+  hist_t nhist;
+  hist_t tmp;
+};
+
+static pthread_key_t blb_rocksdb_merge_key;
+static pthread_once_t blb_rocksdb_merge_once = PTHREAD_ONCE_INIT;
+
+static void blb_rocksdb_merge_key_init(void) {
+  (void)pthread_key_create(&blb_rocksdb_merge_key, free);
+}
+
+static merge_scratch_t* blb_rocksdb_merge_scratch(void) {
+  (void)pthread_once(&blb_rocksdb_merge_once, blb_rocksdb_merge_key_init);
+  merge_scratch_t* m = pthread_getspecific(blb_rocksdb_merge_key);
+  if(m != NULL) { return (m); }
+  m = malloc(sizeof(merge_scratch_t));
+  if(m == NULL) { return (NULL); }
+  if(pthread_setspecific(blb_rocksdb_merge_key, m) != 0) {
+    free(m);
+    return (NULL);
+  }
+  return (m);
+}
+
 static char* blb_rocksdb_merge_fully(
     void* state,
     const char* key,
     size_t key_len,
     value_t* obs,
+    merge_scratch_t* m,
     const char* const* opnds,
     const size_t* opnds_len,
     int n_opnds,
     unsigned char* success,
     size_t* new_len) {
-  (void)state;
+  blb_rocksdb_t* db = state;
   if(key_len < 5) {
     V(log_warn(
         "merge called on unknown key `%p` `%s` `%.*s` opnds `%d`",
@@ -140,14 +622,11 @@ static char* blb_rocksdb_merge_fully(
         key,
         n_opnds));
   }
-  // this is an observation value
-  size_t buf_length = sizeof(uint32_t) * 3;
-  char* buf = malloc(buf_length);
-  if(buf == NULL) {
-    *success = (unsigned char)0;
-    *new_len = 0;
-    return (NULL);
-  }
+  // this is an observation value; histograms are merged whether or not
+  // this instance records them, so none are lost when the feature is off
+  uint32_t hist_max = db->hist_buckets > 0 ? db->hist_buckets
+                                           : ROCKSDB_HIST_MAX;
+  hist_t* hist = &m->hist;
   for(int i = 0; i < n_opnds; i++) {
     value_t nobs = {0, 0, 0};
     int rc = blb_rocksdb_val_decode(&nobs, opnds[i], opnds_len[i]);
@@ -160,9 +639,25 @@ static char* blb_rocksdb_merge_fully(
       continue;
     }
     blb_rocksdb_val_merge(obs, &nobs);
+    if(blb_rocksdb_hist_decode(&m->nhist, opnds[i], opnds_len[i]) != 0) {
+      L(log_error(
+          "blb_rocksdb_hist_decode() failed (key `%.*s` opnd `%d`)",
+          (int)key_len,
+          key,
+          i));
+      continue;
+    }
+    blb_rocksdb_hist_merge(hist, &m->nhist, &m->tmp, hist_max);
+  }
+  size_t buf_length = hist->len > 0 ? ROCKSDB_VAL_MAX : sizeof(uint32_t) * 3;
+  char* buf = malloc(buf_length);
+  if(buf == NULL) {
+    *success = (unsigned char)0;
+    *new_len = 0;
+    return (NULL);
   }
   blb_rocksdb_val_encode(obs, buf, buf_length);
-  *new_len = buf_length;
+  *new_len = blb_rocksdb_hist_encode(hist, buf);
   *success = (unsigned char)1;
   return (buf);
 }
@@ -178,7 +673,15 @@ static char* blb_rocksdb_mergeop_full_merge(
     int n_opnds,
     unsigned char* success,
     size_t* new_len) {
+  merge_scratch_t* m = blb_rocksdb_merge_scratch();
+  if(m == NULL) {
+    *success = (unsigned char)0;
+    *new_len = 0;
+    return (NULL);
+  }
   value_t obs = blb_rocksdb_val_init();
+  m->hist.granularity = 0;
+  m->hist.len = 0;
   if(key[0] == 'o' && existing_value != NULL) {
     int rc =
         blb_rocksdb_val_decode(&obs, existing_value, existing_value_length);
@@ -187,9 +690,24 @@ static char* blb_rocksdb_mergeop_full_merge(
       *success = 1;
       return (NULL);
     }
+    rc = blb_rocksdb_hist_decode(
+        &m->hist, existing_value, existing_value_length);
+    if(rc != 0) {
+      L(log_error("blb_rocksdb_hist_decode() failed"));
+      m->hist.len = 0;
+    }
   }
   char* result = blb_rocksdb_merge_fully(
-      state, key, key_len, &obs, opnds, opnds_len, n_opnds, success, new_len);
+      state,
+      key,
+      key_len,
+      &obs,
+      m,
+      opnds,
+      opnds_len,
+      n_opnds,
+      success,
+      new_len);
   return (result);
 }
 
@@ -202,9 +720,26 @@ static char* blb_rocksdb_mergeop_partial_merge(
     int n_opnds,
     unsigned char* success,
     size_t* new_len) {
+  merge_scratch_t* m = blb_rocksdb_merge_scratch();
+  if(m == NULL) {
+    *success = (unsigned char)0;
+    *new_len = 0;
+    return (NULL);
+  }
   value_t obs = blb_rocksdb_val_init();
+  m->hist.granularity = 0;
+  m->hist.len = 0;
   char* result = blb_rocksdb_merge_fully(
-      state, key, key_len, &obs, opnds, opnds_len, n_opnds, success, new_len);
+      state,
+      key,
+      key_len,
+      &obs,
+      m,
+      opnds,
+      opnds_len,
+      n_opnds,
+      success,
+      new_len);
   return (result);
 }
 
@@ -217,9 +752,10 @@ static const char* blb_rocksdb_mergeop_name(void* state) {
   return ("observation-mergeop");
 }
 
-static inline rocksdb_mergeoperator_t* blb_rocksdb_mergeoperator_create() {
+static inline rocksdb_mergeoperator_t* blb_rocksdb_mergeoperator_create(
+    blb_rocksdb_t* db) {
   return (rocksdb_mergeoperator_create(
-      NULL,
+      db,
       blb_rocksdb_mergeop_destructor,
       blb_rocksdb_mergeop_full_merge,
       blb_rocksdb_mergeop_partial_merge,
@@ -243,21 +779,97 @@ void blb_rocksdb_conn_deinit(conn_t* th, db_t* db) {
   th->usr_ctx_sz = 0;
 }
 
+// with a memory limit, memtables are charged to the block cache through a
+// write buffer manager, so both together stay within the cache's capacity;
+// index and filter blocks live in the cache as well
+static void blb_rocksdb_memory_init(
+    blb_rocksdb_t* db, const blb_rocksdb_config_t* c) {
+  db->cache = NULL;
+  db->table_options = NULL;
+  db->wbm = NULL;
+  if(c->memory_limit == 0) { return; }
+  V(log_info("block cache and memtables limited to `%zu`", c->memory_limit));
+  db->cache = rocksdb_cache_create_lru(c->memory_limit);
+  db->table_options = rocksdb_block_based_options_create();
+  rocksdb_block_based_options_set_block_cache(db->table_options, db->cache);
+  rocksdb_block_based_options_set_cache_index_and_filter_blocks(
+      db->table_options, 1);
+  rocksdb_options_set_block_based_table_factory(
+      db->options, db->table_options);
+  // writers stall rather than overshooting the limit
+  db->wbm = rocksdb_write_buffer_manager_create_with_cache(
+      c->memory_limit / 2, db->cache, true);
+  rocksdb_options_set_write_buffer_manager(db->options, db->wbm);
+}
+
+static void blb_rocksdb_memory_teardown(blb_rocksdb_t* db) {
+  if(db->wbm != NULL) { rocksdb_write_buffer_manager_destroy(db->wbm); }
+  if(db->table_options != NULL) {
+    rocksdb_block_based_options_destroy(db->table_options);
+  }
+  if(db->cache != NULL) { rocksdb_cache_destroy(db->cache); }
+}
+
 void blb_rocksdb_teardown(db_t* _db) {
   ASSERT(_db->dbi == &blb_rocksdb_dbi);
   blb_rocksdb_t* db = (blb_rocksdb_t*)_db;
   L(log_notice("teardown"));
+  if(db->purge_running) {
+    atomic_store(&db->purge_stop, 1);
+    pthread_join(db->purge, NULL);
+  }
+  pthread_mutex_destroy(&db->purge_lock);
+  if(db->catchup_running) {
+    atomic_store(&db->catchup_stop, 1);
+    pthread_join(db->catchup, NULL);
+  }
+  if(db->follow_running) {
+    atomic_store(&db->catchup_stop, 1);
+    pthread_join(db->follow, NULL);
+  }
+  if(db->inv_cache_warmup_running) {
+    atomic_store(&db->inv_cache_warmup_stop, 1);
+    pthread_join(db->inv_cache_warmup, NULL);
+  }
+  blb_keycache_teardown(db->inv_cache);
+  if(db->filter_rebuild_running) {
+    atomic_store(&db->filter_rebuild_stop, 1);
+    pthread_join(db->filter_rebuild, NULL);
+  }
+  if(db->filter != NULL && atomic_load(&db->filter_ready) > 0) {
+    if(blb_bloom_save(db->filter, db->filter_path) == 0) {
+      V(log_info("existence filter saved to `%s`", db->filter_path));
+    }
+  }
+  blb_bloom_teardown(db->filter);
+  if(db->filter_path != NULL) { blb_free(db->filter_path); }
   rocksdb_mergeoperator_destroy(db->mergeop);
   rocksdb_writeoptions_destroy(db->writeoptions);
   rocksdb_readoptions_destroy(db->readoptions);
   // keeping this causes segfault
   // rocksdb_options_destroy(db->options);
+  // nobody else holds a family anymore, handles go before the database
+  blb_rocksdb_cf_release(db->cfs, db->cfs_len);
+  pthread_rwlock_destroy(&db->cfs_lock);
   rocksdb_close(db->db);
+  blb_rocksdb_memory_teardown(db);
   blb_free(db);
 }
 
+// turns bucket indexes into bucket start timestamps, in place
+static inline void blb_rocksdb_hist_fill(hist_t* h, protocol_entry_t* e) {
+  if(h->len == 0) { return; }
+  for(uint32_t k = 0; k < h->len; k++) { h->b[k * 2] *= h->granularity; }
+  e->hist_granularity = h->granularity;
+  e->hist_len = h->len;
+  e->hist = h->b;
+}
+
 static int blb_rocksdb_query_by_o(
-    conn_t* th, const protocol_query_request_t* q) {
+    conn_t* th,
+    const protocol_query_request_t* q,
+    rocksdb_column_family_handle_t* cf,
+    size_t* keys_hit) {
   ASSERT(th->db->dbi == &blb_rocksdb_dbi);
   blb_rocksdb_conn_t* dbc = blb_rocksdb_get_conn(th);
   blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
@@ -284,18 +896,12 @@ static int blb_rocksdb_query_by_o(
 
   X(log_debug("prefix key `%.*s`", (int)prefix_len, dbc->scrtch_key));
 
-  int start_ok = blb_conn_query_stream_start_response(th);
-  if(start_ok != 0) {
-    L(log_error("unable to start query stream response"));
-    return (-1);
-  }
-
-  rocksdb_iterator_t* it = rocksdb_create_iterator(db->db, db->readoptions);
+  rocksdb_iterator_t* it =
+      rocksdb_create_iterator_cf(db->db, db->readoptions, cf);
   rocksdb_iter_seek(it, dbc->scrtch_key, prefix_len);
   size_t keys_visited = 0;
-  size_t keys_hit = 0;
-  for(;
-      rocksdb_iter_valid(it) != (unsigned char)0 && keys_hit < (size_t)q->limit;
+  for(; rocksdb_iter_valid(it) != (unsigned char)0
+        && *keys_hit < (size_t)q->limit;
       rocksdb_iter_next(it)) {
     keys_visited += 1;
     size_t key_len = 0;
@@ -386,8 +992,14 @@ static int blb_rocksdb_query_by_o(
       continue;
     }
 
-    keys_hit += 1;
-    protocol_entry_t __e, *e = &__e;
+    if(q->histogram
+       && blb_rocksdb_hist_decode(&dbc->hist, val, val_size) != 0) {
+      L(log_error("blb_rocksdb_hist_decode() failed"));
+      dbc->hist.len = 0;
+    }
+
+    *keys_hit += 1;
+    protocol_entry_t __e = {0}, *e = &__e;
     e->sensorid = toks[SENSORID].tok;
     e->sensorid_len = toks[SENSORID].tok_len;
     e->rdata = toks[RDATA].tok;
@@ -399,6 +1011,7 @@ static int blb_rocksdb_query_by_o(
     e->count = v.count;
     e->first_seen = v.first_seen;
     e->last_seen = v.last_seen;
+    if(q->histogram) { blb_rocksdb_hist_fill(&dbc->hist, e); }
     int push_ok = blb_conn_query_stream_push_response(th, e);
     if(push_ok != 0) {
       L(log_error("unable to push query response entry"));
@@ -412,8 +1025,7 @@ static int blb_rocksdb_query_by_o(
     free(err);
   }
   rocksdb_iter_destroy(it);
-  (void)blb_conn_query_stream_end_response(th);
-  T(log_debug("keys_visited `%zu` keys_hit `%zu`", keys_visited, keys_hit));
+  T(log_debug("keys_visited `%zu` keys_hit `%zu`", keys_visited, *keys_hit));
   return (0);
 
 stream_error:
@@ -422,7 +1034,10 @@ stream_error:
 }
 
 static int blb_rocksdb_query_by_i(
-    conn_t* th, const protocol_query_request_t* q) {
+    conn_t* th,
+    const protocol_query_request_t* q,
+    rocksdb_column_family_handle_t* cf,
+    size_t* keys_hit) {
   ASSERT(th->db->dbi == &blb_rocksdb_dbi);
   blb_rocksdb_conn_t* dbc = blb_rocksdb_get_conn(th);
   blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
@@ -451,18 +1066,12 @@ static int blb_rocksdb_query_by_i(
 
   T(log_debug("prefix key `%.*s`", (int)prefix_len, dbc->scrtch_inv));
 
-  int start_ok = blb_conn_query_stream_start_response(th);
-  if(start_ok != 0) {
-    L(log_error("unable to start query stream response"));
-    return (-1);
-  }
-
-  rocksdb_iterator_t* it = rocksdb_create_iterator(db->db, db->readoptions);
+  rocksdb_iterator_t* it =
+      rocksdb_create_iterator_cf(db->db, db->readoptions, cf);
   rocksdb_iter_seek(it, dbc->scrtch_inv, prefix_len);
   size_t keys_visited = 0;
-  size_t keys_hit = 0;
-  for(;
-      rocksdb_iter_valid(it) != (unsigned char)0 && keys_hit < (size_t)q->limit;
+  for(; rocksdb_iter_valid(it) != (unsigned char)0
+        && *keys_hit < (size_t)q->limit;
       rocksdb_iter_next(it)) {
     keys_visited += 1;
     size_t key_len = 0;
@@ -561,10 +1170,16 @@ static int blb_rocksdb_query_by_i(
     X(log_debug("full key `%.*s`", (int)fullkey_len, dbc->scrtch_key));
 
     size_t val_size = 0;
-    char* val = rocksdb_get(
-        db->db, db->readoptions, dbc->scrtch_key, fullkey_len, &val_size, &err);
+    char* val = rocksdb_get_cf(
+        db->db,
+        db->readoptions,
+        cf,
+        dbc->scrtch_key,
+        fullkey_len,
+        &val_size,
+        &err);
     if(val == NULL || err != NULL) {
-      X(log_debug("rocksdb_get() failed with `%s`", err));
+      X(log_debug("rocksdb_get_cf() failed with `%s`", err));
       free(err);
       continue;
     }
@@ -582,10 +1197,15 @@ static int blb_rocksdb_query_by_i(
       free(val);
       continue;
     }
+    if(q->histogram
+       && blb_rocksdb_hist_decode(&dbc->hist, val, val_size) != 0) {
+      L(log_error("blb_rocksdb_hist_decode() failed"));
+      dbc->hist.len = 0;
+    }
     free(val);
 
-    keys_hit += 1;
-    protocol_entry_t __e, *e = &__e;
+    *keys_hit += 1;
+    protocol_entry_t __e = {0}, *e = &__e;
     e->sensorid = toks[SENSORID].tok;
     e->sensorid_len = toks[SENSORID].tok_len;
     e->rdata = toks[RDATA].tok;
@@ -597,6 +1217,7 @@ static int blb_rocksdb_query_by_i(
     e->count = v.count;
     e->first_seen = v.first_seen;
     e->last_seen = v.last_seen;
+    if(q->histogram) { blb_rocksdb_hist_fill(&dbc->hist, e); }
     int push_ok = blb_conn_query_stream_push_response(th, e);
     if(push_ok != 0) {
       L(log_error("unable to push query response entry"));
@@ -610,8 +1231,7 @@ static int blb_rocksdb_query_by_i(
     free(err);
   }
   rocksdb_iter_destroy(it);
-  (void)blb_conn_query_stream_end_response(th);
-  T(log_debug("keys_visited `%zu` keys_hit `%zu`", keys_visited, keys_hit));
+  T(log_debug("keys_visited `%zu` keys_hit `%zu`", keys_visited, *keys_hit));
   return (0);
 
 stream_error:
@@ -619,13 +1239,69 @@ stream_error:
   return (-1);
 }
 
-static int blb_rocksdb_query(conn_t* th, const protocol_query_request_t* q) {
-  int rc = -1;
+static inline void blb_rocksdb_filter_add(
+    blb_rocksdb_t* db, const protocol_entry_t* e) {
+  if(db->filter == NULL) { return; }
+  blb_bloom_add(
+      db->filter,
+      blb_hash64(e->rrname, e->rrname_len, ROCKSDB_FILTER_SEED_RRNAME));
+  blb_bloom_add(
+      db->filter,
+      blb_hash64(e->rdata, e->rdata_len, ROCKSDB_FILTER_SEED_RDATA));
+}
+
+// returns false if the query is known to yield no results
+static inline bool blb_rocksdb_filter_maybe(
+    blb_rocksdb_t* db, const protocol_query_request_t* q) {
+  if(db->filter == NULL || atomic_load(&db->filter_ready) == 0) {
+    return (true);
+  }
+  uint64_t h = 0;
   if(q->qrrname_len > 0) {
-    rc = blb_rocksdb_query_by_o(th, q);
+    h = blb_hash64(q->qrrname, q->qrrname_len, ROCKSDB_FILTER_SEED_RRNAME);
   } else {
-    rc = blb_rocksdb_query_by_i(th, q);
+    h = blb_hash64(q->qrdata, q->qrdata_len, ROCKSDB_FILTER_SEED_RDATA);
+  }
+  return (blb_bloom_contains(db->filter, h));
+}
+
+static int blb_rocksdb_query(conn_t* th, const protocol_query_request_t* q) {
+  ASSERT(th->db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
+  if(atomic_load(&db->cfs_stale) > 0) {
+    L(log_error("query rejected: secondary misses column families of its "
+                "primary; restart it"));
+    return (-1);
+  }
+  if(!blb_rocksdb_filter_maybe(db, q)) {
+    atomic_fetch_add(&db->filter_negatives, 1);
+    if(blb_conn_query_stream_start_response(th) != 0) {
+      L(log_error("unable to start query stream response"));
+      return (-1);
+    }
+    (void)blb_conn_query_stream_end_response(th);
+    return (0);
+  }
+
+  blb_rocksdb_cf_t* cfs[ROCKSDB_CFS_MAX];
+  int n = blb_rocksdb_cf_query(db, q->qsensorid, q->qsensorid_len, cfs);
+  if(blb_conn_query_stream_start_response(th) != 0) {
+    L(log_error("unable to start query stream response"));
+    blb_rocksdb_cf_release(cfs, n);
+    return (-1);
+  }
+
+  int rc = 0;
+  size_t keys_hit = 0;
+  for(int i = 0; i < n && rc == 0 && keys_hit < (size_t)q->limit; i++) {
+    if(q->qrrname_len > 0) {
+      rc = blb_rocksdb_query_by_o(th, q, cfs[i]->handle, &keys_hit);
+    } else {
+      rc = blb_rocksdb_query_by_i(th, q, cfs[i]->handle, &keys_hit);
+    }
   }
+  blb_rocksdb_cf_release(cfs, n);
+  if(rc == 0) { (void)blb_conn_query_stream_end_response(th); }
   return (rc);
 }
 
@@ -635,6 +1311,11 @@ static void blb_rocksdb_backup(conn_t* th, const protocol_backup_request_t* b) {
 
   X(log_info("backup `%.*s`", (int)b->path_len, b->path));
 
+  if(db->secondary) {
+    L(log_error("backup rejected: read-only secondary instance"));
+    return;
+  }
+
   if(b->path_len >= 256) {
     L(log_error("invalid path"));
     return;
@@ -661,14 +1342,14 @@ static void blb_rocksdb_backup(conn_t* th, const protocol_backup_request_t* b) {
   }
 }
 
-static void blb_rocksdb_dump(conn_t* th, const protocol_dump_request_t* d) {
-  ASSERT(th->db->dbi == &blb_rocksdb_dbi);
-  blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
-
-  X(log_info("dump `%.*s`", (int)d->path_len, d->path));
-
-  uint64_t cnt = 0;
-  rocksdb_iterator_t* it = rocksdb_create_iterator(db->db, db->readoptions);
+static int blb_rocksdb_dump_cf(
+    conn_t* th,
+    blb_rocksdb_t* db,
+    rocksdb_column_family_handle_t* cf,
+    uint64_t* cnt) {
+  int rc = 0;
+  rocksdb_iterator_t* it =
+      rocksdb_create_iterator_cf(db->db, db->readoptions, cf);
   // rocksdb_iter_seek_to_first(it);
   rocksdb_iter_seek(it, "o", 1);
   for(; rocksdb_iter_valid(it) != (unsigned char)0; rocksdb_iter_next(it)) {
@@ -679,7 +1360,7 @@ static void blb_rocksdb_dump(conn_t* th, const protocol_dump_request_t* d) {
       break;
     }
 
-    if(key[0] == 'i') { continue; }
+    if(key[0] != 'o') { break; }
 
     enum TokIdx { RRNAME = 0, SENSORID = 1, RRTYPE = 2, RDATA = 3, FIELDS = 4 };
 
@@ -727,8 +1408,8 @@ static void blb_rocksdb_dump(conn_t* th, const protocol_dump_request_t* d) {
       continue;
     }
 
-    cnt += 1;
-    protocol_entry_t __e, *e = &__e;
+    *cnt += 1;
+    protocol_entry_t __e = {0}, *e = &__e;
     e->sensorid = toks[SENSORID].tok;
     e->sensorid_len = toks[SENSORID].tok_len;
     e->rdata = toks[RDATA].tok;
@@ -741,7 +1422,7 @@ static void blb_rocksdb_dump(conn_t* th, const protocol_dump_request_t* d) {
     e->first_seen = v.first_seen;
     e->last_seen = v.last_seen;
 
-    int rc = blb_conn_dump_entry(th, e);
+    rc = blb_conn_dump_entry(th, e);
     if(rc != 0) {
       L(log_error("blb_conn_dump_entry() failed"));
       break;
@@ -755,50 +1436,89 @@ static void blb_rocksdb_dump(conn_t* th, const protocol_dump_request_t* d) {
     free(err);
   }
   rocksdb_iter_destroy(it);
+  return (rc);
+}
+
+static void blb_rocksdb_dump(conn_t* th, const protocol_dump_request_t* d) {
+  ASSERT(th->db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
+
+  X(log_info("dump `%.*s`", (int)d->path_len, d->path));
+
+  uint64_t cnt = 0;
+  blb_rocksdb_cf_t* cfs[ROCKSDB_CFS_MAX];
+  int n = blb_rocksdb_cf_query(db, NULL, 0, cfs);
+  for(int i = 0; i < n; i++) {
+    if(blb_rocksdb_dump_cf(th, db, cfs[i]->handle, &cnt) != 0) { break; }
+  }
+  blb_rocksdb_cf_release(cfs, n);
   L(log_notice("dumped `%" PRIu64 "` entries", cnt));
 }
 
+// the histogram an input contributes: the one it carries, if any, otherwise
+// its count in the bucket of its last sighting
+static const hist_t* blb_rocksdb_input_hist(
+    blb_rocksdb_t* db, blb_rocksdb_conn_t* dbc, const protocol_entry_t* e) {
+  hist_t* h = &dbc->hist;
+  h->len = 0;
+  if(e->hist_len > 0 && e->hist_granularity > 0) {
+    uint32_t prev = 0;
+    for(size_t k = 0; k < e->hist_len && k < ROCKSDB_HIST_MAX; k++) {
+      uint32_t idx = e->hist[k * 2] / e->hist_granularity;
+      if(h->len > 0 && idx <= prev) {
+        // not ascending, fall back to the last sighting
+        h->len = 0;
+        break;
+      }
+      h->b[h->len * 2] = idx;
+      h->b[h->len * 2 + 1] = e->hist[k * 2 + 1];
+      h->len += 1;
+      prev = idx;
+    }
+    if(h->len > 0) {
+      h->granularity = e->hist_granularity;
+      return (h);
+    }
+  }
+  if(db->hist_granularity > 0) {
+    h->granularity = db->hist_granularity;
+    h->b[0] = e->last_seen / db->hist_granularity;
+    h->b[1] = e->count;
+    h->len = 1;
+  }
+  return (h);
+}
+
 static int blb_rocksdb_input(conn_t* th, const protocol_input_request_t* i) {
   ASSERT(th->db->dbi == &blb_rocksdb_dbi);
   blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
+  if(db->secondary) {
+    L(log_error("input rejected: read-only secondary instance"));
+    return (-1);
+  }
+  if(db->follower) {
+    L(log_error("input rejected: replication follower"));
+    return (-1);
+  }
   blb_rocksdb_conn_t* dbc = blb_rocksdb_get_conn(th);
   value_t v = {.count = i->entry.count,
                .first_seen = i->entry.first_seen,
                .last_seen = i->entry.last_seen};
-  char val[sizeof(uint32_t) * 3];
-  size_t val_len = sizeof(val);
-  (void)blb_rocksdb_val_encode(&v, val, val_len);
-
-  int key_sz = snprintf(
-      dbc->scrtch_key,
-      ROCKSDB_CONN_SCRTCH_SZ,
-      "o\x1f%.*s\x1f%.*s\x1f%.*s\x1f%.*s",
-      (int)i->entry.rrname_len,
-      i->entry.rrname,
-      (int)i->entry.sensorid_len,
-      i->entry.sensorid,
-      (int)i->entry.rrtype_len,
-      i->entry.rrtype,
-      (int)i->entry.rdata_len,
-      i->entry.rdata);
-  if(key_sz <= 0 || key_sz >= ROCKSDB_CONN_SCRTCH_SZ) {
+  char* val = dbc->scrtch_val;
+  (void)blb_rocksdb_val_encode(&v, val, ROCKSDB_VAL_MAX);
+  size_t val_len =
+      blb_rocksdb_hist_encode(blb_rocksdb_input_hist(db, dbc, &i->entry), val);
+
+  int key_sz =
+      blb_rocksdb_key_o(dbc->scrtch_key, ROCKSDB_CONN_SCRTCH_SZ, &i->entry);
+  if(key_sz < 0) {
     L(log_error("truncated key"));
     return (-1);
   }
 
-  int inv_sz = snprintf(
-      dbc->scrtch_inv,
-      ROCKSDB_CONN_SCRTCH_SZ,
-      "i\x1f%.*s\x1f%.*s\x1f%.*s\x1f%.*s",
-      (int)i->entry.rdata_len,
-      i->entry.rdata,
-      (int)i->entry.sensorid_len,
-      i->entry.sensorid,
-      (int)i->entry.rrname_len,
-      i->entry.rrname,
-      (int)i->entry.rrtype_len,
-      i->entry.rrtype);
-  if(inv_sz <= 0 || inv_sz >= ROCKSDB_CONN_SCRTCH_SZ) {
+  int inv_sz =
+      blb_rocksdb_key_i(dbc->scrtch_inv, ROCKSDB_CONN_SCRTCH_SZ, &i->entry);
+  if(inv_sz < 0) {
     L(log_error("truncated inverted key"));
     return (-1);
   }
@@ -809,79 +1529,2184 @@ static int blb_rocksdb_input(conn_t* th, const protocol_input_request_t* i) {
     return (-1);
   }
 
+  blb_rocksdb_cf_t* cf =
+      blb_rocksdb_cf_input(db, i->entry.sensorid, i->entry.sensorid_len);
+  int rc = -1;
   char* err = NULL;
-  rocksdb_merge(
-      db->db, db->writeoptions, dbc->scrtch_key, key_sz, val, val_len, &err);
+  rocksdb_merge_cf(
+      db->db,
+      db->writeoptions,
+      cf->handle,
+      dbc->scrtch_key,
+      key_sz,
+      val,
+      val_len,
+      &err);
   if(err != NULL) {
-    L(log_error("rocksdb_merge() failed: `%s`", err));
+    L(log_error("rocksdb_merge_cf() failed: `%s`", err));
     free(err);
-    return (-1);
+    goto done;
+  }
+
+  blb_rocksdb_filter_add(db, &i->entry);
+
+  // the inverted key carries no value; skip rewriting it when it is known
+  // to exist already
+  uint64_t inv_h = 0;
+  if(db->inv_cache != NULL) {
+    inv_h =
+        blb_hash64(dbc->scrtch_inv, inv_sz, ROCKSDB_INV_CACHE_SEED ^ cf->h);
+    if(blb_keycache_contains(db->inv_cache, inv_h)) {
+      atomic_fetch_add(&db->inv_skips, 1);
+      rc = 0;
+      goto done;
+    }
   }
 
   // XXX: put vs merge
-  rocksdb_put(db->db, db->writeoptions, dbc->scrtch_inv, inv_sz, "", 0, &err);
+  rocksdb_put_cf(
+      db->db,
+      db->writeoptions,
+      cf->handle,
+      dbc->scrtch_inv,
+      inv_sz,
+      "",
+      0,
+      &err);
   if(err != NULL) {
-    L(log_error("rocksdb_put() failed: `%s`", err));
+    L(log_error("rocksdb_put_cf() failed: `%s`", err));
     free(err);
-    return (-1);
+    goto done;
   }
 
-  return (0);
-}
+  atomic_fetch_add(&db->inv_puts, 1);
+  if(db->inv_cache != NULL) { blb_keycache_insert(db->inv_cache, inv_h); }
+  rc = 0;
 
-rocksdb_t* blb_rocksdb_handle(db_t* _db) {
-  ASSERT(_db->dbi == &blb_rocksdb_dbi);
-  blb_rocksdb_t* db = (blb_rocksdb_t*)_db;
-  return (db->db);
+done:
+  blb_rocksdb_cf_unref(cf);
+  return (rc);
 }
 
-db_t* blb_rocksdb_open(const blb_rocksdb_config_t* c) {
-  V(log_info("rocksdb database at `%s`", c->path));
-  V(log_info(
-      "parallelism `%d` membudget `%zu` max_log_file_size `%zu` "
-      "keep_log_file_num `%d`",
-      c->parallelism,
-      c->membudget,
-      c->max_log_file_size,
-      c->keep_log_file_num));
-
-  blb_rocksdb_t* db = blb_new(blb_rocksdb_t);
-  if(db == NULL) { return (NULL); }
-  db->dbi = &blb_rocksdb_dbi;
+// sends the write batches found in the write ahead log from `*seq` on and
+// advances `*seq` past them; returns -1 on log errors, -2 once the follower
+// went away
+static int blb_rocksdb_replicate_tail(
+    conn_t* th, blb_rocksdb_t* db, uint64_t* seq, uint64_t latest) {
   char* err = NULL;
-  int level_compression[5] = {rocksdb_lz4_compression,
-                              rocksdb_lz4_compression,
-                              rocksdb_lz4_compression,
-                              rocksdb_lz4_compression,
-                              rocksdb_lz4_compression};
-
-  db->mergeop = blb_rocksdb_mergeoperator_create();
-  db->options = rocksdb_options_create();
-  db->writeoptions = rocksdb_writeoptions_create();
-  db->readoptions = rocksdb_readoptions_create();
-
-  rocksdb_options_increase_parallelism(db->options, c->parallelism);
-  rocksdb_options_optimize_level_style_compaction(db->options, c->membudget);
-  rocksdb_options_set_create_if_missing(db->options, 1);
-  rocksdb_options_set_max_log_file_size(db->options, c->max_log_file_size);
-  rocksdb_options_set_keep_log_file_num(db->options, c->keep_log_file_num);
-  rocksdb_options_set_max_open_files(db->options, c->max_open_files);
-  rocksdb_options_set_merge_operator(db->options, db->mergeop);
-  rocksdb_options_set_compression_per_level(db->options, level_compression, 5);
-
-  db->db = rocksdb_open(db->options, c->path, &err);
+  rocksdb_wal_iterator_t* it =
+      rocksdb_get_updates_since(db->db, *seq, NULL, &err);
   if(err != NULL) {
-    L(log_error("rocksdb_open() failed: `%s`", err));
-    rocksdb_options_destroy(db->options);
-    rocksdb_mergeoperator_destroy(db->mergeop);
-    rocksdb_writeoptions_destroy(db->writeoptions);
-    rocksdb_readoptions_destroy(db->readoptions);
+    L(log_error("rocksdb_get_updates_since() failed: `%s`", err));
     free(err);
-    blb_free(db);
-    return (NULL);
+    return (-1);
   }
 
-  V(log_debug("rocksdb at %p", db));
+  int rc = 0;
+  for(; rocksdb_wal_iter_valid(it) != (unsigned char)0;
+      rocksdb_wal_iter_next(it)) {
+    uint64_t batch_seq = 0;
+    rocksdb_writebatch_t* wb = rocksdb_wal_iter_get_batch(it, &batch_seq);
+    uint64_t next = batch_seq + (uint64_t)rocksdb_writebatch_count(wb);
+    // the first batch may start before the requested sequence number
+    if(next <= *seq) {
+      rocksdb_writebatch_destroy(wb);
+      continue;
+    }
+    if(batch_seq > *seq) {
+      L(log_warn(
+          "sequence gap `%" PRIu64 "` to `%" PRIu64 "`; writes that bypassed "
+          "the write ahead log are not replicated",
+          *seq,
+          batch_seq));
+    }
+    protocol_replicate_batch_t b = {
+        .seq = batch_seq, .latest = latest, .data = NULL, .data_len = 0};
+    b.data = rocksdb_writebatch_data(wb, &b.data_len);
+    int wr_ok = blb_conn_replicate_batch(th, &b);
+    rocksdb_writebatch_destroy(wb);
+    if(wr_ok != 0) {
+      rc = -2;
+      break;
+    }
+    *seq = next;
+  }
 
-  return ((db_t*)db);
+  if(rc == 0) {
+    rocksdb_wal_iter_status(it, &err);
+    if(err != NULL) {
+      L(log_error("write ahead log iterator error `%s`", err));
+      free(err);
+      rc = -1;
+    }
+  }
+  rocksdb_wal_iter_destroy(it);
+  return (rc);
+}
+
+static int blb_rocksdb_replicate(
+    conn_t* th, const protocol_replicate_request_t* r) {
+  ASSERT(th->db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
+  if(db->secondary || db->follower) {
+    L(log_error("replication rejected: not a primary instance"));
+    return (-1);
+  }
+  // write batches refer to column families by id, which are local to a
+  // database
+  pthread_rwlock_rdlock(&db->cfs_lock);
+  bool families = db->sensor_families || db->cfs_len > 1;
+  pthread_rwlock_unlock(&db->cfs_lock);
+  if(families) {
+    L(log_error("replication rejected: sensor column families in use"));
+    return (-1);
+  }
+
+  atomic_fetch_add(&db->replicas, 1);
+  uint64_t seq = r->since > 0 ? r->since : 1;
+  int idle = 0;
+  int rc = 0;
+  while(rc == 0) {
+    uint64_t latest = rocksdb_get_latest_sequence_number(db->db);
+    if(seq <= latest) {
+      uint64_t from = seq;
+      rc = blb_rocksdb_replicate_tail(th, db, &seq, latest);
+      if(seq != from) {
+        idle = 0;
+        continue;
+      }
+    }
+    if(rc != 0) { break; }
+    // the tail of the log is reached; tell the follower how far the leader
+    // is every now and then so it can report its lag
+    if(idle++ % ROCKSDB_REPLICATE_HEARTBEAT == 0) {
+      protocol_replicate_batch_t b = {
+          .seq = seq, .latest = latest, .data = NULL, .data_len = 0};
+      if(blb_conn_replicate_batch(th, &b) != 0) { rc = -2; }
+    }
+    usleep(ROCKSDB_REPLICATE_POLL_MS * 1000);
+  }
+  atomic_fetch_sub(&db->replicas, 1);
+
+  if(rc == -1) {
+    L(log_error(
+        "unable to replicate from sequence `%" PRIu64 "`; the follower has to "
+        "be reseeded from a backup",
+        seq));
+    return (-1);
+  }
+  V(log_notice("follower left at sequence `%" PRIu64 "`", seq));
+  return (0);
+}
+
+static const struct {
+  const char* name;
+  int type;
+} blb_rocksdb_compressions[] = {
+    {"none", rocksdb_no_compression},
+    {"snappy", rocksdb_snappy_compression},
+    {"zlib", rocksdb_zlib_compression},
+    {"lz4", rocksdb_lz4_compression},
+    {"lz4hc", rocksdb_lz4hc_compression},
+    {"zstd", rocksdb_zstd_compression},
+};
+
+#define ROCKSDB_COMPRESSIONS \
+  (sizeof(blb_rocksdb_compressions) / sizeof(blb_rocksdb_compressions[0]))
+
+static const char* blb_rocksdb_compression_name(int type) {
+  for(size_t i = 0; i < ROCKSDB_COMPRESSIONS; i++) {
+    if(blb_rocksdb_compressions[i].type == type) {
+      return (blb_rocksdb_compressions[i].name);
+    }
+  }
+  return ("unknown");
+}
+
+// parses a comma separated list of per level compression names
+static int blb_rocksdb_compression_parse(
+    const char* spec, int* types, int types_max) {
+  int n = 0;
+  const char* p = spec;
+  while(*p != '\0') {
+    const char* end = strchr(p, ',');
+    size_t len = end != NULL ? (size_t)(end - p) : strlen(p);
+    size_t i = 0;
+    for(; i < ROCKSDB_COMPRESSIONS; i++) {
+      const char* name = blb_rocksdb_compressions[i].name;
+      if(strlen(name) == len && strncmp(name, p, len) == 0) { break; }
+    }
+    if(i == ROCKSDB_COMPRESSIONS || n == types_max) { return (-1); }
+    types[n++] = blb_rocksdb_compressions[i].type;
+    if(end == NULL) { break; }
+    p = end + 1;
+  }
+  return (n > 0 ? n : -1);
+}
+
+static int blb_rocksdb_info_compression(conn_t* th, blb_rocksdb_t* db) {
+  uint64_t files[ROCKSDB_LEVELS_MAX] = {0};
+  uint64_t bytes[ROCKSDB_LEVELS_MAX] = {0};
+  const rocksdb_livefiles_t* lf = rocksdb_livefiles(db->db);
+  for(int i = 0; lf != NULL && i < rocksdb_livefiles_count(lf); i++) {
+    int level = rocksdb_livefiles_level(lf, i);
+    if(level < 0 || level >= ROCKSDB_LEVELS_MAX) { continue; }
+    files[level] += 1;
+    bytes[level] += rocksdb_livefiles_size(lf, i);
+  }
+  if(lf != NULL) { rocksdb_livefiles_destroy(lf); }
+
+  char text[2048];
+  size_t used = 0;
+  int sz = snprintf(
+      text,
+      sizeof(text),
+      "%-5s %8s %16s %-6s %s\n",
+      "level",
+      "files",
+      "bytes",
+      "codec",
+      "ratio");
+  if(sz > 0) { used += sz; }
+  for(int level = 0; level < ROCKSDB_LEVELS_MAX; level++) {
+    int type = db->compression[blb_rocksdb_min(level, db->compression_len - 1)];
+    char prop[64];
+    (void)snprintf(
+        prop, sizeof(prop), "rocksdb.compression-ratio-at-level%d", level);
+    char* ratio = rocksdb_property_value(db->db, prop);
+    double r_val = ratio != NULL ? atof(ratio) : -1.0;
+    free(ratio);
+    char r_str[32] = "-";
+    if(files[level] > 0 && r_val > 0.0) {
+      (void)snprintf(r_str, sizeof(r_str), "%.2f", r_val);
+    }
+    sz = snprintf(
+        text + used,
+        sizeof(text) - used,
+        "%-5d %8" PRIu64 " %16" PRIu64 " %-6s %s\n",
+        level,
+        files[level],
+        bytes[level],
+        blb_rocksdb_compression_name(type),
+        r_str);
+    if(sz <= 0 || (size_t)sz >= sizeof(text) - used) { break; }
+    used += sz;
+  }
+  return (blb_conn_info_response(th, text, used));
+}
+
+static int blb_rocksdb_info_sensors(conn_t* th, blb_rocksdb_t* db) {
+  blb_rocksdb_cf_t* cfs[ROCKSDB_CFS_MAX];
+  int n = blb_rocksdb_cf_query(db, NULL, 0, cfs);
+  size_t text_sz = 128;
+  for(int i = 0; i < n; i++) { text_sz += cfs[i]->sensorid_len + 64; }
+  char* text = blb_malloc(text_sz);
+  if(text == NULL) {
+    blb_rocksdb_cf_release(cfs, n);
+    return (-1);
+  }
+
+  size_t used = 0;
+  int sz = snprintf(
+      text, text_sz, "%-24s %16s %16s\n", "sensor", "keys", "bytes");
+  if(sz > 0) { used += sz; }
+  for(int i = 0; i < n; i++) {
+    const blb_rocksdb_cf_t* cf = cfs[i];
+    char* keys = rocksdb_property_value_cf(
+        db->db, cf->handle, "rocksdb.estimate-num-keys");
+    char* bytes = rocksdb_property_value_cf(
+        db->db, cf->handle, "rocksdb.total-sst-files-size");
+    sz = snprintf(
+        text + used,
+        text_sz - used,
+        "%-24.*s %16s %16s\n",
+        cf->sensorid_len > 0 ? (int)cf->sensorid_len : 9,
+        cf->sensorid_len > 0 ? cf->sensorid : "(default)",
+        keys != NULL ? keys : "-",
+        bytes != NULL ? bytes : "-");
+    free(keys);
+    free(bytes);
+    if(sz <= 0 || (size_t)sz >= text_sz - used) { break; }
+    used += sz;
+  }
+  blb_rocksdb_cf_release(cfs, n);
+  int rc = blb_conn_info_response(th, text, used);
+  blb_free(text);
+  return (rc);
+}
+
+static int blb_rocksdb_info(conn_t* th, const protocol_info_request_t* r) {
+  ASSERT(th->db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
+  if(r->topic_len == strlen("compression")
+     && strncmp(r->topic, "compression", r->topic_len) == 0) {
+    return (blb_rocksdb_info_compression(th, db));
+  }
+  if(r->topic_len == strlen("sensors")
+     && strncmp(r->topic, "sensors", r->topic_len) == 0) {
+    return (blb_rocksdb_info_sensors(th, db));
+  }
+  return (-1);
+}
+
+// sums up the table files in `dir`
+static int blb_rocksdb_path_usage(
+    const char* dir, uint64_t* bytes, uint64_t* files) {
+  *bytes = 0;
+  *files = 0;
+  DIR* d = opendir(dir);
+  if(d == NULL) { return (-1); }
+  struct dirent* ent;
+  while((ent = readdir(d)) != NULL) {
+    size_t len = strlen(ent->d_name);
+    if(len < 4 || strcmp(ent->d_name + len - 4, ".sst") != 0) { continue; }
+    char path[PATH_MAX];
+    int sz = snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    if(sz <= 0 || (size_t)sz >= sizeof(path)) { continue; }
+    struct stat st;
+    // compactions delete files while we are looking
+    if(stat(path, &st) != 0) { continue; }
+    *bytes += (uint64_t)st.st_size;
+    *files += 1;
+  }
+  closedir(d);
+  return (0);
+}
+
+static void blb_rocksdb_stats(db_t* _db) {
+  ASSERT(_db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)_db;
+  unsigned long long puts = atomic_exchange(&db->inv_puts, 0);
+  unsigned long long skips = atomic_exchange(&db->inv_skips, 0);
+  unsigned long long total = puts + skips;
+  L(log_notice(
+      "inverted index puts `%llu` skipped `%llu` skip rate `%.1f%%`",
+      puts,
+      skips,
+      total > 0 ? 100.0 * (double)skips / (double)total : 0.0));
+  if(db->secondary) {
+    L(log_notice(
+        "secondary catch-ups `%llu` sequence `%llu`",
+        atomic_exchange(&db->catchups, 0),
+        atomic_load(&db->sequence)));
+  }
+  if(db->follower) {
+    unsigned long long next = atomic_load(&db->sequence);
+    unsigned long long latest = atomic_load(&db->follow_latest);
+    L(log_notice(
+        "follower batches `%llu` sequence `%llu` leader `%llu` lag `%llu`",
+        atomic_exchange(&db->follow_batches, 0),
+        next,
+        latest,
+        latest >= next ? latest - next + 1 : 0));
+  } else if(atomic_load(&db->replicas) > 0) {
+    L(log_notice("replication followers `%d`", atomic_load(&db->replicas)));
+  }
+  if(db->filter != NULL) {
+    double fill = blb_bloom_fill(db->filter);
+    double fpr = 1.0;
+    for(int i = 0; i < db->filter->k; i++) { fpr *= fill; }
+    L(log_notice(
+        "existence filter %s negatives `%llu` fill `%.1f%%` fpr `%.4f`",
+        atomic_load(&db->filter_ready) > 0 ? "ready" : "rebuilding",
+        atomic_exchange(&db->filter_negatives, 0),
+        100.0 * fill,
+        fpr));
+  }
+  if(db->cache != NULL) {
+    L(log_notice(
+        "block cache used `%zu` capacity `%zu` memtables `%zu`",
+        rocksdb_cache_get_usage(db->cache),
+        rocksdb_cache_get_capacity(db->cache),
+        rocksdb_write_buffer_manager_memory_usage(db->wbm)));
+  }
+  pthread_rwlock_rdlock(&db->cfs_lock);
+  int families = db->cfs_len - 1;
+  pthread_rwlock_unlock(&db->cfs_lock);
+  if(families > 0 || db->sensor_families) {
+    L(log_notice(
+        "sensor column families `%d` purges `%llu`",
+        families,
+        atomic_load(&db->purges)));
+  }
+  for(int i = 0; i < db->db_paths_len; i++) {
+    const blb_rocksdb_db_path_t* p = &db->db_paths[i];
+    uint64_t bytes = 0, files = 0;
+    if(blb_rocksdb_path_usage(p->path, &bytes, &files) != 0) {
+      L(log_warn("unable to read table files path `%s`", p->path));
+      continue;
+    }
+    L(log_notice(
+        "table files path `%s` files `%" PRIu64 "` size `%" PRIu64
+        "` target `%" PRIu64 "` usage `%.1f%%`",
+        p->path,
+        files,
+        bytes,
+        p->target_size,
+        p->target_size > 0 ? 100.0 * (double)bytes / (double)p->target_size
+                           : 0.0));
+  }
+}
+
+static size_t blb_rocksdb_inv_cache_warmup_cf(
+    blb_rocksdb_t* db,
+    rocksdb_readoptions_t* readoptions,
+    blb_rocksdb_cf_t* cf) {
+  rocksdb_iterator_t* it =
+      rocksdb_create_iterator_cf(db->db, readoptions, cf->handle);
+  size_t keys = 0;
+  rocksdb_iter_seek(it, "i", 1);
+  for(; rocksdb_iter_valid(it) != (unsigned char)0; rocksdb_iter_next(it)) {
+    if(atomic_load(&db->inv_cache_warmup_stop) > 0) { break; }
+    // keys of a purged sensor must not make it back into the cache
+    if(atomic_load(&cf->dropped) > 0) { break; }
+    size_t key_len = 0;
+    const char* key = rocksdb_iter_key(it, &key_len);
+    if(key == NULL || key_len < 1 || key[0] != 'i') { break; }
+    blb_keycache_insert(
+        db->inv_cache,
+        blb_hash64(key, key_len, ROCKSDB_INV_CACHE_SEED ^ cf->h));
+    keys += 1;
+  }
+  char* err = NULL;
+  rocksdb_iter_get_error(it, &err);
+  if(err != NULL) {
+    L(log_error("iterator error `%s`", err));
+    free(err);
+  }
+  rocksdb_iter_destroy(it);
+  return (keys);
+}
+
+static void* blb_rocksdb_inv_cache_warmup(void* usr) {
+  blb_rocksdb_t* db = usr;
+  V(log_info("inverted index cache warmup started"));
+  rocksdb_readoptions_t* readoptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_fill_cache(readoptions, 0);
+  size_t keys = 0;
+  blb_rocksdb_cf_t* cfs[ROCKSDB_CFS_MAX];
+  int n = blb_rocksdb_cf_query(db, NULL, 0, cfs);
+  for(int i = 0; i < n; i++) {
+    keys += blb_rocksdb_inv_cache_warmup_cf(db, readoptions, cfs[i]);
+  }
+  blb_rocksdb_cf_release(cfs, n);
+  rocksdb_readoptions_destroy(readoptions);
+  L(log_notice("inverted index cache warmed up with `%zu` keys", keys));
+  return (NULL);
+}
+
+// rrname of `o\x1f<rrname>\x1f<sensorid>\x1f<rrtype>\x1f<rdata>`
+static inline int blb_rocksdb_key_rrname(
+    const char* key, size_t key_len, const char** p, size_t* p_len) {
+  const char* end = memchr(key + 2, '\x1f', key_len - 2);
+  if(end == NULL) { return (-1); }
+  *p = key + 2;
+  *p_len = end - *p;
+  return (0);
+}
+
+// rdata of `i\x1f<rdata>\x1f<sensorid>\x1f<rrname>\x1f<rrtype>`; the rdata
+// may contain the separator itself, so split from the end
+static inline int blb_rocksdb_key_rdata(
+    const char* key, size_t key_len, const char** p, size_t* p_len) {
+  size_t end = key_len;
+  for(int seps = 0; seps < 3; seps++) {
+    while(end > 2 && key[end - 1] != '\x1f') { end--; }
+    if(end <= 2) { return (-1); }
+    end--;
+  }
+  *p = key + 2;
+  *p_len = end - 2;
+  return (0);
+}
+
+// sensor id of an `o` or an `i` key
+static inline int blb_rocksdb_key_sensorid(
+    const char* key, size_t key_len, const char** p, size_t* p_len) {
+  if(key_len < 3 || key[1] != '\x1f') { return (-1); }
+  if(key[0] == 'o') {
+    const char* rrname = NULL;
+    size_t rrname_len = 0;
+    if(blb_rocksdb_key_rrname(key, key_len, &rrname, &rrname_len) != 0) {
+      return (-1);
+    }
+    const char* start = rrname + rrname_len + 1;
+    const char* end = memchr(start, '\x1f', key + key_len - start);
+    if(end == NULL) { return (-1); }
+    *p = start;
+    *p_len = end - start;
+    return (0);
+  }
+  if(key[0] == 'i') {
+    const char* rdata = NULL;
+    size_t rdata_len = 0;
+    if(blb_rocksdb_key_rdata(key, key_len, &rdata, &rdata_len) != 0) {
+      return (-1);
+    }
+    const char* start = rdata + rdata_len + 1;
+    const char* end = memchr(start, '\x1f', key + key_len - start);
+    if(end == NULL) { return (-1); }
+    *p = start;
+    *p_len = end - start;
+    return (0);
+  }
+  return (-1);
+}
+
+// deletes the keys of a sensor from the default family, where they end up
+// when written before the sensor got a family of its own; this has to look
+// at every key
+static int blb_rocksdb_purge_scan(
+    blb_rocksdb_t* db, const char* sensorid, size_t sensorid_len) {
+  rocksdb_readoptions_t* readoptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_fill_cache(readoptions, 0);
+  rocksdb_iterator_t* it = rocksdb_create_iterator(db->db, readoptions);
+  rocksdb_writebatch_t* wb = rocksdb_writebatch_create();
+  char* err = NULL;
+  int rc = 0;
+  rocksdb_iter_seek_to_first(it);
+  for(; rocksdb_iter_valid(it) != (unsigned char)0 && err == NULL;
+      rocksdb_iter_next(it)) {
+    if(atomic_load(&db->purge_stop) > 0) {
+      L(log_warn("purge interrupted"));
+      rc = -1;
+      break;
+    }
+    size_t key_len = 0;
+    const char* key = rocksdb_iter_key(it, &key_len);
+    const char* p = NULL;
+    size_t p_len = 0;
+    if(key == NULL || blb_rocksdb_key_sensorid(key, key_len, &p, &p_len) != 0
+       || p_len != sensorid_len || memcmp(p, sensorid, p_len) != 0) {
+      continue;
+    }
+    rocksdb_writebatch_delete(wb, key, key_len);
+    atomic_fetch_add(&db->purge_deleted, 1);
+    if(rocksdb_writebatch_count(wb) >= ROCKSDB_PURGE_BATCH) {
+      rocksdb_write(db->db, db->writeoptions, wb, &err);
+      rocksdb_writebatch_clear(wb);
+    }
+  }
+  if(err == NULL && rocksdb_writebatch_count(wb) > 0) {
+    rocksdb_write(db->db, db->writeoptions, wb, &err);
+  }
+  if(err != NULL) {
+    L(log_error("rocksdb_write() failed: `%s`", err));
+    free(err);
+    rc = -1;
+  }
+  err = NULL;
+  rocksdb_iter_get_error(it, &err);
+  if(err != NULL) {
+    L(log_error("iterator error `%s`", err));
+    free(err);
+    rc = -1;
+  }
+  rocksdb_writebatch_destroy(wb);
+  rocksdb_iter_destroy(it);
+  rocksdb_readoptions_destroy(readoptions);
+  return (rc);
+}
+
+// the purge thread: drops the sensor's family, then scans the default one
+static void* blb_rocksdb_purge_run(void* usr) {
+  blb_rocksdb_t* db = usr;
+  const char* sensorid = db->purge_sensorid;
+  size_t sensorid_len = db->purge_sensorid_len;
+
+  // out of the registry the family gets no new users; those holding it
+  // finish on the handle, which stays valid after the drop
+  blb_rocksdb_cf_t* cf = NULL;
+  pthread_rwlock_wrlock(&db->cfs_lock);
+  int i = blb_rocksdb_cf_find(db, sensorid, sensorid_len);
+  if(i > 0) {
+    cf = db->cfs[i];
+    db->cfs[i] = db->cfs[db->cfs_len - 1];
+    db->cfs_len -= 1;
+  }
+  pthread_rwlock_unlock(&db->cfs_lock);
+
+  int rc = 0;
+  if(cf != NULL) {
+    atomic_store(&cf->dropped, 1);
+    char* err = NULL;
+    rocksdb_drop_column_family(db->db, cf->handle, &err);
+    if(err != NULL) {
+      L(log_error("rocksdb_drop_column_family() failed: `%s`", err));
+      free(err);
+      atomic_store(&cf->dropped, 0);
+      pthread_rwlock_wrlock(&db->cfs_lock);
+      db->cfs[db->cfs_len] = cf;
+      db->cfs_len += 1;
+      pthread_rwlock_unlock(&db->cfs_lock);
+      rc = -1;
+    } else {
+      blb_rocksdb_cf_unref(cf);
+    }
+  }
+
+  // cached inverted keys of the sensor would keep them from being rewritten,
+  // both those cached before the scan deletes them and those put during it
+  if(db->inv_cache != NULL) { blb_keycache_clear(db->inv_cache); }
+  if(rc == 0) { rc = blb_rocksdb_purge_scan(db, sensorid, sensorid_len); }
+  if(db->inv_cache != NULL) { blb_keycache_clear(db->inv_cache); }
+  // cached query results may still list the purged entries
+  blb_qcache_invalidate_all();
+  if(rc == 0) { atomic_fetch_add(&db->purges, 1); }
+  db->purge_rc = rc;
+  db->purge_dropped = cf != NULL && rc == 0;
+  atomic_store(&db->purge_done, 1);
+  return (NULL);
+}
+
+// the purge's progress, or its result once it is done
+static int blb_rocksdb_purge_text(blb_rocksdb_t* db, char* text, size_t sz) {
+  if(atomic_load(&db->purge_done) == 0) {
+    return (snprintf(
+        text,
+        sz,
+        "sensor `%.*s`: purge running for `%ld` seconds, `%llu` keys "
+        "deleted from the default column family so far\n",
+        (int)db->purge_sensorid_len,
+        db->purge_sensorid,
+        (long)(time(NULL) - db->purge_start),
+        atomic_load(&db->purge_deleted)));
+  }
+  return (snprintf(
+      text,
+      sz,
+      "sensor `%.*s`: column family %s, `%llu` keys deleted from the "
+      "default column family\n",
+      (int)db->purge_sensorid_len,
+      db->purge_sensorid,
+      db->purge_dropped ? "dropped" : "not present",
+      atomic_load(&db->purge_deleted)));
+}
+
+// purges run in the background, the request is answered right away: the
+// first one starts it, a repeated one reports its progress and, once it is
+// done, its result
+static int blb_rocksdb_purge(conn_t* th, const protocol_purge_request_t* r) {
+  ASSERT(th->db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
+  if(db->secondary || db->follower) {
+    L(log_error("purge rejected: not a primary instance"));
+    return (-1);
+  }
+  if(r->sensorid_len == 0 || r->sensorid_len > ROCKSDB_PURGE_SENSORID_MAX) {
+    L(log_error("purge rejected: no or too long sensor id"));
+    return (-1);
+  }
+
+  char text[512];
+  int sz = 0;
+  int rc = 0;
+  pthread_mutex_lock(&db->purge_lock);
+  bool done = atomic_load(&db->purge_done) > 0;
+  bool same = db->purge_running && db->purge_sensorid_len == r->sensorid_len
+              && memcmp(db->purge_sensorid, r->sensorid, r->sensorid_len) == 0;
+  if(same) {
+    sz = blb_rocksdb_purge_text(db, text, sizeof(text));
+    if(done) {
+      pthread_join(db->purge, NULL);
+      db->purge_running = false;
+      rc = db->purge_rc;
+      if(rc == 0) { L(log_notice("%.*s", sz - 1, text)); }
+    }
+  } else if(db->purge_running && !done) {
+    L(log_error(
+        "purge rejected: sensor `%.*s` is still being purged",
+        (int)db->purge_sensorid_len,
+        db->purge_sensorid));
+    rc = -1;
+  } else {
+    if(db->purge_running) {
+      // the result of the previous purge was never picked up
+      pthread_join(db->purge, NULL);
+      db->purge_running = false;
+    }
+    // the warmup reads the keys being deleted and would put them back into
+    // the cache the purge clears; it stops for good, inputs warm it instead
+    if(db->inv_cache_warmup_running) {
+      atomic_store(&db->inv_cache_warmup_stop, 1);
+      pthread_join(db->inv_cache_warmup, NULL);
+      db->inv_cache_warmup_running = false;
+    }
+    memcpy(db->purge_sensorid, r->sensorid, r->sensorid_len);
+    db->purge_sensorid_len = r->sensorid_len;
+    db->purge_start = time(NULL);
+    db->purge_rc = 0;
+    db->purge_dropped = false;
+    atomic_store(&db->purge_done, 0);
+    atomic_store(&db->purge_deleted, 0);
+    if(blb_rocksdb_thread_start(&db->purge, blb_rocksdb_purge_run, db) != 0) {
+      L(log_error("unable to start purge thread"));
+      rc = -1;
+    } else {
+      db->purge_running = true;
+      sz = snprintf(
+          text,
+          sizeof(text),
+          "sensor `%.*s`: purge started; repeat the request for its "
+          "progress\n",
+          (int)r->sensorid_len,
+          r->sensorid);
+      L(log_notice("%.*s", sz - 1, text));
+    }
+  }
+  pthread_mutex_unlock(&db->purge_lock);
+  if(rc != 0) { return (-1); }
+  if(sz <= 0 || (size_t)sz >= sizeof(text)) { return (-1); }
+  return (blb_conn_info_response(th, text, sz));
+}
+
+// index verification: every `o` key needs its `i` partner and the other way
+// around. the `o` and `i` key spaces of every family are cut into ranges by
+// the first byte past the prefix, which worker threads take on one after
+// the other. the partner keys derived from a range are sorted batch by batch
+// and merge joined against an iterator over the other key space: it seeks
+// once per batch and then steps forward, seeking again only across larger
+// gaps; everything reads from one snapshot
+
+typedef struct blb_rocksdb_verify_key_t blb_rocksdb_verify_key_t;
+struct blb_rocksdb_verify_key_t {
+  // the derived partner key and the key it was derived from
+  const char* partner;
+  const char* key;
+  size_t len;
+};
+
+typedef struct blb_rocksdb_verify_batch_t blb_rocksdb_verify_batch_t;
+struct blb_rocksdb_verify_batch_t {
+  size_t n;
+  size_t used;
+  blb_rocksdb_verify_key_t keys[ROCKSDB_VERIFY_BATCH_KEYS];
+  char buf[ROCKSDB_VERIFY_BATCH_BYTES];
+};
+
+typedef struct blb_rocksdb_verify_t blb_rocksdb_verify_t;
+struct blb_rocksdb_verify_t {
+  blb_rocksdb_t* db;
+  bool repair;
+  blb_rocksdb_cf_t* cfs[ROCKSDB_CFS_MAX];
+  int cfs_len;
+  rocksdb_readoptions_t* readoptions;
+  atomic_int next;
+  atomic_int failed;
+  atomic_ullong o_keys;
+  atomic_ullong i_keys;
+  atomic_ullong missing;
+  atomic_ullong orphaned;
+  atomic_ullong repaired;
+  pthread_mutex_t lock;
+  char examples[ROCKSDB_VERIFY_EXAMPLES][ROCKSDB_VERIFY_EXAMPLE_SZ];
+  int examples_len;
+};
+
+// writes the partner of an `o` or an `i` key to `p`, which has the same
+// length
+static int blb_rocksdb_verify_partner(
+    const char* key, size_t key_len, char* p) {
+  const char *rrname = NULL, *sensorid = NULL, *rrtype = NULL, *rdata = NULL;
+  size_t rrname_len = 0, sensorid_len = 0, rrtype_len = 0, rdata_len = 0;
+  if(blb_rocksdb_key_sensorid(key, key_len, &sensorid, &sensorid_len) != 0) {
+    return (-1);
+  }
+  const char* end = key + key_len;
+  const char* rest = sensorid + sensorid_len + 1;
+  if(key[0] == 'o') {
+    // `o\x1f<rrname>\x1f<sensorid>\x1f<rrtype>\x1f<rdata>`
+    (void)blb_rocksdb_key_rrname(key, key_len, &rrname, &rrname_len);
+    const char* sep = memchr(rest, '\x1f', end - rest);
+    if(sep == NULL) { return (-1); }
+    rrtype = rest;
+    rrtype_len = sep - rest;
+    rdata = sep + 1;
+    rdata_len = end - rdata;
+    *p++ = 'i';
+    *p++ = '\x1f';
+    p = mempcpy(p, rdata, rdata_len);
+    *p++ = '\x1f';
+    p = mempcpy(p, sensorid, sensorid_len);
+    *p++ = '\x1f';
+    p = mempcpy(p, rrname, rrname_len);
+    *p++ = '\x1f';
+    (void)mempcpy(p, rrtype, rrtype_len);
+  } else {
+    // `i\x1f<rdata>\x1f<sensorid>\x1f<rrname>\x1f<rrtype>`
+    (void)blb_rocksdb_key_rdata(key, key_len, &rdata, &rdata_len);
+    const char* sep = memchr(rest, '\x1f', end - rest);
+    if(sep == NULL) { return (-1); }
+    rrname = rest;
+    rrname_len = sep - rest;
+    rrtype = sep + 1;
+    rrtype_len = end - rrtype;
+    *p++ = 'o';
+    *p++ = '\x1f';
+    p = mempcpy(p, rrname, rrname_len);
+    *p++ = '\x1f';
+    p = mempcpy(p, sensorid, sensorid_len);
+    *p++ = '\x1f';
+    p = mempcpy(p, rrtype, rrtype_len);
+    *p++ = '\x1f';
+    (void)mempcpy(p, rdata, rdata_len);
+  }
+  return (0);
+}
+
+// bytewise, like the rocksdb default comparator
+static inline int blb_rocksdb_verify_cmp(
+    const char* a, size_t a_len, const char* b, size_t b_len) {
+  int c = memcmp(a, b, blb_rocksdb_min(a_len, b_len));
+  if(c != 0) { return (c); }
+  return (a_len < b_len ? -1 : (a_len > b_len ? 1 : 0));
+}
+
+static int blb_rocksdb_verify_key_cmp(const void* _a, const void* _b) {
+  const blb_rocksdb_verify_key_t* a = _a;
+  const blb_rocksdb_verify_key_t* b = _b;
+  return (blb_rocksdb_verify_cmp(a->partner, a->len, b->partner, b->len));
+}
+
+static void blb_rocksdb_verify_example(
+    blb_rocksdb_verify_t* v, const char* what, const char* key, size_t len) {
+  pthread_mutex_lock(&v->lock);
+  if(v->examples_len < ROCKSDB_VERIFY_EXAMPLES) {
+    char* p = v->examples[v->examples_len++];
+    int sz = snprintf(p, ROCKSDB_VERIFY_EXAMPLE_SZ, "%s `", what);
+    size_t used = sz > 0 ? (size_t)sz : 0;
+    for(size_t i = 0; i < len && used < ROCKSDB_VERIFY_EXAMPLE_SZ - 2; i++) {
+      char c = key[i];
+      p[used++] = c == '\x1f' ? ' ' : (c < ' ' || c > '~' ? '.' : c);
+    }
+    p[used++] = '`';
+    p[used] = '\0';
+  }
+  pthread_mutex_unlock(&v->lock);
+}
+
+static int blb_rocksdb_verify_join(
+    blb_rocksdb_verify_t* v,
+    blb_rocksdb_verify_batch_t* b,
+    blb_rocksdb_cf_t* cf,
+    rocksdb_iterator_t* probe,
+    char side) {
+  qsort(b->keys, b->n, sizeof(b->keys[0]), blb_rocksdb_verify_key_cmp);
+  rocksdb_writebatch_t* wb = v->repair ? rocksdb_writebatch_create() : NULL;
+  uint64_t mismatches = 0;
+  if(b->n > 0) { rocksdb_iter_seek(probe, b->keys[0].partner, b->keys[0].len); }
+  for(size_t k = 0; k < b->n; k++) {
+    const blb_rocksdb_verify_key_t* want = &b->keys[k];
+    int c = 1;
+    int nexts = 0;
+    while(rocksdb_iter_valid(probe) != (unsigned char)0) {
+      size_t cur_len = 0;
+      const char* cur = rocksdb_iter_key(probe, &cur_len);
+      c = blb_rocksdb_verify_cmp(cur, cur_len, want->partner, want->len);
+      if(c >= 0) { break; }
+      if(nexts++ < ROCKSDB_VERIFY_JOIN_NEXTS) {
+        rocksdb_iter_next(probe);
+      } else {
+        rocksdb_iter_seek(probe, want->partner, want->len);
+        nexts = 0;
+      }
+      c = 1;
+    }
+    if(c == 0) {
+      // the keys of a batch are distinct, the next one is further on
+      rocksdb_iter_next(probe);
+      continue;
+    }
+
+    mismatches += 1;
+    if(side == 'o') {
+      blb_rocksdb_verify_example(v, "missing i key for", want->key, want->len);
+      if(wb != NULL) {
+        rocksdb_writebatch_put_cf(
+            wb, cf->handle, want->partner, want->len, "", 0);
+      }
+    } else {
+      blb_rocksdb_verify_example(v, "orphaned", want->key, want->len);
+      if(wb != NULL) {
+        rocksdb_writebatch_delete_cf(wb, cf->handle, want->key, want->len);
+      }
+    }
+  }
+  atomic_fetch_add(side == 'o' ? &v->missing : &v->orphaned, mismatches);
+
+  int rc = 0;
+  if(wb != NULL && rocksdb_writebatch_count(wb) > 0) {
+    char* err = NULL;
+    rocksdb_write(v->db->db, v->db->writeoptions, wb, &err);
+    if(err != NULL) {
+      L(log_error("rocksdb_write() failed: `%s`", err));
+      free(err);
+      rc = -1;
+    } else {
+      atomic_fetch_add(&v->repaired, mismatches);
+    }
+  }
+  if(wb != NULL) { rocksdb_writebatch_destroy(wb); }
+  b->n = 0;
+  b->used = 0;
+  return (rc);
+}
+
+// checks the keys of `side` starting with `byte` in one family
+static int blb_rocksdb_verify_range(
+    blb_rocksdb_verify_t* v,
+    blb_rocksdb_verify_batch_t* b,
+    blb_rocksdb_cf_t* cf,
+    char side,
+    unsigned char byte) {
+  rocksdb_t* rdb = v->db->db;
+  rocksdb_iterator_t* it =
+      rocksdb_create_iterator_cf(rdb, v->readoptions, cf->handle);
+  rocksdb_iterator_t* probe =
+      rocksdb_create_iterator_cf(rdb, v->readoptions, cf->handle);
+  const char lower[3] = {side, '\x1f', (char)byte};
+  uint64_t keys = 0;
+  int rc = 0;
+  b->n = 0;
+  b->used = 0;
+  rocksdb_iter_seek(it, lower, sizeof(lower));
+  for(; rc == 0 && rocksdb_iter_valid(it) != (unsigned char)0;
+      rocksdb_iter_next(it)) {
+    size_t key_len = 0;
+    const char* key = rocksdb_iter_key(it, &key_len);
+    if(key == NULL || key_len < 3 || memcmp(key, lower, 3) != 0) { break; }
+    keys += 1;
+    if(key_len * 2 > ROCKSDB_VERIFY_BATCH_BYTES) { continue; }
+    if(b->n == ROCKSDB_VERIFY_BATCH_KEYS
+       || b->used + key_len * 2 > ROCKSDB_VERIFY_BATCH_BYTES) {
+      rc = blb_rocksdb_verify_join(v, b, cf, probe, side);
+    }
+    blb_rocksdb_verify_key_t* k = &b->keys[b->n];
+    char* partner = b->buf + b->used;
+    if(blb_rocksdb_verify_partner(key, key_len, partner) != 0) {
+      X(log_debug("invalid key `%.*s`", (int)key_len, key));
+      continue;
+    }
+    k->partner = partner;
+    k->key = memcpy(partner + key_len, key, key_len);
+    k->len = key_len;
+    b->n += 1;
+    b->used += key_len * 2;
+  }
+  if(rc == 0 && b->n > 0) {
+    rc = blb_rocksdb_verify_join(v, b, cf, probe, side);
+  }
+  char* err = NULL;
+  rocksdb_iter_get_error(it, &err);
+  if(err != NULL) {
+    L(log_error("iterator error `%s`", err));
+    free(err);
+    rc = -1;
+  }
+  rocksdb_iter_destroy(probe);
+  rocksdb_iter_destroy(it);
+  atomic_fetch_add(side == 'o' ? &v->o_keys : &v->i_keys, keys);
+  return (rc);
+}
+
+static void* blb_rocksdb_verify_worker(void* usr) {
+  blb_rocksdb_verify_t* v = usr;
+  blb_rocksdb_verify_batch_t* b = blb_new(blb_rocksdb_verify_batch_t);
+  if(b == NULL) {
+    atomic_store(&v->failed, 1);
+    return (NULL);
+  }
+  int ranges = v->cfs_len * 2 * ROCKSDB_VERIFY_RANGES;
+  while(atomic_load(&v->failed) == 0) {
+    int r = atomic_fetch_add(&v->next, 1);
+    if(r >= ranges) { break; }
+    blb_rocksdb_cf_t* cf = v->cfs[r / (2 * ROCKSDB_VERIFY_RANGES)];
+    char side = (r / ROCKSDB_VERIFY_RANGES) % 2 == 0 ? 'o' : 'i';
+    unsigned char byte = r % ROCKSDB_VERIFY_RANGES;
+    if(blb_rocksdb_verify_range(v, b, cf, side, byte) != 0) {
+      atomic_store(&v->failed, 1);
+    }
+  }
+  blb_free(b);
+  return (NULL);
+}
+
+static int blb_rocksdb_verify(conn_t* th, const protocol_verify_request_t* r) {
+  ASSERT(th->db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)th->db;
+  if(db->secondary) {
+    L(log_error("verification rejected: read-only secondary instance"));
+    return (-1);
+  }
+  if(r->repair && db->follower) {
+    L(log_error("repair rejected: replication follower"));
+    return (-1);
+  }
+
+  blb_rocksdb_verify_t* v = blb_new(blb_rocksdb_verify_t);
+  if(v == NULL) { return (-1); }
+  v->db = db;
+  v->repair = r->repair;
+  v->cfs_len = blb_rocksdb_cf_query(db, NULL, 0, v->cfs);
+  atomic_init(&v->next, 0);
+  atomic_init(&v->failed, 0);
+  atomic_init(&v->o_keys, 0);
+  atomic_init(&v->i_keys, 0);
+  atomic_init(&v->missing, 0);
+  atomic_init(&v->orphaned, 0);
+  atomic_init(&v->repaired, 0);
+  pthread_mutex_init(&v->lock, NULL);
+  v->examples_len = 0;
+  const rocksdb_snapshot_t* snapshot = rocksdb_create_snapshot(db->db);
+  v->readoptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_fill_cache(v->readoptions, 0);
+  rocksdb_readoptions_set_snapshot(v->readoptions, snapshot);
+
+  time_t start = time(NULL);
+  pthread_t threads[ROCKSDB_VERIFY_THREADS_MAX];
+  int n = 0;
+  for(; n < db->verify_threads; n++) {
+    if(blb_rocksdb_thread_start(&threads[n], blb_rocksdb_verify_worker, v)
+       != 0) {
+      break;
+    }
+  }
+  // runs on the connection's thread as well
+  (void)blb_rocksdb_verify_worker(v);
+  for(int i = 0; i < n; i++) { pthread_join(threads[i], NULL); }
+
+  rocksdb_readoptions_destroy(v->readoptions);
+  rocksdb_release_snapshot(db->db, snapshot);
+  blb_rocksdb_cf_release(v->cfs, v->cfs_len);
+  // cached inverted keys would keep deleted orphans from being rewritten
+  if(atomic_load(&v->repaired) > 0 && db->inv_cache != NULL) {
+    blb_keycache_clear(db->inv_cache);
+  }
+
+  char text[2048];
+  int sz = snprintf(
+      text,
+      sizeof(text),
+      "%-16s %16llu\n%-16s %16llu\n%-16s %16llu\n%-16s %16llu\n"
+      "%-16s %16llu\n%-16s %16ld\n",
+      "o keys",
+      atomic_load(&v->o_keys),
+      "i keys",
+      atomic_load(&v->i_keys),
+      "missing i keys",
+      atomic_load(&v->missing),
+      "orphaned i keys",
+      atomic_load(&v->orphaned),
+      "repaired",
+      atomic_load(&v->repaired),
+      "seconds",
+      (long)(time(NULL) - start));
+  size_t used = sz > 0 ? (size_t)sz : 0;
+  for(int i = 0; i < v->examples_len && used < sizeof(text); i++) {
+    sz = snprintf(text + used, sizeof(text) - used, "%s\n", v->examples[i]);
+    if(sz <= 0 || (size_t)sz >= sizeof(text) - used) { break; }
+    used += sz;
+  }
+  int rc = atomic_load(&v->failed) == 0 ? 0 : -1;
+  L(log_notice(
+      "index verification: missing i keys `%llu` orphaned i keys `%llu` "
+      "repaired `%llu`",
+      atomic_load(&v->missing),
+      atomic_load(&v->orphaned),
+      atomic_load(&v->repaired)));
+  pthread_mutex_destroy(&v->lock);
+  blb_free(v);
+  if(rc != 0) { return (-1); }
+  return (blb_conn_info_response(th, text, used));
+}
+
+// adds the keys of one family to the filter; false if interrupted
+static bool blb_rocksdb_filter_rebuild_cf(
+    blb_rocksdb_t* db,
+    rocksdb_readoptions_t* readoptions,
+    rocksdb_column_family_handle_t* cf,
+    size_t* keys) {
+  rocksdb_iterator_t* it = rocksdb_create_iterator_cf(db->db, readoptions, cf);
+  bool complete = true;
+  rocksdb_iter_seek_to_first(it);
+  for(; rocksdb_iter_valid(it) != (unsigned char)0; rocksdb_iter_next(it)) {
+    if(atomic_load(&db->filter_rebuild_stop) > 0) {
+      complete = false;
+      break;
+    }
+    size_t key_len = 0;
+    const char* key = rocksdb_iter_key(it, &key_len);
+    if(key == NULL || key_len < 3 || key[1] != '\x1f') { continue; }
+    const char* p = NULL;
+    size_t p_len = 0;
+    if(key[0] == 'o' && blb_rocksdb_key_rrname(key, key_len, &p, &p_len) == 0) {
+      blb_bloom_add(
+          db->filter, blb_hash64(p, p_len, ROCKSDB_FILTER_SEED_RRNAME));
+      *keys += 1;
+    } else if(key[0] == 'i'
+              && blb_rocksdb_key_rdata(key, key_len, &p, &p_len) == 0) {
+      blb_bloom_add(
+          db->filter, blb_hash64(p, p_len, ROCKSDB_FILTER_SEED_RDATA));
+      *keys += 1;
+    }
+  }
+  char* err = NULL;
+  rocksdb_iter_get_error(it, &err);
+  if(err != NULL) {
+    L(log_error("iterator error `%s`", err));
+    free(err);
+    complete = false;
+  }
+  rocksdb_iter_destroy(it);
+  return (complete);
+}
+
+static void* blb_rocksdb_filter_rebuild(void* usr) {
+  blb_rocksdb_t* db = usr;
+  V(log_info("existence filter rebuild started"));
+  rocksdb_readoptions_t* readoptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_fill_cache(readoptions, 0);
+  size_t keys = 0;
+  bool complete = true;
+  blb_rocksdb_cf_t* cfs[ROCKSDB_CFS_MAX];
+  int n = blb_rocksdb_cf_query(db, NULL, 0, cfs);
+  for(int i = 0; i < n && complete; i++) {
+    complete =
+        blb_rocksdb_filter_rebuild_cf(db, readoptions, cfs[i]->handle, &keys);
+  }
+  blb_rocksdb_cf_release(cfs, n);
+  rocksdb_readoptions_destroy(readoptions);
+  if(complete) {
+    atomic_store(&db->filter_ready, 1);
+    L(log_notice("existence filter rebuilt from `%zu` keys", keys));
+  }
+  return (NULL);
+}
+
+static void blb_rocksdb_filter_open(
+    blb_rocksdb_t* db, const blb_rocksdb_config_t* c) {
+  db->filter = blb_bloom_new(c->filter_size, c->filter_fpr);
+  if(db->filter == NULL) {
+    L(log_error("unable to allocate existence filter"));
+    return;
+  }
+  size_t path_sz = strlen(c->path) + sizeof(ROCKSDB_FILTER_FILE) + 1;
+  db->filter_path = blb_malloc(path_sz);
+  if(db->filter_path == NULL) {
+    blb_bloom_teardown(db->filter);
+    db->filter = NULL;
+    return;
+  }
+  (void)snprintf(
+      db->filter_path, path_sz, "%s/%s", c->path, ROCKSDB_FILTER_FILE);
+  V(log_info(
+      "existence filter size `%zu` probes `%d` capacity `%" PRIu64 "`",
+      blb_bloom_memory(db->filter),
+      db->filter->k,
+      blb_bloom_capacity(db->filter)));
+
+  // the file is only valid until the next write; it is rewritten on teardown
+  if(blb_bloom_load(db->filter, db->filter_path) == 0) {
+    (void)remove(db->filter_path);
+    atomic_store(&db->filter_ready, 1);
+    V(log_info("existence filter loaded from `%s`", db->filter_path));
+    return;
+  }
+  int rc = blb_rocksdb_thread_start(
+      &db->filter_rebuild, blb_rocksdb_filter_rebuild, db);
+  db->filter_rebuild_running = rc == 0;
+}
+
+// a secondary opens the families that exist when it starts and no others
+// later on. families the primary dropped leave the registry like on a purge;
+// once the primary has one the secondary does not know about, its queries
+// would silently miss observations and are rejected until a restart
+static void blb_rocksdb_catchup_families(blb_rocksdb_t* db) {
+  char* err = NULL;
+  size_t n = 0;
+  char** names =
+      rocksdb_list_column_families(db->options, db->primary_path, &n, &err);
+  if(err != NULL) {
+    L(log_error("rocksdb_list_column_families() failed: `%s`", err));
+    free(err);
+    return;
+  }
+  size_t prefix_len = strlen(ROCKSDB_CF_SENSOR_PREFIX);
+  // the default family is always there
+  bool listed[ROCKSDB_CFS_MAX] = {true};
+  blb_rocksdb_cf_t* gone[ROCKSDB_CFS_MAX];
+  int gone_len = 0;
+  int unknown = 0;
+  pthread_rwlock_wrlock(&db->cfs_lock);
+  for(size_t k = 0; k < n; k++) {
+    if(strncmp(names[k], ROCKSDB_CF_SENSOR_PREFIX, prefix_len) != 0) {
+      continue;
+    }
+    const char* sensorid = names[k] + prefix_len;
+    int i = blb_rocksdb_cf_find(db, sensorid, strlen(sensorid));
+    if(i > 0) {
+      listed[i] = true;
+    } else {
+      unknown += 1;
+    }
+  }
+  // from the back, so the family moved into a gap was already looked at
+  for(int i = db->cfs_len - 1; i > 0; i--) {
+    if(listed[i]) { continue; }
+    gone[gone_len++] = db->cfs[i];
+    db->cfs[i] = db->cfs[db->cfs_len - 1];
+    listed[i] = listed[db->cfs_len - 1];
+    db->cfs_len -= 1;
+  }
+  pthread_rwlock_unlock(&db->cfs_lock);
+  rocksdb_list_column_families_destroy(names, n);
+
+  for(int i = 0; i < gone_len; i++) {
+    blb_rocksdb_cf_t* cf = gone[i];
+    L(log_notice(
+        "column family of sensor `%.*s` dropped on the primary",
+        (int)cf->sensorid_len,
+        cf->sensorid));
+    atomic_store(&cf->dropped, 1);
+    blb_rocksdb_cf_unref(cf);
+  }
+  if(gone_len > 0) { blb_qcache_invalidate_all(); }
+  if(unknown > 0 && atomic_exchange(&db->cfs_stale, 1) == 0) {
+    L(log_error(
+        "primary has `%d` new column families this secondary cannot open; "
+        "queries are rejected until it is restarted",
+        unknown));
+  }
+}
+
+static void* blb_rocksdb_catchup(void* usr) {
+  blb_rocksdb_t* db = usr;
+  uint64_t seq = rocksdb_get_latest_sequence_number(db->db);
+  atomic_store(&db->sequence, seq);
+  V(log_info("secondary catch-up every `%d` seconds", db->catchup_interval));
+  while(atomic_load(&db->catchup_stop) == 0) {
+    for(int i = 0; i < db->catchup_interval * 10; i++) {
+      if(atomic_load(&db->catchup_stop) > 0) { return (NULL); }
+      usleep(100 * 1000);
+    }
+    char* err = NULL;
+    rocksdb_try_catch_up_with_primary(db->db, &err);
+    if(err != NULL) {
+      L(log_error("rocksdb_try_catch_up_with_primary() failed: `%s`", err));
+      free(err);
+      continue;
+    }
+    atomic_fetch_add(&db->catchups, 1);
+    blb_rocksdb_catchup_families(db);
+    uint64_t latest = rocksdb_get_latest_sequence_number(db->db);
+    if(latest != seq) {
+      // cached query results may be stale now
+      seq = latest;
+      atomic_store(&db->sequence, seq);
+      blb_qcache_invalidate_all();
+    }
+  }
+  return (NULL);
+}
+
+static uint64_t blb_rocksdb_follow_since(blb_rocksdb_t* db) {
+  char* err = NULL;
+  size_t val_size = 0;
+  char* val = rocksdb_get(
+      db->db,
+      db->readoptions,
+      ROCKSDB_FOLLOW_KEY,
+      sizeof(ROCKSDB_FOLLOW_KEY) - 1,
+      &val_size,
+      &err);
+  if(err != NULL) {
+    L(log_error("rocksdb_get() failed: `%s`", err));
+    free(err);
+  }
+  uint64_t since = 0;
+  if(val != NULL && val_size == sizeof(uint64_t)) {
+    const unsigned char* p = (const unsigned char*)val;
+    since = (uint64_t)_read_u32_le(p) | ((uint64_t)_read_u32_le(p + 4) << 32);
+  } else {
+    // never followed before: a database restored from a backup of the
+    // leader shares its sequence numbers, an empty one starts from scratch
+    since = rocksdb_get_latest_sequence_number(db->db) + 1;
+  }
+  free(val);
+  return (since);
+}
+
+static int blb_rocksdb_follow_apply(
+    blb_rocksdb_t* db, const protocol_replicate_batch_t* b) {
+  rocksdb_writebatch_t* wb =
+      rocksdb_writebatch_create_from(b->data, b->data_len);
+  uint64_t next = b->seq + (uint64_t)rocksdb_writebatch_count(wb);
+  unsigned char val[sizeof(uint64_t)];
+  _write_u32_le(val, (uint32_t)next);
+  _write_u32_le(val + 4, (uint32_t)(next >> 32));
+  // recorded atomically with the batch itself
+  rocksdb_writebatch_put(
+      wb,
+      ROCKSDB_FOLLOW_KEY,
+      sizeof(ROCKSDB_FOLLOW_KEY) - 1,
+      (const char*)val,
+      sizeof(val));
+  char* err = NULL;
+  rocksdb_write(db->db, db->writeoptions, wb, &err);
+  rocksdb_writebatch_destroy(wb);
+  if(err != NULL) {
+    L(log_error("rocksdb_write() failed: `%s`", err));
+    free(err);
+    return (-1);
+  }
+  atomic_store(&db->sequence, next);
+  atomic_fetch_add(&db->follow_batches, 1);
+  // cached query results may be stale now
+  blb_qcache_invalidate_all();
+  return (0);
+}
+
+static int blb_rocksdb_follow_stream(blb_rocksdb_t* db, conn_t* c) {
+  protocol_replicate_request_t r = {.since = atomic_load(&db->sequence)};
+  ssize_t used = blb_protocol_encode_replicate_request(
+      &r, c->scrtch, ENGINE_CONN_SCRTCH_SZ);
+  if(used <= 0) {
+    L(log_error("blb_protocol_encode_replicate_request() failed"));
+    return (-1);
+  }
+  if(blb_conn_write_all(c, c->scrtch, used) != 0) { return (-1); }
+
+  protocol_stream_t* stream =
+      blb_engine_stream_new_max(c, ENGINE_REPLICATE_FRAME_MAX);
+  if(stream == NULL) {
+    L(log_error("blb_engine_stream_new_max() failed"));
+    return (-1);
+  }
+  int rc = 0;
+  protocol_message_t msg;
+  while(rc == 0 && atomic_load(&db->catchup_stop) == 0) {
+    if(blb_protocol_stream_decode(stream, &msg) != 0) {
+      L(log_error("replication stream from leader ended"));
+      rc = -1;
+    } else if(msg.ty != PROTOCOL_REPLICATE_BATCH_RESPONSE) {
+      L(log_error("unexpected message type `%d` from leader", msg.ty));
+      rc = -1;
+    } else {
+      atomic_store(&db->follow_latest, msg.u.batch.latest);
+      if(msg.u.batch.data_len > 0) {
+        rc = blb_rocksdb_follow_apply(db, &msg.u.batch);
+      }
+    }
+  }
+  blb_protocol_stream_teardown(stream);
+  return (rc);
+}
+
+static void* blb_rocksdb_follow(void* usr) {
+  blb_rocksdb_t* db = usr;
+  engine_config_t config = blb_engine_client_config_init();
+  config.host = db->follow_host;
+  config.port = db->follow_port;
+  while(atomic_load(&db->catchup_stop) == 0) {
+    atomic_store(&db->sequence, blb_rocksdb_follow_since(db));
+    conn_t* c = blb_engine_client_new(&config);
+    if(c == NULL) {
+      L(log_error(
+          "unable to connect to leader `%s:%d`",
+          db->follow_host,
+          db->follow_port));
+    } else {
+      V(log_info(
+          "following leader `%s:%d` from sequence `%llu`",
+          db->follow_host,
+          db->follow_port,
+          atomic_load(&db->sequence)));
+      engine_t* e = c->engine;
+      (void)blb_rocksdb_follow_stream(db, c);
+      blb_engine_conn_teardown(c);
+      blb_engine_teardown(e);
+    }
+    for(int i = 0; i < ROCKSDB_FOLLOW_RETRY * 10; i++) {
+      if(atomic_load(&db->catchup_stop) > 0) { return (NULL); }
+      usleep(100 * 1000);
+    }
+  }
+  return (NULL);
+}
+
+// all column families have to be opened along with the database; sensors
+// with a family of their own get it back in the registry
+static int blb_rocksdb_open_families(
+    blb_rocksdb_t* db, const blb_rocksdb_config_t* c) {
+  const char* path = db->secondary ? c->primary_path : c->path;
+  char* err = NULL;
+  size_t n = 0;
+  char** names = rocksdb_list_column_families(db->options, path, &n, &err);
+  if(err != NULL) {
+    // a new database
+    free(err);
+    err = NULL;
+    names = NULL;
+    n = 0;
+  }
+  static const char* defaults[] = {"default"};
+  const char* const* cf_names = n > 0 ? (const char* const*)names : defaults;
+  int cf_len = n > 0 ? (int)n : 1;
+  if(cf_len > ROCKSDB_CFS_MAX) {
+    L(log_error(
+        "database has more than `%d` column families", ROCKSDB_CFS_MAX));
+    rocksdb_list_column_families_destroy(names, n);
+    return (-1);
+  }
+
+  const rocksdb_options_t* cf_options[ROCKSDB_CFS_MAX];
+  rocksdb_column_family_handle_t* handles[ROCKSDB_CFS_MAX];
+  for(int i = 0; i < cf_len; i++) { cf_options[i] = db->options; }
+  if(db->secondary) {
+    db->db = rocksdb_open_as_secondary_column_families(
+        db->options,
+        c->primary_path,
+        c->path,
+        cf_len,
+        cf_names,
+        cf_options,
+        handles,
+        &err);
+  } else {
+    db->db = rocksdb_open_column_families(
+        db->options, c->path, cf_len, cf_names, cf_options, handles, &err);
+  }
+  if(err != NULL) {
+    L(log_error("rocksdb_open() failed: `%s`", err));
+    free(err);
+    if(names != NULL) { rocksdb_list_column_families_destroy(names, n); }
+    return (-1);
+  }
+
+  pthread_rwlock_init(&db->cfs_lock, NULL);
+  db->verify_threads = blb_rocksdb_max(
+      0, blb_rocksdb_min(c->parallelism - 1, ROCKSDB_VERIFY_THREADS_MAX));
+  db->sensor_families = c->sensor_families;
+  db->cfs_full = false;
+  atomic_init(&db->purges, 0);
+  pthread_mutex_init(&db->purge_lock, NULL);
+  db->purge_running = false;
+  atomic_init(&db->purge_stop, 0);
+  atomic_init(&db->purge_done, 0);
+  atomic_init(&db->purge_deleted, 0);
+  db->cfs_len = 1;
+  size_t prefix_len = strlen(ROCKSDB_CF_SENSOR_PREFIX);
+  int rc = 0;
+  for(int i = 0; i < cf_len; i++) {
+    const char* name = cf_names[i];
+    blb_rocksdb_cf_t* cf = NULL;
+    if(strcmp(name, "default") == 0) {
+      cf = blb_rocksdb_cf_new(handles[i], "", 0);
+      if(cf != NULL) { db->cfs[0] = cf; }
+    } else if(strncmp(name, ROCKSDB_CF_SENSOR_PREFIX, prefix_len) == 0) {
+      cf = blb_rocksdb_cf_new(
+          handles[i], name + prefix_len, strlen(name) - prefix_len);
+      if(cf != NULL) { db->cfs[db->cfs_len++] = cf; }
+    } else {
+      L(log_error("unknown column family `%s`", name));
+    }
+    if(cf == NULL) {
+      rocksdb_column_family_handle_destroy(handles[i]);
+      rc = -1;
+    }
+  }
+  if(names != NULL) { rocksdb_list_column_families_destroy(names, n); }
+  if(rc != 0) {
+    blb_rocksdb_cf_release(db->cfs + 1, db->cfs_len - 1);
+    rocksdb_close(db->db);
+    pthread_rwlock_destroy(&db->cfs_lock);
+    pthread_mutex_destroy(&db->purge_lock);
+    return (-1);
+  }
+  if(db->cfs_len > 1 || db->sensor_families) {
+    V(log_info("sensor column families `%d`", db->cfs_len - 1));
+  }
+  return (0);
+}
+
+rocksdb_t* blb_rocksdb_handle(db_t* _db) {
+  ASSERT(_db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_t* db = (blb_rocksdb_t*)_db;
+  return (db->db);
+}
+
+db_t* blb_rocksdb_open(const blb_rocksdb_config_t* c) {
+  V(log_info("rocksdb database at `%s`", c->path));
+  V(log_info(
+      "parallelism `%d` membudget `%zu` max_log_file_size `%zu` "
+      "keep_log_file_num `%d`",
+      c->parallelism,
+      c->membudget,
+      c->max_log_file_size,
+      c->keep_log_file_num));
+
+  blb_rocksdb_t* db = blb_new(blb_rocksdb_t);
+  if(db == NULL) { return (NULL); }
+  db->dbi = &blb_rocksdb_dbi;
+  // read by the merge operator
+  db->hist_granularity = c->hist_granularity;
+  db->hist_buckets =
+      blb_rocksdb_min(c->hist_buckets, (uint32_t)ROCKSDB_HIST_MAX);
+  db->compression_len = blb_rocksdb_compression_parse(
+      c->compression, db->compression, ROCKSDB_LEVELS_MAX);
+  if(db->compression_len < 0) {
+    L(log_error("invalid compression per level `%s`", c->compression));
+    blb_free(db);
+    return (NULL);
+  }
+
+  db->mergeop = blb_rocksdb_mergeoperator_create(db);
+  db->options = rocksdb_options_create();
+  db->writeoptions = rocksdb_writeoptions_create();
+  db->readoptions = rocksdb_readoptions_create();
+
+  rocksdb_options_increase_parallelism(db->options, c->parallelism);
+  rocksdb_options_optimize_level_style_compaction(db->options, c->membudget);
+  rocksdb_options_set_create_if_missing(db->options, 1);
+  rocksdb_options_set_max_log_file_size(db->options, c->max_log_file_size);
+  rocksdb_options_set_keep_log_file_num(db->options, c->keep_log_file_num);
+  rocksdb_options_set_max_open_files(db->options, c->max_open_files);
+  rocksdb_options_set_merge_operator(db->options, db->mergeop);
+  blb_rocksdb_memory_init(db, c);
+  // levels past the end of the list use its last entry
+  rocksdb_options_set_compression_per_level(
+      db->options, db->compression, db->compression_len);
+  int bottommost = db->compression[db->compression_len - 1];
+  bool zstd = false;
+  for(int i = 0; i < db->compression_len; i++) {
+    zstd |= db->compression[i] == rocksdb_zstd_compression;
+  }
+  if(zstd) {
+    rocksdb_options_set_compression_options(
+        db->options, -14, c->zstd_level, 0, 0);
+  }
+  if(bottommost == rocksdb_zstd_compression && c->zstd_dict_bytes > 0) {
+    // dns names repeat a lot across blocks; a dictionary trained on samples
+    // of the bottommost level, which holds most of the data, pays off there
+    V(log_info(
+        "zstd dictionary `%d` bytes trained on `%d` bytes",
+        c->zstd_dict_bytes,
+        c->zstd_train_bytes));
+    rocksdb_options_set_bottommost_compression(db->options, bottommost);
+    rocksdb_options_set_bottommost_compression_options(
+        db->options, -14, c->zstd_level, 0, c->zstd_dict_bytes, 1);
+    rocksdb_options_set_bottommost_compression_options_zstd_max_train_bytes(
+        db->options, c->zstd_train_bytes, 1);
+  }
+  // archived log files are what followers replicate from
+  rocksdb_options_set_WAL_ttl_seconds(db->options, c->wal_ttl);
+  rocksdb_options_set_WAL_size_limit_MB(db->options, c->wal_size_limit);
+  if(c->db_paths_len > 0) {
+    // table files fill the paths in order, each up to its target size;
+    // with dynamic level sizes the bottommost level, which holds most of
+    // the data, is the one ending up on the last path
+    const rocksdb_dbpath_t* paths[ROCKSDB_DB_PATHS_MAX];
+    int n = blb_rocksdb_min(c->db_paths_len, ROCKSDB_DB_PATHS_MAX);
+    for(int i = 0; i < n; i++) {
+      paths[i] = rocksdb_dbpath_create(
+          c->db_paths[i].path, c->db_paths[i].target_size);
+      db->db_paths[i] = c->db_paths[i];
+      V(log_info(
+          "table files path `%s` target size `%" PRIu64 "`",
+          c->db_paths[i].path,
+          c->db_paths[i].target_size));
+    }
+    db->db_paths_len = n;
+    rocksdb_options_set_db_paths(db->options, paths, n);
+    rocksdb_options_set_level_compaction_dynamic_level_bytes(db->options, 1);
+    for(int i = 0; i < n; i++) {
+      rocksdb_dbpath_destroy((rocksdb_dbpath_t*)paths[i]);
+    }
+  } else {
+    db->db_paths_len = 0;
+  }
+
+  db->secondary = c->primary_path != NULL;
+  db->primary_path = c->primary_path;
+  atomic_init(&db->cfs_stale, 0);
+  if(db->secondary) {
+    V(log_info(
+        "secondary instance of `%s` with info logs at `%s`",
+        c->primary_path,
+        c->path));
+    // secondaries have to keep all table files open
+    rocksdb_options_set_max_open_files(db->options, -1);
+  }
+  if(blb_rocksdb_open_families(db, c) != 0) {
+    rocksdb_options_destroy(db->options);
+    blb_rocksdb_memory_teardown(db);
+    rocksdb_mergeoperator_destroy(db->mergeop);
+    rocksdb_writeoptions_destroy(db->writeoptions);
+    rocksdb_readoptions_destroy(db->readoptions);
+    blb_free(db);
+    return (NULL);
+  }
+
+  db->inv_cache = NULL;
+  db->inv_cache_warmup_running = false;
+  atomic_store(&db->inv_cache_warmup_stop, 0);
+  atomic_store(&db->inv_puts, 0);
+  atomic_store(&db->inv_skips, 0);
+  db->follower = c->follow_host != NULL && !db->secondary;
+  if(c->inv_cache_size > 0 && !db->secondary && !db->follower) {
+    db->inv_cache = blb_keycache_new(c->inv_cache_size);
+    if(db->inv_cache == NULL) {
+      L(log_error("unable to allocate inverted index cache"));
+    } else {
+      V(log_info(
+          "inverted index cache size `%zu`",
+          blb_keycache_memory(db->inv_cache)));
+      int rc = blb_rocksdb_thread_start(
+          &db->inv_cache_warmup, blb_rocksdb_inv_cache_warmup, db);
+      db->inv_cache_warmup_running = rc == 0;
+    }
+  }
+
+  db->filter = NULL;
+  db->filter_path = NULL;
+  db->filter_rebuild_running = false;
+  atomic_store(&db->filter_rebuild_stop, 0);
+  atomic_store(&db->filter_ready, 0);
+  atomic_store(&db->filter_negatives, 0);
+  if(db->secondary) {
+    // the filter is fed by the input path which a secondary does not have
+    V(log_info("existence filter disabled on secondary instance"));
+  } else if(c->filter_size > 0 && !db->follower) {
+    blb_rocksdb_filter_open(db, c);
+  } else {
+    // a filter left behind would miss everything written from now on; a
+    // follower writes replicated batches, bypassing the input path
+    char path[PATH_MAX];
+    (void)snprintf(path, sizeof(path), "%s/%s", c->path, ROCKSDB_FILTER_FILE);
+    (void)remove(path);
+  }
+
+  db->catchup_interval = c->catchup_interval > 0 ? c->catchup_interval : 1;
+  db->catchup_running = false;
+  atomic_store(&db->catchup_stop, 0);
+  atomic_store(&db->catchups, 0);
+  atomic_store(&db->sequence, 0);
+  if(db->secondary) {
+    int rc = blb_rocksdb_thread_start(&db->catchup, blb_rocksdb_catchup, db);
+    db->catchup_running = rc == 0;
+  }
+
+  atomic_store(&db->replicas, 0);
+  db->follow_host = c->follow_host;
+  db->follow_port = c->follow_port;
+  db->follow_running = false;
+  atomic_store(&db->follow_batches, 0);
+  atomic_store(&db->follow_latest, 0);
+  if(db->follower) {
+    int rc = blb_rocksdb_thread_start(&db->follow, blb_rocksdb_follow, db);
+    db->follow_running = rc == 0;
+  }
+
+  V(log_debug("rocksdb at %p", db));
+
+  return ((db_t*)db);
+}
+
+// offline bulk loading: entries of a dump are sorted in memory bounded runs
+// which are spilled to disk, k-way merged, written to sst files and ingested
+
+#define ROCKSDB_SST_FILE_MAX ((size_t)256 * 1024 * 1024)
+#define ROCKSDB_SST_VAL_MAX (sizeof(uint32_t) * 3)
+#define ROCKSDB_SST_IO_BUFFER (1024 * 1024)
+
+typedef struct blb_rocksdb_sst_rec_t blb_rocksdb_sst_rec_t;
+struct blb_rocksdb_sst_rec_t {
+  uint32_t key_len;
+  uint32_t val_len;
+  char p[];
+};
+
+typedef struct blb_rocksdb_sst_run_t blb_rocksdb_sst_run_t;
+struct blb_rocksdb_sst_run_t {
+  FILE* f;
+  char* io;
+  char key[ROCKSDB_CONN_SCRTCH_SZ * 2];
+  uint32_t key_len;
+  char val[ROCKSDB_SST_VAL_MAX];
+  uint32_t val_len;
+};
+
+typedef struct blb_rocksdb_sst_t blb_rocksdb_sst_t;
+struct blb_rocksdb_sst_t {
+  blb_rocksdb_t* db;
+  const char* dir;
+  // in-memory run
+  char* arena;
+  size_t arena_sz;
+  size_t arena_used;
+  blb_rocksdb_sst_rec_t** recs;
+  size_t recs_len;
+  size_t recs_cap;
+  // spilled runs
+  blb_rocksdb_sst_run_t** runs;
+  size_t runs_len;
+  // sst output
+  rocksdb_envoptions_t* envoptions;
+  rocksdb_sstfilewriter_t* writer;
+  char** files;
+  size_t files_len;
+  size_t file_bytes;
+  char file_prefix;
+  // last merged key, pending write
+  char key[ROCKSDB_CONN_SCRTCH_SZ * 2];
+  uint32_t key_len;
+  value_t val;
+  bool pending;
+  size_t keys;
+};
+
+static int blb_rocksdb_sst_cmp(
+    const char* a, size_t a_len, const char* b, size_t b_len) {
+  int rc = memcmp(a, b, blb_rocksdb_min(a_len, b_len));
+  if(rc != 0) { return (rc); }
+  return (a_len < b_len ? -1 : a_len > b_len ? 1 : 0);
+}
+
+static int blb_rocksdb_sst_rec_cmp(const void* _a, const void* _b) {
+  const blb_rocksdb_sst_rec_t* a = *(blb_rocksdb_sst_rec_t* const*)_a;
+  const blb_rocksdb_sst_rec_t* b = *(blb_rocksdb_sst_rec_t* const*)_b;
+  return (blb_rocksdb_sst_cmp(a->p, a->key_len, b->p, b->key_len));
+}
+
+static int blb_rocksdb_sst_add(
+    blb_rocksdb_sst_t* sst,
+    const char* key,
+    size_t key_len,
+    const char* val,
+    size_t val_len) {
+  size_t sz = sizeof(blb_rocksdb_sst_rec_t) + key_len + val_len;
+  sz = (sz + 7) & ~(size_t)7;
+  if(sst->arena_used + sz > sst->arena_sz) { return (1); }
+  if(sst->recs_len == sst->recs_cap) {
+    size_t cap = sst->recs_cap == 0 ? 4096 : sst->recs_cap * 2;
+    blb_rocksdb_sst_rec_t** recs =
+        blb_realloc(sst->recs, cap * sizeof(blb_rocksdb_sst_rec_t*));
+    if(recs == NULL) { return (-1); }
+    sst->recs = recs;
+    sst->recs_cap = cap;
+  }
+  blb_rocksdb_sst_rec_t* rec =
+      (blb_rocksdb_sst_rec_t*)(sst->arena + sst->arena_used);
+  rec->key_len = key_len;
+  rec->val_len = val_len;
+  memcpy(rec->p, key, key_len);
+  if(val_len > 0) { memcpy(rec->p + key_len, val, val_len); }
+  sst->arena_used += sz;
+  sst->recs[sst->recs_len++] = rec;
+  return (0);
+}
+
+// combines two records of the same key; inverted keys carry no value
+static inline void blb_rocksdb_sst_combine(
+    const char* key, value_t* acc, const char* val, size_t val_len) {
+  if(key[0] != 'o') { return; }
+  value_t v = {0, 0, 0};
+  if(blb_rocksdb_val_decode(&v, val, val_len) == 0) {
+    blb_rocksdb_val_merge(acc, &v);
+  }
+}
+
+static int blb_rocksdb_sst_write_rec(
+    FILE* f, const char* key, uint32_t key_len, const value_t* v) {
+  char val[ROCKSDB_SST_VAL_MAX];
+  uint32_t val_len = 0;
+  if(key[0] == 'o') {
+    (void)blb_rocksdb_val_encode(v, val, sizeof(val));
+    val_len = sizeof(val);
+  }
+  if(fwrite(&key_len, sizeof(key_len), 1, f) != 1
+     || fwrite(&val_len, sizeof(val_len), 1, f) != 1
+     || fwrite(key, key_len, 1, f) != 1
+     || (val_len > 0 && fwrite(val, val_len, 1, f) != 1)) {
+    return (-1);
+  }
+  return (0);
+}
+
+// sorts and pre-merges the in-memory run and spills it to an unlinked
+// temporary file
+static int blb_rocksdb_sst_spill(blb_rocksdb_sst_t* sst) {
+  if(sst->recs_len == 0) { return (0); }
+  qsort(
+      sst->recs,
+      sst->recs_len,
+      sizeof(blb_rocksdb_sst_rec_t*),
+      blb_rocksdb_sst_rec_cmp);
+
+  char path[PATH_MAX];
+  (void)snprintf(
+      path,
+      sizeof(path),
+      "%s/build-sst-%d-run-%zu.tmp",
+      sst->dir,
+      (int)getpid(),
+      sst->runs_len);
+  blb_rocksdb_sst_run_t* run = blb_new(blb_rocksdb_sst_run_t);
+  if(run == NULL) { return (-1); }
+  run->io = blb_malloc(ROCKSDB_SST_IO_BUFFER);
+  run->f = fopen(path, "w+b");
+  if(run->f == NULL || run->io == NULL) {
+    L(log_error("unable to create run file `%s`", path));
+    if(run->f != NULL) { fclose(run->f); }
+    if(run->io != NULL) { blb_free(run->io); }
+    blb_free(run);
+    return (-1);
+  }
+  (void)unlink(path);
+  (void)setvbuf(run->f, run->io, _IOFBF, ROCKSDB_SST_IO_BUFFER);
+
+  size_t written = 0;
+  for(size_t i = 0; i < sst->recs_len;) {
+    blb_rocksdb_sst_rec_t* rec = sst->recs[i];
+    value_t acc = blb_rocksdb_val_init();
+    size_t j = i;
+    for(; j < sst->recs_len; j++) {
+      blb_rocksdb_sst_rec_t* other = sst->recs[j];
+      if(blb_rocksdb_sst_cmp(rec->p, rec->key_len, other->p, other->key_len)
+         != 0) {
+        break;
+      }
+      blb_rocksdb_sst_combine(
+          rec->p, &acc, other->p + other->key_len, other->val_len);
+    }
+    if(blb_rocksdb_sst_write_rec(run->f, rec->p, rec->key_len, &acc) != 0) {
+      L(log_error("unable to write run file `%s`", path));
+      fclose(run->f);
+      blb_free(run->io);
+      blb_free(run);
+      return (-1);
+    }
+    written += 1;
+    i = j;
+  }
+  if(fflush(run->f) != 0) {
+    L(log_error("unable to write run file `%s`", path));
+    fclose(run->f);
+    blb_free(run->io);
+    blb_free(run);
+    return (-1);
+  }
+  rewind(run->f);
+
+  blb_rocksdb_sst_run_t** runs = blb_realloc(
+      sst->runs, (sst->runs_len + 1) * sizeof(blb_rocksdb_sst_run_t*));
+  if(runs == NULL) {
+    fclose(run->f);
+    blb_free(run->io);
+    blb_free(run);
+    return (-1);
+  }
+  sst->runs = runs;
+  sst->runs[sst->runs_len++] = run;
+  V(log_info(
+      "spilled run `%zu` with `%zu` keys (`%zu` records)",
+      sst->runs_len,
+      written,
+      sst->recs_len));
+  sst->recs_len = 0;
+  sst->arena_used = 0;
+  return (0);
+}
+
+static int blb_rocksdb_sst_input(
+    blb_rocksdb_sst_t* sst, const protocol_entry_t* e) {
+  char key[ROCKSDB_CONN_SCRTCH_SZ];
+  char inv[ROCKSDB_CONN_SCRTCH_SZ];
+  int key_sz = blb_rocksdb_key_o(key, sizeof(key), e);
+  int inv_sz = blb_rocksdb_key_i(inv, sizeof(inv), e);
+  if(key_sz < 5 || inv_sz < 5) {
+    L(log_error("unable to derive keys from dump entry"));
+    return (-1);
+  }
+  value_t v = {.count = e->count,
+               .first_seen = e->first_seen,
+               .last_seen = e->last_seen};
+  char val[ROCKSDB_SST_VAL_MAX];
+  (void)blb_rocksdb_val_encode(&v, val, sizeof(val));
+
+  for(int attempt = 0; attempt < 2; attempt++) {
+    size_t mark_used = sst->arena_used;
+    size_t mark_len = sst->recs_len;
+    int rc = blb_rocksdb_sst_add(sst, key, key_sz, val, sizeof(val));
+    if(rc == 0) { rc = blb_rocksdb_sst_add(sst, inv, inv_sz, "", 0); }
+    if(rc == 0) { return (0); }
+    if(rc < 0) { return (-1); }
+    // run is full; drop the partial pair, spill and retry
+    sst->arena_used = mark_used;
+    sst->recs_len = mark_len;
+    if(blb_rocksdb_sst_spill(sst) != 0) { return (-1); }
+  }
+  L(log_error("sort budget too small for a single entry"));
+  return (-1);
+}
+
+// reads the next record of a run; returns 1 on end of run
+static int blb_rocksdb_sst_run_next(blb_rocksdb_sst_run_t* run) {
+  if(fread(&run->key_len, sizeof(run->key_len), 1, run->f) != 1) {
+    return (feof(run->f) ? 1 : -1);
+  }
+  if(fread(&run->val_len, sizeof(run->val_len), 1, run->f) != 1
+     || run->key_len > sizeof(run->key) || run->val_len > sizeof(run->val)
+     || fread(run->key, run->key_len, 1, run->f) != 1
+     || (run->val_len > 0 && fread(run->val, run->val_len, 1, run->f) != 1)) {
+    L(log_error("corrupt run file"));
+    return (-1);
+  }
+  return (0);
+}
+
+static int blb_rocksdb_sst_finish_file(blb_rocksdb_sst_t* sst) {
+  if(sst->writer == NULL) { return (0); }
+  char* err = NULL;
+  rocksdb_sstfilewriter_finish(sst->writer, &err);
+  rocksdb_sstfilewriter_destroy(sst->writer);
+  sst->writer = NULL;
+  if(err != NULL) {
+    L(log_error("rocksdb_sstfilewriter_finish() failed: `%s`", err));
+    free(err);
+    return (-1);
+  }
+  V(log_info("finished sst file `%s`", sst->files[sst->files_len - 1]));
+  return (0);
+}
+
+static int blb_rocksdb_sst_open_file(blb_rocksdb_sst_t* sst, char prefix) {
+  char** files = blb_realloc(sst->files, (sst->files_len + 1) * sizeof(char*));
+  if(files == NULL) { return (-1); }
+  sst->files = files;
+  char* path = blb_malloc(PATH_MAX);
+  if(path == NULL) { return (-1); }
+  (void)snprintf(
+      path,
+      PATH_MAX,
+      "%s/build-sst-%d-%zu.sst",
+      sst->dir,
+      (int)getpid(),
+      sst->files_len);
+  sst->files[sst->files_len++] = path;
+
+  sst->writer = rocksdb_sstfilewriter_create(sst->envoptions, sst->db->options);
+  char* err = NULL;
+  rocksdb_sstfilewriter_open(sst->writer, path, &err);
+  if(err != NULL) {
+    L(log_error("rocksdb_sstfilewriter_open() failed: `%s`", err));
+    free(err);
+    rocksdb_sstfilewriter_destroy(sst->writer);
+    sst->writer = NULL;
+    return (-1);
+  }
+  sst->file_bytes = 0;
+  sst->file_prefix = prefix;
+  return (0);
+}
+
+// writes the pending key; forward and inverted keys go to separate files and
+// files are cut at `ROCKSDB_SST_FILE_MAX` bytes
+static int blb_rocksdb_sst_emit(blb_rocksdb_sst_t* sst) {
+  if(!sst->pending) { return (0); }
+  sst->pending = false;
+  char prefix = sst->key[0];
+  bool cut = sst->file_prefix != prefix
+             || sst->file_bytes >= ROCKSDB_SST_FILE_MAX;
+  if(sst->writer != NULL && cut) {
+    if(blb_rocksdb_sst_finish_file(sst) != 0) { return (-1); }
+  }
+  if(sst->writer == NULL && blb_rocksdb_sst_open_file(sst, prefix) != 0) {
+    return (-1);
+  }
+  char* err = NULL;
+  if(prefix == 'o') {
+    // merge so that existing observations are combined with the ingested ones
+    char val[ROCKSDB_SST_VAL_MAX];
+    (void)blb_rocksdb_val_encode(&sst->val, val, sizeof(val));
+    rocksdb_sstfilewriter_merge(
+        sst->writer, sst->key, sst->key_len, val, sizeof(val), &err);
+    sst->file_bytes += sst->key_len + sizeof(val);
+  } else {
+    rocksdb_sstfilewriter_put(sst->writer, sst->key, sst->key_len, "", 0, &err);
+    sst->file_bytes += sst->key_len;
+  }
+  if(err != NULL) {
+    L(log_error("rocksdb_sstfilewriter() failed: `%s`", err));
+    free(err);
+    return (-1);
+  }
+  sst->keys += 1;
+  return (0);
+}
+
+static void blb_rocksdb_sst_heap_down(
+    blb_rocksdb_sst_run_t** heap, size_t n, size_t i) {
+  for(;;) {
+    size_t l = 2 * i + 1;
+    size_t r = l + 1;
+    size_t m = i;
+    if(l < n
+       && blb_rocksdb_sst_cmp(
+              heap[l]->key, heap[l]->key_len, heap[m]->key, heap[m]->key_len)
+              < 0) {
+      m = l;
+    }
+    if(r < n
+       && blb_rocksdb_sst_cmp(
+              heap[r]->key, heap[r]->key_len, heap[m]->key, heap[m]->key_len)
+              < 0) {
+      m = r;
+    }
+    if(m == i) { return; }
+    blb_rocksdb_sst_run_t* tmp = heap[i];
+    heap[i] = heap[m];
+    heap[m] = tmp;
+    i = m;
+  }
+}
+
+static int blb_rocksdb_sst_merge(blb_rocksdb_sst_t* sst) {
+  size_t n = 0;
+  blb_rocksdb_sst_run_t** heap = sst->runs;
+  for(size_t i = 0; i < sst->runs_len; i++) {
+    int rc = blb_rocksdb_sst_run_next(sst->runs[i]);
+    if(rc < 0) { return (-1); }
+    if(rc == 0) {
+      blb_rocksdb_sst_run_t* tmp = heap[n];
+      heap[n++] = heap[i];
+      heap[i] = tmp;
+    }
+  }
+  for(size_t i = n / 2; i-- > 0;) { blb_rocksdb_sst_heap_down(heap, n, i); }
+
+  while(n > 0) {
+    blb_rocksdb_sst_run_t* top = heap[0];
+    if(!sst->pending
+       || blb_rocksdb_sst_cmp(sst->key, sst->key_len, top->key, top->key_len)
+              != 0) {
+      if(blb_rocksdb_sst_emit(sst) != 0) { return (-1); }
+      memcpy(sst->key, top->key, top->key_len);
+      sst->key_len = top->key_len;
+      sst->val = blb_rocksdb_val_init();
+      sst->pending = true;
+    }
+    blb_rocksdb_sst_combine(top->key, &sst->val, top->val, top->val_len);
+
+    int rc = blb_rocksdb_sst_run_next(top);
+    if(rc < 0) { return (-1); }
+    if(rc > 0) {
+      // exhausted runs stay behind the heap for teardown
+      heap[0] = heap[n - 1];
+      heap[n - 1] = top;
+      n -= 1;
+    }
+    blb_rocksdb_sst_heap_down(heap, n, 0);
+  }
+  if(blb_rocksdb_sst_emit(sst) != 0) { return (-1); }
+  return (blb_rocksdb_sst_finish_file(sst));
+}
+
+static int blb_rocksdb_sst_ingest(blb_rocksdb_sst_t* sst) {
+  if(sst->files_len == 0) { return (0); }
+  rocksdb_ingestexternalfileoptions_t* ingestoptions =
+      rocksdb_ingestexternalfileoptions_create();
+  rocksdb_ingestexternalfileoptions_set_move_files(ingestoptions, 1);
+  char* err = NULL;
+  rocksdb_ingest_external_file(
+      sst->db->db,
+      (const char* const*)sst->files,
+      sst->files_len,
+      ingestoptions,
+      &err);
+  rocksdb_ingestexternalfileoptions_destroy(ingestoptions);
+  if(err != NULL) {
+    L(log_error("rocksdb_ingest_external_file() failed: `%s`", err));
+    free(err);
+    return (-1);
+  }
+  return (0);
+}
+
+static void blb_rocksdb_sst_teardown(blb_rocksdb_sst_t* sst) {
+  if(sst->writer != NULL) { rocksdb_sstfilewriter_destroy(sst->writer); }
+  for(size_t i = 0; i < sst->runs_len; i++) {
+    fclose(sst->runs[i]->f);
+    blb_free(sst->runs[i]->io);
+    blb_free(sst->runs[i]);
+  }
+  for(size_t i = 0; i < sst->files_len; i++) {
+    // moved files are gone already
+    (void)unlink(sst->files[i]);
+    blb_free(sst->files[i]);
+  }
+  if(sst->envoptions != NULL) { rocksdb_envoptions_destroy(sst->envoptions); }
+  blb_free(sst->runs);
+  blb_free(sst->files);
+  blb_free(sst->recs);
+  blb_free(sst->arena);
+}
+
+int blb_rocksdb_build_sst(
+    db_t* _db, const char* dump_path, const char* dir, size_t sort_budget) {
+  ASSERT(_db->dbi == &blb_rocksdb_dbi);
+  blb_rocksdb_sst_t __sst = {0}, *sst = &__sst;
+  sst->db = (blb_rocksdb_t*)_db;
+  sst->dir = dir;
+  sst->arena_sz = sort_budget;
+  sst->arena = blb_malloc(sst->arena_sz);
+  sst->envoptions = rocksdb_envoptions_create();
+  if(sst->arena == NULL) {
+    L(log_error("unable to allocate sort budget `%zu`", sort_budget));
+    blb_rocksdb_sst_teardown(sst);
+    return (-1);
+  }
+
+  FILE* f = stdin;
+  if(strcmp(dump_path, "-") != 0) { f = fopen(dump_path, "rb"); }
+  if(f == NULL) {
+    L(log_error("unable to open file `%s`", dump_path));
+    blb_rocksdb_sst_teardown(sst);
+    return (-1);
+  }
+  V(log_info("building sst files from `%s` in `%s`", dump_path, dir));
+
+  protocol_dump_stream_t* stream = blb_protocol_dump_stream_new(f);
+  size_t entries = 0;
+  int rc = 0;
+  while(rc == 0) {
+    protocol_entry_t entry;
+    int decode_rc = blb_protocol_dump_stream_decode(stream, &entry);
+    if(decode_rc == -1) { break; }
+    if(decode_rc != 0) {
+      L(log_error(
+          "blb_protocol_dump_stream_decode() failed with `%d`", decode_rc));
+      rc = -1;
+      break;
+    }
+    rc = blb_rocksdb_sst_input(sst, &entry);
+    entries += 1;
+  }
+  blb_protocol_dump_stream_teardown(stream);
+  if(f != stdin) { fclose(f); }
+  V(log_info("read `%zu` entries", entries));
+
+  if(rc == 0) { rc = blb_rocksdb_sst_spill(sst); }
+  if(rc == 0) { rc = blb_rocksdb_sst_merge(sst); }
+  if(rc == 0) {
+    V(log_info("ingesting `%zu` keys from `%zu` sst files",
+               sst->keys,
+               sst->files_len));
+    rc = blb_rocksdb_sst_ingest(sst);
+  }
+  if(rc == 0) {
+    L(log_notice("ingested `%zu` entries as `%zu` keys", entries, sst->keys));
+  }
+  blb_rocksdb_sst_teardown(sst);
+  return (rc);
 }
@@ -11,26 +11,79 @@
 
 #include <engine.h>
 
+#define ROCKSDB_DB_PATHS_MAX (4)
+#define ROCKSDB_LEVELS_MAX (7)
+#define ROCKSDB_MEMORY_MIN (64 * 1024 * 1024)
+#define ROCKSDB_SENSOR_FAMILIES_MAX (256)
+
 typedef struct blb_rocksdb_t blb_rocksdb_t;
+typedef struct blb_rocksdb_db_path_t blb_rocksdb_db_path_t;
+struct blb_rocksdb_db_path_t {
+  const char* path;
+  uint64_t target_size;
+};
+
 typedef struct blb_rocksdb_config_t blb_rocksdb_config_t;
 struct blb_rocksdb_config_t {
   size_t membudget;
+  // cap on block cache and memtables together; `0` keeps rocksdb defaults
+  size_t memory_limit;
   int parallelism;
   size_t max_log_file_size;
   int max_open_files;
   int keep_log_file_num;
+  size_t inv_cache_size;
+  size_t filter_size;
+  double filter_fpr;
+  const char* primary_path;
+  int catchup_interval;
+  const char* follow_host;
+  int follow_port;
+  uint64_t wal_ttl;
+  uint64_t wal_size_limit;
+  uint32_t hist_granularity;
+  uint32_t hist_buckets;
+  blb_rocksdb_db_path_t db_paths[ROCKSDB_DB_PATHS_MAX];
+  int db_paths_len;
+  const char* compression;
+  int zstd_level;
+  int zstd_dict_bytes;
+  int zstd_train_bytes;
+  // every sensor gets a column family of its own, so it can be purged by
+  // dropping it
+  bool sensor_families;
   const char* path;
 };
 
 static inline blb_rocksdb_config_t blb_rocksdb_config_init() {
   return ((blb_rocksdb_config_t){.membudget = 128 * 1024 * 1024,
+                                 .memory_limit = 0,
                                  .parallelism = 8,
                                  .max_log_file_size = 10 * 1024 * 1024,
                                  .max_open_files = 300,
                                  .keep_log_file_num = 2,
+                                 .inv_cache_size = 64 * 1024 * 1024,
+                                 .filter_size = 64 * 1024 * 1024,
+                                 .filter_fpr = 0.01,
+                                 .primary_path = NULL,
+                                 .catchup_interval = 5,
+                                 .follow_host = NULL,
+                                 .follow_port = 4242,
+                                 .wal_ttl = 0,
+                                 .wal_size_limit = 0,
+                                 .hist_granularity = 0,
+                                 .hist_buckets = 366,
+                                 .db_paths_len = 0,
+                                 .compression = "lz4,lz4,lz4,lz4,lz4",
+                                 .zstd_level = 3,
+                                 .zstd_dict_bytes = 0,
+                                 .zstd_train_bytes = 0,
+                                 .sensor_families = false,
                                  .path = "/tmp/balboa-rocksdb"});
 }
 
 db_t* blb_rocksdb_open(const blb_rocksdb_config_t* config);
+int blb_rocksdb_build_sst(
+    db_t* db, const char* dump_path, const char* dir, size_t sort_budget);
 
 #endif
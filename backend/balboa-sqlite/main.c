@@ -32,19 +32,29 @@ Usage: balboa-sqlite [options]\n\
     --database_path <path> same as `-d`\n\
     --database_name <name> same as `-n`\n\
     --journal_mode <mode> journale mode to use. one of {wal,memory} (default: %s)\n\
+    --commit_rows <n> commit a write transaction after this many inputs\n\
+        (default: %d)\n\
+    --commit_interval <ms> commit a write transaction after this many\n\
+        milliseconds (default: %d)\n\
+    --backup_pages <n> pages copied per step of an online backup in wal mode,\n\
+        between pauses for the writer (default: %d)\n\
+    --shards <n> spread the database over this many files, `<path>.<n>`,\n\
+        written in parallel; fixed once the database exists (default: %d)\n\
 \n",
       c->path,
       c->name,
-      c->journal_mode);
+      c->journal_mode,
+      c->commit_rows,
+      c->commit_interval,
+      c->backup_pages,
+      c->shards);
   exit(1);
 }
 
 int main(int argc, char** argv) {
   int verbosity = 0;
   int daemonize = 0;
-  char* host = "127.0.0.1";
-  int port = 4242;
-  int conn_throttle_limit = 64;
+  engine_config_t engine_config = blb_engine_server_config_init();
   blb_sqlite_config_t config = blb_sqlite_config_init();
   trace_config_t trace_config = {.stream = stderr,
                                  .host = "pdns",
@@ -56,6 +66,10 @@ int main(int argc, char** argv) {
   static ko_longopt_t opts[] = {{"database_path", ko_required_argument, 301},
                                 {"database_name", ko_required_argument, 302},
                                 {"journal_mode", ko_required_argument, 303},
+                                {"commit_rows", ko_required_argument, 304},
+                                {"commit_interval", ko_required_argument, 305},
+                                {"backup_pages", ko_required_argument, 306},
+                                {"shards", ko_required_argument, 307},
                                 {"version", ko_no_argument, 999},
                                 {NULL, 0, 0}};
 
@@ -65,14 +79,18 @@ int main(int argc, char** argv) {
     case 'D': daemonize = 1; break;
     case 'd': config.path = opt.arg; break;
     case 'n': config.name = opt.arg; break;
-    case 'l': host = opt.arg; break;
-    case 'p': port = atoi(opt.arg); break;
+    case 'l': engine_config.host = opt.arg; break;
+    case 'p': engine_config.port = atoi(opt.arg); break;
     case 'v': verbosity += 1; break;
-    case 'j': conn_throttle_limit = atoi(opt.arg); break;
+    case 'j': engine_config.conn_throttle_limit = atoi(opt.arg); break;
     case 'h': usage(&config);
     case 301: config.path = opt.arg; break;
     case 302: config.name = opt.arg; break;
     case 303: config.journal_mode = opt.arg; break;
+    case 304: config.commit_rows = atoi(opt.arg); break;
+    case 305: config.commit_interval = atoi(opt.arg); break;
+    case 306: config.backup_pages = atoi(opt.arg); break;
+    case 307: config.shards = atoi(opt.arg); break;
     case 999: version();
     default: usage(&config);
     }
@@ -91,16 +109,14 @@ int main(int argc, char** argv) {
     return (1);
   }
 
-  engine_t* e = blb_engine_server_new(db, host, port, conn_throttle_limit);
+  engine_config.db = db;
+  engine_t* e = blb_engine_server_new(&engine_config);
   if(e == NULL) {
     L(log_error("unable to create io engine"));
     blb_dbi_teardown(db);
     return (1);
   }
 
-  blb_engine_spawn_signal_consumer(e);
-  blb_engine_spawn_stats_reporter(e);
-
   blb_engine_run(e);
 
   blb_engine_teardown(e);
@@ -1,15 +1,23 @@
 // balboa
 // Copyright (c) 2018, 2019 DCSO GmbH
 
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include <hash.h>
 #include <sqlite-impl.h>
 
 #include <sqlite3.h>
 
 typedef struct blb_sqlite_t blb_sqlite_t;
+typedef struct blb_sqlite_shard_t blb_sqlite_shard_t;
+typedef struct blb_sqlite_conn_t blb_sqlite_conn_t;
 
 static void blb_sqlite_teardown(db_t* _db);
 static db_t* blb_sqlite_conn_init(conn_t* th, db_t* db);
@@ -18,6 +26,10 @@ static int blb_sqlite_query(conn_t* th, const protocol_query_request_t* q);
 static int blb_sqlite_input(conn_t* th, const protocol_input_request_t* i);
 static void blb_sqlite_dump(conn_t* th, const protocol_dump_request_t* d);
 static void blb_sqlite_backup(conn_t* th, const protocol_backup_request_t* b);
+static void blb_sqlite_stats(db_t* db);
+static void blb_sqlite_close(blb_sqlite_t* db);
+static int blb_sqlite_prepare(
+    sqlite3* h, const char* sql, sqlite3_stmt** stmt);
 
 static const dbi_t blb_sqlite_dbi = {.thread_init = blb_sqlite_conn_init,
                                      .thread_deinit = blb_sqlite_conn_deinit,
@@ -25,36 +37,265 @@ static const dbi_t blb_sqlite_dbi = {.thread_init = blb_sqlite_conn_init,
                                      .query = blb_sqlite_query,
                                      .input = blb_sqlite_input,
                                      .backup = blb_sqlite_backup,
-                                     .dump = blb_sqlite_dump};
+                                     .dump = blb_sqlite_dump,
+                                     .stats = blb_sqlite_stats};
+
+#define SQLITE_QUEUE_ROWS (16 * 1024)
+#define SQLITE_QUEUE_BYTES (4 * 1024 * 1024)
+#define SQLITE_BUSY_TIMEOUT_MS (5000)
+// busy commit attempts, each waiting up to the busy timeout, before the
+// writer goes back to its queue and tries again later
+#define SQLITE_COMMIT_RETRIES (3)
+#define SQLITE_BACKUP_SLEEP_MS (10)
+#define SQLITE_PATH_MAX (256)
+#define SQLITE_SHARD_SEED (0x62616c626f61ULL)
+
+// inputs waiting for the writer; entries point into `buf`
+typedef struct blb_sqlite_queue_t blb_sqlite_queue_t;
+struct blb_sqlite_queue_t {
+  size_t n;
+  size_t used;
+  protocol_entry_t entries[SQLITE_QUEUE_ROWS];
+  char buf[SQLITE_QUEUE_BYTES];
+};
 
-struct blb_sqlite_t {
-  const dbi_t* dbi;
+// one database file with its own writer; observations are spread over the
+// shards by their rrname
+struct blb_sqlite_shard_t {
+  int idx;
+  char path[SQLITE_PATH_MAX];
+  // shared by all connections for queries
   sqlite3* db;
+  // the writer's own handle, so queries never see its open transaction
+  sqlite3* wdb;
   sqlite3_stmt* insert_stmt;
-  sqlite3_stmt* query_stmt;
+  sqlite3_stmt* begin_stmt;
+  sqlite3_stmt* commit_stmt;
+  sqlite3_stmt* rollback_stmt;
+  int commit_rows;
+  int commit_interval;
+  // connections fill `pending` while the writer works through `writing`
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  blb_sqlite_queue_t* pending;
+  blb_sqlite_queue_t* writing;
+  bool stop;
+  pthread_t writer;
+  atomic_ullong inserts;
+  atomic_ullong insert_errors;
+  // inputs lost with a rolled back transaction
+  atomic_ullong dropped;
+  atomic_ullong commits;
+  atomic_ullong commit_ns;
+  atomic_ullong commit_ns_max;
 };
 
-db_t* blb_sqlite_conn_init(conn_t* th, db_t* db) {
-  th->usr_ctx = NULL;
-  return (db);
+struct blb_sqlite_t {
+  const dbi_t* dbi;
+  int backup_pages;
+  // whether the shards are in wal mode, where readers and the writer do not
+  // block each other
+  bool wal;
+  struct timespec stats_last;
+  int shards_len;
+  blb_sqlite_shard_t shards[SQLITE_SHARDS_MAX];
+};
+
+// prepared statements are bound to one connection, so concurrent queries
+// never share one
+struct blb_sqlite_conn_t {
+  int shards_len;
+  sqlite3_stmt* query_by_rrname_stmt[SQLITE_SHARDS_MAX];
+  sqlite3_stmt* query_by_rdata_stmt[SQLITE_SHARDS_MAX];
+};
+
+// the indexes leave out the counters and timestamps, which every input
+// rewrites; queries fetch those from the table
+static const char* _query_by_rrname_stmt =
+    "\n\
+select rrname,rrtype,rdata,sensorid,count,first_seen,last_seen\n\
+  from pdns indexed by pdns_by_rrname\n\
+  where rrname=?1\n\
+    and (?2 is null or sensorid=?2)\n\
+    and (?3 is null or rrtype=?3)\n\
+    and (?4 is null or rdata=?4)\n\
+  limit ?5\n\
+;";
+
+static const char* _query_by_rdata_stmt =
+    "\n\
+select rrname,rrtype,rdata,sensorid,count,first_seen,last_seen\n\
+  from pdns indexed by pdns_by_rdata\n\
+  where rdata=?4\n\
+    and (?2 is null or sensorid=?2)\n\
+    and (?3 is null or rrtype=?3)\n\
+    and (?1 is null or rrname=?1)\n\
+  limit ?5\n\
+;";
+
+#define SQLITE_QUERY_RRNAME_IDX (1)
+#define SQLITE_QUERY_SENSORID_IDX (2)
+#define SQLITE_QUERY_RRTYPE_IDX (3)
+#define SQLITE_QUERY_RDATA_IDX (4)
+#define SQLITE_QUERY_LIMIT_IDX (5)
+
+#define SQLITE_COLUMN_RRNAME (0)
+#define SQLITE_COLUMN_RRTYPE (1)
+#define SQLITE_COLUMN_RDATA (2)
+#define SQLITE_COLUMN_SENSORID (3)
+#define SQLITE_COLUMN_COUNT (4)
+#define SQLITE_COLUMN_FIRSTSEEN (5)
+#define SQLITE_COLUMN_LASTSEEN (6)
+
+// points `e` at the columns of the current row, valid until the next step
+static void blb_sqlite_row_entry(sqlite3_stmt* stmt, protocol_entry_t* e) {
+  e->rrname = (const char*)sqlite3_column_text(stmt, SQLITE_COLUMN_RRNAME);
+  e->rrname_len = sqlite3_column_bytes(stmt, SQLITE_COLUMN_RRNAME);
+  e->rrtype = (const char*)sqlite3_column_text(stmt, SQLITE_COLUMN_RRTYPE);
+  e->rrtype_len = sqlite3_column_bytes(stmt, SQLITE_COLUMN_RRTYPE);
+  e->rdata = (const char*)sqlite3_column_blob(stmt, SQLITE_COLUMN_RDATA);
+  e->rdata_len = sqlite3_column_bytes(stmt, SQLITE_COLUMN_RDATA);
+  e->sensorid = (const char*)sqlite3_column_text(stmt, SQLITE_COLUMN_SENSORID);
+  e->sensorid_len = sqlite3_column_bytes(stmt, SQLITE_COLUMN_SENSORID);
+  e->count = sqlite3_column_int64(stmt, SQLITE_COLUMN_COUNT);
+  e->first_seen = sqlite3_column_int64(stmt, SQLITE_COLUMN_FIRSTSEEN);
+  e->last_seen = sqlite3_column_int64(stmt, SQLITE_COLUMN_LASTSEEN);
+  if(e->rdata == NULL) { e->rdata = ""; }
+}
+
+static inline blb_sqlite_conn_t* blb_sqlite_get_conn(conn_t* conn) {
+  ASSERT(
+      conn->usr_ctx != NULL && conn->usr_ctx_sz == sizeof(blb_sqlite_conn_t));
+  return ((blb_sqlite_conn_t*)(conn->usr_ctx));
+}
+
+static void blb_sqlite_conn_finalize(blb_sqlite_conn_t* conn) {
+  for(int i = 0; i < conn->shards_len; i++) {
+    sqlite3_finalize(conn->query_by_rrname_stmt[i]);
+    sqlite3_finalize(conn->query_by_rdata_stmt[i]);
+  }
+}
+
+db_t* blb_sqlite_conn_init(conn_t* th, db_t* _db) {
+  ASSERT(_db->dbi == &blb_sqlite_dbi);
+  blb_sqlite_t* db = (blb_sqlite_t*)_db;
+  blb_sqlite_conn_t* conn = blb_new(blb_sqlite_conn_t);
+  if(conn == NULL) { return (NULL); }
+  conn->shards_len = db->shards_len;
+  for(int i = 0; i < conn->shards_len; i++) {
+    conn->query_by_rrname_stmt[i] = NULL;
+    conn->query_by_rdata_stmt[i] = NULL;
+  }
+
+  for(int i = 0; i < conn->shards_len; i++) {
+    sqlite3* h = db->shards[i].db;
+    if(blb_sqlite_prepare(
+           h, _query_by_rrname_stmt, &conn->query_by_rrname_stmt[i])
+           != 0
+       || blb_sqlite_prepare(
+              h, _query_by_rdata_stmt, &conn->query_by_rdata_stmt[i])
+              != 0) {
+      blb_sqlite_conn_finalize(conn);
+      blb_free(conn);
+      return (NULL);
+    }
+  }
+
+  th->usr_ctx = conn;
+  th->usr_ctx_sz = sizeof(blb_sqlite_conn_t);
+  return (_db);
 }
 
 void blb_sqlite_conn_deinit(conn_t* th, db_t* db) {
-  (void)th;
-  (void)db;
+  ASSERT(db->dbi == &blb_sqlite_dbi);
+  blb_sqlite_conn_t* conn = blb_sqlite_get_conn(th);
+  blb_sqlite_conn_finalize(conn);
+  blb_free(conn);
+  th->usr_ctx = NULL;
+  th->usr_ctx_sz = 0;
+}
+
+// stops the first `n` writers, which commit what is still queued
+static void blb_sqlite_writers_stop(blb_sqlite_t* db, int n) {
+  for(int i = 0; i < n; i++) {
+    blb_sqlite_shard_t* sh = &db->shards[i];
+    pthread_mutex_lock(&sh->lock);
+    sh->stop = true;
+    pthread_cond_broadcast(&sh->not_empty);
+    pthread_cond_broadcast(&sh->not_full);
+    pthread_mutex_unlock(&sh->lock);
+  }
+  for(int i = 0; i < n; i++) { pthread_join(db->shards[i].writer, NULL); }
 }
 
 void blb_sqlite_teardown(db_t* _db) {
   ASSERT(_db->dbi == &blb_sqlite_dbi);
   blb_sqlite_t* db = (blb_sqlite_t*)_db;
-  sqlite3_finalize(db->insert_stmt);
-  sqlite3_finalize(db->query_stmt);
-  sqlite3_close(db->db);
-  blb_free(_db);
+  blb_sqlite_writers_stop(db, db->shards_len);
+  blb_sqlite_close(db);
+}
+
+static inline blb_sqlite_shard_t* blb_sqlite_shard(
+    blb_sqlite_t* db, const char* rrname, size_t rrname_len) {
+  if(db->shards_len == 1) { return (&db->shards[0]); }
+  uint64_t h = blb_hash64(rrname, rrname_len, SQLITE_SHARD_SEED);
+  return (&db->shards[h % (uint64_t)db->shards_len]);
+}
+
+// binds `p` or, when it is empty, `null`, which disables its condition
+static inline int blb_sqlite_bind_optional(
+    sqlite3_stmt* stmt, int idx, const char* p, size_t p_len) {
+  if(p_len == 0) { return (sqlite3_bind_null(stmt, idx)); }
+  return (sqlite3_bind_text(stmt, idx, p, p_len, SQLITE_STATIC));
+}
+
+// streams the rows of one shard; `rows` counts towards the request's limit
+static int blb_sqlite_query_shard(
+    conn_t* th,
+    const protocol_query_request_t* q,
+    sqlite3* h,
+    sqlite3_stmt* stmt,
+    size_t* rows) {
+  (void)blb_sqlite_bind_optional(
+      stmt, SQLITE_QUERY_RRNAME_IDX, q->qrrname, q->qrrname_len);
+  (void)blb_sqlite_bind_optional(
+      stmt, SQLITE_QUERY_SENSORID_IDX, q->qsensorid, q->qsensorid_len);
+  (void)blb_sqlite_bind_optional(
+      stmt, SQLITE_QUERY_RRTYPE_IDX, q->qrrtype, q->qrrtype_len);
+  (void)blb_sqlite_bind_optional(
+      stmt, SQLITE_QUERY_RDATA_IDX, q->qrdata, q->qrdata_len);
+  sqlite3_bind_int(stmt, SQLITE_QUERY_LIMIT_IDX, q->limit - (int)*rows);
+
+  int rc = 0;
+  int step = SQLITE_ROW;
+  while((step = sqlite3_step(stmt)) == SQLITE_ROW) {
+    *rows += 1;
+    protocol_entry_t __e = {0}, *e = &__e;
+    blb_sqlite_row_entry(stmt, e);
+    int push_ok = blb_conn_query_stream_push_response(th, e);
+    if(push_ok != 0) {
+      L(log_error("unable to push query response entry"));
+      rc = -1;
+      break;
+    }
+  }
+  if(rc == 0 && step != SQLITE_DONE) {
+    L(log_error("sqlite3_step() failed with `%s`", sqlite3_errmsg(h)));
+    rc = -1;
+  }
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  return (rc);
 }
 
+// an rrname lives in exactly one shard; an rdata can be in any of them, so
+// those queries go through the rdata index of every shard in turn
 static int blb_sqlite_query(conn_t* th, const protocol_query_request_t* q) {
-  (void)q;
+  ASSERT(th->db->dbi == &blb_sqlite_dbi);
+  blb_sqlite_t* db = (blb_sqlite_t*)th->db;
+  blb_sqlite_conn_t* conn = blb_sqlite_get_conn(th);
 
   int start_ok = blb_conn_query_stream_start_response(th);
   if(start_ok != 0) {
@@ -62,27 +303,23 @@ static int blb_sqlite_query(conn_t* th, const protocol_query_request_t* q) {
     return (-1);
   }
 
-  protocol_entry_t __e, *e = &__e;
-  e->sensorid = "test-sensor-id";
-  e->sensorid_len = strlen(e->sensorid);
-  e->rdata = "";
-  e->rdata_len = 0;
-  e->rrname = "test-rrname";
-  e->rrname_len = strlen(e->rrname);
-  e->rrtype = "A";
-  e->rrtype_len = 1;
-  e->count = 23;
-  e->first_seen = 15000000;
-  e->last_seen = 15001000;
-  int push_ok = blb_conn_query_stream_push_response(th, e);
-  if(push_ok != 0) {
-    L(log_error("unable to push query response entry"));
-    return (-1);
+  int rc = 0;
+  size_t rows = 0;
+  if(q->qrrname_len > 0) {
+    blb_sqlite_shard_t* sh = blb_sqlite_shard(db, q->qrrname, q->qrrname_len);
+    rc = blb_sqlite_query_shard(
+        th, q, sh->db, conn->query_by_rrname_stmt[sh->idx], &rows);
+  } else {
+    for(int i = 0; i < db->shards_len && rc == 0 && rows < (size_t)q->limit;
+        i++) {
+      rc = blb_sqlite_query_shard(
+          th, q, db->shards[i].db, conn->query_by_rdata_stmt[i], &rows);
+    }
   }
+  T(log_debug("rows `%zu`", rows));
 
-  (void)blb_conn_query_stream_end_response(th);
-
-  return (0);
+  if(rc == 0) { (void)blb_conn_query_stream_end_response(th); }
+  return (rc);
 }
 
 #define SQLITE_BIND_RRNAME_IDX (1)
@@ -93,67 +330,414 @@ static int blb_sqlite_query(conn_t* th, const protocol_query_request_t* q) {
 #define SQLITE_BIND_FIRSTSEEN_IDX (6)
 #define SQLITE_BIND_LASTSEEN_IDX (7)
 
+static inline uint64_t blb_sqlite_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static inline char* blb_sqlite_queue_copy(
+    blb_sqlite_queue_t* q, const char* p, size_t p_len) {
+  char* dst = q->buf + q->used;
+  if(p_len > 0) { memcpy(dst, p, p_len); }
+  q->used += p_len;
+  return (dst);
+}
+
+// queues the entry for the writer of its shard; waits while the queue is
+// full
 static int blb_sqlite_input(conn_t* th, const protocol_input_request_t* i) {
   ASSERT(th->db->dbi == &blb_sqlite_dbi);
-  blb_sqlite_t* db = (blb_sqlite_t*)th->db;
+  const protocol_entry_t* e = &i->entry;
+  blb_sqlite_shard_t* db =
+      blb_sqlite_shard((blb_sqlite_t*)th->db, e->rrname, e->rrname_len);
+
+  X(blb_protocol_log_entry(e));
+
+  size_t sz = e->rrname_len + e->rrtype_len + e->rdata_len + e->sensorid_len;
+  if(sz > SQLITE_QUEUE_BYTES) {
+    L(log_error("entry of `%zu` bytes too large", sz));
+    return (-1);
+  }
+
+  pthread_mutex_lock(&db->lock);
+  while(!db->stop
+        && (db->pending->n == SQLITE_QUEUE_ROWS
+            || db->pending->used + sz > SQLITE_QUEUE_BYTES)) {
+    pthread_cond_wait(&db->not_full, &db->lock);
+  }
+  if(db->stop) {
+    pthread_mutex_unlock(&db->lock);
+    return (-1);
+  }
+  blb_sqlite_queue_t* q = db->pending;
+  protocol_entry_t* dst = &q->entries[q->n++];
+  *dst = (protocol_entry_t){0};
+  dst->rrname = blb_sqlite_queue_copy(q, e->rrname, e->rrname_len);
+  dst->rrname_len = e->rrname_len;
+  dst->rrtype = blb_sqlite_queue_copy(q, e->rrtype, e->rrtype_len);
+  dst->rrtype_len = e->rrtype_len;
+  dst->rdata = blb_sqlite_queue_copy(q, e->rdata, e->rdata_len);
+  dst->rdata_len = e->rdata_len;
+  dst->sensorid = blb_sqlite_queue_copy(q, e->sensorid, e->sensorid_len);
+  dst->sensorid_len = e->sensorid_len;
+  dst->count = e->count;
+  dst->first_seen = e->first_seen;
+  dst->last_seen = e->last_seen;
+  pthread_cond_signal(&db->not_empty);
+  pthread_mutex_unlock(&db->lock);
 
-  X(blb_protocol_log_entry(&i->entry));
+  return (0);
+}
 
+static int blb_sqlite_insert(
+    blb_sqlite_shard_t* db, const protocol_entry_t* e) {
   sqlite3_bind_text(
       db->insert_stmt,
       SQLITE_BIND_RRNAME_IDX,
-      i->entry.rrname,
-      i->entry.rrname_len,
+      e->rrname,
+      e->rrname_len,
       SQLITE_STATIC);
   sqlite3_bind_text(
       db->insert_stmt,
       SQLITE_BIND_RRTYPE_IDX,
-      i->entry.rrtype,
-      i->entry.rrtype_len,
+      e->rrtype,
+      e->rrtype_len,
       SQLITE_STATIC);
   sqlite3_bind_text(
       db->insert_stmt,
       SQLITE_BIND_RDATA_IDX,
-      i->entry.rdata,
-      i->entry.rdata_len,
+      e->rdata,
+      e->rdata_len,
       SQLITE_STATIC);
   sqlite3_bind_text(
       db->insert_stmt,
       SQLITE_BIND_SENSORID_IDX,
-      i->entry.sensorid,
-      i->entry.sensorid_len,
+      e->sensorid,
+      e->sensorid_len,
       SQLITE_STATIC);
-  sqlite3_bind_int(db->insert_stmt, SQLITE_BIND_COUNT_IDX, i->entry.count);
-  sqlite3_bind_int(
-      db->insert_stmt, SQLITE_BIND_FIRSTSEEN_IDX, i->entry.first_seen);
-  sqlite3_bind_int(
-      db->insert_stmt, SQLITE_BIND_LASTSEEN_IDX, i->entry.last_seen);
+  sqlite3_bind_int(db->insert_stmt, SQLITE_BIND_COUNT_IDX, e->count);
+  sqlite3_bind_int(db->insert_stmt, SQLITE_BIND_FIRSTSEEN_IDX, e->first_seen);
+  sqlite3_bind_int(db->insert_stmt, SQLITE_BIND_LASTSEEN_IDX, e->last_seen);
 
   int step_ok = sqlite3_step(db->insert_stmt);
+  sqlite3_clear_bindings(db->insert_stmt);
+  sqlite3_reset(db->insert_stmt);
   if(step_ok != SQLITE_DONE) {
     L(log_error("sqlite3_step() failed with rc `%d`", step_ok));
-    sqlite3_clear_bindings(db->insert_stmt);
     return (-1);
   }
+  return (0);
+}
 
-  sqlite3_clear_bindings(db->insert_stmt);
-  sqlite3_reset(db->insert_stmt);
+static int blb_sqlite_exec_stmt(blb_sqlite_shard_t* db, sqlite3_stmt* stmt) {
+  int rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  if(rc != SQLITE_DONE) {
+    L(log_error("sqlite3_step() failed with `%s`", sqlite3_errmsg(db->wdb)));
+    return (-1);
+  }
+  return (0);
+}
+
+// commits the writer's transaction of `rows` inputs. a busy database is
+// retried and, unless this is the `last` attempt, left to a later round;
+// on any other error the transaction is rolled back and its rows are
+// counted as dropped. returns 0 once the transaction is closed
+static int blb_sqlite_commit(blb_sqlite_shard_t* db, int rows, bool last) {
+  uint64_t start = blb_sqlite_now_ns();
+  int rc = SQLITE_BUSY;
+  for(int i = 0; i < SQLITE_COMMIT_RETRIES && rc == SQLITE_BUSY; i++) {
+    rc = sqlite3_step(db->commit_stmt);
+    sqlite3_reset(db->commit_stmt);
+  }
+  if(rc == SQLITE_DONE) {
+    uint64_t ns = blb_sqlite_now_ns() - start;
+    atomic_fetch_add(&db->commits, 1);
+    atomic_fetch_add(&db->commit_ns, ns);
+    unsigned long long max = atomic_load(&db->commit_ns_max);
+    while(ns > max
+          && !atomic_compare_exchange_weak(&db->commit_ns_max, &max, ns)) {}
+    return (0);
+  }
+  if(rc == SQLITE_BUSY && !last) {
+    L(log_warn(
+        "shard `%d` busy, commit of `%d` rows postponed", db->idx, rows));
+    return (-1);
+  }
+
+  L(log_error("commit of shard `%d` failed with `%s`; dropping `%d` rows",
+              db->idx,
+              sqlite3_errmsg(db->wdb),
+              rows));
+  // some errors already rolled the transaction back
+  if(sqlite3_get_autocommit(db->wdb) == 0
+     && blb_sqlite_exec_stmt(db, db->rollback_stmt) != 0) {
+    return (-1);
+  }
+  atomic_fetch_add(&db->dropped, rows);
+  return (0);
+}
+
+// groups the inputs of all connections to one shard into transactions,
+// committed once `commit_rows` inputs are in or `commit_interval`
+// milliseconds passed
+static void* blb_sqlite_writer(void* usr) {
+  blb_sqlite_shard_t* db = usr;
+  V(log_info("sqlite writer thread of shard `%d` started", db->idx));
+  bool in_txn = false;
+  int txn_rows = 0;
+  uint64_t txn_start = 0;
+  uint64_t interval_ns = (uint64_t)db->commit_interval * 1000000ULL;
+  for(;;) {
+    pthread_mutex_lock(&db->lock);
+    while(!db->stop && db->pending->n == 0) {
+      if(!in_txn) {
+        pthread_cond_wait(&db->not_empty, &db->lock);
+        continue;
+      }
+      uint64_t now = blb_sqlite_now_ns();
+      if(now - txn_start >= interval_ns) { break; }
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      uint64_t wait = interval_ns - (now - txn_start);
+      ts.tv_sec += wait / 1000000000ULL;
+      ts.tv_nsec += wait % 1000000000ULL;
+      if(ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000L;
+      }
+      (void)pthread_cond_timedwait(&db->not_empty, &db->lock, &ts);
+    }
+    bool stop = db->stop;
+    blb_sqlite_queue_t* q = db->pending;
+    db->pending = db->writing;
+    db->writing = q;
+    pthread_cond_broadcast(&db->not_full);
+    pthread_mutex_unlock(&db->lock);
+
+    if(q->n > 0 && !in_txn) {
+      in_txn = blb_sqlite_exec_stmt(db, db->begin_stmt) == 0;
+      txn_rows = 0;
+      txn_start = blb_sqlite_now_ns();
+    }
+    for(size_t i = 0; i < q->n; i++) {
+      if(blb_sqlite_insert(db, &q->entries[i]) != 0) {
+        atomic_fetch_add(&db->insert_errors, 1);
+      }
+    }
+    atomic_fetch_add(&db->inserts, q->n);
+    txn_rows += q->n;
+    q->n = 0;
+    q->used = 0;
+
+    if(in_txn
+       && (stop || txn_rows >= db->commit_rows
+           || blb_sqlite_now_ns() - txn_start >= interval_ns)) {
+      in_txn = blb_sqlite_commit(db, txn_rows, stop) != 0;
+    }
+    if(stop) { break; }
+  }
+  V(log_info("sqlite writer thread of shard `%d` stopped", db->idx));
+  return (NULL);
+}
+
+static void blb_sqlite_stats(db_t* _db) {
+  ASSERT(_db->dbi == &blb_sqlite_dbi);
+  blb_sqlite_t* db = (blb_sqlite_t*)_db;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double dt = (double)(now.tv_sec - db->stats_last.tv_sec)
+              + (double)(now.tv_nsec - db->stats_last.tv_nsec) / 1e9;
+  db->stats_last = now;
+  unsigned long long inserts = 0, errors = 0, commits = 0, commit_ns = 0;
+  unsigned long long commit_ns_max = 0, dropped = 0;
+  for(int i = 0; i < db->shards_len; i++) {
+    blb_sqlite_shard_t* sh = &db->shards[i];
+    inserts += atomic_exchange(&sh->inserts, 0);
+    errors += atomic_exchange(&sh->insert_errors, 0);
+    dropped += atomic_exchange(&sh->dropped, 0);
+    commits += atomic_exchange(&sh->commits, 0);
+    commit_ns += atomic_exchange(&sh->commit_ns, 0);
+    unsigned long long max = atomic_exchange(&sh->commit_ns_max, 0);
+    if(max > commit_ns_max) { commit_ns_max = max; }
+  }
+  L(log_notice(
+      "inserts/s `%.0f` errors `%llu` dropped `%llu` commits `%llu` commit "
+      "latency avg `%.2fms` max `%.2fms` shards `%d`",
+      dt > 0 ? (double)inserts / dt : 0.0,
+      errors,
+      dropped,
+      commits,
+      commits > 0 ? (double)commit_ns / (double)commits / 1e6 : 0.0,
+      (double)commit_ns_max / 1e6,
+      db->shards_len));
+}
+
+// copies a shard to the file at `path` from a read only handle of its own.
+// in wal mode that handle holds one read transaction, so the copy sees a
+// single snapshot: the writer's commits neither restart it nor are held up
+// by it, and the copy goes `backup_pages` pages at a time with pauses in
+// between. any other journal mode would block the writer for as long as the
+// transaction stays open, so there the copy is done in one step
+static int blb_sqlite_backup_shard(
+    blb_sqlite_t* db, blb_sqlite_shard_t* sh, const char* path) {
+  sqlite3* src = NULL;
+  if(sqlite3_open_v2(sh->path, &src, SQLITE_OPEN_READONLY, NULL)
+     != SQLITE_OK) {
+    L(log_error("sqlite3_open_v2() failed with `%s`", sqlite3_errmsg(src)));
+    sqlite3_close(src);
+    return (-1);
+  }
+  (void)sqlite3_busy_timeout(src, SQLITE_BUSY_TIMEOUT_MS);
+
+  int pages_per_step = -1;
+  if(db->wal) {
+    char* err = NULL;
+    if(sqlite3_exec(
+           src,
+           "begin; select count(*) from sqlite_master;",
+           NULL,
+           NULL,
+           &err)
+       != SQLITE_OK) {
+      L(log_error("sqlite3_exec() failed with `%s`", err));
+      sqlite3_free(err);
+      sqlite3_close(src);
+      return (-1);
+    }
+    pages_per_step = db->backup_pages;
+  }
+
+  sqlite3* dst = NULL;
+  if(sqlite3_open(path, &dst) != SQLITE_OK) {
+    L(log_error("sqlite3_open() failed with `%s`", sqlite3_errmsg(dst)));
+    sqlite3_close(dst);
+    sqlite3_close(src);
+    return (-1);
+  }
+
+  sqlite3_backup* bk = sqlite3_backup_init(dst, "main", src, "main");
+  if(bk == NULL) {
+    L(log_error("sqlite3_backup_init() failed with `%s`", sqlite3_errmsg(dst)));
+    sqlite3_close(dst);
+    sqlite3_close(src);
+    return (-1);
+  }
+
+  int rc = SQLITE_OK;
+  int steps = 0;
+  do {
+    rc = sqlite3_backup_step(bk, pages_per_step);
+    steps += 1;
+    if(rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+      sqlite3_sleep(SQLITE_BACKUP_SLEEP_MS);
+    }
+  } while(rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+  int pages = sqlite3_backup_pagecount(bk);
+  (void)sqlite3_backup_finish(bk);
+
+  sqlite3_close(dst);
+  // closing the handle ends its read transaction
+  sqlite3_close(src);
+  if(rc != SQLITE_DONE) {
+    L(log_error("sqlite3_backup_step() failed with `%s`", sqlite3_errstr(rc)));
+    return (-1);
+  }
+  L(log_notice(
+      "backup to `%s` done: pages `%d` steps `%d`", path, pages, steps));
+  return (0);
+}
 
+// shards are named after the database files, `<path>.<shard>`
+static int blb_sqlite_shard_path(
+    char* p, size_t p_sz, const char* path, int path_len, int shards, int i) {
+  int sz = shards == 1 ? snprintf(p, p_sz, "%.*s", path_len, path)
+                       : snprintf(p, p_sz, "%.*s.%d", path_len, path, i);
+  if(sz <= 0 || (size_t)sz >= p_sz) { return (-1); }
   return (0);
 }
 
 static void blb_sqlite_backup(conn_t* th, const protocol_backup_request_t* b) {
   ASSERT(th->db->dbi == &blb_sqlite_dbi);
-  // blb_sqlite_t* db=(blb_sqlite_t*)th->db;
+  blb_sqlite_t* db = (blb_sqlite_t*)th->db;
+
+  X(log_info("backup `%.*s`", (int)b->path_len, b->path));
+
+  for(int i = 0; i < db->shards_len; i++) {
+    char path[SQLITE_PATH_MAX];
+    if(b->path_len == 0
+       || blb_sqlite_shard_path(
+              path,
+              sizeof(path),
+              b->path,
+              (int)b->path_len,
+              db->shards_len,
+              i)
+              != 0) {
+      L(log_error("invalid path"));
+      return;
+    }
+    if(blb_sqlite_backup_shard(db, &db->shards[i], path) != 0) { return; }
+  }
+}
+
+static const char* _dump_stmt =
+    "\n\
+select rrname,rrtype,rdata,sensorid,count,first_seen,last_seen from pdns\n\
+;";
+
+// streams every row of a shard; the statement runs on a handle of its own
+// and is one read transaction, which in wal mode does not hold up the
+// writer
+static int blb_sqlite_dump_shard(
+    conn_t* th, blb_sqlite_shard_t* sh, uint64_t* cnt) {
+  sqlite3* h = NULL;
+  if(sqlite3_open_v2(sh->path, &h, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+    L(log_error("sqlite3_open_v2() failed with `%s`", sqlite3_errmsg(h)));
+    sqlite3_close(h);
+    return (-1);
+  }
+  (void)sqlite3_busy_timeout(h, SQLITE_BUSY_TIMEOUT_MS);
+
+  sqlite3_stmt* stmt = NULL;
+  if(blb_sqlite_prepare(h, _dump_stmt, &stmt) != 0) {
+    sqlite3_close(h);
+    return (-1);
+  }
 
-  X(log_debug("backup `%.*s`", (int)b->path_len, b->path));
+  int rc = 0;
+  int step = SQLITE_ROW;
+  while((step = sqlite3_step(stmt)) == SQLITE_ROW) {
+    protocol_entry_t __e = {0}, *e = &__e;
+    blb_sqlite_row_entry(stmt, e);
+    if(blb_conn_dump_entry(th, e) != 0) {
+      L(log_error("unable to dump entry"));
+      rc = -1;
+      break;
+    }
+    *cnt += 1;
+  }
+  if(rc == 0 && step != SQLITE_DONE) {
+    L(log_error("sqlite3_step() failed with `%s`", sqlite3_errmsg(h)));
+    rc = -1;
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(h);
+  return (rc);
 }
 
 static void blb_sqlite_dump(conn_t* th, const protocol_dump_request_t* d) {
   ASSERT(th->db->dbi == &blb_sqlite_dbi);
-  // blb_sqlite_t* db=(blb_sqlite_t*)th->db;
+  blb_sqlite_t* db = (blb_sqlite_t*)th->db;
+
+  X(log_info("dump `%.*s`", (int)d->path_len, d->path));
 
-  X(log_debug("dump `%.*s`", (int)d->path_len, d->path));
+  uint64_t cnt = 0;
+  for(int i = 0; i < db->shards_len; i++) {
+    if(blb_sqlite_dump_shard(th, &db->shards[i], &cnt) != 0) { break; }
+  }
+  L(log_notice("dumped `%" PRIu64 "` entries", cnt));
 }
 
 static const char* _create_table =
@@ -168,6 +752,12 @@ create table if not exists pdns(\n\
   last_seen integer not null,\n\
   unique ( rrname,rrtype,rdata,sensorid )\n\
 );\n\
+create index if not exists pdns_by_rrname on pdns(\n\
+  rrname,sensorid,rrtype,rdata\n\
+);\n\
+create index if not exists pdns_by_rdata on pdns(\n\
+  rdata,sensorid\n\
+);\n\
 pragma journal_mode=%s;\n\
 pragma synchronous=off;\n\
 ";
@@ -183,31 +773,98 @@ insert into pdns (rrname,rrtype,rdata,sensorid,count,first_seen,last_seen)\n\
       last_seen=max(last_seen,excluded.last_seen)\n\
 ;";
 
-db_t* blb_sqlite_open(const blb_sqlite_config_t* config) {
-  ASSERT(config->path != NULL);
-  blb_sqlite_t* db = blb_new(blb_sqlite_t);
-  if(db == NULL) { return (NULL); }
-  db->dbi = &blb_sqlite_dbi;
+static int blb_sqlite_prepare(
+    sqlite3* h, const char* sql, sqlite3_stmt** stmt) {
+  int rc = sqlite3_prepare_v2(h, sql, strlen(sql), stmt, NULL);
+  if(rc != SQLITE_OK) {
+    L(log_error("sqlite3_prepare_v2() failed with `%s`", sqlite3_errmsg(h)));
+    return (-1);
+  }
+  return (0);
+}
 
-  V(log_info("sqlite database is `%s`", config->path));
+static const char* _shard_stmt =
+    "\n\
+create table if not exists shard(\n\
+  idx integer not null,\n\
+  shards integer not null\n\
+);\n\
+insert into shard (idx,shards) select %d,%d\n\
+  where not exists (select 1 from shard);\n\
+";
 
-  if(strcmp(config->journal_mode, "wal") != 0
-     && strcmp(config->journal_mode, "memory") != 0) {
-    L(log_error("unknown journal_mode `%s`", config->journal_mode));
-    blb_free(db);
-    return (NULL);
+// finalizing and closing `NULL` is a no-op, so this also cleans up after a
+// partial open
+static void blb_sqlite_shard_close(blb_sqlite_shard_t* sh) {
+  sqlite3_finalize(sh->insert_stmt);
+  sqlite3_finalize(sh->begin_stmt);
+  sqlite3_finalize(sh->commit_stmt);
+  sqlite3_finalize(sh->rollback_stmt);
+  sqlite3_close(sh->wdb);
+  sqlite3_close(sh->db);
+  if(sh->pending != NULL) { blb_free(sh->pending); }
+  if(sh->writing != NULL) { blb_free(sh->writing); }
+  pthread_cond_destroy(&sh->not_full);
+  pthread_cond_destroy(&sh->not_empty);
+  pthread_mutex_destroy(&sh->lock);
+}
+
+static void blb_sqlite_close(blb_sqlite_t* db) {
+  for(int i = 0; i < db->shards_len; i++) {
+    blb_sqlite_shard_close(&db->shards[i]);
+  }
+  blb_free(db);
+}
+
+// a database file remembers its place, so that it is never opened with
+// another number of shards, which would route rrnames elsewhere
+static int blb_sqlite_shard_check(blb_sqlite_shard_t* sh, int shards) {
+  char stmt[512];
+  (void)snprintf(stmt, sizeof(stmt), _shard_stmt, sh->idx, shards);
+  char* err = NULL;
+  if(sqlite3_exec(sh->wdb, stmt, NULL, NULL, &err) != SQLITE_OK) {
+    L(log_error("sqlite3_exec() failed with `%s`", err));
+    sqlite3_free(err);
+    return (-1);
+  }
+
+  sqlite3_stmt* select = NULL;
+  if(blb_sqlite_prepare(sh->wdb, "select idx,shards from shard;", &select)
+     != 0) {
+    return (-1);
+  }
+  int rc = -1;
+  if(sqlite3_step(select) == SQLITE_ROW) {
+    int idx = sqlite3_column_int(select, 0);
+    int n = sqlite3_column_int(select, 1);
+    if(idx == sh->idx && n == shards) {
+      rc = 0;
+    } else {
+      L(log_error(
+          "`%s` is shard `%d` of `%d`, not `%d` of `%d`",
+          sh->path,
+          idx,
+          n,
+          sh->idx,
+          shards));
+    }
   }
+  sqlite3_finalize(select);
+  return (rc);
+}
 
-  db->insert_stmt = NULL;
-  db->query_stmt = NULL;
-  int rc = sqlite3_open(config->path, &db->db);
+static int blb_sqlite_shard_open(
+    blb_sqlite_shard_t* sh, const blb_sqlite_config_t* config) {
+  int rc = sqlite3_open(sh->path, &sh->db);
+  if(rc == SQLITE_OK) { rc = sqlite3_open(sh->path, &sh->wdb); }
   if(rc != SQLITE_OK) {
-    L(log_error("sqlite_open() failed with `%s`", sqlite3_errmsg(db->db)));
-    ASSERT(db->db != NULL);
-    sqlite3_close(db->db);
-    blb_free(db);
-    return (NULL);
+    L(log_error(
+        "sqlite_open() failed with `%s`",
+        sqlite3_errmsg(sh->wdb != NULL ? sh->wdb : sh->db)));
+    return (-1);
   }
+  (void)sqlite3_busy_timeout(sh->db, SQLITE_BUSY_TIMEOUT_MS);
+  (void)sqlite3_busy_timeout(sh->wdb, SQLITE_BUSY_TIMEOUT_MS);
 
   char _create_table_stmt[1024];
   (void)snprintf(
@@ -217,27 +874,120 @@ db_t* blb_sqlite_open(const blb_sqlite_config_t* config) {
       config->journal_mode);
 
   char* err = NULL;
-  int stmt_ok = sqlite3_exec(db->db, _create_table_stmt, NULL, NULL, &err);
+  int stmt_ok = sqlite3_exec(sh->wdb, _create_table_stmt, NULL, NULL, &err);
   if(stmt_ok != SQLITE_OK) {
     ASSERT(err != NULL);
     L(log_error("sqlite3_exec() failed with `%s`", err));
     sqlite3_free(err);
-    sqlite3_close(db->db);
-    blb_free(db);
-    return (NULL);
+    return (-1);
   }
 
-  int insert_stmt_ok = sqlite3_prepare_v2(
-      db->db, _insert_stmt, strlen(_insert_stmt), &db->insert_stmt, NULL);
-  if(insert_stmt_ok != SQLITE_OK) {
-    L(log_error(
-        "sqlite3_prepare_v2() failed with `%s`", sqlite3_errmsg(db->db)));
-    sqlite3_close(db->db);
-    blb_free(db);
+  if(blb_sqlite_shard_check(sh, config->shards) != 0) { return (-1); }
+
+  if(blb_sqlite_prepare(sh->wdb, _insert_stmt, &sh->insert_stmt) != 0
+     || blb_sqlite_prepare(sh->wdb, "begin;", &sh->begin_stmt) != 0
+     || blb_sqlite_prepare(sh->wdb, "commit;", &sh->commit_stmt) != 0
+     || blb_sqlite_prepare(sh->wdb, "rollback;", &sh->rollback_stmt) != 0) {
+    return (-1);
+  }
+
+  ASSERT(sh->insert_stmt != NULL);
+  return (0);
+}
+
+static void blb_sqlite_shard_init(
+    blb_sqlite_shard_t* sh, int idx, const blb_sqlite_config_t* config) {
+  sh->idx = idx;
+  sh->db = NULL;
+  sh->wdb = NULL;
+  sh->insert_stmt = NULL;
+  sh->begin_stmt = NULL;
+  sh->commit_stmt = NULL;
+  sh->rollback_stmt = NULL;
+  sh->commit_rows = config->commit_rows;
+  sh->commit_interval = config->commit_interval;
+  pthread_mutex_init(&sh->lock, NULL);
+  pthread_cond_init(&sh->not_empty, NULL);
+  pthread_cond_init(&sh->not_full, NULL);
+  sh->stop = false;
+  atomic_init(&sh->inserts, 0);
+  atomic_init(&sh->insert_errors, 0);
+  atomic_init(&sh->dropped, 0);
+  atomic_init(&sh->commits, 0);
+  atomic_init(&sh->commit_ns, 0);
+  atomic_init(&sh->commit_ns_max, 0);
+  sh->pending = blb_new(blb_sqlite_queue_t);
+  sh->writing = blb_new(blb_sqlite_queue_t);
+  if(sh->pending != NULL) { sh->pending->n = sh->pending->used = 0; }
+  if(sh->writing != NULL) { sh->writing->n = sh->writing->used = 0; }
+}
+
+db_t* blb_sqlite_open(const blb_sqlite_config_t* config) {
+  ASSERT(config->path != NULL);
+
+  V(log_info("sqlite database is `%s`", config->path));
+
+  if(strcmp(config->journal_mode, "wal") != 0
+     && strcmp(config->journal_mode, "memory") != 0) {
+    L(log_error("unknown journal_mode `%s`", config->journal_mode));
+    return (NULL);
+  }
+  if(config->commit_rows <= 0 || config->commit_interval <= 0) {
+    L(log_error("commit rows and interval must be positive"));
+    return (NULL);
+  }
+  if(config->backup_pages <= 0) {
+    L(log_error("backup pages per step must be positive"));
+    return (NULL);
+  }
+  if(config->shards < 1 || config->shards > SQLITE_SHARDS_MAX) {
+    L(log_error("shards must be within 1 and %d", SQLITE_SHARDS_MAX));
     return (NULL);
   }
 
-  ASSERT(db->insert_stmt != NULL);
+  blb_sqlite_t* db = blb_new(blb_sqlite_t);
+  if(db == NULL) { return (NULL); }
+  db->dbi = &blb_sqlite_dbi;
+  db->backup_pages = config->backup_pages;
+  db->wal = strcmp(config->journal_mode, "wal") == 0;
+  db->shards_len = 0;
+  clock_gettime(CLOCK_MONOTONIC, &db->stats_last);
+
+  for(int i = 0; i < config->shards; i++) {
+    blb_sqlite_shard_t* sh = &db->shards[i];
+    blb_sqlite_shard_init(sh, i, config);
+    db->shards_len += 1;
+    if(sh->pending == NULL || sh->writing == NULL
+       || blb_sqlite_shard_path(
+              sh->path,
+              sizeof(sh->path),
+              config->path,
+              (int)strlen(config->path),
+              config->shards,
+              i)
+              != 0
+       || blb_sqlite_shard_open(sh, config) != 0) {
+      blb_sqlite_close(db);
+      return (NULL);
+    }
+  }
+
+  // signals belong to the engine's consumer thread; the writers inherit a
+  // mask blocking them
+  sigset_t s, old;
+  sigfillset(&s);
+  pthread_sigmask(SIG_BLOCK, &s, &old);
+  for(int i = 0; i < db->shards_len; i++) {
+    blb_sqlite_shard_t* sh = &db->shards[i];
+    if(pthread_create(&sh->writer, NULL, blb_sqlite_writer, sh) != 0) {
+      pthread_sigmask(SIG_SETMASK, &old, NULL);
+      L(log_error("unable to start writer thread"));
+      blb_sqlite_writers_stop(db, i);
+      blb_sqlite_close(db);
+      return (NULL);
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
 
   return ((db_t*)db);
 }
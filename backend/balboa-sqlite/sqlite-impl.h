@@ -11,19 +11,33 @@
 
 #include <engine.h>
 
+#define SQLITE_SHARDS_MAX (64)
+
 typedef struct blb_sqlite_config_t blb_sqlite_config_t;
 struct blb_sqlite_config_t {
   const char* path;
   const char* name;
   const char* compression;
   const char* journal_mode;
+  // a transaction is committed after this many inputs or milliseconds
+  int commit_rows;
+  int commit_interval;
+  // pages copied per backup step, with a short pause after each
+  int backup_pages;
+  // observations are spread by rrname over this many database files,
+  // `<path>.<shard>`, each with a writer of its own; `1` uses `path` as is
+  int shards;
 };
 
 static inline blb_sqlite_config_t blb_sqlite_config_init(void) {
   return ((blb_sqlite_config_t){.path = "/tmp/balboa-sqlite.db",
                                 .name = "pdns",
                                 .compression = "none",
-                                .journal_mode = "wal"});
+                                .journal_mode = "wal",
+                                .commit_rows = 10000,
+                                .commit_interval = 1000,
+                                .backup_pages = 256,
+                                .shards = 1});
 }
 
 db_t* blb_sqlite_open(const blb_sqlite_config_t* config);
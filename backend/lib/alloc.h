@@ -29,6 +29,14 @@ static inline void* blb_realloc_impl(
     X(log_debug("alloc `%zu` `%p`", p_sz, p)); \
     p;                                         \
   })
+#define blb_calloc(n, sz)                                  \
+  ({                                                       \
+    size_t p_n = (n);                                      \
+    size_t p_sz = (sz);                                    \
+    void* p = calloc(p_n, p_sz);                           \
+    X(log_debug("calloc `%zu` `%zu` `%p`", p_n, p_sz, p)); \
+    p;                                                     \
+  })
 #define blb_realloc(p, sz)                                \
   ({                                                      \
     size_t p_sz = (sz);                                   \
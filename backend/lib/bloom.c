@@ -0,0 +1,159 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <alloc.h>
+#include <bloom.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <trace.h>
+
+#define BLOOM_MAGIC "BLBBLM01"
+#define BLOOM_MAGIC_LEN (8)
+#define BLOOM_K_MAX (16)
+#define BLOOM_IO_WORDS (4096)
+
+bloom_t* blb_bloom_new(size_t memcap, double fpr) {
+  size_t n_words = memcap / sizeof(atomic_uint_least64_t);
+  if(n_words == 0 || fpr <= 0.0 || fpr >= 1.0) { return (NULL); }
+  // k = ceil(-log2(fpr))
+  int k = 0;
+  for(double p = 1.0; p > fpr && k < BLOOM_K_MAX; p /= 2.0) { k++; }
+  bloom_t* b = blb_new(bloom_t);
+  if(b == NULL) { return (NULL); }
+  b->n_words = n_words;
+  b->n_bits = (uint64_t)n_words * 64;
+  b->k = k;
+  b->words = blb_malloc(n_words * sizeof(atomic_uint_least64_t));
+  if(b->words == NULL) {
+    blb_free(b);
+    return (NULL);
+  }
+  blb_bloom_clear(b);
+  return (b);
+}
+
+void blb_bloom_teardown(bloom_t* b) {
+  if(b == NULL) { return; }
+  blb_free(b->words);
+  blb_free(b);
+}
+
+void blb_bloom_clear(bloom_t* b) {
+  for(size_t i = 0; i < b->n_words; i++) {
+    atomic_store_explicit(&b->words[i], 0, memory_order_relaxed);
+  }
+}
+
+// double hashing: probe i is at h1 + i * h2
+static inline uint64_t blb_bloom_step(uint64_t h) {
+  return (((h >> 32) | (h << 32)) | 1);
+}
+
+void blb_bloom_add(bloom_t* b, uint64_t h) {
+  uint64_t step = blb_bloom_step(h);
+  for(int i = 0; i < b->k; i++, h += step) {
+    uint64_t bit = h % b->n_bits;
+    uint64_t mask = (uint64_t)1 << (bit & 63);
+    atomic_uint_least64_t* w = &b->words[bit >> 6];
+    if((atomic_load_explicit(w, memory_order_relaxed) & mask) == 0) {
+      atomic_fetch_or_explicit(w, mask, memory_order_relaxed);
+    }
+  }
+}
+
+bool blb_bloom_contains(const bloom_t* b, uint64_t h) {
+  uint64_t step = blb_bloom_step(h);
+  for(int i = 0; i < b->k; i++, h += step) {
+    uint64_t bit = h % b->n_bits;
+    uint64_t mask = (uint64_t)1 << (bit & 63);
+    uint64_t w = atomic_load_explicit(
+        (atomic_uint_least64_t*)&b->words[bit >> 6], memory_order_relaxed);
+    if((w & mask) == 0) { return (false); }
+  }
+  return (true);
+}
+
+double blb_bloom_fill(const bloom_t* b) {
+  uint64_t set = 0;
+  for(size_t i = 0; i < b->n_words; i++) {
+    uint64_t w = atomic_load_explicit(
+        (atomic_uint_least64_t*)&b->words[i], memory_order_relaxed);
+    set += (uint64_t)__builtin_popcountll(w);
+  }
+  return ((double)set / (double)b->n_bits);
+}
+
+int blb_bloom_save(const bloom_t* b, const char* path) {
+  char tmp[PATH_MAX];
+  int tmp_sz = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if(tmp_sz <= 0 || tmp_sz >= (int)sizeof(tmp)) {
+    L(log_error("filter path too long `%s`", path));
+    return (-1);
+  }
+  FILE* f = fopen(tmp, "wb");
+  if(f == NULL) {
+    L(log_error("unable to open `%s`", tmp));
+    return (-1);
+  }
+  uint64_t n_bits = b->n_bits;
+  uint32_t k = (uint32_t)b->k;
+  int ok = 0;
+  ok += fwrite(BLOOM_MAGIC, BLOOM_MAGIC_LEN, 1, f) == 1 ? 0 : -1;
+  ok += fwrite(&n_bits, sizeof(n_bits), 1, f) == 1 ? 0 : -1;
+  ok += fwrite(&k, sizeof(k), 1, f) == 1 ? 0 : -1;
+  uint64_t buf[BLOOM_IO_WORDS];
+  for(size_t i = 0; i < b->n_words && ok == 0; i += BLOOM_IO_WORDS) {
+    size_t n = b->n_words - i;
+    if(n > BLOOM_IO_WORDS) { n = BLOOM_IO_WORDS; }
+    for(size_t j = 0; j < n; j++) {
+      buf[j] = atomic_load_explicit(
+          (atomic_uint_least64_t*)&b->words[i + j], memory_order_relaxed);
+    }
+    ok += fwrite(buf, sizeof(uint64_t), n, f) == n ? 0 : -1;
+  }
+  ok += fclose(f) == 0 ? 0 : -1;
+  if(ok != 0 || rename(tmp, path) != 0) {
+    L(log_error("unable to write filter to `%s`", path));
+    (void)remove(tmp);
+    return (-1);
+  }
+  return (0);
+}
+
+int blb_bloom_load(bloom_t* b, const char* path) {
+  FILE* f = fopen(path, "rb");
+  if(f == NULL) { return (-1); }
+  char magic[BLOOM_MAGIC_LEN];
+  uint64_t n_bits = 0;
+  uint32_t k = 0;
+  if(fread(magic, BLOOM_MAGIC_LEN, 1, f) != 1
+     || memcmp(magic, BLOOM_MAGIC, BLOOM_MAGIC_LEN) != 0
+     || fread(&n_bits, sizeof(n_bits), 1, f) != 1
+     || fread(&k, sizeof(k), 1, f) != 1) {
+    L(log_error("invalid filter file `%s`", path));
+    fclose(f);
+    return (-1);
+  }
+  if(n_bits != b->n_bits || k != (uint32_t)b->k) {
+    V(log_info("filter file `%s` geometry differs from configuration", path));
+    fclose(f);
+    return (-1);
+  }
+  uint64_t buf[BLOOM_IO_WORDS];
+  for(size_t i = 0; i < b->n_words; i += BLOOM_IO_WORDS) {
+    size_t n = b->n_words - i;
+    if(n > BLOOM_IO_WORDS) { n = BLOOM_IO_WORDS; }
+    if(fread(buf, sizeof(uint64_t), n, f) != n) {
+      L(log_error("truncated filter file `%s`", path));
+      fclose(f);
+      blb_bloom_clear(b);
+      return (-1);
+    }
+    for(size_t j = 0; j < n; j++) {
+      atomic_store_explicit(&b->words[i + j], buf[j], memory_order_relaxed);
+    }
+  }
+  fclose(f);
+  return (0);
+}
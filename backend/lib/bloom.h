@@ -0,0 +1,43 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __BLOOM_H
+#define __BLOOM_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// a fixed size bloom filter over 64bit hashes. the memory budget fixes the
+// number of bits, the target false positive rate the number of probes; the
+// capacity (number of keys at which the target rate is reached) follows from
+// both. bits are set atomically so concurrent adds and lookups are safe.
+
+typedef struct bloom_t bloom_t;
+struct bloom_t {
+  size_t n_words;
+  uint64_t n_bits;
+  int k;
+  atomic_uint_least64_t* words;
+};
+
+bloom_t* blb_bloom_new(size_t memcap, double fpr);
+void blb_bloom_teardown(bloom_t* b);
+void blb_bloom_add(bloom_t* b, uint64_t h);
+bool blb_bloom_contains(const bloom_t* b, uint64_t h);
+void blb_bloom_clear(bloom_t* b);
+double blb_bloom_fill(const bloom_t* b);
+int blb_bloom_save(const bloom_t* b, const char* path);
+int blb_bloom_load(bloom_t* b, const char* path);
+
+static inline size_t blb_bloom_memory(const bloom_t* b) {
+  return (b->n_words * sizeof(atomic_uint_least64_t));
+}
+
+static inline uint64_t blb_bloom_capacity(const bloom_t* b) {
+  // n = m * ln(2) / k for an optimally loaded filter
+  return ((uint64_t)((double)b->n_bits * 0.6931 / (double)b->k));
+}
+
+#endif
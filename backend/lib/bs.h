@@ -317,11 +317,52 @@ static inline int bs_sink_escape( bytestring_sink_t* sink, uint8_t c ) {
   return ( bs_append( sink, ( const uint8_t* )entry->r, entry->l ) );
 }
 
+// flags the bytes of the little endian word `w` that `bs_sink_escape`
+// rewrites: control characters, `"`, `\`, DEL and everything above ascii.
+// borrows may flag bytes above the first hit, never below it, so only the
+// lowest flagged byte is meaningful
+static inline uint64_t _escape_mask_w64( uint64_t w ) {
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t high = 0x8080808080808080ULL;
+  uint64_t ctrl = ( w - ones * 0x20 ) & ~w;
+  uint64_t quote = w ^ ( ones * '"' );
+  uint64_t bslash = w ^ ( ones * '\\' );
+  uint64_t del = w ^ ( ones * 0x7f );
+  quote = ( quote - ones ) & ~quote;
+  bslash = ( bslash - ones ) & ~bslash;
+  del = ( del - ones ) & ~del;
+  return ( ( ctrl | quote | bslash | del | w ) & high );
+}
+
+static inline int _escape_byte( uint8_t c ) {
+  return ( c < 0x20 || c == '"' || c == '\\' || c >= 0x7f );
+}
+
+// length of the prefix of `p` that needs no escaping, eight bytes at a time
+static inline size_t _escape_span( const uint8_t* p, size_t n ) {
+  size_t i = 0;
+  for( ; i + 8 <= n; i += 8 ) {
+    uint64_t m = _escape_mask_w64( _read_w64_le( p + i ) );
+    if( m != 0 ) { return ( i + ( __builtin_ctzll( m ) >> 3 ) ); }
+  }
+  while( i < n && !_escape_byte( p[i] ) ) { i++; }
+  return ( i );
+}
+
+// runs that need no escaping, typically all of a domain name, are copied
+// in one go; only the bytes in between go through the table
 static inline int bs_append_escape(
     bytestring_sink_t* bs, const uint8_t* p, size_t n ) {
-  int64_t ok = 0;
-  for( size_t i = 0; i < n; i++ ) { ok += bs_sink_escape( bs, p[i] ); }
-  return ( ok < 0 ? -1 : 0 );
+  size_t i = 0;
+  while( i < n ) {
+    size_t run = _escape_span( p + i, n - i );
+    if( run > 0 && bs_append( bs, p + i, run ) != 0 ) { return ( -1 ); }
+    i += run;
+    if( i == n ) { break; }
+    if( bs_sink_escape( bs, p[i] ) != 0 ) { return ( -1 ); }
+    i += 1;
+  }
+  return ( 0 );
 }
 
 static inline int bs_cat_escape(
@@ -329,4 +370,30 @@ static inline int bs_cat_escape(
   return ( bs_append_escape( bs, ( const uint8_t* )p, n ) );
 }
 
+// decimal representation of `v`, two digits per division
+static inline int bs_append_u64( bytestring_sink_t* bs, uint64_t v ) {
+  static const char digits[201] =
+      "0001020304050607080910111213141516171819"
+      "2021222324252627282930313233343536373839"
+      "4041424344454647484950515253545556575859"
+      "6061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+  char buf[20];
+  char* q = buf + sizeof( buf );
+  while( v >= 100 ) {
+    const char* d = digits + ( v % 100 ) * 2;
+    v /= 100;
+    *--q = d[1];
+    *--q = d[0];
+  }
+  if( v >= 10 ) {
+    const char* d = digits + v * 2;
+    *--q = d[1];
+    *--q = d[0];
+  } else {
+    *--q = ( char )( '0' + v );
+  }
+  return ( bs_append( bs, ( const uint8_t* )q, buf + sizeof( buf ) - q ) );
+}
+
 #endif
\ No newline at end of file
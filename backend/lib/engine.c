@@ -7,6 +7,7 @@
 #include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,8 +22,17 @@
 
 #define ENGINE_MPACK_TREE_MEMCAP (1024 * 100)
 #define ENGINE_MPACK_TREE_NODES_LIMIT (1024)
+// select() rounds of the blocking reads and writes; a timed out round only
+// checks for an engine stop and polls again, so a peer may take arbitrarily
+// long, e.g. to answer a purge or a verification
 #define ENGINE_POLL_READ_TIMEOUT (60)
 #define ENGINE_POLL_WRITE_TIMEOUT (30)
+#define ENGINE_SUBSCRIPTION_POLL_MS (1000)
+// a connection's decode stream: the mpack tree buffer and its node pages
+#define ENGINE_CONN_STREAM_MEMORY (ENGINE_MPACK_TREE_MEMCAP * 2)
+// how long new connections wait in the listen backlog for memory to free up
+// before they are shed
+#define ENGINE_MEMORY_QUEUE_SECONDS (5)
 
 static atomic_int blb_engine_stop = ATOMIC_VAR_INIT(0);
 static atomic_int blb_conn_cnt = ATOMIC_VAR_INIT(0);
@@ -116,6 +126,101 @@ int blb_conn_write_all(conn_t* th, char* _p, size_t _p_sz) {
   return (0);
 }
 
+// charges `sz` bytes against the memory limit; forced charges always
+// succeed and may overshoot the limit
+static bool blb_engine_mem_charge(engine_t* e, size_t sz, bool force) {
+  size_t used = atomic_fetch_add(&e->memory_used, sz) + sz;
+  if(force || e->memory_limit == 0 || used <= e->memory_limit) {
+    return (true);
+  }
+  atomic_fetch_sub(&e->memory_used, sz);
+  return (false);
+}
+
+static inline void blb_engine_mem_release(engine_t* e, size_t sz) {
+  atomic_fetch_sub(&e->memory_used, sz);
+}
+
+// accounting hooks for the buffers held by subscriptions and coalesced
+// queries; these are never forced, the owner drops data on a refusal
+static bool blb_engine_mem_charge_cb(void* usr, size_t sz) {
+  return (blb_engine_mem_charge((engine_t*)usr, sz, false));
+}
+
+static void blb_engine_mem_release_cb(void* usr, size_t sz) {
+  blb_engine_mem_release((engine_t*)usr, sz);
+}
+
+// whether another connection fits into the memory limit
+static inline bool blb_engine_mem_admit(engine_t* e) {
+  return (
+      e->memory_limit == 0
+      || atomic_load(&e->memory_used) + atomic_load(&e->conn_memory)
+             <= e->memory_limit);
+}
+
+static void blb_conn_capture_start(conn_t* th, size_t max) {
+  th->capture_len = 0;
+  th->capture_max = max;
+  th->capture_overflow = false;
+}
+
+static void blb_conn_capture_stop(conn_t* th) {
+  th->capture_max = 0;
+  th->capture_len = 0;
+}
+
+static void blb_conn_capture(conn_t* th, const char* p, size_t p_sz) {
+  if(th->capture_max == 0 || th->capture_overflow) { return; }
+  size_t need = th->capture_len + p_sz;
+  if(need > th->capture_max) {
+    th->capture_overflow = true;
+    return;
+  }
+  if(need > th->capture_sz) {
+    size_t sz = th->capture_sz == 0 ? ENGINE_CONN_SCRTCH_SZ : th->capture_sz;
+    while(sz < need) { sz *= 2; }
+    // the result just does not get cached when memory is short
+    if(!blb_engine_mem_charge(th->engine, sz - th->capture_sz, false)) {
+      th->capture_overflow = true;
+      return;
+    }
+    char* capture = blb_realloc(th->capture, sz);
+    if(capture == NULL) {
+      blb_engine_mem_release(th->engine, sz - th->capture_sz);
+      th->capture_overflow = true;
+      return;
+    }
+    th->capture = capture;
+    th->capture_sz = sz;
+  }
+  memcpy(th->capture + th->capture_len, p, p_sz);
+  th->capture_len = need;
+}
+
+// writes a query stream frame and records it for the query cache and for
+// connections coalesced onto this query
+static int blb_conn_write_frame(conn_t* th, char* p, size_t p_sz) {
+  blb_conn_capture(th, p, p_sz);
+  if(th->flight != NULL) {
+    blb_flight_push(th->engine->flights, th->flight, p, p_sz);
+  }
+  if(th->flight_detached) { return (0); }
+  int rc = blb_conn_write_all(th, p, p_sz);
+  if(rc != 0 && th->flight != NULL
+     && blb_flight_has_followers(th->engine->flights, th->flight)) {
+    // keep the scan going for the followers
+    L(log_warn("thread <%04lx> detached from coalesced query", th->thread));
+    th->flight_detached = true;
+    return (0);
+  }
+  return (rc);
+}
+
+static int blb_conn_write_flight(void* usr, char* p, size_t p_sz) {
+  return (blb_conn_write_all((conn_t*)usr, p, p_sz));
+}
+
 int blb_conn_query_stream_start_response(conn_t* th) {
   if(blb_engine_poll_stop() > 0) {
     L(log_notice("thread <%04lx> engine stop detected", th->thread));
@@ -129,7 +234,7 @@ int blb_conn_query_stream_start_response(conn_t* th) {
     return (-1);
   }
 
-  return (blb_conn_write_all(th, th->scrtch, used));
+  return (blb_conn_write_frame(th, th->scrtch, used));
 }
 
 int blb_conn_dump_entry(conn_t* th, const protocol_entry_t* entry) {
@@ -151,6 +256,75 @@ int blb_conn_dump_entry(conn_t* th, const protocol_entry_t* entry) {
   return (blb_conn_write_all(th, th->scrtch, used));
 }
 
+int blb_conn_replicate_batch(conn_t* th, const protocol_replicate_batch_t* b) {
+  if(blb_engine_poll_stop() > 0) {
+    L(log_notice("thread <%04lx> engine stop detected", th->thread));
+    return (-1);
+  }
+
+  // the outer message is assembled behind the inner one
+  size_t need = 2 * (b->data_len + 64);
+  if(need > ENGINE_REPLICATE_FRAME_MAX) {
+    L(log_error("write batch of `%zu` bytes exceeds frame limit", b->data_len));
+    return (-1);
+  }
+  char* p = th->scrtch;
+  size_t p_sz = ENGINE_CONN_SCRTCH_SZ;
+  if(need > p_sz) {
+    p = blb_malloc(need);
+    if(p == NULL) { return (-1); }
+    p_sz = need;
+  }
+
+  int rc = -1;
+  ssize_t used = blb_protocol_encode_replicate_batch(b, p, p_sz);
+  if(used <= 0) {
+    L(log_error("blb_protocol_encode_replicate_batch() failed"));
+  } else {
+    rc = blb_conn_write_all(th, p, used);
+  }
+  if(p != th->scrtch) { blb_free(p); }
+  return (rc);
+}
+
+int blb_conn_info_response(conn_t* th, const char* text, size_t text_len) {
+  // the outer message is assembled behind the inner one
+  size_t need = 2 * (text_len + 64);
+  char* p = th->scrtch;
+  size_t p_sz = ENGINE_CONN_SCRTCH_SZ;
+  if(need > p_sz) {
+    p = blb_malloc(need);
+    if(p == NULL) { return (-1); }
+    p_sz = need;
+  }
+
+  int rc = -1;
+  protocol_info_response_t r = {.text = text, .text_len = text_len};
+  ssize_t used = blb_protocol_encode_info_response(&r, p, p_sz);
+  if(used <= 0) {
+    L(log_error("blb_protocol_encode_info_response() failed"));
+  } else {
+    rc = blb_conn_write_all(th, p, used);
+  }
+  if(p != th->scrtch) { blb_free(p); }
+  return (rc);
+}
+
+// a buffer of at least `sz` bytes for frames larger than the scratch buffer
+static char* blb_conn_frame_buffer(conn_t* th, size_t sz) {
+  if(sz <= th->frame_sz) { return (th->frame); }
+  (void)blb_engine_mem_charge(th->engine, sz - th->frame_sz, true);
+  char* frame = blb_realloc(th->frame, sz);
+  if(frame == NULL) {
+    blb_engine_mem_release(th->engine, sz - th->frame_sz);
+    L(log_error("unable to allocate a frame of `%zu` bytes", sz));
+    return (NULL);
+  }
+  th->frame = frame;
+  th->frame_sz = sz;
+  return (frame);
+}
+
 int blb_conn_query_stream_push_response(
     conn_t* th, const protocol_entry_t* entry) {
   T(log_debug("query stream push entry"));
@@ -161,14 +335,27 @@ int blb_conn_query_stream_push_response(
     return (-1);
   }
 
-  ssize_t used = blb_protocol_encode_stream_entry(
-      entry, th->scrtch, ENGINE_CONN_SCRTCH_SZ);
+  char* p = th->scrtch;
+  size_t p_sz = ENGINE_CONN_SCRTCH_SZ;
+  if(entry->hist_len > 0) {
+    // the outer message is assembled behind the inner one
+    size_t need = 2
+                  * (entry->rrname_len + entry->rrtype_len + entry->rdata_len
+                     + entry->sensorid_len + entry->hist_len * 2 * 5 + 256);
+    if(need > p_sz) {
+      p = blb_conn_frame_buffer(th, need);
+      if(p == NULL) { return (-1); }
+      p_sz = need;
+    }
+  }
+
+  ssize_t used = blb_protocol_encode_stream_entry(entry, p, p_sz);
   if(used <= 0) {
     L(log_error("blb_protocol_encode_stream_entry() failed"));
     return (-1);
   }
 
-  return (blb_conn_write_all(th, th->scrtch, used));
+  return (blb_conn_write_frame(th, p, used));
 }
 
 int blb_conn_query_stream_end_response(conn_t* th) {
@@ -187,7 +374,7 @@ int blb_conn_query_stream_end_response(conn_t* th) {
   X(log_debug(
       "blb_protocol_encode_stream_end_response() returned `%zd`", used));
 
-  return (blb_conn_write_all(th, th->scrtch, used));
+  return (blb_conn_write_frame(th, th->scrtch, used));
 }
 
 static conn_t* blb_engine_conn_new(engine_t* e, int fd) {
@@ -206,11 +393,30 @@ static conn_t* blb_engine_conn_new(engine_t* e, int fd) {
   }
   th->engine = e;
   th->fd = fd;
+  th->capture = NULL;
+  th->capture_len = 0;
+  th->capture_sz = 0;
+  th->capture_max = 0;
+  th->capture_overflow = false;
+  th->flight = NULL;
+  th->flight_detached = false;
+  th->frame = NULL;
+  th->frame_sz = 0;
+  // admission was checked before accepting
+  th->charged = sizeof(conn_t) + th->usr_ctx_sz + ENGINE_CONN_STREAM_MEMORY;
+  (void)blb_engine_mem_charge(e, th->charged, true);
+  atomic_store(&e->conn_memory, th->charged);
   return (th);
 }
 
+// gives the connection's memory back to its engine, so a client tears its
+// connection down before the engine
 void blb_engine_conn_teardown(conn_t* th) {
+  blb_engine_mem_release(
+      th->engine, th->charged + th->capture_sz + th->frame_sz);
   if(th->db != NULL) { blb_dbi_conn_deinit(th, th->db); }
+  if(th->capture != NULL) { blb_free(th->capture); }
+  if(th->frame != NULL) { blb_free(th->frame); }
   close(th->fd);
   blb_free(th);
 }
@@ -247,13 +453,158 @@ static inline int blb_engine_conn_consume_dump(
   return (0);
 }
 
+static inline int blb_engine_conn_consume_replicate(
+    conn_t* th, const protocol_replicate_request_t* replicate) {
+  V(log_notice(
+      "thread <%04lx> replication requested since sequence `%" PRIu64 "`",
+      th->thread,
+      replicate->since));
+  int rc = blb_dbi_replicate(th, replicate);
+  if(rc != 0) { L(log_error("blb_dbi_replicate() failed")); }
+  return (rc);
+}
+
+static inline int blb_engine_conn_consume_info(
+    conn_t* th, const protocol_info_request_t* info) {
+  int rc = blb_dbi_info(th, info);
+  if(rc != 0) {
+    L(log_error(
+        "info on `%.*s` not available", (int)info->topic_len, info->topic));
+  }
+  return (rc);
+}
+
+static inline int blb_engine_conn_consume_purge(
+    conn_t* th, const protocol_purge_request_t* purge) {
+  L(log_notice(
+      "thread <%04lx> purge of sensor `%.*s` requested",
+      th->thread,
+      (int)purge->sensorid_len,
+      purge->sensorid));
+  int rc = blb_dbi_purge(th, purge);
+  if(rc != 0) {
+    L(log_error("blb_dbi_purge() failed"));
+    return (rc);
+  }
+  return (0);
+}
+
+static inline int blb_engine_conn_consume_verify(
+    conn_t* th, const protocol_verify_request_t* verify) {
+  L(log_notice(
+      "thread <%04lx> index %s requested",
+      th->thread,
+      verify->repair ? "repair" : "verification"));
+  int rc = blb_dbi_verify(th, verify);
+  if(rc != 0) {
+    L(log_error("blb_dbi_verify() failed"));
+    return (rc);
+  }
+  // repaired index entries change what rdata queries return
+  if(verify->repair) { blb_qcache_invalidate_all(); }
+  return (0);
+}
+
 static inline int blb_engine_conn_consume_query(
     conn_t* th, const protocol_query_request_t* query) {
+  qcache_t* qc = th->engine->qcache;
+  flight_group_t* fg = th->engine->flights;
+  qcache_key_t __key, *key = &__key;
+  if((qc != NULL || fg != NULL) && blb_qcache_key(qc, query, key) != 0) {
+    qc = NULL;
+    fg = NULL;
+  }
+
+  uint64_t epoch = 0;
+  if(qc != NULL) {
+    qcache_entry_t* hit = blb_qcache_lookup(qc, key);
+    if(hit != NULL) {
+      X(log_debug("query cache hit `%zu` bytes", hit->frames_len));
+      int rc = blb_conn_write_all(th, hit->frames, hit->frames_len);
+      blb_qcache_release(hit);
+      return (rc);
+    }
+    epoch = blb_qcache_epoch(qc, key);
+  }
+
+  if(fg != NULL) {
+    bool leader = false;
+    flight_cursor_t cursor;
+    flight_t* f = blb_flight_join(fg, key, &leader, &cursor);
+    if(f != NULL && !leader) {
+      X(log_debug("thread <%04lx> following in-flight query", th->thread));
+      int rc = blb_flight_follow(fg, f, &cursor, blb_conn_write_flight, th);
+      if(rc == 0) { return (0); }
+      if(rc != FLIGHT_RERUN) {
+        L(log_error("coalesced query failed"));
+        return (-1);
+      }
+      L(log_notice(
+          "thread <%04lx> fell behind a coalesced query; running it alone",
+          th->thread));
+      f = NULL;
+    }
+    th->flight = f;
+    th->flight_detached = false;
+  }
+
+  if(qc != NULL) { blb_conn_capture_start(th, blb_qcache_entry_max(qc)); }
   int query_ok = blb_dbi_query(th, query);
+  if(th->flight != NULL) {
+    blb_flight_finish(fg, th->flight, query_ok);
+    th->flight = NULL;
+  }
+  if(qc != NULL) {
+    if(query_ok == 0 && !th->capture_overflow) {
+      blb_qcache_insert(qc, key, epoch, th->capture, th->capture_len);
+    }
+    blb_conn_capture_stop(th);
+  }
   if(query_ok != 0) {
     L(log_error("blb_dbi_query() failed"));
     return (-1);
   }
+  if(th->flight_detached) {
+    th->flight_detached = false;
+    return (-1);
+  }
+  return (0);
+}
+
+// the peer closed the connection; it is not expected to send anything while
+// it is being streamed to
+static bool blb_conn_closed(conn_t* th) {
+  char c;
+  ssize_t rc = recv(th->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK));
+}
+
+static inline int blb_engine_conn_consume_subscribe(
+    conn_t* th, const protocol_query_request_t* query) {
+  subs_t* subs = th->engine->subs;
+  if(subs == NULL) {
+    L(log_error("subscriptions are disabled"));
+    return (-1);
+  }
+  sub_t* sub = blb_subs_add(subs, query);
+  if(sub == NULL) {
+    L(log_error("unable to subscribe; an rrname or rdata is required"));
+    return (-1);
+  }
+  V(log_info("thread <%04lx> subscribed", th->thread));
+
+  int rc = blb_conn_query_stream_start_response(th);
+  while(rc == 0 && blb_engine_poll_stop() == 0) {
+    sub_frame_t* frames = blb_subs_take(sub, ENGINE_SUBSCRIPTION_POLL_MS);
+    if(frames == NULL && blb_conn_closed(th)) { break; }
+    for(sub_frame_t* fr = frames; fr != NULL && rc == 0; fr = fr->next) {
+      rc = blb_conn_write_all(th, fr->p, fr->len);
+    }
+    blb_subs_frames_free(subs, frames);
+  }
+  blb_subs_remove(subs, sub);
+  V(log_info("thread <%04lx> unsubscribed", th->thread));
+  if(rc == 0) { (void)blb_conn_query_stream_end_response(th); }
   return (0);
 }
 
@@ -265,6 +616,12 @@ static inline int blb_engine_conn_consume_input(
     L(log_error("blb_dbi_input() failed"));
     return (-1);
   }
+  if(th->engine->qcache != NULL) {
+    blb_qcache_bump(th->engine->qcache, &input->entry);
+  }
+  if(th->engine->subs != NULL) {
+    blb_subs_publish(th->engine->subs, &input->entry);
+  }
   return (0);
 }
 
@@ -279,6 +636,16 @@ static inline int blb_engine_conn_consume(conn_t* th, protocol_message_t* msg) {
   case PROTOCOL_DUMP_REQUEST:
     blb_engine_stats_bump(th->engine, ENGINE_STATS_DUMPS);
     return (blb_engine_conn_consume_dump(th, &msg->u.dump));
+  case PROTOCOL_REPLICATE_REQUEST:
+    return (blb_engine_conn_consume_replicate(th, &msg->u.replicate));
+  case PROTOCOL_SUBSCRIBE_REQUEST:
+    return (blb_engine_conn_consume_subscribe(th, &msg->u.query));
+  case PROTOCOL_INFO_REQUEST:
+    return (blb_engine_conn_consume_info(th, &msg->u.info));
+  case PROTOCOL_PURGE_REQUEST:
+    return (blb_engine_conn_consume_purge(th, &msg->u.purge));
+  case PROTOCOL_VERIFY_REQUEST:
+    return (blb_engine_conn_consume_verify(th, &msg->u.verify));
   case PROTOCOL_QUERY_REQUEST:
     blb_engine_stats_bump(th->engine, ENGINE_STATS_QUERIES);
     return (blb_engine_conn_consume_query(th, &msg->u.query));
@@ -290,11 +657,12 @@ static inline int blb_engine_conn_consume(conn_t* th, protocol_message_t* msg) {
 }
 
 protocol_stream_t* blb_engine_stream_new(conn_t* c) {
+  return (blb_engine_stream_new_max(c, ENGINE_MPACK_TREE_MEMCAP));
+}
+
+protocol_stream_t* blb_engine_stream_new_max(conn_t* c, size_t max_sz) {
   protocol_stream_t* stream = blb_protocol_stream_new(
-      c,
-      blb_conn_read_stream_cb,
-      ENGINE_MPACK_TREE_MEMCAP,
-      ENGINE_MPACK_TREE_NODES_LIMIT);
+      c, blb_conn_read_stream_cb, max_sz, ENGINE_MPACK_TREE_NODES_LIMIT);
   return (stream);
 }
 
@@ -327,8 +695,12 @@ static void* blb_engine_conn_fn(void* usr) {
     }
     int th_rc = blb_engine_conn_consume(th, &msg);
     if(th_rc != 0) { goto thread_exit; }
-    if(msg.ty == PROTOCOL_DUMP_REQUEST || msg.ty == PROTOCOL_BACKUP_REQUEST) {
-      V(log_notice("closing client connection after dump or backup request"));
+    if(msg.ty == PROTOCOL_DUMP_REQUEST || msg.ty == PROTOCOL_BACKUP_REQUEST
+       || msg.ty == PROTOCOL_REPLICATE_REQUEST
+       || msg.ty == PROTOCOL_SUBSCRIBE_REQUEST) {
+      V(log_notice(
+          "closing client connection after dump, backup, replicate or "
+          "subscribe request"));
       goto thread_exit;
     }
   }
@@ -381,9 +753,53 @@ engine_t* blb_engine_server_new(const engine_config_t* config) {
   }
 
   e->conn_throttle_limit = config->conn_throttle_limit;
+  e->memory_limit = config->memory_limit;
+  atomic_init(&e->memory_used, 0);
+  atomic_init(&e->conn_memory, sizeof(conn_t) + ENGINE_CONN_STREAM_MEMORY);
+  atomic_init(&e->shed, 0);
   e->enable_signal_consumer = config->enable_signal_consumer;
   e->enable_stats_reporter = config->enable_stats_reporter;
   e->db = config->db;
+  e->qcache = NULL;
+  if(config->query_cache_size > 0) {
+    e->qcache = blb_qcache_new(config->query_cache_size);
+    if(e->qcache == NULL) {
+      L(log_error("unable to allocate query cache"));
+      close(fd);
+      blb_free(e);
+      return (NULL);
+    }
+    V(log_info("query cache size `%zu`", config->query_cache_size));
+  }
+  e->flights = NULL;
+  if(config->enable_query_coalescing) {
+    e->flights = blb_flight_group_new(ENGINE_FLIGHT_BUFFER_MAX);
+    if(e->flights == NULL) {
+      L(log_error("unable to allocate query coalescing table"));
+      blb_qcache_teardown(e->qcache);
+      close(fd);
+      blb_free(e);
+      return (NULL);
+    }
+    e->flights->mem_charge = blb_engine_mem_charge_cb;
+    e->flights->mem_release = blb_engine_mem_release_cb;
+    e->flights->mem_usr = e;
+  }
+  e->subs = NULL;
+  if(config->enable_subscriptions) {
+    e->subs = blb_subs_new(ENGINE_SUBSCRIPTION_QUEUE_MAX);
+    if(e->subs == NULL) {
+      L(log_error("unable to allocate subscription index"));
+      blb_flight_group_teardown(e->flights);
+      blb_qcache_teardown(e->qcache);
+      close(fd);
+      blb_free(e);
+      return (NULL);
+    }
+    e->subs->mem_charge = blb_engine_mem_charge_cb;
+    e->subs->mem_release = blb_engine_mem_release_cb;
+    e->subs->mem_usr = e;
+  }
   e->listen_fd = fd;
   e->stats.interval = 10;
   for(int i = 0; i < ENGINE_STATS_N; i++) {
@@ -399,6 +815,15 @@ engine_t* blb_engine_server_new(const engine_config_t* config) {
   return (e);
 }
 
+// responses are written as many small frames; without this every frame
+// after the first waits for the peer's delayed ack
+static void blb_engine_sock_nodelay(int fd) {
+  int one = 1;
+  if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+    L(log_warn("setsockopt(TCP_NODELAY) failed: `%s`", strerror(errno)));
+  }
+}
+
 static int blb_engine_client_connect(const char* host, int port) {
   struct sockaddr_in addr;
   int addr_ok = inet_pton(AF_INET, host, &addr.sin_addr);
@@ -413,6 +838,7 @@ static int blb_engine_client_connect(const char* host, int port) {
     close(fd);
     return (-1);
   }
+  blb_engine_sock_nodelay(fd);
   return (fd);
 }
 
@@ -428,6 +854,13 @@ conn_t* blb_engine_client_new(const engine_config_t* config) {
     return (NULL);
   }
   e->db = NULL;
+  e->qcache = NULL;
+  e->flights = NULL;
+  e->subs = NULL;
+  e->memory_limit = 0;
+  atomic_init(&e->memory_used, 0);
+  atomic_init(&e->conn_memory, 0);
+  atomic_init(&e->shed, 0);
 
   conn_t* c = blb_engine_conn_new(e, fd);
   if(c == NULL) {
@@ -506,6 +939,37 @@ static void* blb_engine_stats_report(void* usr) {
         blb_stats_slurp(&e->stats, ENGINE_STATS_BYTES_SEND),
         blb_stats_slurp(&e->stats, ENGINE_STATS_BYTES_RECV),
         blb_stats_slurp(&e->stats, ENGINE_STATS_CONNECTIONS)));
+    if(e->qcache != NULL) {
+      unsigned long long hits = atomic_exchange(&e->qcache->hits, 0);
+      unsigned long long misses = atomic_exchange(&e->qcache->misses, 0);
+      L(log_notice(
+          "query cache hits `%llu` misses `%llu` hit rate `%.1f%%` used `%zu` "
+          "cap `%zu`",
+          hits,
+          misses,
+          hits + misses > 0 ? 100.0 * (double)hits / (double)(hits + misses)
+                            : 0.0,
+          e->qcache->used,
+          e->qcache->memcap));
+    }
+    if(e->flights != NULL) {
+      L(log_notice("query coalescing leaders `%llu` followers `%llu`",
+                   atomic_exchange(&e->flights->leaders, 0),
+                   atomic_exchange(&e->flights->followers, 0)));
+    }
+    if(e->memory_limit > 0) {
+      L(log_notice("connection memory used `%zu` limit `%zu` shed `%llu`",
+                   atomic_load(&e->memory_used),
+                   e->memory_limit,
+                   atomic_exchange(&e->shed, 0)));
+    }
+    if(e->subs != NULL && atomic_load(&e->subs->active) > 0) {
+      L(log_notice("subscriptions `%d` matches `%llu` dropped `%llu`",
+                   atomic_load(&e->subs->active),
+                   atomic_exchange(&e->subs->matches, 0),
+                   atomic_exchange(&e->subs->dropped, 0)));
+    }
+    if(e->db != NULL) { blb_dbi_stats(e->db); }
     e->stats.last = ts;
     (void)pthread_mutex_unlock(&m);
   }
@@ -545,6 +1009,7 @@ void blb_engine_run(engine_t* e) {
 
   fd_set fds;
   struct timeval to;
+  time_t over_since = 0;
   while(1) {
   timeout_retry:
     if(blb_engine_poll_stop() > 0) {
@@ -556,6 +1021,22 @@ void blb_engine_run(engine_t* e) {
       L(log_warn("thread throttle reached"));
       goto timeout_retry;
     }
+    // over the memory limit new connections queue up in the listen backlog
+    // for a while, after that they are shed so that clients fail fast
+    bool shed = false;
+    if(blb_engine_mem_admit(e)) {
+      over_since = 0;
+    } else if(over_since == 0
+              || time(NULL) - over_since < ENGINE_MEMORY_QUEUE_SECONDS) {
+      if(over_since == 0) {
+        over_since = time(NULL);
+        L(log_warn("memory limit reached, queueing new connections"));
+      }
+      blb_engine_sleep(1);
+      goto timeout_retry;
+    } else {
+      shed = true;
+    }
     FD_ZERO(&fds);
     FD_SET(e->listen_fd, &fds);
     to.tv_sec = 5;
@@ -574,6 +1055,12 @@ void blb_engine_run(engine_t* e) {
       blb_engine_request_stop();
       goto teardown;
     }
+    if(shed) {
+      atomic_fetch_add(&e->shed, 1);
+      close(fd);
+      goto timeout_retry;
+    }
+    blb_engine_sock_nodelay(fd);
     conn_t* th = blb_engine_conn_new(e, fd);
     if(th == NULL) {
       L(log_error("blb_engine_conn_new() failed"));
@@ -597,5 +1084,8 @@ teardown:
 }
 
 void blb_engine_teardown(engine_t* e) {
+  blb_qcache_teardown(e->qcache);
+  blb_flight_group_teardown(e->flights);
+  blb_subs_teardown(e->subs);
   blb_free(e);
 }
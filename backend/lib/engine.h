@@ -5,15 +5,21 @@
 #define __ENGINE_H
 
 #include <alloc.h>
+#include <flight.h>
 #include <inttypes.h>
 #include <protocol.h>
 #include <pthread.h>
+#include <qcache.h>
 #include <stdatomic.h>
+#include <subscribe.h>
 #include <time.h>
 #include <trace.h>
 
 #define ENGINE_CONN_SCRTCH_SZ (1024 * 10)
 #define ENGINE_CONN_SCRTCH_BUFFERS (10)
+#define ENGINE_FLIGHT_BUFFER_MAX (64 * 1024 * 1024)
+#define ENGINE_REPLICATE_FRAME_MAX (64 * 1024 * 1024)
+#define ENGINE_SUBSCRIPTION_QUEUE_MAX (16 * 1024 * 1024)
 
 typedef int socket_t;
 
@@ -33,6 +39,20 @@ struct dbi_t {
   int (*input)(conn_t* th, const protocol_input_request_t* input);
   void (*backup)(conn_t* th, const protocol_backup_request_t* backup);
   void (*dump)(conn_t* th, const protocol_dump_request_t* dump);
+  // optional; called periodically by the engine stats reporter
+  void (*stats)(db_t* db);
+  // optional; streams write batches to a follower until the connection or
+  // the engine stops
+  int (*replicate)(conn_t* th, const protocol_replicate_request_t* r);
+  // optional; answers with one `blb_conn_info_response()` or fails for
+  // unknown topics
+  int (*info)(conn_t* th, const protocol_info_request_t* r);
+  // optional; deletes a sensor's data and answers with one
+  // `blb_conn_info_response()`
+  int (*purge)(conn_t* th, const protocol_purge_request_t* r);
+  // optional; cross-checks the indexes and answers with one
+  // `blb_conn_info_response()`
+  int (*verify)(conn_t* th, const protocol_verify_request_t* r);
 };
 
 struct db_t {
@@ -60,7 +80,15 @@ struct engine_stats_t {
 struct engine_t {
   engine_stats_t stats;
   int conn_throttle_limit;
+  // connection memory accounting; `0` means unlimited
+  size_t memory_limit;
+  atomic_size_t memory_used;
+  atomic_size_t conn_memory;
+  atomic_ullong shed;
   db_t* db;
+  qcache_t* qcache;
+  flight_group_t* flights;
+  subs_t* subs;
   socket_t listen_fd;
   bool enable_stats_reporter;
   bool enable_signal_consumer;
@@ -75,6 +103,17 @@ struct conn_t {
   void* usr_ctx;
   size_t usr_ctx_sz;
   socket_t fd;
+  char* capture;
+  size_t capture_len;
+  size_t capture_sz;
+  size_t capture_max;
+  bool capture_overflow;
+  flight_t* flight;
+  bool flight_detached;
+  size_t charged;
+  // frames that outgrow `scrtch`, entries with a histogram; grown on demand
+  char* frame;
+  size_t frame_sz;
   char scrtch[ENGINE_CONN_SCRTCH_SZ];
 };
 
@@ -118,6 +157,33 @@ static inline void blb_dbi_dump(conn_t* th, const protocol_dump_request_t* d) {
   th->db->dbi->dump(th, d);
 }
 
+static inline void blb_dbi_stats(db_t* db) {
+  if(db->dbi->stats != NULL) { db->dbi->stats(db); }
+}
+
+static inline int blb_dbi_replicate(
+    conn_t* th, const protocol_replicate_request_t* r) {
+  if(th->db->dbi->replicate == NULL) { return (-1); }
+  return (th->db->dbi->replicate(th, r));
+}
+
+static inline int blb_dbi_info(conn_t* th, const protocol_info_request_t* r) {
+  if(th->db->dbi->info == NULL) { return (-1); }
+  return (th->db->dbi->info(th, r));
+}
+
+static inline int blb_dbi_purge(
+    conn_t* th, const protocol_purge_request_t* r) {
+  if(th->db->dbi->purge == NULL) { return (-1); }
+  return (th->db->dbi->purge(th, r));
+}
+
+static inline int blb_dbi_verify(
+    conn_t* th, const protocol_verify_request_t* r) {
+  if(th->db->dbi->verify == NULL) { return (-1); }
+  return (th->db->dbi->verify(th, r));
+}
+
 static inline void blb_engine_stats_bump(
     engine_t* engine, enum engine_stats_counter_t counter) {
   if(counter < 0 || counter >= ENGINE_STATS_N) { return; }
@@ -138,9 +204,13 @@ struct engine_config_t {
   bool is_server;
   bool enable_signal_consumer;
   bool enable_stats_reporter;
+  bool enable_query_coalescing;
+  bool enable_subscriptions;
   db_t* db;
   const char* host;
   int port;
+  size_t query_cache_size;
+  size_t memory_limit;
 };
 
 static inline engine_config_t blb_engine_server_config_init() {
@@ -148,9 +218,13 @@ static inline engine_config_t blb_engine_server_config_init() {
                             .conn_throttle_limit = 64,
                             .is_server = true,
                             .enable_stats_reporter = true,
+                            .enable_query_coalescing = true,
+                            .enable_subscriptions = true,
                             .enable_signal_consumer = true,
                             .host = "127.0.0.1",
-                            .port = 4242});
+                            .port = 4242,
+                            .query_cache_size = 0,
+                            .memory_limit = 0});
 }
 
 static inline engine_config_t blb_engine_client_config_init() {
@@ -158,9 +232,13 @@ static inline engine_config_t blb_engine_client_config_init() {
                             .conn_throttle_limit = 64,
                             .is_server = false,
                             .enable_stats_reporter = true,
+                            .enable_query_coalescing = false,
+                            .enable_subscriptions = false,
                             .enable_signal_consumer = true,
                             .host = "127.0.0.1",
-                            .port = 4242});
+                            .port = 4242,
+                            .query_cache_size = 0,
+                            .memory_limit = 0});
 }
 
 void blb_engine_signals_init(void);
@@ -170,6 +248,7 @@ void blb_engine_teardown(engine_t* e);
 void blb_engine_run(engine_t* e);
 void blb_engine_request_stop(void);
 protocol_stream_t* blb_engine_stream_new(conn_t* c);
+protocol_stream_t* blb_engine_stream_new_max(conn_t* c, size_t max_sz);
 int blb_conn_write_all(conn_t* th, char* _p, size_t _p_sz);
 void blb_engine_conn_teardown(conn_t* th);
 
@@ -177,5 +256,7 @@ int blb_conn_query_stream_start_response(conn_t* th);
 int blb_conn_query_stream_push_response(conn_t*, const protocol_entry_t* entry);
 int blb_conn_query_stream_end_response(conn_t* th);
 int blb_conn_dump_entry(conn_t* th, const protocol_entry_t* entry);
+int blb_conn_replicate_batch(conn_t* th, const protocol_replicate_batch_t* b);
+int blb_conn_info_response(conn_t* th, const char* text, size_t text_len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,321 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <alloc.h>
+#include <flight.h>
+#include <string.h>
+#include <trace.h>
+
+#define FLIGHT_BUCKETS (256)
+
+flight_group_t* blb_flight_group_new(size_t max_buffered) {
+  flight_group_t* g = blb_new(flight_group_t);
+  if(g == NULL) { return (NULL); }
+  g->max_buffered = max_buffered;
+  g->mem_charge = NULL;
+  g->mem_release = NULL;
+  g->mem_usr = NULL;
+  g->n_buckets = FLIGHT_BUCKETS;
+  g->buckets = blb_calloc(g->n_buckets, sizeof(flight_t*));
+  if(g->buckets == NULL) {
+    blb_free(g);
+    return (NULL);
+  }
+  atomic_init(&g->leaders, 0);
+  atomic_init(&g->followers, 0);
+  pthread_mutex_init(&g->lock, NULL);
+  return (g);
+}
+
+void blb_flight_group_teardown(flight_group_t* g) {
+  if(g == NULL) { return; }
+  // all connections are gone by now, so are all flights
+  blb_free(g->buckets);
+  pthread_mutex_destroy(&g->lock);
+  blb_free(g);
+}
+
+static void blb_flight_frame_free(flight_group_t* g, flight_frame_t* fr) {
+  if(g->mem_release != NULL) {
+    g->mem_release(g->mem_usr, sizeof(flight_frame_t) + fr->len);
+  }
+  blb_free(fr);
+}
+
+static void blb_flight_frames_free(flight_group_t* g, flight_t* f) {
+  flight_frame_t* fr = f->head;
+  while(fr != NULL) {
+    flight_frame_t* next = fr->next;
+    blb_flight_frame_free(g, fr);
+    fr = next;
+  }
+  f->head = NULL;
+  f->tail = &f->head;
+  f->held = 0;
+}
+
+// must be called with the flight lock held. frees the frames all followers
+// sent on, keeping the one each sent last as its position, and cuts off the
+// slowest followers while more than `max_buffered` bytes remain
+static void blb_flight_trim(flight_group_t* g, flight_t* f) {
+  for(;;) {
+    uint64_t min = f->seq;
+    for(flight_cursor_t* c = f->cursors; c != NULL; c = c->next) {
+      if(!c->cut && c->seq < min) { min = c->seq; }
+    }
+    while(f->head != NULL && f->head->seq + 1 < min) {
+      flight_frame_t* fr = f->head;
+      f->head = fr->next;
+      if(f->head == NULL) { f->tail = &f->head; }
+      f->held -= fr->len;
+      bool pinned = false;
+      for(flight_cursor_t* c = f->cursors; c != NULL; c = c->next) {
+        if(c->pin == fr) {
+          c->pin_dropped = true;
+          pinned = true;
+        }
+      }
+      if(!pinned) { blb_flight_frame_free(g, fr); }
+    }
+    if(f->held <= g->max_buffered) { return; }
+    bool cut = false;
+    for(flight_cursor_t* c = f->cursors; c != NULL; c = c->next) {
+      if(!c->cut && c->seq == min) {
+        c->cut = true;
+        cut = true;
+      }
+    }
+    if(!cut) { return; }
+    L(log_warn("cut off followers lagging `%zu` bytes behind a coalesced query",
+               f->held));
+  }
+}
+
+static void blb_flight_release(flight_group_t* g, flight_t* f) {
+  pthread_mutex_lock(&g->lock);
+  f->refs -= 1;
+  bool last = f->refs == 0;
+  pthread_mutex_unlock(&g->lock);
+  if(!last) { return; }
+  blb_flight_frames_free(g, f);
+  pthread_cond_destroy(&f->cond);
+  pthread_mutex_destroy(&f->lock);
+  blb_free(f);
+}
+
+// must be called with the group lock held
+static void blb_flight_unlink(flight_group_t* g, flight_t* f) {
+  if(!f->linked) { return; }
+  flight_t** pp = &g->buckets[f->key.h & (g->n_buckets - 1)];
+  while(*pp != NULL && *pp != f) { pp = &(*pp)->next; }
+  if(*pp == f) { *pp = f->next; }
+  f->linked = false;
+}
+
+flight_t* blb_flight_join(
+    flight_group_t* g,
+    const qcache_key_t* key,
+    bool* leader,
+    flight_cursor_t* cursor) {
+  pthread_mutex_lock(&g->lock);
+  flight_t** bucket = &g->buckets[key->h & (g->n_buckets - 1)];
+  for(flight_t* f = *bucket; f != NULL; f = f->next) {
+    if(f->open && f->key.h == key->h && f->key.len == key->len
+       && memcmp(f->key.p, key->p, key->len) == 0) {
+      f->refs += 1;
+      // registered before the group lock is dropped, so the leader never
+      // trims frames a joined follower has yet to send
+      pthread_mutex_lock(&f->lock);
+      cursor->seq = 0;
+      cursor->pin = NULL;
+      cursor->pin_dropped = false;
+      cursor->cut = false;
+      cursor->next = f->cursors;
+      f->cursors = cursor;
+      pthread_mutex_unlock(&f->lock);
+      pthread_mutex_unlock(&g->lock);
+      atomic_fetch_add(&g->followers, 1);
+      *leader = false;
+      return (f);
+    }
+  }
+
+  flight_t* f = blb_new(flight_t);
+  if(f == NULL) {
+    pthread_mutex_unlock(&g->lock);
+    return (NULL);
+  }
+  f->refs = 1;
+  f->open = true;
+  f->linked = true;
+  f->key.h = key->h;
+  f->key.epoch_slot = key->epoch_slot;
+  f->key.len = key->len;
+  memcpy(f->key.p, key->p, key->len);
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_cond_init(&f->cond, NULL);
+  f->head = NULL;
+  f->tail = &f->head;
+  f->cursors = NULL;
+  f->seq = 0;
+  f->held = 0;
+  f->done = false;
+  f->failed = false;
+  f->rc = 0;
+  f->buffered = 0;
+  f->buffering = true;
+  f->next = *bucket;
+  *bucket = f;
+  pthread_mutex_unlock(&g->lock);
+  atomic_fetch_add(&g->leaders, 1);
+  *leader = true;
+  return (f);
+}
+
+void blb_flight_push(
+    flight_group_t* g, flight_t* f, const char* p, size_t len) {
+  if(!f->buffering) { return; }
+
+  f->buffered += len;
+  if(f->open && f->buffered > g->max_buffered) {
+    pthread_mutex_lock(&g->lock);
+    f->open = false;
+    bool followers = f->refs > 1;
+    pthread_mutex_unlock(&g->lock);
+    if(!followers) {
+      X(log_debug("flight exceeded `%zu` bytes without followers",
+                  g->max_buffered));
+      f->buffering = false;
+      pthread_mutex_lock(&f->lock);
+      blb_flight_frames_free(g, f);
+      pthread_mutex_unlock(&f->lock);
+      return;
+    }
+  }
+
+  size_t sz = sizeof(flight_frame_t) + len;
+  bool charged = g->mem_charge == NULL || g->mem_charge(g->mem_usr, sz);
+  flight_frame_t* fr = charged ? blb_malloc(sz) : NULL;
+  if(fr == NULL && charged && g->mem_release != NULL) {
+    g->mem_release(g->mem_usr, sz);
+  }
+  if(!charged) {
+    // the stream has a gap from here on, so nobody may join anymore
+    pthread_mutex_lock(&g->lock);
+    f->open = false;
+    pthread_mutex_unlock(&g->lock);
+    f->buffering = false;
+  }
+  pthread_mutex_lock(&f->lock);
+  if(!charged) {
+    // followers that sent nothing yet run the query themselves
+    L(log_warn("memory limit reached; cutting off followers of a query"));
+    for(flight_cursor_t* c = f->cursors; c != NULL; c = c->next) {
+      c->cut = true;
+    }
+  } else if(fr == NULL) {
+    L(log_error("unable to buffer query frame for followers"));
+    f->failed = true;
+  } else {
+    fr->next = NULL;
+    fr->seq = f->seq++;
+    fr->len = len;
+    memcpy(fr->p, p, len);
+    *f->tail = fr;
+    f->tail = &fr->next;
+    f->held += len;
+  }
+  // nobody joins a closed flight, so frames only need to be kept for the
+  // followers still attached
+  if(!f->open) {
+    blb_flight_trim(g, f);
+    if(f->cursors == NULL) {
+      f->buffering = false;
+      blb_flight_frames_free(g, f);
+    }
+  }
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&f->lock);
+}
+
+bool blb_flight_has_followers(flight_group_t* g, flight_t* f) {
+  pthread_mutex_lock(&g->lock);
+  bool followers = f->refs > 1;
+  pthread_mutex_unlock(&g->lock);
+  return (followers);
+}
+
+void blb_flight_finish(flight_group_t* g, flight_t* f, int rc) {
+  pthread_mutex_lock(&g->lock);
+  blb_flight_unlink(g, f);
+  pthread_mutex_unlock(&g->lock);
+
+  pthread_mutex_lock(&f->lock);
+  f->done = true;
+  f->rc = rc;
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&f->lock);
+
+  blb_flight_release(g, f);
+}
+
+int blb_flight_follow(
+    flight_group_t* g,
+    flight_t* f,
+    flight_cursor_t* cursor,
+    flight_write_t write,
+    void* usr) {
+  flight_frame_t* cur = NULL;
+  int rc = 0;
+  for(;;) {
+    pthread_mutex_lock(&f->lock);
+    flight_frame_t* next = NULL;
+    while(!cursor->cut && !f->failed) {
+      next = cur == NULL ? f->head : cur->next;
+      if(next != NULL || f->done) { break; }
+      pthread_cond_wait(&f->cond, &f->lock);
+    }
+    bool cut = cursor->cut;
+    bool failed = f->failed;
+    int leader_rc = f->rc;
+    if(!cut && !failed && next != NULL) {
+      cursor->seq = next->seq + 1;
+      cursor->pin = next;
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    if(cut) {
+      rc = cursor->seq == 0 ? FLIGHT_RERUN : -1;
+      break;
+    }
+    if(failed) {
+      rc = -1;
+      break;
+    }
+    if(next == NULL) {
+      rc = leader_rc;
+      break;
+    }
+    int write_rc = write(usr, next->p, next->len);
+    pthread_mutex_lock(&f->lock);
+    bool dropped = cursor->pin_dropped;
+    cursor->pin = NULL;
+    cursor->pin_dropped = false;
+    pthread_mutex_unlock(&f->lock);
+    // only a cut off follower loses its frame, and it stops below
+    if(dropped) { blb_flight_frame_free(g, next); }
+    if(write_rc != 0) {
+      rc = -1;
+      break;
+    }
+    cur = next;
+  }
+
+  pthread_mutex_lock(&f->lock);
+  flight_cursor_t** pp = &f->cursors;
+  while(*pp != NULL && *pp != cursor) { pp = &(*pp)->next; }
+  if(*pp == cursor) { *pp = cursor->next; }
+  pthread_mutex_unlock(&f->lock);
+  blb_flight_release(g, f);
+  return (rc);
+}
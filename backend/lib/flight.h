@@ -0,0 +1,111 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __FLIGHT_H
+#define __FLIGHT_H
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <qcache.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// coalescing of identical concurrent queries. the first connection issuing
+// a query becomes the leader and runs the backend scan; connections issuing
+// the same query while it is in flight attach as followers and are sent the
+// encoded frames the leader produces, in order, as they become available.
+//
+// frames are buffered until every follower sent them on. once a flight
+// produced more than `max_buffered` bytes no further followers may join; if
+// at that point nobody joined buffering stops altogether. past that point the
+// frames held for the followers never exceed `max_buffered` bytes either:
+// the slowest followers are cut off instead. a cut off follower that sent
+// nothing yet gets `FLIGHT_RERUN` and runs the query itself, the others fail.
+
+#define FLIGHT_RERUN (1)
+
+typedef struct flight_t flight_t;
+typedef struct flight_frame_t flight_frame_t;
+typedef struct flight_cursor_t flight_cursor_t;
+typedef struct flight_group_t flight_group_t;
+typedef int (*flight_write_t)(void* usr, char* p, size_t p_sz);
+typedef bool (*flight_mem_charge_t)(void* usr, size_t sz);
+typedef void (*flight_mem_release_t)(void* usr, size_t sz);
+
+struct flight_frame_t {
+  flight_frame_t* next;
+  uint64_t seq;
+  size_t len;
+  char p[];
+};
+
+// a follower's position; protected by the flight lock
+struct flight_cursor_t {
+  flight_cursor_t* next;
+  // sequence number of the next frame to send
+  uint64_t seq;
+  // frame being sent outside the lock; freed by the follower if it was
+  // dropped meanwhile
+  flight_frame_t* pin;
+  bool pin_dropped;
+  bool cut;
+};
+
+struct flight_t {
+  // protected by the group lock
+  flight_t* next;
+  int refs;
+  bool open;
+  bool linked;
+  qcache_key_t key;
+  // protected by the flight lock
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  flight_frame_t* head;
+  flight_frame_t** tail;
+  flight_cursor_t* cursors;
+  uint64_t seq;
+  size_t held;
+  bool done;
+  bool failed;
+  int rc;
+  // only touched by the leader
+  size_t buffered;
+  bool buffering;
+};
+
+struct flight_group_t {
+  pthread_mutex_t lock;
+  size_t max_buffered;
+  // memory accounting of the owner, set up before the first flight; a
+  // refused charge cuts off all followers of the flight
+  flight_mem_charge_t mem_charge;
+  flight_mem_release_t mem_release;
+  void* mem_usr;
+  size_t n_buckets;
+  flight_t** buckets;
+  atomic_ullong leaders;
+  atomic_ullong followers;
+};
+
+flight_group_t* blb_flight_group_new(size_t max_buffered);
+void blb_flight_group_teardown(flight_group_t* g);
+// a follower is registered with `cursor`, which must stay valid until
+// `blb_flight_follow` returned
+flight_t* blb_flight_join(
+    flight_group_t* g,
+    const qcache_key_t* key,
+    bool* leader,
+    flight_cursor_t* cursor);
+void blb_flight_push(flight_group_t* g, flight_t* f, const char* p, size_t len);
+bool blb_flight_has_followers(flight_group_t* g, flight_t* f);
+void blb_flight_finish(flight_group_t* g, flight_t* f, int rc);
+int blb_flight_follow(
+    flight_group_t* g,
+    flight_t* f,
+    flight_cursor_t* cursor,
+    flight_write_t write,
+    void* usr);
+
+#endif
@@ -0,0 +1,43 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __HASH_H
+#define __HASH_H
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// MurmurHash64A by Austin Appleby (public domain)
+static inline uint64_t blb_hash64(const void* key, size_t len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+  const unsigned char* p = key;
+  const unsigned char* end = p + (len & ~(size_t)7);
+  while(p != end) {
+    uint64_t k;
+    memcpy(&k, p, sizeof(k));
+    p += sizeof(k);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  switch(len & 7) {
+  case 7: h ^= (uint64_t)p[6] << 48; // fall through
+  case 6: h ^= (uint64_t)p[5] << 40; // fall through
+  case 5: h ^= (uint64_t)p[4] << 32; // fall through
+  case 4: h ^= (uint64_t)p[3] << 24; // fall through
+  case 3: h ^= (uint64_t)p[2] << 16; // fall through
+  case 2: h ^= (uint64_t)p[1] << 8;  // fall through
+  case 1: h ^= (uint64_t)p[0]; h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return (h);
+}
+
+#endif
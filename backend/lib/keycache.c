@@ -0,0 +1,86 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <alloc.h>
+#include <keycache.h>
+#include <trace.h>
+
+keycache_t* blb_keycache_new(size_t memcap) {
+  size_t bucket_sz = KEYCACHE_BUCKET_SLOTS * sizeof(atomic_uint_least64_t);
+  if(memcap < bucket_sz) { return (NULL); }
+  // round down to a power of two number of buckets
+  int bits = 0;
+  while(((size_t)1 << (bits + 1)) * bucket_sz <= memcap && bits < 62) {
+    bits++;
+  }
+  keycache_t* cache = blb_new(keycache_t);
+  if(cache == NULL) { return (NULL); }
+  cache->buckets = (size_t)1 << bits;
+  cache->shift = 64 - bits;
+  cache->slots = blb_malloc(cache->buckets * bucket_sz);
+  if(cache->slots == NULL) {
+    blb_free(cache);
+    return (NULL);
+  }
+  blb_keycache_clear(cache);
+  return (cache);
+}
+
+void blb_keycache_teardown(keycache_t* cache) {
+  if(cache == NULL) { return; }
+  blb_free(cache->slots);
+  blb_free(cache);
+}
+
+void blb_keycache_clear(keycache_t* cache) {
+  size_t n = cache->buckets * KEYCACHE_BUCKET_SLOTS;
+  for(size_t i = 0; i < n; i++) {
+    atomic_store_explicit(&cache->slots[i], 0, memory_order_relaxed);
+  }
+}
+
+static inline atomic_uint_least64_t* blb_keycache_bucket(
+    keycache_t* cache, uint64_t h) {
+  size_t b = cache->shift >= 64 ? 0 : (size_t)(h >> cache->shift);
+  return (&cache->slots[b * KEYCACHE_BUCKET_SLOTS]);
+}
+
+// zero marks an empty slot
+static inline uint64_t blb_keycache_fingerprint(uint64_t h) {
+  return (h == 0 ? 1 : h);
+}
+
+bool blb_keycache_contains(keycache_t* cache, uint64_t h) {
+  uint64_t fp = blb_keycache_fingerprint(h);
+  atomic_uint_least64_t* bucket = blb_keycache_bucket(cache, h);
+  for(int i = 0; i < KEYCACHE_BUCKET_SLOTS; i++) {
+    if(atomic_load_explicit(&bucket[i], memory_order_relaxed) == fp) {
+      return (true);
+    }
+  }
+  return (false);
+}
+
+void blb_keycache_insert(keycache_t* cache, uint64_t h) {
+  uint64_t fp = blb_keycache_fingerprint(h);
+  atomic_uint_least64_t* bucket = blb_keycache_bucket(cache, h);
+  for(int i = 0; i < KEYCACHE_BUCKET_SLOTS; i++) {
+    uint64_t cur = atomic_load_explicit(&bucket[i], memory_order_relaxed);
+    if(cur == fp) { return; }
+    if(cur == 0) {
+      uint64_t expected = 0;
+      if(atomic_compare_exchange_strong_explicit(
+             &bucket[i],
+             &expected,
+             fp,
+             memory_order_relaxed,
+             memory_order_relaxed)) {
+        return;
+      }
+      if(expected == fp) { return; }
+    }
+  }
+  // bucket is full; evict a slot chosen by low fingerprint bits
+  atomic_store_explicit(
+      &bucket[fp & (KEYCACHE_BUCKET_SLOTS - 1)], fp, memory_order_relaxed);
+}
@@ -0,0 +1,38 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __KEYCACHE_H
+#define __KEYCACHE_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// a bounded, lossy set of 64bit key fingerprints organized in 4-way buckets.
+// unlike a bloom filter a lookup only reports a key as present if its full
+// 64bit hash was inserted before, which keeps false positives negligible.
+// when a bucket is full a random slot is overwritten; losing a fingerprint
+// only costs the caller a redundant write.
+
+#define KEYCACHE_BUCKET_SLOTS (4)
+
+typedef struct keycache_t keycache_t;
+struct keycache_t {
+  size_t buckets;
+  int shift;
+  atomic_uint_least64_t* slots;
+};
+
+keycache_t* blb_keycache_new(size_t memcap);
+void blb_keycache_teardown(keycache_t* cache);
+bool blb_keycache_contains(keycache_t* cache, uint64_t h);
+void blb_keycache_insert(keycache_t* cache, uint64_t h);
+void blb_keycache_clear(keycache_t* cache);
+
+static inline size_t blb_keycache_memory(const keycache_t* cache) {
+  return (
+      cache->buckets * KEYCACHE_BUCKET_SLOTS * sizeof(atomic_uint_least64_t));
+}
+
+#endif
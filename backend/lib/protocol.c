@@ -5,6 +5,7 @@
 #include <mpack.h>
 #include <protocol.h>
 #include <trace.h>
+#include <zio.h>
 
 enum {
   OBS_RRNAME_IDX = 0,
@@ -24,6 +25,19 @@ enum {
 
 #define PROTOCOL_DUMP_REQUEST_PATH_KEY ("P")
 
+#define PROTOCOL_REPLICATE_REQUEST_SINCE_KEY ("S")
+
+#define PROTOCOL_REPLICATE_BATCH_SEQ_KEY ("S")
+#define PROTOCOL_REPLICATE_BATCH_LATEST_KEY ("L")
+#define PROTOCOL_REPLICATE_BATCH_DATA_KEY ("B")
+
+#define PROTOCOL_INFO_REQUEST_TOPIC_KEY ("T")
+#define PROTOCOL_INFO_RESPONSE_TEXT_KEY ("V")
+
+#define PROTOCOL_PURGE_REQUEST_SENSORID_KEY ("S")
+
+#define PROTOCOL_VERIFY_REQUEST_REPAIR_KEY ("R")
+
 #define PROTOCOL_QUERY_REQUEST_QRDATA_KEY ("Qrdata")
 #define PROTOCOL_QUERY_REQUEST_QRRNAME_KEY ("Qrrname")
 #define PROTOCOL_QUERY_REQUEST_QRRTYPE_KEY ("Qrrtype")
@@ -33,6 +47,7 @@ enum {
 #define PROTOCOL_QUERY_REQUEST_HRRTYPE_KEY ("Hrrtype")
 #define PROTOCOL_QUERY_REQUEST_HSENSORID_KEY ("HsensorID")
 #define PROTOCOL_QUERY_REQUEST_LIMIT_KEY ("Limit")
+#define PROTOCOL_QUERY_REQUEST_HISTOGRAM_KEY ("Histogram")
 
 #define PROTOCOL_INPUT_REQUEST_OBSERVATION_KEY0 ('O')
 
@@ -43,6 +58,7 @@ enum {
 #define PROTOCOL_PDNS_ENTRY_COUNT_KEY0 ('C')
 #define PROTOCOL_PDNS_ENTRY_FIRSTSEEN_KEY0 ('F')
 #define PROTOCOL_PDNS_ENTRY_LASTSEEN_KEY0 ('L')
+#define PROTOCOL_PDNS_ENTRY_HISTOGRAM_KEY0 ('H')
 
 #define PROTOCOL_PDNS_ENTRY_RRNAME_KEY ("N")
 #define PROTOCOL_PDNS_ENTRY_RRTYPE_KEY ("T")
@@ -51,6 +67,7 @@ enum {
 #define PROTOCOL_PDNS_ENTRY_COUNT_KEY ("C")
 #define PROTOCOL_PDNS_ENTRY_FIRSTSEEN_KEY ("F")
 #define PROTOCOL_PDNS_ENTRY_LASTSEEN_KEY ("L")
+#define PROTOCOL_PDNS_ENTRY_HISTOGRAM_KEY ("H")
 
 #define PROTOCOL_SCRTCH_SZ (1024 * 10)
 #define PROTOCOL_SCRTCH_BUFFERS (10)
@@ -60,10 +77,15 @@ struct protocol_stream_t {
   void* usr;
   ssize_t (*read_cb)(void* usr, char* p, size_t p_sz);
   char scrtch[PROTOCOL_SCRTCH_BUFFERS][PROTOCOL_SCRTCH_SZ];
+  uint32_t hist[PROTOCOL_HISTOGRAM_MAX * 2];
 };
 
+#define PROTOCOL_DUMP_BUFFER_SZ (64 * 1024)
+
 struct protocol_dump_stream_t {
   mpack_reader_t reader;
+  zio_reader_t* zio;
+  char buf[PROTOCOL_DUMP_BUFFER_SZ];
   unsigned char scrtch[PROTOCOL_SCRTCH_SZ];
 };
 
@@ -147,6 +169,166 @@ ssize_t blb_protocol_encode_backup_request(
       PROTOCOL_BACKUP_REQUEST, p, p_sz, used_inner));
 }
 
+ssize_t blb_protocol_encode_replicate_request(
+    const protocol_replicate_request_t* r, char* p, size_t p_sz) {
+  mpack_writer_t __wr = {0}, *wr = &__wr;
+
+  // encode inner message
+  mpack_writer_init(wr, p, p_sz);
+  mpack_start_map(wr, 1);
+  mpack_write_cstr(wr, PROTOCOL_REPLICATE_REQUEST_SINCE_KEY);
+  mpack_write_u64(wr, r->since);
+  mpack_finish_map(wr);
+  mpack_error_t err = mpack_writer_error(wr);
+  if(err != mpack_ok) {
+    L(log_error("encoding inner msgpack data failed `%d`", err));
+    mpack_writer_destroy(wr);
+    return (-1);
+  }
+
+  size_t used_inner = mpack_writer_buffer_used(wr);
+  X(log_debug("encoded inner message size `%zu`", used_inner));
+  ASSERT(used_inner < p_sz);
+  mpack_writer_destroy(wr);
+
+  return (blb_protocol_encode_outer_request(
+      PROTOCOL_REPLICATE_REQUEST, p, p_sz, used_inner));
+}
+
+ssize_t blb_protocol_encode_replicate_batch(
+    const protocol_replicate_batch_t* b, char* p, size_t p_sz) {
+  mpack_writer_t __wr = {0}, *wr = &__wr;
+
+  // encode inner message
+  mpack_writer_init(wr, p, p_sz);
+  mpack_start_map(wr, 3);
+  mpack_write_cstr(wr, PROTOCOL_REPLICATE_BATCH_SEQ_KEY);
+  mpack_write_u64(wr, b->seq);
+  mpack_write_cstr(wr, PROTOCOL_REPLICATE_BATCH_LATEST_KEY);
+  mpack_write_u64(wr, b->latest);
+  mpack_write_cstr(wr, PROTOCOL_REPLICATE_BATCH_DATA_KEY);
+  mpack_write_bin(wr, b->data, b->data_len);
+  mpack_finish_map(wr);
+  mpack_error_t err = mpack_writer_error(wr);
+  if(err != mpack_ok) {
+    L(log_error("encoding inner msgpack data failed `%d`", err));
+    mpack_writer_destroy(wr);
+    return (-1);
+  }
+
+  size_t used_inner = mpack_writer_buffer_used(wr);
+  X(log_debug("encoded inner message size `%zu`", used_inner));
+  ASSERT(used_inner < p_sz);
+  mpack_writer_destroy(wr);
+
+  return (blb_protocol_encode_outer_request(
+      PROTOCOL_REPLICATE_BATCH_RESPONSE, p, p_sz, used_inner));
+}
+
+ssize_t blb_protocol_encode_info_request(
+    const protocol_info_request_t* r, char* p, size_t p_sz) {
+  mpack_writer_t __wr = {0}, *wr = &__wr;
+
+  // encode inner message
+  mpack_writer_init(wr, p, p_sz);
+  mpack_start_map(wr, 1);
+  mpack_write_cstr(wr, PROTOCOL_INFO_REQUEST_TOPIC_KEY);
+  mpack_write_str(wr, r->topic, r->topic_len);
+  mpack_finish_map(wr);
+  mpack_error_t err = mpack_writer_error(wr);
+  if(err != mpack_ok) {
+    L(log_error("encoding inner msgpack data failed `%d`", err));
+    mpack_writer_destroy(wr);
+    return (-1);
+  }
+
+  size_t used_inner = mpack_writer_buffer_used(wr);
+  X(log_debug("encoded inner message size `%zu`", used_inner));
+  ASSERT(used_inner < p_sz);
+  mpack_writer_destroy(wr);
+
+  return (blb_protocol_encode_outer_request(
+      PROTOCOL_INFO_REQUEST, p, p_sz, used_inner));
+}
+
+ssize_t blb_protocol_encode_purge_request(
+    const protocol_purge_request_t* r, char* p, size_t p_sz) {
+  mpack_writer_t __wr = {0}, *wr = &__wr;
+
+  // encode inner message
+  mpack_writer_init(wr, p, p_sz);
+  mpack_start_map(wr, 1);
+  mpack_write_cstr(wr, PROTOCOL_PURGE_REQUEST_SENSORID_KEY);
+  mpack_write_str(wr, r->sensorid, r->sensorid_len);
+  mpack_finish_map(wr);
+  mpack_error_t err = mpack_writer_error(wr);
+  if(err != mpack_ok) {
+    L(log_error("encoding inner msgpack data failed `%d`", err));
+    mpack_writer_destroy(wr);
+    return (-1);
+  }
+
+  size_t used_inner = mpack_writer_buffer_used(wr);
+  X(log_debug("encoded inner message size `%zu`", used_inner));
+  ASSERT(used_inner < p_sz);
+  mpack_writer_destroy(wr);
+
+  return (blb_protocol_encode_outer_request(
+      PROTOCOL_PURGE_REQUEST, p, p_sz, used_inner));
+}
+
+ssize_t blb_protocol_encode_verify_request(
+    const protocol_verify_request_t* r, char* p, size_t p_sz) {
+  mpack_writer_t __wr = {0}, *wr = &__wr;
+
+  // encode inner message
+  mpack_writer_init(wr, p, p_sz);
+  mpack_start_map(wr, 1);
+  mpack_write_cstr(wr, PROTOCOL_VERIFY_REQUEST_REPAIR_KEY);
+  mpack_write_bool(wr, r->repair);
+  mpack_finish_map(wr);
+  mpack_error_t err = mpack_writer_error(wr);
+  if(err != mpack_ok) {
+    L(log_error("encoding inner msgpack data failed `%d`", err));
+    mpack_writer_destroy(wr);
+    return (-1);
+  }
+
+  size_t used_inner = mpack_writer_buffer_used(wr);
+  X(log_debug("encoded inner message size `%zu`", used_inner));
+  ASSERT(used_inner < p_sz);
+  mpack_writer_destroy(wr);
+
+  return (blb_protocol_encode_outer_request(
+      PROTOCOL_VERIFY_REQUEST, p, p_sz, used_inner));
+}
+
+ssize_t blb_protocol_encode_info_response(
+    const protocol_info_response_t* r, char* p, size_t p_sz) {
+  mpack_writer_t __wr = {0}, *wr = &__wr;
+
+  // encode inner message
+  mpack_writer_init(wr, p, p_sz);
+  mpack_start_map(wr, 1);
+  mpack_write_cstr(wr, PROTOCOL_INFO_RESPONSE_TEXT_KEY);
+  mpack_write_str(wr, r->text, r->text_len);
+  mpack_finish_map(wr);
+  mpack_error_t err = mpack_writer_error(wr);
+  if(err != mpack_ok) {
+    L(log_error("encoding inner msgpack data failed `%d`", err));
+    mpack_writer_destroy(wr);
+    return (-1);
+  }
+
+  size_t used_inner = mpack_writer_buffer_used(wr);
+  X(log_debug("encoded inner message size `%zu`", used_inner));
+  ASSERT(used_inner < p_sz);
+  mpack_writer_destroy(wr);
+
+  return (blb_protocol_encode_outer_request(
+      PROTOCOL_INFO_RESPONSE, p, p_sz, used_inner));
+}
+
 ssize_t blb_protocol_encode_dump_entry(
     const protocol_entry_t* entry, char* p, size_t p_sz) {
   mpack_writer_t __wr = {0}, *wr = &__wr;
@@ -191,7 +373,8 @@ ssize_t blb_protocol_encode_entry(
   mpack_writer_t __wr = {0}, *wr = &__wr;
   mpack_writer_init(wr, p, p_sz);
 
-  mpack_start_map(wr, 7);
+  bool hist = entry->hist_len > 0;
+  mpack_start_map(wr, hist ? 8 : 7);
   mpack_write_cstr(wr, PROTOCOL_PDNS_ENTRY_COUNT_KEY);
   mpack_write_uint(wr, entry->count);
   mpack_write_cstr(wr, PROTOCOL_PDNS_ENTRY_FIRSTSEEN_KEY);
@@ -208,6 +391,16 @@ ssize_t blb_protocol_encode_entry(
   mpack_write_str(wr, entry->rrtype, entry->rrtype_len);
   mpack_write_cstr(wr, PROTOCOL_PDNS_ENTRY_SENSORID_KEY);
   mpack_write_str(wr, entry->sensorid, entry->sensorid_len);
+  if(hist) {
+    // [granularity, start0, count0, start1, count1, ...]
+    mpack_write_cstr(wr, PROTOCOL_PDNS_ENTRY_HISTOGRAM_KEY);
+    mpack_start_array(wr, 1 + entry->hist_len * 2);
+    mpack_write_u32(wr, entry->hist_granularity);
+    for(size_t i = 0; i < entry->hist_len * 2; i++) {
+      mpack_write_u32(wr, entry->hist[i]);
+    }
+    mpack_finish_array(wr);
+  }
   mpack_finish_map(wr);
 
   size_t used_inner = mpack_writer_buffer_used(wr);
@@ -229,10 +422,16 @@ static ssize_t blb_protocol_encode_query(
   mpack_writer_t __wr = {0}, *wr = &__wr;
   mpack_writer_init(wr, p, p_sz);
 
-  mpack_start_map(wr, 9);
+  // the histogram flag is only sent when set so that backends not knowing
+  // it keep accepting plain queries
+  mpack_start_map(wr, query->histogram ? 10 : 9);
 
   mpack_write_cstr(wr, PROTOCOL_QUERY_REQUEST_LIMIT_KEY);
   mpack_write_uint(wr, query->limit);
+  if(query->histogram) {
+    mpack_write_cstr(wr, PROTOCOL_QUERY_REQUEST_HISTOGRAM_KEY);
+    mpack_write_bool(wr, true);
+  }
 
   mpack_write_cstr(wr, PROTOCOL_QUERY_REQUEST_QRRNAME_KEY);
   mpack_write_str(wr, query->qrrname, query->qrrname_len);
@@ -281,6 +480,17 @@ ssize_t blb_protocol_encode_query_request(
       PROTOCOL_QUERY_REQUEST, p, p_sz, used_inner));
 }
 
+ssize_t blb_protocol_encode_subscribe_request(
+    const protocol_query_request_t* query, char* p, size_t p_sz) {
+  ssize_t used_inner = blb_protocol_encode_query(query, p, p_sz);
+  if(used_inner <= 0) {
+    L(log_error("blb_protocol_encode_query() failed"));
+    return (-1);
+  }
+  return (blb_protocol_encode_outer_request(
+      PROTOCOL_SUBSCRIBE_REQUEST, p, p_sz, used_inner));
+}
+
 ssize_t blb_protocol_encode_input_request(
     const protocol_input_request_t* input, char* p, size_t p_sz) {
   ssize_t used_inner = blb_protocol_encode_entry(&input->entry, p, p_sz);
@@ -376,7 +586,7 @@ static int blb_protocol_decode_input(
 
   uint32_t cnt = mpack_expect_map(rd);
   mpack_error_t map_ok = mpack_reader_error(rd);
-  if(cnt != 7 || map_ok != mpack_ok) {
+  if((cnt != 7 && cnt != 8) || map_ok != mpack_ok) {
     L(log_error(
         "invalid inner message: map with `7` elements expected got `%u`", cnt));
     goto decode_error;
@@ -386,6 +596,9 @@ static int blb_protocol_decode_input(
 
   protocol_input_request_t* i = &out->u.input;
   out->ty = PROTOCOL_INPUT_REQUEST;
+  i->entry.hist_granularity = 0;
+  i->entry.hist_len = 0;
+  i->entry.hist = NULL;
   uint32_t w = 0;
   for(uint32_t j = 0; j < cnt; j++) {
     char key[1] = {'\0'};
@@ -440,6 +653,22 @@ static int blb_protocol_decode_input(
       w++;
       break;
     }
+    case PROTOCOL_PDNS_ENTRY_HISTOGRAM_KEY0: {
+      X(log_debug("got histogram"));
+      uint32_t n = mpack_expect_array_max(rd, 1 + PROTOCOL_HISTOGRAM_MAX * 2);
+      if(n == 0 || n % 2 != 1) {
+        L(log_error("invalid inner message: invalid histogram"));
+        goto decode_error;
+      }
+      i->entry.hist_granularity = mpack_expect_u32(rd);
+      for(uint32_t k = 0; k < n - 1; k++) {
+        stream->hist[k] = mpack_expect_u32(rd);
+      }
+      mpack_done_array(rd);
+      i->entry.hist_len = (n - 1) / 2;
+      i->entry.hist = stream->hist;
+      break;
+    }
     default:
       L(log_error(
           "invalid inner message: invalid key: %02x",
@@ -485,12 +714,12 @@ static int blb_protocol_decode_query(
   mpack_reader_init(rd, (char*)p, p_sz, p_sz);
 
   uint32_t cnt = mpack_expect_map(rd);
-  if(cnt != 9 || mpack_reader_error(rd) != mpack_ok) {
+  if((cnt != 9 && cnt != 10) || mpack_reader_error(rd) != mpack_ok) {
     L(log_error("invalid inner message: query map expected"));
     goto decode_error;
   }
 
-  ASSERT(cnt < PROTOCOL_SCRTCH_BUFFERS);
+  ASSERT(cnt <= PROTOCOL_SCRTCH_BUFFERS);
 
   struct have_t {
     bool hrrname;
@@ -502,6 +731,7 @@ static int blb_protocol_decode_query(
   struct have_t __h = {0}, *h = &__h;
   protocol_query_request_t* q = &out->u.query;
   out->ty = PROTOCOL_QUERY_REQUEST;
+  q->histogram = false;
   uint32_t w = 0;
   for(uint32_t j = 0; j < cnt; j++) {
     char key[64] = {'\0'};
@@ -513,6 +743,10 @@ static int blb_protocol_decode_query(
     if(strncmp(key, PROTOCOL_QUERY_REQUEST_LIMIT_KEY, key_len) == 0) {
       X(log_debug("got query request limit"));
       q->limit = mpack_expect_int(rd);
+    } else if(
+        strncmp(key, PROTOCOL_QUERY_REQUEST_HISTOGRAM_KEY, key_len) == 0) {
+      X(log_debug("got query request histogram"));
+      q->histogram = mpack_expect_bool(rd);
     } else if(strncmp(key, PROTOCOL_QUERY_REQUEST_QRRNAME_KEY, key_len) == 0) {
       X(log_debug("got input request rrname"));
       q->qrrname_len =
@@ -576,6 +810,14 @@ decode_error:
   return (-1);
 }
 
+static int blb_protocol_decode_subscribe(
+    protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
+  int rc = blb_protocol_decode_query(stream, payload, out);
+  if(rc != 0) { return (rc); }
+  out->ty = PROTOCOL_SUBSCRIBE_REQUEST;
+  return (0);
+}
+
 static int blb_protocol_decode_backup(
     protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
   const char* p = mpack_node_bin_data(payload);
@@ -688,6 +930,294 @@ decode_error:
   return (-1);
 }
 
+static int blb_protocol_decode_replicate(
+    protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
+  const char* p = mpack_node_bin_data(payload);
+  size_t p_sz = mpack_node_bin_size(payload);
+  X(log_debug("encoded message ptr `%p` sz `%zu`", p, p_sz));
+  if(p == NULL || p_sz == 0) {
+    L(log_error("invalid message"));
+    return (-1);
+  }
+  (void)stream;
+
+  mpack_reader_t __rd = {0}, *rd = &__rd;
+  mpack_reader_init(rd, (char*)p, p_sz, p_sz);
+
+  uint32_t cnt = mpack_expect_map(rd);
+  if(cnt != 1 || mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message: replicate map expected"));
+    goto decode_error;
+  }
+
+  char key[1] = {'\0'};
+  (void)mpack_expect_str_buf(rd, key, 1);
+  if(key[0] != PROTOCOL_REPLICATE_REQUEST_SINCE_KEY[0]) {
+    L(log_error("invalid inner message: since key expected"));
+    goto decode_error;
+  }
+
+  protocol_replicate_request_t* r = &out->u.replicate;
+  out->ty = PROTOCOL_REPLICATE_REQUEST;
+  r->since = mpack_expect_u64(rd);
+
+  mpack_done_map(rd);
+  if(mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message; decode replicate request failed"));
+    goto decode_error;
+  }
+
+  mpack_reader_destroy(rd);
+  return (0);
+
+decode_error:
+  mpack_reader_destroy(rd);
+  return (-1);
+}
+
+// the batch data is not copied; it points into the stream's message buffer
+// and is valid until the next call to `blb_protocol_stream_decode()`
+static int blb_protocol_decode_replicate_batch(
+    protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
+  const char* p = mpack_node_bin_data(payload);
+  size_t p_sz = mpack_node_bin_size(payload);
+  X(log_debug("encoded message ptr `%p` sz `%zu`", p, p_sz));
+  if(p == NULL || p_sz == 0) {
+    L(log_error("invalid message"));
+    return (-1);
+  }
+  (void)stream;
+
+  mpack_reader_t __rd = {0}, *rd = &__rd;
+  mpack_reader_init(rd, (char*)p, p_sz, p_sz);
+
+  uint32_t cnt = mpack_expect_map(rd);
+  if(cnt != 3 || mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message: replicate batch map expected"));
+    goto decode_error;
+  }
+
+  protocol_replicate_batch_t* b = &out->u.batch;
+  out->ty = PROTOCOL_REPLICATE_BATCH_RESPONSE;
+  b->data = NULL;
+  b->data_len = 0;
+  for(uint32_t j = 0; j < cnt; j++) {
+    char key[1] = {'\0'};
+    (void)mpack_expect_str_buf(rd, key, 1);
+    if(key[0] == PROTOCOL_REPLICATE_BATCH_SEQ_KEY[0]) {
+      b->seq = mpack_expect_u64(rd);
+    } else if(key[0] == PROTOCOL_REPLICATE_BATCH_LATEST_KEY[0]) {
+      b->latest = mpack_expect_u64(rd);
+    } else if(key[0] == PROTOCOL_REPLICATE_BATCH_DATA_KEY[0]) {
+      b->data_len = mpack_expect_bin(rd);
+      b->data = mpack_read_bytes_inplace(rd, b->data_len);
+      mpack_done_bin(rd);
+    } else {
+      L(log_error("invalid inner message: unknown key `%c`", key[0]));
+      goto decode_error;
+    }
+  }
+
+  mpack_done_map(rd);
+  if(mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message; decode replicate batch failed"));
+    goto decode_error;
+  }
+
+  mpack_reader_destroy(rd);
+  return (0);
+
+decode_error:
+  mpack_reader_destroy(rd);
+  return (-1);
+}
+
+static int blb_protocol_decode_info(
+    protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
+  const char* p = mpack_node_bin_data(payload);
+  size_t p_sz = mpack_node_bin_size(payload);
+  X(log_debug("encoded message ptr `%p` sz `%zu`", p, p_sz));
+  if(p == NULL || p_sz == 0) {
+    L(log_error("invalid message"));
+    return (-1);
+  }
+
+  mpack_reader_t __rd = {0}, *rd = &__rd;
+  mpack_reader_init(rd, (char*)p, p_sz, p_sz);
+
+  uint32_t cnt = mpack_expect_map(rd);
+  if(cnt != 1 || mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message: info map expected"));
+    goto decode_error;
+  }
+
+  char key[1] = {'\0'};
+  (void)mpack_expect_str_buf(rd, key, 1);
+  if(key[0] != PROTOCOL_INFO_REQUEST_TOPIC_KEY[0]) {
+    L(log_error("invalid inner message: topic key expected"));
+    goto decode_error;
+  }
+
+  protocol_info_request_t* r = &out->u.info;
+  out->ty = PROTOCOL_INFO_REQUEST;
+  r->topic_len =
+      mpack_expect_str_buf(rd, stream->scrtch[0], PROTOCOL_SCRTCH_SZ);
+  r->topic = stream->scrtch[0];
+
+  mpack_done_map(rd);
+  if(mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message; decode info request failed"));
+    goto decode_error;
+  }
+
+  mpack_reader_destroy(rd);
+  return (0);
+
+decode_error:
+  mpack_reader_destroy(rd);
+  return (-1);
+}
+
+static int blb_protocol_decode_purge(
+    protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
+  const char* p = mpack_node_bin_data(payload);
+  size_t p_sz = mpack_node_bin_size(payload);
+  X(log_debug("encoded message ptr `%p` sz `%zu`", p, p_sz));
+  if(p == NULL || p_sz == 0) {
+    L(log_error("invalid message"));
+    return (-1);
+  }
+
+  mpack_reader_t __rd = {0}, *rd = &__rd;
+  mpack_reader_init(rd, (char*)p, p_sz, p_sz);
+
+  uint32_t cnt = mpack_expect_map(rd);
+  if(cnt != 1 || mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message: purge map expected"));
+    goto decode_error;
+  }
+
+  char key[1] = {'\0'};
+  (void)mpack_expect_str_buf(rd, key, 1);
+  if(key[0] != PROTOCOL_PURGE_REQUEST_SENSORID_KEY[0]) {
+    L(log_error("invalid inner message: sensor id key expected"));
+    goto decode_error;
+  }
+
+  protocol_purge_request_t* r = &out->u.purge;
+  out->ty = PROTOCOL_PURGE_REQUEST;
+  r->sensorid_len =
+      mpack_expect_str_buf(rd, stream->scrtch[0], PROTOCOL_SCRTCH_SZ);
+  r->sensorid = stream->scrtch[0];
+
+  mpack_done_map(rd);
+  if(mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message; decode purge request failed"));
+    goto decode_error;
+  }
+
+  mpack_reader_destroy(rd);
+  return (0);
+
+decode_error:
+  mpack_reader_destroy(rd);
+  return (-1);
+}
+
+static int blb_protocol_decode_verify(
+    protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
+  (void)stream;
+  const char* p = mpack_node_bin_data(payload);
+  size_t p_sz = mpack_node_bin_size(payload);
+  X(log_debug("encoded message ptr `%p` sz `%zu`", p, p_sz));
+  if(p == NULL || p_sz == 0) {
+    L(log_error("invalid message"));
+    return (-1);
+  }
+
+  mpack_reader_t __rd = {0}, *rd = &__rd;
+  mpack_reader_init(rd, (char*)p, p_sz, p_sz);
+
+  uint32_t cnt = mpack_expect_map(rd);
+  if(cnt != 1 || mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message: verify map expected"));
+    goto decode_error;
+  }
+
+  char key[1] = {'\0'};
+  (void)mpack_expect_str_buf(rd, key, 1);
+  if(key[0] != PROTOCOL_VERIFY_REQUEST_REPAIR_KEY[0]) {
+    L(log_error("invalid inner message: repair key expected"));
+    goto decode_error;
+  }
+
+  protocol_verify_request_t* r = &out->u.verify;
+  out->ty = PROTOCOL_VERIFY_REQUEST;
+  r->repair = mpack_expect_bool(rd);
+
+  mpack_done_map(rd);
+  if(mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message; decode verify request failed"));
+    goto decode_error;
+  }
+
+  mpack_reader_destroy(rd);
+  return (0);
+
+decode_error:
+  mpack_reader_destroy(rd);
+  return (-1);
+}
+
+// the text is not copied; it points into the stream's message buffer and is
+// valid until the next call to `blb_protocol_stream_decode()`
+static int blb_protocol_decode_info_response(
+    protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
+  const char* p = mpack_node_bin_data(payload);
+  size_t p_sz = mpack_node_bin_size(payload);
+  X(log_debug("encoded message ptr `%p` sz `%zu`", p, p_sz));
+  if(p == NULL || p_sz == 0) {
+    L(log_error("invalid message"));
+    return (-1);
+  }
+  (void)stream;
+
+  mpack_reader_t __rd = {0}, *rd = &__rd;
+  mpack_reader_init(rd, (char*)p, p_sz, p_sz);
+
+  uint32_t cnt = mpack_expect_map(rd);
+  if(cnt != 1 || mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message: info response map expected"));
+    goto decode_error;
+  }
+
+  char key[1] = {'\0'};
+  (void)mpack_expect_str_buf(rd, key, 1);
+  if(key[0] != PROTOCOL_INFO_RESPONSE_TEXT_KEY[0]) {
+    L(log_error("invalid inner message: text key expected"));
+    goto decode_error;
+  }
+
+  protocol_info_response_t* r = &out->u.info_response;
+  out->ty = PROTOCOL_INFO_RESPONSE;
+  r->text_len = mpack_expect_str(rd);
+  r->text = mpack_read_bytes_inplace(rd, r->text_len);
+  mpack_done_str(rd);
+
+  mpack_done_map(rd);
+  if(mpack_reader_error(rd) != mpack_ok) {
+    L(log_error("invalid inner message; decode info response failed"));
+    goto decode_error;
+  }
+
+  mpack_reader_destroy(rd);
+  return (0);
+
+decode_error:
+  mpack_reader_destroy(rd);
+  return (-1);
+}
+
 static int blb_protocol_decode_stream_start(
     protocol_stream_t* stream, mpack_node_t payload, protocol_message_t* out) {
   const char* p = mpack_node_bin_data(payload);
@@ -772,6 +1302,21 @@ int blb_protocol_stream_decode(
   case PROTOCOL_DUMP_REQUEST:
     X(log_debug("got dump request"));
     return (blb_protocol_decode_dump(stream, payload, out));
+  case PROTOCOL_SUBSCRIBE_REQUEST:
+    X(log_debug("got subscribe request"));
+    return (blb_protocol_decode_subscribe(stream, payload, out));
+  case PROTOCOL_REPLICATE_REQUEST:
+    X(log_debug("got replicate request"));
+    return (blb_protocol_decode_replicate(stream, payload, out));
+  case PROTOCOL_INFO_REQUEST:
+    X(log_debug("got info request"));
+    return (blb_protocol_decode_info(stream, payload, out));
+  case PROTOCOL_PURGE_REQUEST:
+    X(log_debug("got purge request"));
+    return (blb_protocol_decode_purge(stream, payload, out));
+  case PROTOCOL_VERIFY_REQUEST:
+    X(log_debug("got verify request"));
+    return (blb_protocol_decode_verify(stream, payload, out));
   case PROTOCOL_QUERY_STREAM_START_RESPONSE:
     X(log_debug("got stream start response"));
     return (blb_protocol_decode_stream_start(stream, payload, out));
@@ -781,19 +1326,47 @@ int blb_protocol_stream_decode(
   case PROTOCOL_QUERY_STREAM_DATA_RESPONSE:
     X(log_debug("got stream data response"));
     return (blb_protocol_decode_stream_data(stream, payload, out));
+  case PROTOCOL_REPLICATE_BATCH_RESPONSE:
+    X(log_debug("got replicate batch response"));
+    return (blb_protocol_decode_replicate_batch(stream, payload, out));
+  case PROTOCOL_INFO_RESPONSE:
+    X(log_debug("got info response"));
+    return (blb_protocol_decode_info_response(stream, payload, out));
   default: L(log_error("invalid message type")); return (-1);
   }
 }
 
+static size_t blb_protocol_dump_stream_fill(
+    mpack_reader_t* rd, char* p, size_t sz) {
+  protocol_dump_stream_t* stream = rd->context;
+  ssize_t rc = blb_zio_read(stream->zio, p, sz);
+  if(rc == 0) {
+    mpack_reader_flag_error(rd, mpack_error_eof);
+  } else if(rc < 0) {
+    mpack_reader_flag_error(rd, mpack_error_io);
+    return (0);
+  }
+  return ((size_t)rc);
+}
+
+// lz4 and zstd compressed dumps are detected and decompressed on the fly
 protocol_dump_stream_t* blb_protocol_dump_stream_new(FILE* file) {
   protocol_dump_stream_t* stream = blb_new(protocol_dump_stream_t);
   if(stream == NULL) { return (NULL); }
-  mpack_reader_init_stdfile(&stream->reader, file, 0);
+  stream->zio = blb_zio_reader_new(file);
+  if(stream->zio == NULL) {
+    blb_free(stream);
+    return (NULL);
+  }
+  mpack_reader_init(&stream->reader, stream->buf, sizeof(stream->buf), 0);
+  mpack_reader_set_context(&stream->reader, stream);
+  mpack_reader_set_fill(&stream->reader, blb_protocol_dump_stream_fill);
   return (stream);
 }
 
 void blb_protocol_dump_stream_teardown(protocol_dump_stream_t* stream) {
   mpack_reader_destroy(&stream->reader);
+  blb_zio_reader_teardown(stream->zio);
   blb_free(stream);
 }
 
@@ -818,6 +1391,9 @@ int blb_protocol_dump_stream_decode(
         cnt));
     return (-2);
   }
+  entry->hist_granularity = 0;
+  entry->hist_len = 0;
+  entry->hist = NULL;
   bytestring_sink_t sink = bs_sink(stream->scrtch, PROTOCOL_SCRTCH_SZ);
   for(uint32_t i = 0; i < cnt; i++) {
     uint32_t field = mpack_expect_uint(rd);
@@ -5,6 +5,7 @@
 #define __PROTOCOL_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -12,11 +13,20 @@
 #define PROTOCOL_QUERY_REQUEST 2
 #define PROTOCOL_BACKUP_REQUEST 3
 #define PROTOCOL_DUMP_REQUEST 4
+#define PROTOCOL_REPLICATE_REQUEST 5
+#define PROTOCOL_SUBSCRIBE_REQUEST 6
+#define PROTOCOL_INFO_REQUEST 7
+#define PROTOCOL_PURGE_REQUEST 8
+#define PROTOCOL_VERIFY_REQUEST 9
 #define PROTOCOL_ERROR_RESPONSE 128
 #define PROTOCOL_QUERY_RESPONSE 129
 #define PROTOCOL_QUERY_STREAM_START_RESPONSE 130
 #define PROTOCOL_QUERY_STREAM_DATA_RESPONSE 131
 #define PROTOCOL_QUERY_STREAM_END_RESPONSE 132
+#define PROTOCOL_REPLICATE_BATCH_RESPONSE 133
+#define PROTOCOL_INFO_RESPONSE 134
+
+#define PROTOCOL_HISTOGRAM_MAX (1024)
 
 typedef struct protocol_dump_request_t protocol_dump_request_t;
 struct protocol_dump_request_t {
@@ -36,6 +46,69 @@ struct protocol_backup_request_t {
 ssize_t blb_protocol_encode_backup_request(
     const protocol_backup_request_t* r, char* p, size_t p_sz);
 
+typedef struct protocol_replicate_request_t protocol_replicate_request_t;
+struct protocol_replicate_request_t {
+  uint64_t since;
+};
+
+ssize_t blb_protocol_encode_replicate_request(
+    const protocol_replicate_request_t* r, char* p, size_t p_sz);
+
+// a write batch as found in the leader's write ahead log starting at
+// sequence number `seq`; an empty batch is a heartbeat carrying the leader's
+// latest sequence number only
+typedef struct protocol_replicate_batch_t protocol_replicate_batch_t;
+struct protocol_replicate_batch_t {
+  uint64_t seq;
+  uint64_t latest;
+  const char* data;
+  size_t data_len;
+};
+
+ssize_t blb_protocol_encode_replicate_batch(
+    const protocol_replicate_batch_t* b, char* p, size_t p_sz);
+
+// asks the backend for a human readable report on `topic`, e.g.
+// `compression`; backends not knowing the topic close the connection
+typedef struct protocol_info_request_t protocol_info_request_t;
+struct protocol_info_request_t {
+  const char* topic;
+  size_t topic_len;
+};
+
+ssize_t blb_protocol_encode_info_request(
+    const protocol_info_request_t* r, char* p, size_t p_sz);
+
+typedef struct protocol_info_response_t protocol_info_response_t;
+struct protocol_info_response_t {
+  const char* text;
+  size_t text_len;
+};
+
+ssize_t blb_protocol_encode_info_response(
+    const protocol_info_response_t* r, char* p, size_t p_sz);
+
+// asks the backend to delete everything recorded by one sensor; answered
+// with an info response describing what was removed
+typedef struct protocol_purge_request_t protocol_purge_request_t;
+struct protocol_purge_request_t {
+  const char* sensorid;
+  size_t sensorid_len;
+};
+
+ssize_t blb_protocol_encode_purge_request(
+    const protocol_purge_request_t* r, char* p, size_t p_sz);
+
+// asks the backend to cross-check its indexes, and with `repair` to fix what
+// it finds; answered with an info response reporting the outcome
+typedef struct protocol_verify_request_t protocol_verify_request_t;
+struct protocol_verify_request_t {
+  bool repair;
+};
+
+ssize_t blb_protocol_encode_verify_request(
+    const protocol_verify_request_t* r, char* p, size_t p_sz);
+
 typedef struct protocol_entry_t protocol_entry_t;
 struct protocol_entry_t {
   const char* rdata;
@@ -49,6 +122,11 @@ struct protocol_entry_t {
   uint32_t count;
   uint32_t first_seen;
   uint32_t last_seen;
+  // optional activity histogram of `hist_len` buckets `hist_granularity`
+  // seconds wide; `hist` holds (bucket start, count) pairs, oldest first
+  uint32_t hist_granularity;
+  size_t hist_len;
+  const uint32_t* hist;
 };
 
 typedef struct protocol_input_request_t protocol_input_request_t;
@@ -73,10 +151,14 @@ struct protocol_query_request_t {
   const char* qsensorid;
   size_t qsensorid_len;
   int limit;
+  bool histogram;
 };
 
 ssize_t blb_protocol_encode_query_request(
     const protocol_query_request_t* q, char* p, size_t p_sz);
+// a subscription is encoded like a query; the limit is ignored
+ssize_t blb_protocol_encode_subscribe_request(
+    const protocol_query_request_t* q, char* p, size_t p_sz);
 
 ssize_t blb_protocol_encode_stream_start_response(char* p, size_t p_sz);
 ssize_t blb_protocol_encode_stream_end_response(char* p, size_t p_sz);
@@ -100,6 +182,12 @@ struct protocol_message_t {
     protocol_query_request_t query;
     protocol_backup_request_t backup;
     protocol_dump_request_t dump;
+    protocol_replicate_request_t replicate;
+    protocol_replicate_batch_t batch;
+    protocol_info_request_t info;
+    protocol_info_response_t info_response;
+    protocol_purge_request_t purge;
+    protocol_verify_request_t verify;
     protocol_entry_t entry;
   } u;
 };
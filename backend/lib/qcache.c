@@ -0,0 +1,237 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <alloc.h>
+#include <bs.h>
+#include <hash.h>
+#include <qcache.h>
+#include <trace.h>
+
+#define QCACHE_SEED_KEY (0x71636b6579ULL)
+#define QCACHE_SEED_RRNAME (0x7172726e616d65ULL)
+#define QCACHE_SEED_RDATA (0x71726461746aULL)
+#define QCACHE_EPOCHS (1 << 16)
+
+// bumped for changes the engine input path does not see (e.g. a secondary
+// instance catching up with its primary); added to every slot epoch
+static atomic_uint_least64_t blb_qcache_generation;
+
+static size_t blb_qcache_pow2(size_t x) {
+  size_t n = 1;
+  while(n < x) { n <<= 1; }
+  return (n);
+}
+
+qcache_t* blb_qcache_new(size_t memcap) {
+  qcache_t* c = blb_new(qcache_t);
+  if(c == NULL) { return (NULL); }
+  c->memcap = memcap;
+  c->used = 0;
+  c->n_buckets = blb_qcache_pow2(memcap / 4096);
+  if(c->n_buckets < 1024) { c->n_buckets = 1024; }
+  if(c->n_buckets > (1 << 20)) { c->n_buckets = 1 << 20; }
+  c->buckets = blb_calloc(c->n_buckets, sizeof(qcache_entry_t*));
+  c->n_epochs = QCACHE_EPOCHS;
+  c->epochs = blb_calloc(c->n_epochs, sizeof(atomic_uint_least64_t));
+  c->ring = NULL;
+  c->ring_len = 0;
+  c->ring_cap = 0;
+  c->hand = 0;
+  if(c->buckets == NULL || c->epochs == NULL) {
+    blb_free(c->buckets);
+    blb_free(c->epochs);
+    blb_free(c);
+    return (NULL);
+  }
+  for(size_t i = 0; i < c->n_epochs; i++) { atomic_init(&c->epochs[i], 0); }
+  atomic_init(&c->hits, 0);
+  atomic_init(&c->misses, 0);
+  pthread_mutex_init(&c->lock, NULL);
+  return (c);
+}
+
+void blb_qcache_release(qcache_entry_t* e) {
+  if(atomic_fetch_sub(&e->refs, 1) == 1) { blb_free(e); }
+}
+
+static inline size_t blb_qcache_entry_size(const qcache_entry_t* e) {
+  return (sizeof(qcache_entry_t) + e->key_len + e->frames_len);
+}
+
+// must be called with the lock held
+static void blb_qcache_unlink(qcache_t* c, qcache_entry_t* e) {
+  qcache_entry_t** pp = &c->buckets[e->h & (c->n_buckets - 1)];
+  while(*pp != NULL && *pp != e) { pp = &(*pp)->next; }
+  if(*pp == e) { *pp = e->next; }
+  ASSERT(e->ring_idx < c->ring_len && c->ring[e->ring_idx] == e);
+  c->ring_len -= 1;
+  if(e->ring_idx != c->ring_len) {
+    c->ring[e->ring_idx] = c->ring[c->ring_len];
+    c->ring[e->ring_idx]->ring_idx = e->ring_idx;
+  }
+  c->used -= blb_qcache_entry_size(e);
+  blb_qcache_release(e);
+}
+
+void blb_qcache_teardown(qcache_t* c) {
+  if(c == NULL) { return; }
+  while(c->ring_len > 0) { blb_qcache_unlink(c, c->ring[0]); }
+  blb_free(c->ring);
+  blb_free(c->buckets);
+  blb_free(c->epochs);
+  pthread_mutex_destroy(&c->lock);
+  blb_free(c);
+}
+
+static inline size_t blb_qcache_slot(
+    const qcache_t* c, const char* p, size_t p_sz, uint64_t seed) {
+  return (blb_hash64(p, p_sz, seed) & (c->n_epochs - 1));
+}
+
+static inline int blb_qcache_key_u32(bytestring_sink_t* sink, uint32_t x) {
+  uint8_t p[4];
+  _write_w32_le(p, x);
+  return (bs_append(sink, p, sizeof(p)));
+}
+
+int blb_qcache_key(
+    const qcache_t* c, const protocol_query_request_t* q, qcache_key_t* key) {
+  bytestring_sink_t sink = bs_sink((unsigned char*)key->p, QCACHE_KEY_MAX);
+  int ok = 0;
+  ok += blb_qcache_key_u32(&sink, (uint32_t)q->limit);
+  ok += bs_append1(&sink, q->histogram ? 1 : 0);
+  const char* fields[4] = {q->qrrname, q->qrdata, q->qrrtype, q->qsensorid};
+  size_t lens[4] = {
+      q->qrrname_len, q->qrdata_len, q->qrrtype_len, q->qsensorid_len};
+  for(int i = 0; i < 4; i++) {
+    ok += blb_qcache_key_u32(&sink, (uint32_t)lens[i]);
+    if(lens[i] > 0) {
+      ok += bs_append(&sink, (const uint8_t*)fields[i], lens[i]);
+    }
+  }
+  if(ok != 0) { return (-1); }
+  key->len = sink.index;
+  key->h = blb_hash64(key->p, key->len, QCACHE_SEED_KEY);
+  if(c == NULL) {
+    // key only used for identity (e.g. query coalescing)
+    key->epoch_slot = 0;
+  } else if(q->qrrname_len > 0) {
+    key->epoch_slot =
+        blb_qcache_slot(c, q->qrrname, q->qrrname_len, QCACHE_SEED_RRNAME);
+  } else {
+    key->epoch_slot =
+        blb_qcache_slot(c, q->qrdata, q->qrdata_len, QCACHE_SEED_RDATA);
+  }
+  return (0);
+}
+
+// both counters only ever increase, so their sum changes whenever either does
+uint64_t blb_qcache_epoch(const qcache_t* c, const qcache_key_t* key) {
+  return (
+      atomic_load(&c->epochs[key->epoch_slot])
+      + atomic_load(&blb_qcache_generation));
+}
+
+void blb_qcache_invalidate_all(void) {
+  atomic_fetch_add(&blb_qcache_generation, 1);
+}
+
+void blb_qcache_bump(qcache_t* c, const protocol_entry_t* entry) {
+  size_t rrname_slot = blb_qcache_slot(
+      c, entry->rrname, entry->rrname_len, QCACHE_SEED_RRNAME);
+  size_t rdata_slot =
+      blb_qcache_slot(c, entry->rdata, entry->rdata_len, QCACHE_SEED_RDATA);
+  atomic_fetch_add(&c->epochs[rrname_slot], 1);
+  atomic_fetch_add(&c->epochs[rdata_slot], 1);
+}
+
+// must be called with the lock held
+static qcache_entry_t* blb_qcache_find(
+    qcache_t* c, const qcache_key_t* key) {
+  qcache_entry_t* e = c->buckets[key->h & (c->n_buckets - 1)];
+  for(; e != NULL; e = e->next) {
+    if(e->h == key->h && e->key_len == key->len
+       && memcmp(e->key, key->p, key->len) == 0) {
+      return (e);
+    }
+  }
+  return (NULL);
+}
+
+qcache_entry_t* blb_qcache_lookup(qcache_t* c, const qcache_key_t* key) {
+  pthread_mutex_lock(&c->lock);
+  qcache_entry_t* e = blb_qcache_find(c, key);
+  if(e != NULL && e->epoch != blb_qcache_epoch(c, key)) {
+    blb_qcache_unlink(c, e);
+    e = NULL;
+  }
+  if(e != NULL) {
+    atomic_fetch_add(&e->refs, 1);
+    e->referenced = true;
+  }
+  pthread_mutex_unlock(&c->lock);
+  atomic_fetch_add(e != NULL ? &c->hits : &c->misses, 1);
+  return (e);
+}
+
+void blb_qcache_insert(
+    qcache_t* c,
+    const qcache_key_t* key,
+    uint64_t epoch,
+    const char* frames,
+    size_t frames_len) {
+  size_t sz = sizeof(qcache_entry_t) + key->len + frames_len;
+  if(sz > blb_qcache_entry_max(c)) { return; }
+  qcache_entry_t* e = blb_malloc(sz);
+  if(e == NULL) { return; }
+  e->next = NULL;
+  e->h = key->h;
+  e->epoch = epoch;
+  e->epoch_slot = key->epoch_slot;
+  e->referenced = false;
+  atomic_init(&e->refs, 1);
+  e->key_len = key->len;
+  e->frames_len = frames_len;
+  e->frames = e->key + key->len;
+  memcpy(e->key, key->p, key->len);
+  memcpy(e->frames, frames, frames_len);
+
+  pthread_mutex_lock(&c->lock);
+  if(epoch != blb_qcache_epoch(c, key)) {
+    // a write raced with the query; the result is stale already
+    pthread_mutex_unlock(&c->lock);
+    blb_free(e);
+    return;
+  }
+  qcache_entry_t* old = blb_qcache_find(c, key);
+  if(old != NULL) { blb_qcache_unlink(c, old); }
+  while(c->used + sz > c->memcap && c->ring_len > 0) {
+    if(c->hand >= c->ring_len) { c->hand = 0; }
+    qcache_entry_t* victim = c->ring[c->hand];
+    if(victim->referenced) {
+      victim->referenced = false;
+      c->hand += 1;
+    } else {
+      blb_qcache_unlink(c, victim);
+    }
+  }
+  if(c->ring_len == c->ring_cap) {
+    size_t ring_cap = c->ring_cap == 0 ? 1024 : c->ring_cap * 2;
+    qcache_entry_t** ring =
+        blb_realloc(c->ring, ring_cap * sizeof(qcache_entry_t*));
+    if(ring == NULL) {
+      pthread_mutex_unlock(&c->lock);
+      blb_free(e);
+      return;
+    }
+    c->ring = ring;
+    c->ring_cap = ring_cap;
+  }
+  e->ring_idx = c->ring_len;
+  c->ring[c->ring_len++] = e;
+  qcache_entry_t** bucket = &c->buckets[e->h & (c->n_buckets - 1)];
+  e->next = *bucket;
+  *bucket = e;
+  c->used += sz;
+  pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,83 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __QCACHE_H
+#define __QCACHE_H
+
+#include <inttypes.h>
+#include <protocol.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// query result cache storing the encoded stream frames of a query response.
+// entries are evicted with the CLOCK algorithm once the memory cap is
+// exceeded. writes bump a per-key-prefix epoch (hashed on rrname and rdata);
+// an entry is only served while the epoch it was computed under is current.
+// blb_qcache_invalidate_all() retires every entry of every cache at once.
+
+#define QCACHE_KEY_MAX (1024)
+
+typedef struct qcache_t qcache_t;
+typedef struct qcache_entry_t qcache_entry_t;
+typedef struct qcache_key_t qcache_key_t;
+
+struct qcache_key_t {
+  uint64_t h;
+  size_t epoch_slot;
+  size_t len;
+  char p[QCACHE_KEY_MAX];
+};
+
+struct qcache_entry_t {
+  qcache_entry_t* next;
+  uint64_t h;
+  uint64_t epoch;
+  size_t epoch_slot;
+  size_t ring_idx;
+  atomic_int refs;
+  bool referenced;
+  size_t key_len;
+  size_t frames_len;
+  char* frames;
+  char key[];
+};
+
+struct qcache_t {
+  pthread_mutex_t lock;
+  size_t memcap;
+  size_t used;
+  size_t n_buckets;
+  qcache_entry_t** buckets;
+  qcache_entry_t** ring;
+  size_t ring_len;
+  size_t ring_cap;
+  size_t hand;
+  size_t n_epochs;
+  atomic_uint_least64_t* epochs;
+  atomic_ullong hits;
+  atomic_ullong misses;
+};
+
+qcache_t* blb_qcache_new(size_t memcap);
+void blb_qcache_teardown(qcache_t* c);
+int blb_qcache_key(
+    const qcache_t* c, const protocol_query_request_t* q, qcache_key_t* key);
+uint64_t blb_qcache_epoch(const qcache_t* c, const qcache_key_t* key);
+qcache_entry_t* blb_qcache_lookup(qcache_t* c, const qcache_key_t* key);
+void blb_qcache_release(qcache_entry_t* e);
+void blb_qcache_insert(
+    qcache_t* c,
+    const qcache_key_t* key,
+    uint64_t epoch,
+    const char* frames,
+    size_t frames_len);
+void blb_qcache_bump(qcache_t* c, const protocol_entry_t* entry);
+void blb_qcache_invalidate_all(void);
+
+static inline size_t blb_qcache_entry_max(const qcache_t* c) {
+  return (c->memcap / 8);
+}
+
+#endif
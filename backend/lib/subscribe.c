@@ -0,0 +1,238 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <alloc.h>
+#include <hash.h>
+#include <string.h>
+#include <subscribe.h>
+#include <time.h>
+#include <trace.h>
+
+#define SUBS_BUCKETS (4096)
+#define SUBS_SEED_RRNAME (0x7375626e616d65ULL)
+#define SUBS_SEED_RDATA (0x7375626461746dULL)
+
+subs_t* blb_subs_new(size_t max_queued) {
+  subs_t* s = blb_new(subs_t);
+  if(s == NULL) { return (NULL); }
+  s->n_buckets = SUBS_BUCKETS;
+  s->buckets = blb_calloc(s->n_buckets, sizeof(sub_t*));
+  if(s->buckets == NULL) {
+    blb_free(s);
+    return (NULL);
+  }
+  s->max_queued = max_queued;
+  s->mem_charge = NULL;
+  s->mem_release = NULL;
+  s->mem_usr = NULL;
+  atomic_init(&s->active, 0);
+  atomic_init(&s->matches, 0);
+  atomic_init(&s->dropped, 0);
+  pthread_rwlock_init(&s->lock, NULL);
+  return (s);
+}
+
+void blb_subs_teardown(subs_t* s) {
+  if(s == NULL) { return; }
+  // all connections are gone by now, so are all subscriptions
+  blb_free(s->buckets);
+  pthread_rwlock_destroy(&s->lock);
+  blb_free(s);
+}
+
+void blb_subs_frames_free(subs_t* s, sub_frame_t* fr) {
+  while(fr != NULL) {
+    sub_frame_t* next = fr->next;
+    if(s->mem_release != NULL) {
+      s->mem_release(s->mem_usr, sizeof(sub_frame_t) + fr->len);
+    }
+    blb_free(fr);
+    fr = next;
+  }
+}
+
+static inline uint64_t blb_subs_hash(const char* p, size_t len, bool rdata) {
+  return (blb_hash64(p, len, rdata ? SUBS_SEED_RDATA : SUBS_SEED_RRNAME));
+}
+
+sub_t* blb_subs_add(subs_t* s, const protocol_query_request_t* q) {
+  bool by_rdata = q->qrrname_len == 0;
+  const char* key = by_rdata ? q->qrdata : q->qrrname;
+  size_t key_len = by_rdata ? q->qrdata_len : q->qrrname_len;
+  if(key_len == 0) { return (NULL); }
+
+  size_t rdata_len = by_rdata ? 0 : q->qrdata_len;
+  size_t len = key_len + rdata_len + q->qrrtype_len + q->qsensorid_len;
+  sub_t* sub = blb_malloc(sizeof(sub_t) + len);
+  if(sub == NULL) { return (NULL); }
+  char* p = sub->p;
+  memcpy(p, key, key_len);
+  sub->key = p;
+  sub->key_len = key_len;
+  p += key_len;
+  memcpy(p, q->qrdata, rdata_len);
+  sub->rdata = p;
+  sub->rdata_len = rdata_len;
+  p += rdata_len;
+  memcpy(p, q->qrrtype, q->qrrtype_len);
+  sub->rrtype = p;
+  sub->rrtype_len = q->qrrtype_len;
+  p += q->qrrtype_len;
+  memcpy(p, q->qsensorid, q->qsensorid_len);
+  sub->sensorid = p;
+  sub->sensorid_len = q->qsensorid_len;
+  sub->by_rdata = by_rdata;
+  sub->h = blb_subs_hash(key, key_len, by_rdata);
+  pthread_mutex_init(&sub->lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&sub->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  sub->head = NULL;
+  sub->tail = &sub->head;
+  sub->queued = 0;
+  sub->dropped = 0;
+
+  pthread_rwlock_wrlock(&s->lock);
+  sub_t** bucket = &s->buckets[sub->h & (s->n_buckets - 1)];
+  sub->next = *bucket;
+  *bucket = sub;
+  pthread_rwlock_unlock(&s->lock);
+  atomic_fetch_add(&s->active, 1);
+  return (sub);
+}
+
+void blb_subs_remove(subs_t* s, sub_t* sub) {
+  pthread_rwlock_wrlock(&s->lock);
+  sub_t** pp = &s->buckets[sub->h & (s->n_buckets - 1)];
+  while(*pp != NULL && *pp != sub) { pp = &(*pp)->next; }
+  if(*pp == sub) { *pp = sub->next; }
+  pthread_rwlock_unlock(&s->lock);
+  atomic_fetch_sub(&s->active, 1);
+
+  if(sub->dropped > 0) {
+    L(log_warn("subscriber lost `%llu` matches", sub->dropped));
+  }
+  blb_subs_frames_free(s, sub->head);
+  pthread_cond_destroy(&sub->cond);
+  pthread_mutex_destroy(&sub->lock);
+  blb_free(sub);
+}
+
+static inline bool blb_subs_match(
+    const sub_t* sub, uint64_t h, bool by_rdata, const protocol_entry_t* e) {
+  if(sub->h != h || sub->by_rdata != by_rdata) { return (false); }
+  const char* v = by_rdata ? e->rdata : e->rrname;
+  size_t v_len = by_rdata ? e->rdata_len : e->rrname_len;
+  if(sub->key_len != v_len || memcmp(sub->key, v, v_len) != 0) {
+    return (false);
+  }
+  if(sub->rdata_len > 0
+     && (sub->rdata_len != e->rdata_len
+         || memcmp(sub->rdata, e->rdata, e->rdata_len) != 0)) {
+    return (false);
+  }
+  if(sub->rrtype_len > 0
+     && (sub->rrtype_len != e->rrtype_len
+         || memcmp(sub->rrtype, e->rrtype, e->rrtype_len) != 0)) {
+    return (false);
+  }
+  if(sub->sensorid_len > 0
+     && (sub->sensorid_len != e->sensorid_len
+         || memcmp(sub->sensorid, e->sensorid, e->sensorid_len) != 0)) {
+    return (false);
+  }
+  return (true);
+}
+
+static void blb_subs_push(subs_t* s, sub_t* sub, const char* p, size_t len) {
+  atomic_fetch_add(&s->matches, 1);
+  pthread_mutex_lock(&sub->lock);
+  size_t sz = sizeof(sub_frame_t) + len;
+  sub_frame_t* fr = NULL;
+  if(sub->queued + len <= s->max_queued
+     && (s->mem_charge == NULL || s->mem_charge(s->mem_usr, sz))) {
+    fr = blb_malloc(sz);
+    if(fr == NULL && s->mem_release != NULL) {
+      s->mem_release(s->mem_usr, sz);
+    }
+  }
+  if(fr == NULL) {
+    sub->dropped += 1;
+    pthread_mutex_unlock(&sub->lock);
+    atomic_fetch_add(&s->dropped, 1);
+    return;
+  }
+  fr->next = NULL;
+  fr->len = len;
+  memcpy(fr->p, p, len);
+  *sub->tail = fr;
+  sub->tail = &fr->next;
+  sub->queued += len;
+  pthread_cond_signal(&sub->cond);
+  pthread_mutex_unlock(&sub->lock);
+}
+
+void blb_subs_publish(subs_t* s, const protocol_entry_t* e) {
+  if(atomic_load_explicit(&s->active, memory_order_relaxed) == 0) { return; }
+
+  struct {
+    uint64_t h;
+    bool by_rdata;
+  } probes[2] = {
+      {blb_subs_hash(e->rrname, e->rrname_len, false), false},
+      {blb_subs_hash(e->rdata, e->rdata_len, true), true},
+  };
+
+  // the frame is encoded once, on the first match
+  char* frame = NULL;
+  ssize_t frame_len = 0;
+  pthread_rwlock_rdlock(&s->lock);
+  for(int i = 0; i < 2; i++) {
+    sub_t* sub = s->buckets[probes[i].h & (s->n_buckets - 1)];
+    for(; sub != NULL; sub = sub->next) {
+      if(!blb_subs_match(sub, probes[i].h, probes[i].by_rdata, e)) {
+        continue;
+      }
+      if(frame == NULL) {
+        // the outer message is assembled behind the inner one
+        size_t sz = 2
+                    * (e->rrname_len + e->rdata_len + e->rrtype_len
+                       + e->sensorid_len + e->hist_len * 10 + 256);
+        frame = blb_malloc(sz);
+        if(frame == NULL) { goto unlock; }
+        frame_len = blb_protocol_encode_stream_entry(e, frame, sz);
+      }
+      if(frame_len <= 0) {
+        L(log_error("blb_protocol_encode_stream_entry() failed"));
+        goto unlock;
+      }
+      blb_subs_push(s, sub, frame, frame_len);
+    }
+  }
+unlock:
+  pthread_rwlock_unlock(&s->lock);
+  if(frame != NULL) { blb_free(frame); }
+}
+
+sub_frame_t* blb_subs_take(sub_t* sub, long timeout_ms) {
+  pthread_mutex_lock(&sub->lock);
+  if(sub->head == NULL) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec += 1;
+      ts.tv_nsec -= 1000000000L;
+    }
+    (void)pthread_cond_timedwait(&sub->cond, &sub->lock, &ts);
+  }
+  sub_frame_t* fr = sub->head;
+  sub->head = NULL;
+  sub->tail = &sub->head;
+  sub->queued = 0;
+  pthread_mutex_unlock(&sub->lock);
+  return (fr);
+}
@@ -0,0 +1,84 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __SUBSCRIBE_H
+#define __SUBSCRIBE_H
+
+#include <inttypes.h>
+#include <protocol.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// live subscriptions. a connection registers a query on an rrname or an
+// rdata and is pushed every ingested entry matching it, optionally narrowed
+// down by rrtype and sensor id, and by rdata when watching an rrname.
+// subscriptions are indexed by a hash of the value they watch, so matching
+// an input costs two bucket lookups however many subscriptions there are.
+//
+// matches are queued per subscription as encoded stream frames; once more
+// than `max_queued` bytes are waiting, or the owner's memory accounting
+// refuses a frame, further matches are dropped instead of stalling the input
+// path.
+
+typedef struct subs_t subs_t;
+typedef struct sub_t sub_t;
+typedef struct sub_frame_t sub_frame_t;
+
+struct sub_frame_t {
+  sub_frame_t* next;
+  size_t len;
+  char p[];
+};
+
+struct sub_t {
+  // protected by the registry lock
+  sub_t* next;
+  uint64_t h;
+  bool by_rdata;
+  const char* key;
+  size_t key_len;
+  // only set when watching an rrname
+  const char* rdata;
+  size_t rdata_len;
+  const char* rrtype;
+  size_t rrtype_len;
+  const char* sensorid;
+  size_t sensorid_len;
+  // protected by the subscription lock
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  sub_frame_t* head;
+  sub_frame_t** tail;
+  size_t queued;
+  unsigned long long dropped;
+  char p[];
+};
+
+typedef bool (*subs_mem_charge_t)(void* usr, size_t sz);
+typedef void (*subs_mem_release_t)(void* usr, size_t sz);
+
+struct subs_t {
+  pthread_rwlock_t lock;
+  size_t n_buckets;
+  sub_t** buckets;
+  size_t max_queued;
+  // memory accounting of the owner, set up before the first subscription
+  subs_mem_charge_t mem_charge;
+  subs_mem_release_t mem_release;
+  void* mem_usr;
+  atomic_int active;
+  atomic_ullong matches;
+  atomic_ullong dropped;
+};
+
+subs_t* blb_subs_new(size_t max_queued);
+void blb_subs_teardown(subs_t* s);
+sub_t* blb_subs_add(subs_t* s, const protocol_query_request_t* q);
+void blb_subs_remove(subs_t* s, sub_t* sub);
+void blb_subs_publish(subs_t* s, const protocol_entry_t* e);
+sub_frame_t* blb_subs_take(sub_t* sub, long timeout_ms);
+void blb_subs_frames_free(subs_t* s, sub_frame_t* fr);
+
+#endif
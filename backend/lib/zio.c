@@ -0,0 +1,518 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include <alloc.h>
+#include <trace.h>
+#include <zio.h>
+
+#ifdef BLB_WITH_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef BLB_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#define ZIO_MAGIC_SZ (4)
+#define ZIO_IN_SZ (256 * 1024)
+#define ZIO_BLOCKS (4)
+#define ZIO_BLOCK_SZ (1024 * 1024)
+
+static const unsigned char blb_zio_lz4_magic[ZIO_MAGIC_SZ] = {
+    0x04, 0x22, 0x4d, 0x18};
+static const unsigned char blb_zio_zstd_magic[ZIO_MAGIC_SZ] = {
+    0x28, 0xb5, 0x2f, 0xfd};
+
+// the decompression thread fills `blocks` round robin; the reader drains
+// them in the same order. `head`, `filled`, `eof` and `error` are guarded
+// by `lock`, `tail` and `tail_len` belong to the thread and `pos` to the
+// reader
+struct zio_reader_t {
+  FILE* f;
+  zio_codec_t codec;
+  // the bytes read for detecting the codec, handed out first
+  char magic[ZIO_MAGIC_SZ];
+  size_t magic_len;
+  size_t magic_pos;
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char* blocks[ZIO_BLOCKS];
+  size_t blocks_len[ZIO_BLOCKS];
+  size_t head;
+  size_t filled;
+  size_t pos;
+  size_t tail;
+  size_t tail_len;
+  bool eof;
+  bool error;
+  bool stop;
+};
+
+struct zio_writer_t {
+  FILE* f;
+  zio_codec_t codec;
+  char* out;
+  size_t out_sz;
+#ifdef BLB_WITH_LZ4
+  LZ4F_cctx* lz4;
+#endif
+#ifdef BLB_WITH_ZSTD
+  ZSTD_CStream* zstd;
+#endif
+};
+
+static const char* blb_zio_codec_name(zio_codec_t codec) {
+  switch(codec) {
+  case ZIO_LZ4: return ("lz4");
+  case ZIO_ZSTD: return ("zstd");
+  default: return ("none");
+  }
+}
+
+static bool blb_zio_codec_supported(zio_codec_t codec) {
+  switch(codec) {
+  case ZIO_NONE: return (true);
+#ifdef BLB_WITH_LZ4
+  case ZIO_LZ4: return (true);
+#endif
+#ifdef BLB_WITH_ZSTD
+  case ZIO_ZSTD: return (true);
+#endif
+  default: return (false);
+  }
+}
+
+int blb_zio_codec_parse(const char* name, zio_codec_t* codec) {
+  if(strcmp(name, "none") == 0) {
+    *codec = ZIO_NONE;
+  } else if(strcmp(name, "lz4") == 0) {
+    *codec = ZIO_LZ4;
+  } else if(strcmp(name, "zstd") == 0) {
+    *codec = ZIO_ZSTD;
+  } else {
+    L(log_error("unknown compression `%s`", name));
+    return (-1);
+  }
+  if(!blb_zio_codec_supported(*codec)) {
+    L(log_error("built without `%s` support", name));
+    return (-1);
+  }
+  return (0);
+}
+
+// raw bytes of the file, starting with the ones consumed for detection
+static size_t blb_zio_fill(zio_reader_t* r, char* p, size_t sz) {
+  size_t n = r->magic_len - r->magic_pos;
+  if(n > sz) { n = sz; }
+  memcpy(p, r->magic + r->magic_pos, n);
+  r->magic_pos += n;
+  if(n < sz) { n += fread(p + n, 1, sz - n, r->f); }
+  return (n);
+}
+
+// hands the block being filled to the reader and waits for a free one;
+// fails once the reader is gone
+static int blb_zio_publish(zio_reader_t* r) {
+  pthread_mutex_lock(&r->lock);
+  r->blocks_len[r->tail] = r->tail_len;
+  r->filled += 1;
+  pthread_cond_broadcast(&r->cond);
+  while(r->filled == ZIO_BLOCKS && !r->stop) {
+    pthread_cond_wait(&r->cond, &r->lock);
+  }
+  r->tail = (r->head + r->filled) % ZIO_BLOCKS;
+  r->tail_len = 0;
+  bool stop = r->stop;
+  pthread_mutex_unlock(&r->lock);
+  return (stop ? -1 : 0);
+}
+
+#ifdef BLB_WITH_LZ4
+static int blb_zio_lz4_run(zio_reader_t* r, char* in) {
+  LZ4F_dctx* dctx = NULL;
+  size_t rc = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+  if(LZ4F_isError(rc)) {
+    L(log_error("lz4: `%s`", LZ4F_getErrorName(rc)));
+    return (-1);
+  }
+  int res = 0;
+  size_t in_len = 0;
+  size_t in_pos = 0;
+  bool frame_end = true;
+  // a full output block may leave decoded bytes behind in the context
+  bool drained = true;
+  while(res == 0) {
+    if(in_pos == in_len && drained) {
+      in_len = blb_zio_fill(r, in, ZIO_IN_SZ);
+      in_pos = 0;
+      if(in_len == 0) {
+        if(!frame_end) {
+          L(log_error("lz4: truncated frame"));
+          res = -1;
+        }
+        break;
+      }
+    }
+    size_t avail = ZIO_BLOCK_SZ - r->tail_len;
+    size_t dst_sz = avail;
+    size_t src_sz = in_len - in_pos;
+    rc = LZ4F_decompress(
+        dctx,
+        r->blocks[r->tail] + r->tail_len,
+        &dst_sz,
+        in + in_pos,
+        &src_sz,
+        NULL);
+    if(LZ4F_isError(rc)) {
+      L(log_error("lz4: `%s`", LZ4F_getErrorName(rc)));
+      res = -1;
+      break;
+    }
+    // `0` marks the end of a frame; another one may follow
+    frame_end = rc == 0;
+    drained = dst_sz < avail;
+    in_pos += src_sz;
+    r->tail_len += dst_sz;
+    if(r->tail_len == ZIO_BLOCK_SZ) { res = blb_zio_publish(r); }
+  }
+  LZ4F_freeDecompressionContext(dctx);
+  return (res);
+}
+#endif
+
+#ifdef BLB_WITH_ZSTD
+static int blb_zio_zstd_run(zio_reader_t* r, char* in) {
+  ZSTD_DStream* ds = ZSTD_createDStream();
+  if(ds == NULL) {
+    L(log_error("zstd: unable to create stream"));
+    return (-1);
+  }
+  size_t rc = ZSTD_initDStream(ds);
+  int res = 0;
+  if(ZSTD_isError(rc)) {
+    L(log_error("zstd: `%s`", ZSTD_getErrorName(rc)));
+    res = -1;
+  }
+  ZSTD_inBuffer ib = {.src = in, .size = 0, .pos = 0};
+  bool frame_end = true;
+  bool drained = true;
+  while(res == 0) {
+    if(ib.pos == ib.size && drained) {
+      ib.size = blb_zio_fill(r, in, ZIO_IN_SZ);
+      ib.pos = 0;
+      if(ib.size == 0) {
+        if(!frame_end) {
+          L(log_error("zstd: truncated frame"));
+          res = -1;
+        }
+        break;
+      }
+    }
+    ZSTD_outBuffer ob = {.dst = r->blocks[r->tail] + r->tail_len,
+                         .size = ZIO_BLOCK_SZ - r->tail_len,
+                         .pos = 0};
+    rc = ZSTD_decompressStream(ds, &ob, &ib);
+    if(ZSTD_isError(rc)) {
+      L(log_error("zstd: `%s`", ZSTD_getErrorName(rc)));
+      res = -1;
+      break;
+    }
+    frame_end = rc == 0;
+    drained = ob.pos < ob.size;
+    r->tail_len += ob.pos;
+    if(r->tail_len == ZIO_BLOCK_SZ) { res = blb_zio_publish(r); }
+  }
+  ZSTD_freeDStream(ds);
+  return (res);
+}
+#endif
+
+static void* blb_zio_decompress(void* usr) {
+  zio_reader_t* r = usr;
+  char* in = blb_malloc(ZIO_IN_SZ);
+  int rc = -1;
+  if(in != NULL) {
+    switch(r->codec) {
+#ifdef BLB_WITH_LZ4
+    case ZIO_LZ4: rc = blb_zio_lz4_run(r, in); break;
+#endif
+#ifdef BLB_WITH_ZSTD
+    case ZIO_ZSTD: rc = blb_zio_zstd_run(r, in); break;
+#endif
+    default: break;
+    }
+    if(rc == 0 && ferror(r->f)) {
+      L(log_error("read failed: `%s`", strerror(errno)));
+      rc = -1;
+    }
+    if(rc == 0 && r->tail_len > 0) { rc = blb_zio_publish(r); }
+    blb_free(in);
+  }
+  pthread_mutex_lock(&r->lock);
+  r->error = rc != 0;
+  r->eof = true;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+  return (NULL);
+}
+
+static void blb_zio_reader_free(zio_reader_t* r) {
+  for(size_t i = 0; i < ZIO_BLOCKS; i++) {
+    if(r->blocks[i] != NULL) { blb_free(r->blocks[i]); }
+  }
+  pthread_cond_destroy(&r->cond);
+  pthread_mutex_destroy(&r->lock);
+  blb_free(r);
+}
+
+zio_reader_t* blb_zio_reader_new(FILE* f) {
+  zio_reader_t* r = blb_new(zio_reader_t);
+  if(r == NULL) { return (NULL); }
+  *r = (zio_reader_t){.f = f, .codec = ZIO_NONE};
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->cond, NULL);
+
+  r->magic_len = fread(r->magic, 1, ZIO_MAGIC_SZ, f);
+  if(r->magic_len == ZIO_MAGIC_SZ) {
+    if(memcmp(r->magic, blb_zio_lz4_magic, ZIO_MAGIC_SZ) == 0) {
+      r->codec = ZIO_LZ4;
+    } else if(memcmp(r->magic, blb_zio_zstd_magic, ZIO_MAGIC_SZ) == 0) {
+      r->codec = ZIO_ZSTD;
+    }
+  }
+  if(!blb_zio_codec_supported(r->codec)) {
+    L(log_error(
+        "stream is `%s` compressed; built without support",
+        blb_zio_codec_name(r->codec)));
+    blb_zio_reader_free(r);
+    return (NULL);
+  }
+  if(r->codec == ZIO_NONE) { return (r); }
+
+  V(log_info("decompressing `%s` stream", blb_zio_codec_name(r->codec)));
+  for(size_t i = 0; i < ZIO_BLOCKS; i++) {
+    r->blocks[i] = blb_malloc(ZIO_BLOCK_SZ);
+    if(r->blocks[i] == NULL) {
+      blb_zio_reader_free(r);
+      return (NULL);
+    }
+  }
+  if(pthread_create(&r->thread, NULL, blb_zio_decompress, r) != 0) {
+    L(log_error("unable to start decompression thread"));
+    blb_zio_reader_free(r);
+    return (NULL);
+  }
+  r->running = true;
+  return (r);
+}
+
+ssize_t blb_zio_read(zio_reader_t* r, char* p, size_t sz) {
+  if(r->codec == ZIO_NONE) {
+    size_t n = blb_zio_fill(r, p, sz);
+    if(n == 0 && ferror(r->f)) {
+      L(log_error("read failed: `%s`", strerror(errno)));
+      return (-1);
+    }
+    return ((ssize_t)n);
+  }
+
+  pthread_mutex_lock(&r->lock);
+  while(r->filled == 0 && !r->eof) { pthread_cond_wait(&r->cond, &r->lock); }
+  if(r->filled == 0) {
+    ssize_t rc = r->error ? -1 : 0;
+    pthread_mutex_unlock(&r->lock);
+    return (rc);
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  // the head block is left alone by the thread until it is released
+  size_t avail = r->blocks_len[r->head] - r->pos;
+  size_t n = avail < sz ? avail : sz;
+  memcpy(p, r->blocks[r->head] + r->pos, n);
+  r->pos += n;
+  if(r->pos == r->blocks_len[r->head]) {
+    pthread_mutex_lock(&r->lock);
+    r->head = (r->head + 1) % ZIO_BLOCKS;
+    r->filled -= 1;
+    r->pos = 0;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+  }
+  return ((ssize_t)n);
+}
+
+void blb_zio_reader_teardown(zio_reader_t* r) {
+  if(r->running) {
+    pthread_mutex_lock(&r->lock);
+    r->stop = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+  }
+  blb_zio_reader_free(r);
+}
+
+#if defined(BLB_WITH_LZ4) || defined(BLB_WITH_ZSTD)
+static int blb_zio_write_out(zio_writer_t* w, size_t len) {
+  if(len > 0 && fwrite(w->out, len, 1, w->f) != 1) {
+    L(log_error("write failed: `%s`", strerror(errno)));
+    return (-1);
+  }
+  return (0);
+}
+#endif
+
+static void blb_zio_writer_free(zio_writer_t* w) {
+#ifdef BLB_WITH_LZ4
+  if(w->lz4 != NULL) { LZ4F_freeCompressionContext(w->lz4); }
+#endif
+#ifdef BLB_WITH_ZSTD
+  if(w->zstd != NULL) { ZSTD_freeCStream(w->zstd); }
+#endif
+  if(w->out != NULL) { blb_free(w->out); }
+  blb_free(w);
+}
+
+zio_writer_t* blb_zio_writer_new(FILE* f, zio_codec_t codec) {
+  if(!blb_zio_codec_supported(codec)) {
+    L(log_error("built without `%s` support", blb_zio_codec_name(codec)));
+    return (NULL);
+  }
+  zio_writer_t* w = blb_new(zio_writer_t);
+  if(w == NULL) { return (NULL); }
+  *w = (zio_writer_t){.f = f, .codec = codec};
+  int rc = 0;
+  switch(codec) {
+#ifdef BLB_WITH_LZ4
+  case ZIO_LZ4: {
+    // large enough for the header, any update of `ZIO_IN_SZ` and the end
+    w->out_sz = LZ4F_compressBound(ZIO_IN_SZ, NULL) + LZ4F_HEADER_SIZE_MAX;
+    w->out = blb_malloc(w->out_sz);
+    size_t r = LZ4F_createCompressionContext(&w->lz4, LZ4F_VERSION);
+    if(w->out == NULL || LZ4F_isError(r)) {
+      w->lz4 = NULL;
+      rc = -1;
+      break;
+    }
+    r = LZ4F_compressBegin(w->lz4, w->out, w->out_sz, NULL);
+    if(LZ4F_isError(r)) {
+      L(log_error("lz4: `%s`", LZ4F_getErrorName(r)));
+      rc = -1;
+      break;
+    }
+    rc = blb_zio_write_out(w, r);
+    break;
+  }
+#endif
+#ifdef BLB_WITH_ZSTD
+  case ZIO_ZSTD: {
+    w->out_sz = ZSTD_CStreamOutSize();
+    w->out = blb_malloc(w->out_sz);
+    w->zstd = ZSTD_createCStream();
+    if(w->out == NULL || w->zstd == NULL) {
+      rc = -1;
+      break;
+    }
+    size_t r = ZSTD_initCStream(w->zstd, 3);
+    if(ZSTD_isError(r)) {
+      L(log_error("zstd: `%s`", ZSTD_getErrorName(r)));
+      rc = -1;
+    }
+    break;
+  }
+#endif
+  default: break;
+  }
+  if(rc != 0) {
+    blb_zio_writer_free(w);
+    return (NULL);
+  }
+  return (w);
+}
+
+int blb_zio_write(zio_writer_t* w, const char* p, size_t sz) {
+  switch(w->codec) {
+#ifdef BLB_WITH_LZ4
+  case ZIO_LZ4:
+    while(sz > 0) {
+      size_t n = sz < ZIO_IN_SZ ? sz : ZIO_IN_SZ;
+      size_t r = LZ4F_compressUpdate(w->lz4, w->out, w->out_sz, p, n, NULL);
+      if(LZ4F_isError(r)) {
+        L(log_error("lz4: `%s`", LZ4F_getErrorName(r)));
+        return (-1);
+      }
+      if(blb_zio_write_out(w, r) != 0) { return (-1); }
+      p += n;
+      sz -= n;
+    }
+    return (0);
+#endif
+#ifdef BLB_WITH_ZSTD
+  case ZIO_ZSTD: {
+    ZSTD_inBuffer ib = {.src = p, .size = sz, .pos = 0};
+    while(ib.pos < ib.size) {
+      ZSTD_outBuffer ob = {.dst = w->out, .size = w->out_sz, .pos = 0};
+      size_t r = ZSTD_compressStream(w->zstd, &ob, &ib);
+      if(ZSTD_isError(r)) {
+        L(log_error("zstd: `%s`", ZSTD_getErrorName(r)));
+        return (-1);
+      }
+      if(blb_zio_write_out(w, ob.pos) != 0) { return (-1); }
+    }
+    return (0);
+  }
+#endif
+  default:
+    if(sz > 0 && fwrite(p, sz, 1, w->f) != 1) {
+      L(log_error("write failed: `%s`", strerror(errno)));
+      return (-1);
+    }
+    return (0);
+  }
+}
+
+int blb_zio_writer_finish(zio_writer_t* w) {
+  int rc = 0;
+  switch(w->codec) {
+#ifdef BLB_WITH_LZ4
+  case ZIO_LZ4: {
+    size_t r = LZ4F_compressEnd(w->lz4, w->out, w->out_sz, NULL);
+    if(LZ4F_isError(r)) {
+      L(log_error("lz4: `%s`", LZ4F_getErrorName(r)));
+      rc = -1;
+    } else {
+      rc = blb_zio_write_out(w, r);
+    }
+    break;
+  }
+#endif
+#ifdef BLB_WITH_ZSTD
+  case ZIO_ZSTD: {
+    size_t r = 1;
+    while(r != 0 && rc == 0) {
+      ZSTD_outBuffer ob = {.dst = w->out, .size = w->out_sz, .pos = 0};
+      r = ZSTD_endStream(w->zstd, &ob);
+      if(ZSTD_isError(r)) {
+        L(log_error("zstd: `%s`", ZSTD_getErrorName(r)));
+        rc = -1;
+      } else {
+        rc = blb_zio_write_out(w, ob.pos);
+      }
+    }
+    break;
+  }
+#endif
+  default: break;
+  }
+  if(fflush(w->f) != 0) {
+    L(log_error("flush failed: `%s`", strerror(errno)));
+    rc = -1;
+  }
+  blb_zio_writer_free(w);
+  return (rc);
+}
@@ -0,0 +1,36 @@
+// balboa
+// Copyright (c) 2018, 2019 DCSO GmbH
+
+#ifndef __ZIO_H
+#define __ZIO_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+// transparent LZ4 frame and zstd streams for dump files. the codec of a
+// stream being read is detected from its magic bytes and the stream is
+// decompressed on a thread of its own, ahead of the reader. codecs are
+// compiled in with `-DBLB_WITH_LZ4` and `-DBLB_WITH_ZSTD`; without them
+// only uncompressed streams are accepted.
+
+typedef enum zio_codec_t { ZIO_NONE = 0, ZIO_LZ4, ZIO_ZSTD } zio_codec_t;
+
+typedef struct zio_reader_t zio_reader_t;
+typedef struct zio_writer_t zio_writer_t;
+
+zio_reader_t* blb_zio_reader_new(FILE* f);
+// fills up to `sz` bytes; returns `0` at the end of the stream, `-1` on
+// error
+ssize_t blb_zio_read(zio_reader_t* r, char* p, size_t sz);
+void blb_zio_reader_teardown(zio_reader_t* r);
+
+// accepts `none`, `lz4` and `zstd`; fails for codecs not compiled in
+int blb_zio_codec_parse(const char* name, zio_codec_t* codec);
+zio_writer_t* blb_zio_writer_new(FILE* f, zio_codec_t codec);
+int blb_zio_write(zio_writer_t* w, const char* p, size_t sz);
+// ends the stream, flushes `f` and frees the writer
+int blb_zio_writer_finish(zio_writer_t* w);
+
+#endif